@@ -11,10 +11,12 @@
 #define SAMPLES      1000       // number of samples to obtain (per prcoessor)
 #define EQ           500       // number of samples to equilibrate for (change to time?) 
 
+#define BOND_CUTOFF_2D  1.04    // if two particles are less than this distance, bonded
+#define BOND_CUTOFF_3D  1.05    //original was 1.029
 #if (DIMENSION == 2)
-	#define BOND_CUTOFF  1.04       // if two particles are less than this distance, bonded
+	#define BOND_CUTOFF  BOND_CUTOFF_2D
 #elif (DIMENSION == 3)
-	#define BOND_CUTOFF  1.05      //original was 1.029
+	#define BOND_CUTOFF  BOND_CUTOFF_3D
 #endif
 
 //Newton's Method Parameters
@@ -7,10 +7,13 @@
 #include <vector>
 #include <map>
 #include <deque>
+#include <limits>
+#include <algorithm>
 #include <eigen3/unsupported/Eigen/MatrixFunctions>
 #include <eigen3/Eigen/Dense>
 #include <cstdlib>   // rand and srand
 #include <ctime>     // For the time function
+#include <omp.h>
 #include "point.h"
 #include "pair.h"
 #include "adjacency.h"
@@ -54,7 +57,7 @@ void getBondTypes(int N, int* particleTypes, Database* db, std::vector<int> targ
 		printf("\n State: %d, AA: %d, AB %d, BB %d\n", state, AA, AB, BB);
 		double* X = new double[N*DIMENSION];
 		Cluster c = (*db)[state].getRandomIC();
-		c.makeArray3d(X,N);
+		c.makeArray<DIMENSION>(X, N);
 		printCluster(X,N);
 		delete []X;
 	}
@@ -106,29 +109,113 @@ void allPerms(int N, std::deque<std::string>& perms) {
 }
 
 void distinctPerms(int N, std::deque<std::string>& perms) {
-	//generate all permutations of N 0s and 1s w/o reflections
+	//generate all permutations of N 0s and 1s w/o reflections or swaps
 
-	//first generate all (N-1) length possibilities, fill preliminary deque
-	std::string p0 = "0"; std::string p1 = "1";
-	std::deque<std::string> prelim;
-	prelim.push_back(p0); prelim.push_back(p1);
-	int elements = 2;
-	int final_size = pow(2,N-1); 
-	while (elements < final_size) {
-		std::string f = prelim.front(); prelim.pop_front();
-		prelim.push_back(f+p0); prelim.push_back(f+p1);
-		elements += 1;
+	std::vector<TypeMask> masks;
+	canonicalTypes(N, 2, masks);
+	for (int i = 0; i < masks.size(); i++) {
+		perms.push_back(typeString(N, 2, masks[i]));
+	}
+
+	printf("Found %ld distinct permutations\n", perms.size());
+
+}
+
+int typeBits(int numTypes) {
+	//number of bits to store one particle type
+	int bits = 1;
+	while ((1 << bits) < numTypes) bits++;
+	return bits;
+}
+
+static TypeMask relabelTypes(int N, int bits, const int* t, bool reverse) {
+	//mask of the assignment with the types renamed in order of first appearance
+
+	int label[64]; 
+	for (int i = 0; i < 64; i++) label[i] = -1;
+	int next = 0;
+
+	TypeMask mask = 0;
+	for (int k = 0; k < N; k++) {
+		int p = t[reverse ? N-1-k : k];
+		if (label[p] == -1) {
+			label[p] = next; next++;
+		}
+		mask = (mask << bits) | (TypeMask)label[p];
 	}
 
-	//next, add 0 and 1 to each (N-1) length permuation, only add it to perms
-	//if its reflection is not already in it
-	for (int i = 0; i < prelim.size(); i++) {
-		std::string f = prelim[i];
-		checkPerm(f+p0, perms); checkPerm(f+p1, perms);
+	return mask;
+}
+
+static void growTypes(int N, int numTypes, int bits, int k, int used, int* t,
+											std::vector<TypeMask>& masks) {
+	//depth first over assignments where types first appear in order 0,1,2,..
+	//keep the ones no larger than their reversal
+
+	if (k == N) {
+		TypeMask m = relabelTypes(N, bits, t, false);
+		if (m <= relabelTypes(N, bits, t, true)) {
+			masks.push_back(m);
+		}
+		return;
 	}
 
-	printf("Found %ld distinct permutations\n", perms.size());
+	for (int p = 0; p <= used && p < numTypes; p++) {
+		t[k] = p;
+		growTypes(N, numTypes, bits, k+1, std::max(used, p+1), t, masks);
+	}
+}
+
+void canonicalTypes(int N, int numTypes, std::vector<TypeMask>& masks) {
+	//fill masks with the canonical type assignments, in increasing order
+
+	int bits = typeBits(numTypes);
+	if (N*bits > 64) {
+		fprintf(stderr, "Type assignments of %d particles with %d types do not fit in a mask\n",
+						N, numTypes);
+		return;
+	}
+
+	int* t = new int[N];
+	growTypes(N, numTypes, bits, 0, 0, t, masks);
+	delete []t;
+}
+
+void setTypes(int N, int numTypes, TypeMask mask, int* particleTypes) {
+	//unpack the types in mask
+
+	int bits = typeBits(numTypes);
+	TypeMask low = ((TypeMask)1 << bits) - 1;
+	for (int i = 0; i < N; i++) {
+		particleTypes[i] = (mask >> (bits*(N-1-i))) & low;
+	}
+}
+
+std::string typeString(int N, int numTypes, TypeMask mask) {
+	//the types in mask as a string of digits
+
+	int* t = new int[N];
+	setTypes(N, numTypes, mask, t);
+	std::string word(N, '0');
+	for (int i = 0; i < N; i++) {
+		word[i] = '0' + t[i];
+	}
+	delete []t;
+
+	return word;
+}
+
+static void permDone(int& finished, int& next, int num_perms) {
+	//count a finished permutation inside a parallel loop. the master thread
+	//prints the progress about every tenth of the permutations
 
+	int f;
+	#pragma omp atomic capture
+	f = ++finished;
+	if (omp_get_thread_num() == 0 && f >= next) {
+		printf("%d of %d permutations done\n", f, num_perms);
+		next = f + std::max(1, num_perms/10);
+	}
 }
 
 void setTypes(int N, int* particleTypes, std::deque<std::string> perms, int perm) {
@@ -218,12 +305,7 @@ double getPdet(int N, int state, Database* db, int* particleTypes,
 	const Cluster& c = (*db)[state].getRandomIC();
 	//cluster structs to arrays
 	double* X = new double[DIMENSION*N];
-#if (DIMENSION == 2) 
-	c.makeArray2d(X, N);
-#endif
-#if (DIMENSION == 3)
-	c.makeArray3d(X, N);
-#endif
+	c.makeArray<DIMENSION>(X, N);
 
 	//init the jacobian matrix
 	Eigen::MatrixXd J(b, 2*N); J.fill(0.0);
@@ -291,114 +373,430 @@ double getPdet(int N, int state, Database* db, int* particleTypes,
 
 void reweight7(int N, int num_states, Database* db, int* particleTypes, double* eq,
 						  std::map<std::pair<int,int>,double> kappa) {
-	//reweight in the case of 7 particles
+	//reweight in the case of 7 particles. the 12 bond states are in the
+	//histogram's flower list, so this is the same as reweight
+	reweight(N, num_states, db, particleTypes, eq, kappa);
+}
 
-	double kap0 = KAP;                 //sticky parameter for initial measurement
-	double beta = BETA;                //inverse temp
-	double r = RANGE;                  //range of potential
-	double E = stickyNewton(8.0, r, kap0, beta); //energy corresponding to kap0
-	double a = 2*r*r*E;                // parameter multiplying rigidity matrix
-	double alpha2 = sqrt(beta*a);      //alpha^2 parameter
-	double gamma = exp(beta*E);        //gamma parameter
+void reweight(int N, int num_states, Database* db, int* particleTypes, double* eq,
+						  std::map<std::pair<int,int>,double> kappa) {
+	//perform the re-weighting of the eq measure for new sticky params
 
-	double Z = 0;                     //normalizing constant for eq
+	if (N != 6 && N != 7) {
+		return;
+	}
+
+	//get the bond counts for these particle types
+	int numTypes = kappa.rbegin()->first.first + 1;
+	const BondHistogram& H = getBondHistogram(N, db, particleTypes, numTypes);
+
+	//put the kappa map in kappaVals order
+	std::vector<double> kappaVals(H.getNumInteractions());
+	for (int i = 0; i < numTypes; i++) {
+		for (int j = i; j < numTypes; j++) {
+			kappaVals[H.getType(i,j)] = kappa[{i,j}];
+		}
+	}
 
-	//loop over states, get the equilibrium measure entry
+	reweight(H, db, kappaVals.data(), eq);
+}
+
+void reweight(const BondHistogram& H, Database* db, const double* kappaVals, double* eq) {
+	//re-weight the eq measure using the bond counts in H
+
+	int num_states = H.getNumStates();
+
+	//standard re-weight, prob * prod kappa^n / KAP^nt, in log space
+	const Eigen::VectorXd& lw = H.logWeights(kappaVals, KAP);
 	for (int i = 0; i < num_states; i++) {
-		//get initial eq prob and number of bonds
-		int b = (*db)[i].getBonds();
-		int ntBonds = b - (N-1);               //number of non-trivial bonds
-		double prob = (*db)[i].getFrequency();
-		double new_prob;
-
-		//determine which reweight to use
-		if (b != 12) { //do standard re-weight
-			//get the denominator of reweight factor - KAP^b_i
-			double denom = pow(kap0, ntBonds);
-
-			//get the numerator of the re-weight factor
-			double num = getStickyProduct(N, i, db, particleTypes, kappa); 
-
-			//compute the new probability
-			new_prob = prob * num / denom;
+		eq[i] = (*db)[i].getFrequency() * exp(lw(i));
+	}
+
+	//the 12 bond states for 7 particles use the rigidity re-weight
+	const std::vector<int>& flower = H.getFlowerStates();
+	if (flower.size() > 0) {
+		const Eigen::VectorXd& fw = H.flowerWeights(kappaVals);
+		for (int k = 0; k < flower.size(); k++) {
+			int i = flower[k];
+			eq[i] = (*db)[i].getFrequency() * fw(k);
 		}
-		else if (b == 12) { //special reweight
-			//get the denominator of reweight factor - KAP^b_i
-			double denom = pow(gamma, ntBonds);
+	}
 
-			//get a and gamma parameters for each new kappa
-			std::map<std::pair<int,int>,double> a_new;
-			std::map<std::pair<int,int>,double> gamma_new;
-			getReweightMaps(kappa, a_new, gamma_new);
+	//re-normalize
+	double Z = 0;
+	for (int i = 0; i < num_states; i++) Z += eq[i];
+	for (int i = 0; i < num_states; i++) eq[i] /= Z;
+}
 
-			//get the numerator of reweight factor
-			double num = getStickyProduct(N, i, db, particleTypes, gamma_new); 
+BondHistogram::BondHistogram() {
+	generation = 0; N = 0; num_states = 0; numTypes = 0;
+}
 
-			//get the pseudo-determinant factor
-			double det = 0;
-			det = getPdet(N, i, db, particleTypes, a, a_new);
+BondHistogram::BondHistogram(int N_, Database* db, int* particleTypes, int numTypes_) {
+	//count the bonds of each type in every state of db
 
-			//debug the flower reweight
-			//printf("prob = %f\n det = %f\n num = %f\n denom = %f\n\n", prob, det, num, denom);
+	int ns = db->getNumStates();
+	resize(db->getGeneration(), N_, ns, particleTypes, numTypes_);
 
-			//compute new prob
-			new_prob = prob * det * num / denom;
+	//loop over the adjacency matrix, determine bond types
+	for (int s = 0; s < ns; s++) {
+		for (int i = 0; i < N; i++) {
+			for (int j = i+2; j < N; j++) {
+				if ((*db)[s].isInteracting(i,j,N)) {
+					addBond(s, particleTypes[i], particleTypes[j]);
+				}
+			}
 		}
+		int b = (*db)[s].getBonds();
+		setBonds(s, b);
+		if (N == 7 && b == 12) {
+			addFlower(db, s);
+		}
+	}
+	allocate();
+}
 
-		//debug line for corect reweight
-		//printf("State %d, Old prob %f, New prob %f\n", i, prob, new_prob);
+void BondHistogram::addFlower(Database* db, int state) {
+	//cache the rigidity geometry of a flower state, see getPdet
 
-		//increment Z and add to array
-		Z += new_prob;
-		eq[i] = new_prob;
+	//the geometry needs a sample. without one the state gets no flower term
+	if ((*db)[state].getNumCoords() == 0) {
+		return;
 	}
 
-	//re-normalize
-	for (int i = 0; i < num_states; i++) eq[i] /= Z;
+	//get the number of bonds, adjacency matrix, and coordinates from db
+	int b = (*db)[state].getBonds();
+	int* M = new int[N*N]; 
+	extractAM(N, state, M, db);
+	//one fixed sample, so the weight does not change between calls
+	const Cluster& c = (*db)[state].getCoords(0);
+	double* X = new double[DIMENSION*N];
+	c.makeArray<DIMENSION>(X, N);
 
+	//rigidity matrix without the sqrt(a) row multipliers
+	Eigen::MatrixXd J(b, DIMENSION*N); J.fill(0.0);
+	std::vector<int> rows;
+	int row = 0;
+	for (int i = 0; i < N; i++) {
+		for (int j = i+1; j < N; j++) {
+			if (M[bd::toIndex(i,j,N)] == 1) {
+				for (int d = 0; d < DIMENSION; d++) {
+					double XD = X[DIMENSION*i+d] - X[DIMENSION*j+d];
+					J(row, DIMENSION*i+d) = 2*XD; J(row, DIMENSION*j+d) = -2*XD;
+				}
+				rows.push_back(typeIndex(types[i], types[j]));
+				row++;
+			}
+		}
+	}
+
+	//keep the singular vectors getPdet counts, it scales J by sqrt(a) at KAP
+	double beta = BETA; double r = RANGE;
+	double E = stickyNewton(8.0, r, KAP, beta);
+	double m = sqrt(2*r*r*E);
+	Eigen::JacobiSVD<Eigen::MatrixXd> svd(J, Eigen::ComputeThinU);
+	Eigen::VectorXd s = svd.singularValues();
+	int rank = 0;
+	for (int i = 0; i < s.size(); i++) {
+		if (fabs(s(i)*m) > N_TOL) rank++;
+	}
+
+	flower.push_back(state);
+	flowerU.push_back(svd.matrixU().leftCols(rank));
+	flowerRows.push_back(rows);
+
+	delete []M; delete []X;
 }
-void reweight(int N, int num_states, Database* db, int* particleTypes, double* eq,
-						  std::map<std::pair<int,int>,double> kappa) {
-	//perform the re-weighting of the eq measure for new sticky params
 
-	if (N == 6) {
-		double kap0 = KAP;                 //sticky parameter for initial measurement
-		double beta = BETA;                //inverse temp
+void BondHistogram::resize(unsigned long generation_, int N_, int num_states_, 
+													 const int* particleTypes, int numTypes_) {
+	//empty histogram for num_states_ states
 
-		double Z = 0;                     //normalizing constant for eq
+	generation = generation_; N = N_; num_states = num_states_; numTypes = numTypes_;
+	types.assign(particleTypes, particleTypes+N);
 
-		//loop over states, get the equilibrium measure entry
-		for (int i = 0; i < num_states; i++) {
-			//get initial eq prob and number of bonds
-			int b = (*db)[i].getBonds();
-			int ntBonds = b - (N-1);               //number of non-trivial bonds
-			double prob = (*db)[i].getFrequency();
+	//interaction index of each type pair, same order as makeKappaMap
+	typeIndex.resize(numTypes, numTypes);
+	int counter = 0;
+	for (int i = 0; i < numTypes; i++) {
+		for (int j = i; j < numTypes; j++) {
+			typeIndex(i,j) = typeIndex(j,i) = counter;
+			counter++;
+		}
+	}
+
+	count = Eigen::MatrixXd::Zero(num_states, counter);
+	nt = Eigen::VectorXd::Zero(num_states);
+	flower.clear(); flowerU.clear(); flowerRows.clear();
+	allocate();
+}
+
+void BondHistogram::allocate() {
+	//size the workspace for the current counts and flower states
+
+	int numInteractions = count.cols();
+	logk.resize(numInteractions); lw.resize(num_states); kv.resize(numInteractions);
+	aNew.resize(numInteractions); logGammaNew.resize(numInteractions);
+	fw.resize(flower.size()); fwp.resize(flower.size());
+	dlogfw.resize(flower.size(), numInteractions);
+
+	flowerWU.resize(flower.size()); flowerUWU.resize(flower.size()); 
+	flowerLU.resize(flower.size());
+	for (int f = 0; f < flower.size(); f++) {
+		int r = flowerU[f].cols();
+		flowerWU[f].resize(flowerU[f].rows(), r);
+		flowerUWU[f].resize(r, r);
+		flowerLU[f] = Eigen::PartialPivLU<Eigen::MatrixXd>(r);
+	}
+}
+
+bool BondHistogram::matches(unsigned long generation_, int N_, int num_states_, 
+														const int* particleTypes, int numTypes_) const {
+	//check if the histogram was built for this database and assignment
+	return generation == generation_ && N == N_ && num_states == num_states_ && 
+				 numTypes == numTypes_ && std::equal(types.begin(), types.end(), particleTypes);
+}
 
-			//get the denominator of reweight factor - KAP^b_i
-			double denom = pow(KAP, ntBonds);
+void BondHistogram::logWeights(const double* kappaVals, double kap0, Eigen::VectorXd& lw_) const {
+	lw_ = logWeights(kappaVals, kap0);
+}
 
-			//get the numerator of the re-weight factor
-			double num = getStickyProduct(N, i, db, particleTypes, kappa); 
-			//std::cout << num << "\n";
+const Eigen::VectorXd& BondHistogram::logWeights(const double* kappaVals, double kap0) const {
+	//log of the re-weight factor of every state
 
-			//compute the new probability
-			double new_prob = prob * num / denom;
+	int numInteractions = count.cols();
+	for (int k = 0; k < numInteractions; k++) {
+		//a zero kappa removes every state with that bond type
+		logk(k) = (kappaVals[k] > 0) ? log(kappaVals[k]) : -std::numeric_limits<double>::max();
+	}
 
-			//debug line for corect reweight
-			//printf("Test: Old %f, New %f\n", prob, new_prob);
+	lw.noalias() = count * logk;
+	lw -= nt * log(kap0);
+	return lw;
+}
+
+void BondHistogram::flowerWeights(const double* kappaVals, Eigen::VectorXd& fw_) const {
+	fw_ = flowerWeights(kappaVals);
+}
 
-			//increment Z and add to array
-			Z += new_prob;
-			eq[i] = new_prob;
+const Eigen::VectorXd& BondHistogram::flowerWeights(const double* kappaVals) const {
+	//prod gamma_new^n / gamma^nt times the pseudo-determinant factor of getPdet.
+	//J_new is J with row q scaled by sqrt(a_q/a), so det/det_new = 1/det(U^T W U)
+	//with W = diag(a_q/a). one newton solve per interaction, no svd
+
+	double beta = BETA;                //inverse temp
+	double r = RANGE;                  //range of potential
+	double E = stickyNewton(8.0, r, KAP, beta);
+	double a = 2*r*r*E; double logGamma = beta*E;
+
+	//a and log gamma of each interaction
+	int numInteractions = count.cols();
+	for (int k = 0; k < numInteractions; k++) {
+		double E_k = stickyNewton(8.0, r, kappaVals[k], beta);
+		aNew(k) = 2*r*r*E_k / a; logGammaNew(k) = beta*E_k;
+	}
+
+	for (int f = 0; f < flower.size(); f++) {
+		const Eigen::MatrixXd& U = flowerU[f];
+		Eigen::MatrixXd& WU = flowerWU[f];
+		for (int q = 0; q < U.rows(); q++) {
+			WU.row(q) = aNew(flowerRows[f][q]) * U.row(q);
 		}
+		flowerUWU[f].noalias() = U.transpose() * WU;
+		double det = flowerLU[f].compute(flowerUWU[f]).determinant();
 
-		//re-normalize
-		for (int i = 0; i < num_states; i++) eq[i] /= Z;
+		int i = flower[f];
+		double num = exp(count.row(i).dot(logGammaNew) - nt(i)*logGamma);
+		fw(f) = num / sqrt(det);
 	}
-	else if (N == 7) {
-		reweight7(N, num_states, db, particleTypes, eq, kappa);
+	return fw;
+}
+
+const Eigen::MatrixXd& BondHistogram::flowerLogDerivative(const double* kappaVals) const {
+	//central difference of log flowerWeights in each kappa
+
+	double h = 1e-5;
+	int numInteractions = count.cols();
+	std::copy(kappaVals, kappaVals+numInteractions, kv.begin());
+	for (int k = 0; k < numInteractions; k++) {
+		kv[k] += h; fwp = flowerWeights(kv.data());
+		kv[k] -= 2*h; flowerWeights(kv.data());
+		kv[k] += h;
+		for (int f = 0; f < flower.size(); f++) {
+			dlogfw(f,k) = (log(fwp(f)) - log(fw(f))) / (2*h);
+		}
 	}
-	
+	return dlogfw;
+}
+
+const BondHistogram& getBondHistogram(int N, Database* db, int* particleTypes, int numTypes) {
+	//one histogram per thread, so the ga can evaluate persons in parallel.
+	//keyed on the database generation, rebuilt when the database changes
+
+	static thread_local BondHistogram H;
+	if (!H.matches(db->getGeneration(), N, db->getNumStates(), particleTypes, numTypes)) {
+		H = BondHistogram(N, db, particleTypes, numTypes);
+	}
+
+	return H;
+}
+
+void reweightGradient(int N, int num_states, Database* db, int* particleTypes, int numTypes,
+											double* kappaVals, double* eq, Eigen::MatrixXd& dlogeq) {
+	//reweight and derivative with the histogram of this thread
+
+	const BondHistogram& H = getBondHistogram(N, db, particleTypes, numTypes);
+	reweightGradient(H, db, kappaVals, eq, dlogeq);
+}
+
+void reweightGradient(const BondHistogram& H, Database* db, const double* kappaVals, double* eq, 
+											Eigen::MatrixXd& dlogeq) {
+	/*reweight to get eq, and the derivative of log eq_i in each kappa.
+	  a state with n_k bonds of type k has weight prop. to prod kappa_k^n_k, so
+	  d log w_i = n_k/kappa_k. the 12 bond states for 7 particles use a central
+	  difference of their own weight, no other state is touched. the normalization
+	  subtracts the eq weighted mean of each column. dlogeq is only resized if
+	  it has the wrong shape */
+
+	int num_states = H.getNumStates();
+	int numInteractions = H.getNumInteractions();
+
+	//reweight at kappaVals
+	reweight(H, db, kappaVals, eq);
+
+	//standard states
+	dlogeq.resize(num_states, numInteractions);
+	for (int k = 0; k < numInteractions; k++) {
+		for (int i = 0; i < num_states; i++) {
+			dlogeq(i,k) = H.getCount(i,k) / kappaVals[k];
+		}
+	}
+
+	//flower states
+	const std::vector<int>& flower = H.getFlowerStates();
+	if (flower.size() > 0) {
+		const Eigen::MatrixXd& dlogfw = H.flowerLogDerivative(kappaVals);
+		for (int k = 0; k < numInteractions; k++) {
+			for (int f = 0; f < flower.size(); f++) {
+				dlogeq(flower[f],k) = dlogfw(f,k);
+			}
+		}
+	}
+
+	//normalization
+	for (int k = 0; k < numInteractions; k++) {
+		double S = 0;
+		for (int i = 0; i < num_states; i++) {
+			S += eq[i] * dlogeq(i,k);
+		}
+		for (int i = 0; i < num_states; i++) {
+			dlogeq(i,k) -= S;
+		}
+	}
+}
+
+DesignEvaluator::DesignEvaluator(DesignObjective objective_, Database* db_, int numTypes_, 
+																 int initial_, const std::vector<int>& targets_, 
+																 const RateMatrix& forward, const std::vector<int>& endStates) {
+	//allocate everything the objective needs, types are set with setTypes
+
+	objective = objective_; db = db_; numTypes = numTypes_;
+	initial = initial_; targets = targets_;
+	N = db->getN(); num_states = db->getNumStates();
+
+	mfpt = NULL; hit = NULL;
+	if (objective == DESIGN_RATE) {
+		mfpt = new MFPTSolver(forward, targets);
+	}
+	else if (objective == DESIGN_HIT) {
+		hit = new HittingSolver(forward, endStates, targets);
+	}
+
+	int numInteractions = numTypes*(numTypes+1)/2;
+	eq = new double[num_states]; m = new double[num_states]; dm = new double[numInteractions];
+	dlogeq.resize(num_states, numInteractions);
+	for (int i = 0; i < num_states; i++) {
+		eq[i] = m[i] = 0;
+	}
+}
+
+DesignEvaluator::~DesignEvaluator() {
+	delete mfpt; delete hit;
+	delete []eq; delete []m; delete []dm;
+}
+
+void DesignEvaluator::setTypes(int* particleTypes) {
+	//rebuild the histogram only for a new assignment
+
+	if (!H.matches(db->getGeneration(), N, num_states, particleTypes, numTypes)) {
+		H = BondHistogram(N, db, particleTypes, numTypes);
+	}
+}
+
+double DesignEvaluator::getEqProb() const {
+	//sum eq over the targets
+
+	double prob = 0;
+	for (int i = 0; i < targets.size(); i++) {
+		prob += eq[targets[i]];
+	}
+	return prob;
+}
+
+double DesignEvaluator::evaluate(const double* kappaVals) {
+	//value of the objective at kappaVals
+
+	reweight(H, db, kappaVals, eq);
+
+	if (objective == DESIGN_RATE) {
+		mfpt->solve(eq, m);
+		return 1.0/m[initial];
+	}
+	else if (objective == DESIGN_HIT) {
+		return hit->solve(eq, initial);
+	}
+	return getEqProb();
+}
+
+double DesignEvaluator::evaluateWithGradient(const double* kappaVals, double* g) {
+	//value of the objective at kappaVals and its gradient in g
+
+	int numInteractions = H.getNumInteractions();
+	reweightGradient(H, db, kappaVals, eq, dlogeq);
+
+	double f0;
+	if (objective == DESIGN_RATE) {
+		//the rate is 1/mfpt, the mfpt gradient is one adjoint solve
+		mfpt->solve(eq, m);
+		double tau = mfpt->gradient(initial, dlogeq, dm);
+		f0 = 1.0/tau;
+		for (int k = 0; k < numInteractions; k++) {
+			g[k] = -dm[k] / (tau*tau);
+		}
+	}
+	else if (objective == DESIGN_HIT) {
+		f0 = hit->solve(eq, initial);
+		hit->gradient(dlogeq, g);
+	}
+	else {
+		f0 = getEqProb();
+		for (int k = 0; k < numInteractions; k++) {
+			g[k] = 0;
+			if (kappaVals[k] > 100000) continue;
+			for (int i = 0; i < targets.size(); i++) {
+				g[k] += eq[targets[i]] * dlogeq(targets[i],k);
+			}
+		}
+	}
+
+	//no steps below the smallest kappa
+	for (int k = 0; k < numInteractions; k++) {
+		if (kappaVals[k] < 0.011) {
+			g[k] = 0;
+		}
+	}
+
+	return f0;
 }
 
 void initKappaVals(int numInteractions, double* kappaVals) {
@@ -557,11 +955,8 @@ void constructScatterTOY(int N, Database* db, int initial, int target, bool useF
 	double* kappaVals = new double[numInteractions];
 	initKappaVals(numInteractions, kappaVals);
 
-	//declare rate matrix, probability transition matrix, equilibrium measure
-	double* T = new double[num_states*num_states]; //rate matrix
+	//declare rate matrix - only forward entries
 	double* Tconst = new double[num_states*num_states]; //rate matrix - only forward entries
-	double* eq = new double[num_states];           //equilibrium measure
-	double* m = new double[num_states];            //mfpts 
 
 	//init the rate matrix with zeros
 	for (int i = 0; i < num_states*num_states; i++) {
@@ -582,8 +977,10 @@ void constructScatterTOY(int N, Database* db, int initial, int target, bool useF
 		std::cout << targets[i] << "\n";
 	}
 
-	//declare the kappa mapping
-	std::map<std::pair<int,int>,double> kappa;
+	//evaluator for the rate, holds the eq measure too
+	RateMatrix forward(Tconst, num_states);
+	DesignEvaluator evaluator(DESIGN_RATE, db, numTypes, initial, targets, forward, ground);
+	evaluator.setTypes(particleTypes);
 
 	//declare outfile
 	std::ofstream ofile;
@@ -628,28 +1025,10 @@ void constructScatterTOY(int N, Database* db, int initial, int target, bool useF
 
 				//std::cout << kappaVals[0] << ' ' << kappaVals[1] << ' ' << kappaVals[2] << "\n";
 
-				//make the map
-				makeKappaMap(numTypes, kappaVals, kappa);
-				//std::cout << kappa[{0,0}] << ' ' << kappa[{1,0}] << ' ' << kappa[{1,1}] << "\n";
-				//do rewieght
-				reweight(N, num_states, db, particleTypes, eq, kappa);
-				//get eq prob
-				double eqProb = getEqProb(initial, kappaVals, db, particleTypes, numTypes, targets);
-				//copy Tconst into T
-				std::copy(Tconst, Tconst+num_states*num_states, T);
-				//fill in transposed entries such that T satisfies detailed balance
-				satisfyDB(T, num_states, db, eq);
-				//fill in diagonal with negative sum of row entries
-				fillDiag(T, num_states);
-				//get the transition rate
-				if (num_states > 400) { //sparse solve
-					computeMFPTsSP(num_states, T, targets, m);
-				}
-				else { //dense solve
-					computeMFPTs(num_states, T, targets, m);
-				}
-				
-				double rate = 1/m[initial];
+				//get the transition rate and eq prob
+				double rate = evaluator.evaluate(kappaVals);
+				double eqProb = evaluator.getEqProb();
+				const double* eq = evaluator.getEq();
 
 				//update maxima
 				if (eqProb > eqM) {
@@ -690,8 +1069,8 @@ void constructScatterTOY(int N, Database* db, int initial, int target, bool useF
 	ofile.close();
 
 	//free memory
-	delete []particleTypes; delete []kappaVals; delete []eq;
-	delete []T; delete []Tconst; delete []m; delete []Ks;
+	delete []particleTypes; delete []kappaVals;
+	delete []Tconst; delete []Ks;
 	delete []ek; delete []rk;
 }
 
@@ -715,11 +1094,8 @@ void constructScatterTOY1(int N, Database* db, int initial, int target) {
 	double* kappaVals = new double[numInteractions];
 	initKappaVals(numInteractions, kappaVals);
 
-	//declare rate matrix, probability transition matrix, equilibrium measure
-	double* T = new double[num_states*num_states]; //rate matrix
+	//declare rate matrix - only forward entries
 	double* Tconst = new double[num_states*num_states]; //rate matrix - only forward entries
-	double* eq = new double[num_states];           //equilibrium measure
-	double* m = new double[num_states];            //mfpts 
 
 	//init the rate matrix with zeros
 	for (int i = 0; i < num_states*num_states; i++) {
@@ -740,8 +1116,10 @@ void constructScatterTOY1(int N, Database* db, int initial, int target) {
 		std::cout << targets[i] << "\n";
 	}
 
-	//declare the kappa mapping
-	std::map<std::pair<int,int>,double> kappa;
+	//evaluator for the rate, holds the eq measure too
+	RateMatrix forward(Tconst, num_states);
+	DesignEvaluator evaluator(DESIGN_RATE, db, numTypes, initial, targets, forward, ground);
+	evaluator.setTypes(particleTypes);
 
 	//declare outfile
 	std::ofstream ofile;
@@ -777,23 +1155,10 @@ void constructScatterTOY1(int N, Database* db, int initial, int target) {
 		//set kappa
 		kappaVals[0] = Ks[x];
 
-		//make the map
+		//get the transition rate and eq prob
 		assert(numTypes == 1);
-		makeKappaMap(numTypes, kappaVals, kappa);
-		//std::cout << kappa[{0,0}] << ' ' << kappa[{1,0}] << ' ' << kappa[{1,1}] << "\n";
-		//do rewieght
-		reweight(N, num_states, db, particleTypes, eq, kappa);
-		//get eq prob
-		double eqProb = getEqProb(initial, kappaVals, db, particleTypes, numTypes, targets);
-		//copy Tconst into T
-		std::copy(Tconst, Tconst+num_states*num_states, T);
-		//fill in transposed entries such that T satisfies detailed balance
-		satisfyDB(T, num_states, db, eq);
-		//fill in diagonal with negative sum of row entries
-		fillDiag(T, num_states);
-		//get the transition rate
-		computeMFPTs(num_states, T, targets, m);
-		double rate = 1/m[initial];
+		double rate = evaluator.evaluate(kappaVals);
+		double eqProb = evaluator.getEqProb();
 
 		//update maxima
 		if (eqProb > eqM) {
@@ -822,8 +1187,8 @@ void constructScatterTOY1(int N, Database* db, int initial, int target) {
 	ofile.close();
 
 	//free memory
-	delete []particleTypes; delete []kappaVals; delete []eq;
-	delete []T; delete []Tconst; delete []m; delete []Ks;
+	delete []particleTypes; delete []kappaVals;
+	delete []Tconst; delete []Ks;
 	delete []ek; delete []rk;
 }
 
@@ -882,11 +1247,11 @@ void perturbDBconstP(Database* db) {
 	int num_states = db->getNumStates();
 
 	for (int i = 0; i < num_states; i++) {
-		std::vector<Pair> P = (*db)[i].getP();
+		std::vector<Pair> P = db->getP(i).pairs();
 		for (int j = 0; j < P.size(); j++) {
 			P[j].value = 1.0; 
 		}
-		(*db)[i].P = P;
+		db->setRow(i, P, db->getZ(i).pairs(), db->getZerr(i).pairs());
 	}
 }
 
@@ -1123,37 +1488,53 @@ double computeGradHP(int initial, int numInteractions, double* kappaVals, Databa
 	//compute the gradient of the hitting probability in kappa
 	//returns the hitting probability at current point
 
-	//declare parameters
-	double h = 1e-5; //step size for finite differences
+	RateMatrix forward(Tconst, db->getNumStates());
+	return computeGradHP(initial, numInteractions, kappaVals, db, particleTypes, numTypes, 
+											 forward, ground, targets, g);
+}
+
+double computeGradHP(int initial, int numInteractions, double* kappaVals, Database* db, 
+								 int* particleTypes, int numTypes, const RateMatrix& forward, std::vector<int> ground, 
+								 std::vector<int> targets, double* g) {
+	//compute the gradient of the hitting probability in kappa
+	//returns the hitting probability at current point
+	//one forward and one adjoint solve, see hittingGradient
+
+	//get parameters from database
+	int N = db->getN();
+	int num_states = db->getNumStates();
 
-	//get the hitting probability at the current kappa vals
-	double f0 = solveAbsorbProblem(initial, kappaVals, db, particleTypes, numTypes,
-																 Tconst, ground, targets);
+	//eq and its log derivatives at the current kappa vals
+	double* eq = new double[num_states];
+	Eigen::MatrixXd dlogeq;
+	reweightGradient(N, num_states, db, particleTypes, numTypes, kappaVals, eq, dlogeq);
+
+	//get the hitting probability and its gradient
+	double f0 = hittingGradient(forward, eq, dlogeq, initial, ground, targets, g);
 
 	//std::cout << "Hitting Prob = " << f0 << "\n";
 
-	//take a step h in each direction and compute new hitting prob
 	for (int k = 0; k < numInteractions; k++) {
 		if (kappaVals[k] < 0.011) {
 			g[k] = 0;
 		}
-		else {
-			kappaVals[k] += h;
-			double f1 = solveAbsorbProblem(initial, kappaVals, db, particleTypes, numTypes,
-																		 Tconst, ground, targets);
-			kappaVals[k] -= h;
-
-			g[k] = (f1 - f0) / h;
-		}
 	}
 
+	delete []eq;
+
 	return f0;
 }
 
 
 void hittingProbMaxTOYperms(int N, Database* db, int initial, int target) {
+	//optimize over all 2 type particle perms
+	hittingProbMaxTOYperms(N, db, initial, target, 2);
+}
+
+void hittingProbMaxTOYperms(int N, Database* db, int initial, int target, int numTypes) {
 	//use optimization scheme to get max hitting probability for target in toy model
 	//does optimization over all particle perms and outputs max probability
+	//perms are split over threads one at a time, they take very different times
 
 	//get database info
 	int num_states = db->getNumStates(); 
@@ -1161,14 +1542,9 @@ void hittingProbMaxTOYperms(int N, Database* db, int initial, int target) {
 	//set iteration settings
 	int max_its = 2000; double tol = 2e-3; double step = 0.9;
 
-	//set up particle identity
-	int* particleTypes = new int[N];
-	int numTypes = 2;
+	//number of sticky parameters
 	int numInteractions = numTypes*(numTypes+1)/2;
 
-	//set up sticky parameter values
-	double* kappaVals = new double[numInteractions];
-
 	//declare rate matrix
 	double* Tconst = new double[num_states*num_states]; //rate matrix - only forward entries
 
@@ -1183,6 +1559,7 @@ void hittingProbMaxTOYperms(int N, Database* db, int initial, int target) {
 	for (int i = 0; i < ground.size(); i++) {
 		std::cout << ground[i] << "\n";
 	}
+	RateMatrix forward(Tconst, num_states);
 
 	//find all target states consistent with input target
 	std::vector<int> targets; 
@@ -1191,29 +1568,33 @@ void hittingProbMaxTOYperms(int N, Database* db, int initial, int target) {
 		std::cout << targets[i] << "\n";
 	}
 
-	//init a gradient array
-	double* g = new double[numInteractions];
-
 	//loop over all permutations
-	std::deque<std::string> perms; 
-	//allPerms(N,perms);
-	distinctPerms(N, perms);
+	std::vector<TypeMask> perms; 
+	canonicalTypes(N, numTypes, perms);
 	int num_perms = perms.size();
 	double* permProb = new double[num_perms];
+	printf("Found %d distinct permutations\n", num_perms);
+	int finished = 0; int next = std::max(1, num_perms/10);
 
+	#pragma omp parallel
+	{
+	//workspace for this thread
+	int* particleTypes = new int[N];
+	double* kappaVals = new double[numInteractions];
+	double* g = new double[numInteractions];
+
+	#pragma omp for schedule(dynamic)
 	for (int p = 0; p < num_perms; p++) {
 		//get the permutation
-		setTypes(N, particleTypes, perms, p);
+		setTypes(N, numTypes, perms[p], particleTypes);
 		initKappaVals(numInteractions, kappaVals);
 		double hit;
 
-		printf("Testing permutation %d of %d\n", p+1, num_perms);
-
 		//optimization - steepest ascent
 		for (int it = 0; it < max_its; it++) {
 			//compute the gradient of kappa
 			hit = computeGradHP(initial, numInteractions, kappaVals, db, particleTypes, numTypes,
-												Tconst,  ground, targets, g);
+												forward,  ground, targets, g);
 
 			//update kappa - set to 0.1 if it goes negative
 			for (int k = 0; k < numInteractions; k++) {
@@ -1226,26 +1607,27 @@ void hittingProbMaxTOYperms(int N, Database* db, int initial, int target) {
 			//check for gradient tolerance
 			double res = 0;
 			for (int k = 0; k < numInteractions; k++) res += abs(g[k]);
-			std::cout << "Iteration " << it << ", Res: " << res << "\n";
+			//std::cout << "Iteration " << it << ", Res: " << res << "\n";
 			if (res < tol) {
 				break;
 			}
 		}
 
 		permProb[p] = hit;
+		permDone(finished, next, num_perms);
+	}
+
+	delete []particleTypes; delete []kappaVals; delete []g;
 	}
 
 	//print out the hitting probability with permutation
 	for (int p = 0; p < num_perms; p++) {
-		printf("Hitting Prob: %f, ID: %s\n", permProb[p], perms[p].c_str());
+		printf("Hitting Prob: %f, ID: %s\n", permProb[p], typeString(N, numTypes, perms[p]).c_str());
 	}
 
-	//std::cout << kappaVals[0] << ' ' << kappaVals[1] << ' ' << kappaVals[2] << ' ' << "\n";
-
 
 	//free memory
-	delete []particleTypes; delete []kappaVals; 
-	delete []Tconst; delete []g; delete []permProb;
+	delete []Tconst; delete []permProb;
 }
 
 void hittingProbMaxTOY(int N, Database* db, int initial, int target, bool useFile) {
@@ -1414,15 +1796,22 @@ double computeGradEQ(int initial, int numInteractions, double* kappaVals, Databa
 	//compute the gradient of the eqiluibrium probability in kappa
 	//returns the eq probability at current point
 
-	//declare parameters
-	double h = 1e-6; //step size for finite differences
+	//get parameters from database
+	int N = db->getN();
+	int num_states = db->getNumStates();
 
-	//get the hitting probability at the current kappa vals
-	double f0 = getEqProb(initial, kappaVals, db, particleTypes, numTypes, targets);
+	//eq and its log derivatives at the current kappa vals
+	double* eq = new double[num_states];
+	Eigen::MatrixXd dlogeq;
+	reweightGradient(N, num_states, db, particleTypes, numTypes, kappaVals, eq, dlogeq);
 
-	//std::cout << "Hitting Prob = " << f0 << "\n";
+	//get the eq probability of the targets
+	double f0 = 0;
+	for (int i = 0; i < targets.size(); i++) {
+		f0 += eq[targets[i]];
+	}
 
-	//take a step h in each direction and compute new hitting prob
+	//sum the derivatives of the targets
 	for (int k = 0; k < numInteractions; k++) {
 		if (kappaVals[k] < 0.011) {
 			g[k] = 0;
@@ -1431,14 +1820,15 @@ double computeGradEQ(int initial, int numInteractions, double* kappaVals, Databa
 			g[k] = 0;
 		}
 		else {
-			kappaVals[k] += h;
-			double f1 = getEqProb(initial, kappaVals, db, particleTypes, numTypes, targets);
-			kappaVals[k] -= h;
-
-			g[k] = (f1 - f0) / h;
+			g[k] = 0;
+			for (int i = 0; i < targets.size(); i++) {
+				g[k] += eq[targets[i]] * dlogeq(targets[i],k);
+			}
 		}
 	}
 
+	delete []eq;
+
 	return f0;
 }
 
@@ -1519,8 +1909,14 @@ void eqProbMaxTOY(int N, Database* db, int initial, int target, bool useFile) {
 }
 
 void eqProbMaxTOYperms(int N, Database* db, int initial, int target) {
+	//optimize over all 2 type particle perms
+	eqProbMaxTOYperms(N, db, initial, target, 2);
+}
+
+void eqProbMaxTOYperms(int N, Database* db, int initial, int target, int numTypes) {
 	//use optimization scheme to get max hitting probability for target in toy model
 	//does optimization over all particle perms and outputs max probability
+	//perms are split over threads one at a time, they take very different times
 
 	//get database info
 	int num_states = db->getNumStates(); 
@@ -1528,14 +1924,9 @@ void eqProbMaxTOYperms(int N, Database* db, int initial, int target) {
 	//set iteration settings
 	int max_its = 60000; double tol = 1e-6; double step = 0.9;
 
-	//set up particle identity
-	int* particleTypes = new int[N];
-	int numTypes = 2;
+	//number of sticky parameters
 	int numInteractions = numTypes*(numTypes+1)/2;
 
-	//set up sticky parameter values
-	double* kappaVals = new double[numInteractions];
-
 	//find all target states consistent with input target
 	std::vector<int> targets; 
 	findIsomorphic(N, num_states, target, db, targets);
@@ -1543,24 +1934,28 @@ void eqProbMaxTOYperms(int N, Database* db, int initial, int target) {
 		std::cout << targets[i] << "\n";
 	}
 
-	//init a gradient array
-	double* g = new double[numInteractions];
-
 	//loop over all permutations
-	std::deque<std::string> perms; 
-	//allPerms(N, perms);
-	distinctPerms(N,perms);
+	std::vector<TypeMask> perms; 
+	canonicalTypes(N, numTypes, perms);
 	int num_perms = perms.size();
 	double* permProb = new double[num_perms];
+	printf("Found %d distinct permutations\n", num_perms);
+	int finished = 0; int next = std::max(1, num_perms/10);
 
+	#pragma omp parallel
+	{
+	//workspace for this thread
+	int* particleTypes = new int[N];
+	double* kappaVals = new double[numInteractions];
+	double* g = new double[numInteractions];
+
+	#pragma omp for schedule(dynamic)
 	for (int p = 0; p < num_perms; p++) {
 		//get the permutation
-		setTypes(N, particleTypes, perms, p);
+		setTypes(N, numTypes, perms[p], particleTypes);
 		initKappaVals(numInteractions, kappaVals);
 		double eq;
 
-		printf("Testing permutation %d of %d\n", p+1, num_perms);
-
 		//optimization - steepest ascent
 		for (int it = 0; it < max_its; it++) {
 			//compute the gradient of kappa
@@ -1588,19 +1983,20 @@ void eqProbMaxTOYperms(int N, Database* db, int initial, int target) {
 		}
 
 		permProb[p] = eq;
+		permDone(finished, next, num_perms);
+	}
+
+	delete []particleTypes; delete []kappaVals; delete []g;
 	}
 
 	//print out the hitting probability with permutation
 	for (int p = 0; p < num_perms; p++) {
-		printf("Eq Prob: %f, ID: %s\n", permProb[p], perms[p].c_str());
+		printf("Eq Prob: %f, ID: %s\n", permProb[p], typeString(N, numTypes, perms[p]).c_str());
 	}
 
-	//std::cout << kappaVals[0] << ' ' << kappaVals[1] << ' ' << kappaVals[2] << ' ' << "\n";
-
 
 	//free memory
-	delete []particleTypes; delete []kappaVals; 
-	delete []g; delete []permProb;
+	delete []permProb;
 }
 
 
@@ -1612,15 +2008,20 @@ double getRate(int initial, double* kappaVals, Database* db, int* particleTypes,
 							 int numTypes, double* Tconst, std::vector<int> targets) {
 	//get transition rate as 1/mfpt to targets
 
+	RateMatrix forward(Tconst, db->getNumStates());
+	MFPTSolver solver(forward, targets);
+	return getRate(initial, kappaVals, db, particleTypes, numTypes, solver);
+}
+
+double getRate(int initial, double* kappaVals, Database* db, int* particleTypes, 
+							 int numTypes, MFPTSolver& solver) {
+	//get transition rate as 1/mfpt to the targets of solver
+	//solver keeps the factorization pattern between calls
+
 	//get parameters from database
 	int N = db->getN();
 	int num_states = db->getNumStates();
 
-	//initialize the transition rate matrix
-	double* T = new double[num_states*num_states];
-	//copy Tconst into T
-	std::copy(Tconst, Tconst+num_states*num_states, T);
-
 	//init array for equilibrium distribution and compute it
 	double* eq = new double[num_states];
 	//declare and fill kappa map
@@ -1629,19 +2030,13 @@ double getRate(int initial, double* kappaVals, Database* db, int* particleTypes,
 	//do reweight to fill eq
 	reweight(N, num_states, db, particleTypes, eq, kappa);
 
-	//fill in transposed entries such that T satisfies detailed balance
-	satisfyDB(T, num_states, db, eq);
-
-	//fill in diagonal with negative sum of row entries
-	fillDiag(T, num_states);
-
 	//construct array of mfpts and caluclate it
 	double* m = new double[num_states];
-	computeMFPTsSP(num_states, T, targets, m);
+	solver.solve(eq, m);
 	double mfpt = m[initial];
 
 	//free memory
-	delete []T; delete []eq; delete []m;
+	delete []eq; delete []m;
 
 	return 1.0/mfpt;
 }
@@ -1696,28 +2091,47 @@ double computeGradRate(int initial, int numInteractions, double* kappaVals, Data
 	//compute the gradient of the avg transition rate in kappa
 	//returns the avg transition rate at current point
 
-	//declare parameters
-	double h = 1e-5; //step size for finite differences
+	RateMatrix forward(Tconst, db->getNumStates());
+	MFPTSolver solver(forward, targets);
+	return computeGradRate(initial, numInteractions, kappaVals, db, particleTypes, numTypes,
+												 solver, g);
+}
+
+double computeGradRate(int initial, int numInteractions, double* kappaVals, Database* db, 
+								 int* particleTypes, int numTypes, MFPTSolver& solver, double* g) {
+	//compute the gradient of the avg transition rate in kappa
+	//returns the avg transition rate at current point
+	//the rate is 1/mfpt, the mfpt gradient is one adjoint solve
 
-	//get the hitting probability at the current kappa vals
-	double f0 = getRate(initial, kappaVals, db, particleTypes, numTypes, Tconst, targets);
+	//get parameters from database
+	int N = db->getN();
+	int num_states = db->getNumStates();
 
-	//std::cout << "Hitting Prob = " << f0 << "\n";
+	//eq and its log derivatives at the current kappa vals
+	double* eq = new double[num_states];
+	Eigen::MatrixXd dlogeq;
+	reweightGradient(N, num_states, db, particleTypes, numTypes, kappaVals, eq, dlogeq);
+
+	//solve for the mfpts, then the gradient of the initial one
+	double* m = new double[num_states];
+	double* dm = new double[numInteractions];
+	solver.solve(eq, m);
+	double mfpt = solver.gradient(initial, dlogeq, dm);
+	double f0 = 1.0/mfpt;
+
+	//std::cout << "Rate = " << f0 << "\n";
 
-	//take a step h in each direction and compute new hitting prob
 	for (int k = 0; k < numInteractions; k++) {
 		if (kappaVals[k] < 0.011) {
 			g[k] = 0;
 		}
 		else {
-			kappaVals[k] += h;
-			double f1 = getRate(initial, kappaVals, db, particleTypes, numTypes, Tconst, targets);
-			kappaVals[k] -= h;
-
-			g[k] = (f1 - f0) / h;
+			g[k] = -dm[k] / (mfpt*mfpt);
 		}
 	}
 
+	delete []eq; delete []m; delete []dm;
+
 	return f0;
 }
 
@@ -1770,6 +2184,10 @@ void rateMaxTOY(int N, Database* db, int initial, int target, bool useFile) {
 		std::cout << targets[i] << "\n";
 	}
 
+	//solver context, the factorization pattern is shared by every kappa
+	RateMatrix forward(Tconst, num_states);
+	MFPTSolver solver(forward, targets);
+
 	//init a gradient array
 	double* g = new double[numInteractions];
 
@@ -1782,7 +2200,7 @@ void rateMaxTOY(int N, Database* db, int initial, int target, bool useFile) {
 	for (int it = 0; it < max_its; it++) {
 		//compute the gradient of kappa
 		R = computeGradRate(initial, numInteractions, kappaVals, db, particleTypes, numTypes,
-											Tconst, targets, g);
+											solver, g);
 
 		//update kappa - set to 0.1 if it goes negative
 		for (int k = 0; k < numInteractions; k++) {
@@ -1821,8 +2239,14 @@ void rateMaxTOY(int N, Database* db, int initial, int target, bool useFile) {
 }
 
 void rateMaxTOYperms(int N, Database* db, int initial, int target) {
+	//optimize over all 2 type particle perms
+	rateMaxTOYperms(N, db, initial, target, 2);
+}
+
+void rateMaxTOYperms(int N, Database* db, int initial, int target, int numTypes) {
 	//use optimization scheme to get max rate for target in toy model
-	//uses the file for the permutation
+	//does optimization over all particle perms and outputs max rate
+	//perms are split over threads one at a time, they take very different times
 
 	//get database info
 	int num_states = db->getNumStates(); 
@@ -1830,14 +2254,9 @@ void rateMaxTOYperms(int N, Database* db, int initial, int target) {
 	//set iteration settings
 	int max_its = 5000; double tol = 1e-10; double step = 0.9;
 
-	//set up particle identity
-	int* particleTypes = new int[N];
-	int numTypes = 2;
+	//number of sticky parameters
 	int numInteractions = numTypes*(numTypes+1)/2;
 
-	//set up sticky parameter values
-	double* kappaVals = new double[numInteractions];
-
 	//declare rate matrix
 	double* Tconst = new double[num_states*num_states]; //rate matrix - only forward entries
 
@@ -1852,6 +2271,7 @@ void rateMaxTOYperms(int N, Database* db, int initial, int target) {
 	for (int i = 0; i < ground.size(); i++) {
 		std::cout << ground[i] << "\n";
 	}
+	RateMatrix forward(Tconst, num_states);
 
 	//find all target states consistent with input target
 	std::vector<int> targets; 
@@ -1860,29 +2280,34 @@ void rateMaxTOYperms(int N, Database* db, int initial, int target) {
 		std::cout << targets[i] << "\n";
 	}
 
-	//init a gradient array
-	double* g = new double[numInteractions];
-
 	//loop over all permutations
-	std::deque<std::string> perms; 
-	//allPerms(N,perms);
-	distinctPerms(N, perms);
+	std::vector<TypeMask> perms; 
+	canonicalTypes(N, numTypes, perms);
 	int num_perms = perms.size();
 	double* permRate = new double[num_perms];
+	printf("Found %d distinct permutations\n", num_perms);
+	int finished = 0; int next = std::max(1, num_perms/10);
 
+	#pragma omp parallel
+	{
+	//workspace for this thread, the solver pattern does not depend on the types
+	int* particleTypes = new int[N];
+	double* kappaVals = new double[numInteractions];
+	double* g = new double[numInteractions];
+	MFPTSolver solver(forward, targets);
+
+	#pragma omp for schedule(dynamic)
 	for (int p = 0; p < num_perms; p++) {
 		//get the permutation
-		setTypes(N, particleTypes, perms, p);
+		setTypes(N, numTypes, perms[p], particleTypes);
 		initKappaVals(numInteractions, kappaVals);
 		double R;
 
-		printf("Testing permutation %d of %d\n", p+1, num_perms);
-
 		//optimization - steepest ascent
 		for (int it = 0; it < max_its; it++) {
 			//compute the gradient of kappa
 			R = computeGradRate(initial, numInteractions, kappaVals, db, particleTypes, numTypes,
-												Tconst, targets, g);
+												solver, g);
 
 			//update kappa - set to 0.1 if it goes negative
 			for (int k = 0; k < numInteractions; k++) {
@@ -1901,19 +2326,20 @@ void rateMaxTOYperms(int N, Database* db, int initial, int target) {
 		}
 
 		permRate[p] = R;
+		permDone(finished, next, num_perms);
+	}
+
+	delete []particleTypes; delete []kappaVals; delete []g;
 	}
 
 	//print out the hitting probability with permutation
 	for (int p = 0; p < num_perms; p++) {
-		printf("Average Rate: %f, ID: %s\n", permRate[p], perms[p].c_str());
+		printf("Average Rate: %f, ID: %s\n", permRate[p], typeString(N, numTypes, perms[p]).c_str());
 	}
 
-	//std::cout << kappaVals[0] << ' ' << kappaVals[1] << ' ' << kappaVals[2] << ' ' << "\n";
-
 
 	//free memory
-	delete []particleTypes; delete []kappaVals; 
-	delete []g; delete []permRate; delete []Tconst;
+	delete []Tconst; delete []permRate;
 }
 
 
@@ -2058,6 +2484,20 @@ double lineSearchRate(int initial, int numInteractions, double* kappaVals, Datab
 	//perform a line search to get a step size for the objective fn
 	//step is passed by reference, returns difference in obj fn
 
+	RateMatrix forward(Tconst, db->getNumStates());
+	MFPTSolver solver(forward, targets);
+	return lineSearchRate(initial, numInteractions, kappaVals, db, particleTypes, numTypes,
+												solver, c, r, eq, R, g, step);
+}
+
+double lineSearchRate(int initial, int numInteractions, double* kappaVals, Database* db, 
+											int* particleTypes, int numTypes, MFPTSolver& solver, 
+											double c, double r, double eq, double R, double* g, double& step) {
+	//perform a line search to get a step size for the objective fn
+	//step is passed by reference, returns difference in obj fn
+
+	std::vector<int> targets = solver.getTargets();
+
 	//define initial step size and reducing factor
 	double step0 = 2; double alpha = 0.5;
 
@@ -2081,7 +2521,7 @@ double lineSearchRate(int initial, int numInteractions, double* kappaVals, Datab
 
 		//evaluate the objective
 		double Enew = getEqProb(initial, testKappa, db, particleTypes, numTypes, targets);
-		double Rnew = getRate(initial, testKappa, db, particleTypes, numTypes, Tconst, targets);
+		double Rnew = getRate(initial, testKappa, db, particleTypes, numTypes, solver);
 		
 		objNew = Rnew - r * (Enew - c) * (Enew - c);
 		//printf("New obj: %f\n", objNew);
@@ -2439,26 +2879,15 @@ int findMatrix(int N, double* X, Database* db) {
 	//find the adjacency matrix for state X in the database
 
 	//construct the AM
-	int* M = new int[N*N]; for (int i = 0; i < N*N; i++) M[i]=0;
+	AdjBits M;
 	getAdj(X,N,M);
 	//refine(N, X, M); //refines X and fills M
-	int* dbM = new int[N*N];
 
 	//define the return variable to be -1 if not found
 	int state = -1;
 
-	//loop over the database to search
-	for (int i = 0; i < db->getNumStates(); i++) {
-		extractAM(N, i, dbM, db);
-		bool S = checkSame(dbM, M, N);
-		if (S) { //found matrix
-			state = i;
-			break;
-		}
-	}
-
-	//free memory
-	delete []M; delete []dbM;
+	//look up the matrix in the database index
+	state = db->lookup(M);
 
 	return state;
 }
@@ -2518,6 +2947,9 @@ void estimateHittingProbability(int N, Database* db, int target) {
 	//vector of hitting times
 	std::vector<double> avgT;
 
+	//set up the integrator once, reuse for every trajectory
+	Integrator sde(N, rho, beta, E, P, method, pot);
+
 	//loop over some number of trajectories to get first hit probs
 	int traj = 0;
 	while (traj < num_trajectories) {
@@ -2526,7 +2958,7 @@ void estimateHittingProbability(int N, Database* db, int target) {
 		double T = 0; 
 		while (T < T_cut) {
 			//solve the sde, determine new state
-			solveSDE(X0, N, DT, rho, beta, E, P, method, pot);
+			sde.solveSDE(X0, DT);
 			T += DT;
 			int new_state = findMatrix(N, X0, db);
 
@@ -2792,6 +3224,10 @@ void computeParetoFront(int N, Database* db, int initial, int target, bool useFi
 		std::cout << targets[i] << "\n";
 	}
 
+	//solver context, the factorization pattern is shared by every kappa
+	RateMatrix forward(Tconst, num_states);
+	MFPTSolver solver(forward, targets);
+
 	//get the permutation
 	//initKappaVals(numInteractions, kappaVals);
 	readKappaFile(numInteractions, kappaVals);
@@ -2813,7 +3249,7 @@ void computeParetoFront(int N, Database* db, int initial, int target, bool useFi
 		double eq = computeGradEQ(initial, numInteractions, kappaVals, db, particleTypes, numTypes,
 												targets, gE);
 		double rate = computeGradRate(initial, numInteractions, kappaVals, db, particleTypes, numTypes,
-													Tconst, targets, gR);
+											solver, gR);
 
 		printf("rate grad: %f, %f, %f\n", gR[0], gR[1], gR[2]);
 		printf("eq grad: %f, %f, %f\n", gE[0], gE[1], gE[2]);
@@ -2872,6 +3308,10 @@ double rateMaxPareto(double& c, int initial, Database* db, int num_states, int*
 	int max_its = 20; double objTol = 1e-8; 
 	double r = 200;    //cost 
 
+	//solver context, the factorization pattern is shared by every kappa
+	RateMatrix forward(Tconst, num_states);
+	MFPTSolver solver(forward, targets);
+
 	//init a gradient array
 	double* gH = new double[numInteractions];
 	double* gR = new double[numInteractions];
@@ -2887,7 +3327,7 @@ double rateMaxPareto(double& c, int initial, Database* db, int num_states, int*
 		eq = computeGradEQ(initial, numInteractions, kappaVals, db, particleTypes, numTypes,
 												targets, gH);
 		R = computeGradRate(initial, numInteractions, kappaVals, db, particleTypes, numTypes, 
-												Tconst, targets, gR);
+												solver, gR);
 
 		//define the objevtive function
 		double obj = R - r * (eq - c) * (eq-c);  //maybe use quadratic penalty
@@ -2900,7 +3340,7 @@ double rateMaxPareto(double& c, int initial, Database* db, int num_states, int*
 		//find a step size to give decrease in obj fn
 		double step = 0; 
 		double delta = lineSearchRate(initial, numInteractions, kappaVals, db, particleTypes, 
-															numTypes, Tconst, targets, c, r, eq, R, gR, step);
+															numTypes, solver, c, r, eq, R, gR, step);
 
 		//take the step
 		for (int i = 0; i < numInteractions; i++) {
@@ -3199,23 +3639,12 @@ double analyticEqGradient(Database* db, int* particleTypes, int numTypes, int nu
 	int ns = db->getNumStates();
 	double tol = 1e-6;
 
-	//declare the kappa mapping
-	std::map<std::pair<int,int>,double> kappa;
-	makeKappaMap(numTypes, kappaVals, kappa);
-	
-	//declare the index mapping
-	std::map<std::pair<int,int>,int> index;
-	int* indexVals = new int[numInteractions];
-	for (int i = 0; i < numInteractions; i++) {
-		indexVals[i] = i;
-	}
-	makeIndexMap(numTypes, indexVals, index);
-
 	//create an array for the derivative of each component
 	double* eqDeriv = new double[ns];
 
 	//first, reweight the eq distribution
-	reweight(N, ns, db, particleTypes, eq, kappa);
+	const BondHistogram& H = getBondHistogram(N, db, particleTypes, numTypes);
+	reweight(H, db, kappaVals, eq);
 
 	//loop over all bond types
 	for (int bond = 0; bond < numInteractions; bond++) {
@@ -3223,13 +3652,13 @@ double analyticEqGradient(Database* db, int* particleTypes, int numTypes, int nu
 
 		//sum the eq prob over all states, weighted by n_b
 		for (int i = 0; i < ns; i++) {
-			int b = searchForBonds(N, db, i, bond, particleTypes, index);
+			int b = H.getCount(i, bond);
 			S += eq[i] * float(b);
 		}
 
 		//fill in the derivative array
 		for (int i = 0; i < ns; i++) {
-			int b = searchForBonds(N, db, i, bond, particleTypes, index);
+			int b = H.getCount(i, bond);
 			eqDeriv[i] = eq[i] / kappaVals[bond] * (float(b) - S);
 		}
 
@@ -3254,7 +3683,7 @@ double analyticEqGradient(Database* db, int* particleTypes, int numTypes, int nu
 
 
 	//free memory
-	delete []eqDeriv; delete []indexVals;
+	delete []eqDeriv;
 
 	return eqProb;
 
@@ -2,6 +2,7 @@
 #include "point.h"
 #include "bDynamics.h"
 #include "tpt.h"
+#include "rateMatrix.h"
 #include <vector>
 #include <map>
 #include <deque>
@@ -9,6 +10,141 @@
 namespace bd { 
 class Database; 
 
+/* bond type histogram. count(i,k) is the number of non-trivial bonds of
+	 interaction type k (same ordering as kappaVals) in state i, for one
+	 assignment of particle types. built once per assignment, after that the
+	 standard reweight at any kappa is one matrix vector product in log space,
+		log w_i = log freq_i + sum_k count(i,k) log kappa_k - nt_i log kap0.
+	 getBondHistogram keeps one per thread and rebuilds it only when the
+	 database or the particle types change.
+	 Members:
+		generation - generation of the database the counts were taken from (see
+		             Database::generation), N and types the assignment
+		num_states, numTypes - size of the histogram
+		typeIndex - interaction index of each pair of particle types
+		count - state by interaction matrix of bond counts
+		nt - number of non-trivial bonds of each state
+		flower - states needing the rigidity reweight (12 bonds, 7 particles)
+		flowerU - left singular vectors of the unit rigidity matrix of each flower
+		          state, for the nonzero singular values. the geometry is fixed,
+		          new kappa only rescale rows, so the pseudo-determinant ratio is
+		          a^r / det(U^T W U) with W the a value of each bond's type
+		flowerRows - interaction index of each row (bond) of the rigidity matrix
+		logk, lw, ... - workspace for the const functions, sized once when the
+		                histogram is built. so a histogram is used by one thread
+		                at a time, as getBondHistogram hands them out
+*/
+class BondHistogram {
+	public:
+		BondHistogram();
+		BondHistogram(int N, Database* db, int* particleTypes, int numTypes);
+
+		//accessor functions
+		int getNumStates() const {return num_states;}
+		int getNumTypes() const {return numTypes;}
+		int getNumInteractions() const {return count.cols();}
+		int getType(int p1, int p2) const {return typeIndex(p1,p2);}
+		int getCount(int state, int k) const {return count(state,k);}
+		const Eigen::MatrixXd& getCounts() const {return count;}
+		const std::vector<int>& getTypes() const {return types;}
+		const std::vector<int>& getFlowerStates() const {return flower;}
+
+		//set up for any database type, then count bonds one at a time
+		void resize(unsigned long generation_, int N_, int num_states_, const int* particleTypes, 
+								int numTypes_);
+		void addBond(int state, int p1, int p2) {count(state, typeIndex(p1,p2)) += 1;}
+		void setBonds(int state, int b) {nt(state) = b - (N-1);}
+		bool matches(unsigned long generation_, int N_, int num_states_, const int* particleTypes, 
+								 int numTypes_) const;
+
+		//count(i,:).log(kappa) - nt_i log(kap0) for every state
+		void logWeights(const double* kappaVals, double kap0, Eigen::VectorXd& lw) const;
+		const Eigen::VectorXd& logWeights(const double* kappaVals, double kap0) const;
+		//rigidity re-weight factor of each flower state, relative to KAP
+		void flowerWeights(const double* kappaVals, Eigen::VectorXd& fw) const;
+		const Eigen::VectorXd& flowerWeights(const double* kappaVals) const;
+		//derivative of log flowerWeights, flower state by interaction
+		const Eigen::MatrixXd& flowerLogDerivative(const double* kappaVals) const;
+
+	private:
+		unsigned long generation; int N; std::vector<int> types;
+		int num_states; int numTypes;
+		Eigen::MatrixXi typeIndex; Eigen::MatrixXd count; Eigen::VectorXd nt;
+		std::vector<int> flower;
+		std::vector<Eigen::MatrixXd> flowerU; std::vector<std::vector<int> > flowerRows;
+
+		//workspace
+		mutable Eigen::VectorXd logk; mutable Eigen::VectorXd lw; mutable Eigen::VectorXd fw; 
+		mutable Eigen::VectorXd fwp; mutable Eigen::VectorXd aNew; mutable Eigen::VectorXd logGammaNew;
+		mutable Eigen::MatrixXd dlogfw; mutable std::vector<double> kv;
+		mutable std::vector<Eigen::MatrixXd> flowerWU; mutable std::vector<Eigen::MatrixXd> flowerUWU;
+		mutable std::vector<Eigen::PartialPivLU<Eigen::MatrixXd> > flowerLU;
+
+		void addFlower(Database* db, int state);
+		void allocate();
+};
+
+//the histogram for this thread, rebuilt if db or particleTypes changed
+const BondHistogram& getBondHistogram(int N, Database* db, int* particleTypes, int numTypes);
+
+/* evaluates one design objective at many kappa with the buffers allocated once.
+	 the bond histogram, the generator pattern and the lu analysis are set up per
+	 (database, particle types, targets), every evaluate only rewrites values.
+	 eigen's sparse lu still allocates inside factorize. not thread safe, use one
+	 per thread, like MFPTSolver.
+		DESIGN_EQ   - eq probability of the targets
+		DESIGN_HIT  - probability to hit the targets before the other end states
+		DESIGN_RATE - transition rate, 1/mfpt from initial to the targets
+	 gradients in kappa are set to 0 for kappa < 0.011 (and > 100000 for eq), as
+	 in computeGradEQ, computeGradHP and computeGradRate.
+	 Members:
+		objective - which quantity evaluate returns
+		db, N, num_states, numTypes - the database and number of particle types
+		initial, targets - initial state and target states
+		H - bond histogram for the current particle types
+		mfpt - solver for DESIGN_RATE, hit - solver for DESIGN_HIT, NULL if unused
+		eq, m, dm - equilibrium measure, mfpts, mfpt gradient
+		dlogeq - derivative of log eq in each kappa
+*/
+enum DesignObjective {DESIGN_EQ, DESIGN_HIT, DESIGN_RATE};
+
+class DesignEvaluator {
+	public:
+		//forward and endStates as from createTransitionMatrix
+		DesignEvaluator(DesignObjective objective_, Database* db_, int numTypes_, int initial_, 
+										const std::vector<int>& targets_, const RateMatrix& forward, 
+										const std::vector<int>& endStates);
+		~DesignEvaluator();
+
+		//accessor functions
+		int getNumInteractions() const {return H.getNumInteractions();}
+		const double* getEq() const {return eq;}
+		//eq probability of the targets at the last evaluate
+		double getEqProb() const;
+
+		//particle types for the next evaluations, histogram rebuilt if they changed
+		void setTypes(int* particleTypes);
+		double evaluate(const double* kappaVals);
+		double evaluateWithGradient(const double* kappaVals, double* g);
+
+	private:
+		DesignObjective objective;
+		Database* db; int N; int num_states; int numTypes;
+		int initial; std::vector<int> targets;
+		BondHistogram H;
+		MFPTSolver* mfpt; HittingSolver* hit;
+		double* eq; double* m; double* dm;
+		Eigen::MatrixXd dlogeq;
+
+		//copy constructors - the solvers can not be copied
+		DesignEvaluator(const DesignEvaluator&) {
+			throw 1;
+		}
+		DesignEvaluator& operator=(const DesignEvaluator&) {
+			throw 1;
+		}
+};
+
 //general functions
 void getBondTypes(int N, int* particleTypes, Database* db, std::vector<int> targets);
 int setTypes(int N, int* particleTypes, int IC);
@@ -17,8 +153,13 @@ double getStickyProduct(int N, int state,  Database* db, int* particleTypes,
 												std::map<std::pair<int,int>,double> kappa);
 void reweight(int N, int num_states, Database* db, int* particleTypes, double* eq,
 						  std::map<std::pair<int,int>,double> kappa);
+void reweight(const BondHistogram& H, Database* db, const double* kappaVals, double* eq);
 void reweight7(int N, int num_states, Database* db, int* particleTypes, double* eq,
 						  std::map<std::pair<int,int>,double> kappa);
+void reweightGradient(int N, int num_states, Database* db, int* particleTypes, int numTypes,
+											double* kappaVals, double* eq, Eigen::MatrixXd& dlogeq);
+void reweightGradient(const BondHistogram& H, Database* db, const double* kappaVals, double* eq, 
+											Eigen::MatrixXd& dlogeq);
 void getReweightMaps(std::map<std::pair<int,int>,double> kappa,
 										 std::map<std::pair<int,int>,double>& a_new,
 										 std::map<std::pair<int,int>,double>& gamma_new); 
@@ -27,6 +168,18 @@ double getPdet(int N, int state, Database* db, int* particleTypes,
 void initKappaVals(int numInteractions, double* kappaVals);
 void allPerms(int N, std::deque<std::string>&);
 void distinctPerms(int N, std::deque<std::string>&);
+
+/* particle type assignments packed in a bitmask. each particle takes enough
+	 bits for numTypes, particle 0 in the highest bits, so comparing masks compares
+	 the assignments lexicographically. an assignment is canonical if it is the
+	 smallest in its class under chain reversal and relabeling of the types, i.e.
+	 types first appear in the order 0,1,2,.. and it is no larger than its reversal.
+	 fewer than numTypes types may be used. N*bits must fit in 64 bits */
+typedef unsigned long long TypeMask;
+int typeBits(int numTypes);
+void canonicalTypes(int N, int numTypes, std::vector<TypeMask>& masks);
+void setTypes(int N, int numTypes, TypeMask mask, int* particleTypes);
+std::string typeString(int N, int numTypes, TypeMask mask);
 void checkPerm(std::string , std::deque<std::string>&);
 void checkPositive(int numInteractions, double* kappaVals); 
 void applyMax(int numInteractions, double* kappaVals, double M);
@@ -52,13 +205,19 @@ double computeGradHP(int initial, int numInteractions,  double* kappaVals,
 										 Database* db, int* particleTypes, int numTypes, 
 										 double* Tconst, std::vector<int> ground, 
 								 		 std::vector<int> targets, double* g);
+double computeGradHP(int initial, int numInteractions,  double* kappaVals, 
+										 Database* db, int* particleTypes, int numTypes, 
+										 const RateMatrix& forward, std::vector<int> ground, 
+								 		 std::vector<int> targets, double* g);
 
 void hittingProbMaxTOY(int N, Database* db, int initial, int target, bool useFile);
 void hittingProbMaxTOYperms(int N, Database* db, int initial, int target);
+void hittingProbMaxTOYperms(int N, Database* db, int initial, int target, int numTypes);
 
 //equilibrium probability optimization
 void eqProbMaxTOY(int N, Database* db, int initial, int target, bool useFile);
 void eqProbMaxTOYperms(int N, Database* db, int initial, int target);
+void eqProbMaxTOYperms(int N, Database* db, int initial, int target, int numTypes);
 double computeGradEQ(int initial, int numInteractions, double* kappaVals, Database* db, 
 								 int* particleTypes, int numTypes, std::vector<int> targets, double* g);
 double getEqProb(int initial, double* kappaVals, Database* db, 
@@ -69,6 +228,7 @@ double printEqProb(int initial, double* kappaVals, Database* db,
 //average transition rate optimization
 void rateMaxTOY(int N, Database* db, int initial, int target, bool useFile);
 void rateMaxTOYperms(int N, Database* db, int initial, int target);
+void rateMaxTOYperms(int N, Database* db, int initial, int target, int numTypes);
 double computeGradRate(int initial, int numInteractions, double* kappaVals, Database* db, 
 								 int* particleTypes, int numTypes, double* Tconst, std::vector<int> targets, 
 								 double* g);
@@ -76,6 +236,11 @@ double getRateTPT(int initial, double* kappaVals, Database* db, int* particleTyp
 							 double* Tconst, std::vector<int> targets);
 double getRate(int initial, double* kappaVals, Database* db, int* particleTypes, int numTypes,
 							 double* Tconst, std::vector<int> targets);
+//same as above, reusing the factorization in solver across kappa
+double computeGradRate(int initial, int numInteractions, double* kappaVals, Database* db, 
+								 int* particleTypes, int numTypes, MFPTSolver& solver, double* g);
+double getRate(int initial, double* kappaVals, Database* db, int* particleTypes, int numTypes,
+							 MFPTSolver& solver);
 
 //hitting probability optimization with rate constraints
 void hittingProbMaxTOYc(int N, Database* db, int initial, int target, bool useFile);
@@ -93,6 +258,9 @@ double lineSearchRate(int initial, int numInteractions, double* kappaVals, Datab
 											int* particleTypes, int numTypes, double* Tconst, 
 											std::vector<int> targets, double c, double r, double eq, double R, 
 											double* g, double& step);
+double lineSearchRate(int initial, int numInteractions, double* kappaVals, Database* db, 
+											int* particleTypes, int numTypes, MFPTSolver& solver, 
+											double c, double r, double eq, double R, double* g, double& step);
 void applyRateConstraint(double R, double c, double r, int numInteractions, 
 												 double* gH, double* gR); 
 
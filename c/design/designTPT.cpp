@@ -139,8 +139,16 @@ void performTPT(int N, Database* db, int initial, int target, bool useFile) {
 	double* q = new double[num_states];
 	for (int i = 0; i < num_states; i++) q[i] = 0;
 	
+	//one factorization for the committor and the mfpts, any ground state
+	//can be a boundary
+	RateMatrix L(T, num_states);
+	std::vector<int> boundary(groundStates); 
+	boundary.insert(boundary.end(), targets.begin(), targets.end());
+	boundary.push_back(initial);
+	BoundarySolver S(L, boundary);
+
 	//solve dirichlet problem for committor, q 
-	computeCommittor(q, T, num_states, initial, targets);
+	S.committor(initial, targets, q);
 
 	//init and compute the probability fluxes
 	double* flux = new double[num_states*num_states]; 
@@ -151,7 +159,7 @@ void performTPT(int N, Database* db, int initial, int target, bool useFile) {
 	double R = computeTransitionRateTPT(num_states, q, T, eq);
 	std::cout << "TPT rate " << R << "\n";
 	double* r = new double[num_states];
-	computeMFPTs(num_states, T, targets, r);
+	S.mfpt(targets, r);
 	//go from mfpt to rates
 	for (int i = 0; i < num_states; i++) r[i] = 1.0 / r[i];
 
@@ -773,10 +773,11 @@ void graphQuenches(int N, Database* db, int initial) {
 
 void matrixExp(int num_states, double t, Eigen::MatrixXd G, Eigen::VectorXd P, 
 							 Eigen::VectorXd& Pnew) {
-	//computes the matrix exponential and product, Pnew = exp(tG)*P
+	//computes the matrix exponential and product, Pnew = exp(tG)^T*P
+	//by krylov propagation on the sparse generator, see expmv
 
-	G *= t;
-	Pnew =  (G.exp()).transpose() * P;
+	SpMat Gt = G.transpose().sparseView();
+	expmv(Gt, t, P, Pnew);
 
 }
 
@@ -873,11 +874,12 @@ void evolveProbability(int N, Database* db, int initial, bool useFile) {
 	}
 	ofile << "\n";
 
-	//loop over time increments to construct P(t)
+	//loop over time increments to construct P(t), P(t+dt) = exp(dtG)^T*P(t)
 	double t = 0;
 	for (int i = 0; i < M; i++) {
 		t += dt;
-		matrixExp(new_states, t, G, P, Pnew);
+		matrixExp(new_states, dt, G, P, Pnew);
+		P = Pnew;
 		ofile << t << ' ';
 		for (int i = 0; i < new_states; i++) {
 			ofile << Pnew(i) << ' ';
@@ -975,11 +977,14 @@ void evaluatePtc(int N, Database* db, int initial, int numTypes, int numInteract
 	double dt = double(t_max) / double(M);
 	double t_ss = 100.0;
 
+	//the pre quench distribution at tc is carried forward one step at a time
 	double tc = 0; 
+	Pnew = P;
 	for (int i = 0; i < M; i++) {
-		matrixExp(new_states, tc, Gpre, P, Pnew);
 		matrixExp(new_states, t_ss-tc, Gpost, Pnew, Pnew2);
 		ofile << tc << ' ' << Pnew2(c2) << "\n";
+		matrixExp(new_states, dt, Gpre, Pnew, P);
+		Pnew = P;
 		tc += dt;
 	}
 
@@ -0,0 +1,132 @@
+/* Microbenchmark of the force kernels. Compares the original per-particle
+   morse/lj gradient functions against the pair list kernels for a few
+   system sizes and checks that both give the same gradient. The vector
+   morse kernels the cpu supports are checked against the scalar pair kernel,
+   every component to a relative tolerance of SIMD_TOL. Returns 1 if any check fails. */
+
+#include <cstdlib>
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+#include <random>
+#include "bDynamics.h"
+#include "adjacency.h"
+#include "../defines.h"
+
+//time reps calls of a gradient function, return ns per call
+template <typename F>
+double timeKernel(F f, int reps) {
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int r = 0; r < reps; r++) {
+		f();
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double, std::nano>(end-start).count() / reps;
+}
+
+//largest relative difference of any component, equal components count as 0
+double relativeError(const double* g1, const double* g2, int n) {
+	double err = 0;
+	for (int i = 0; i < n; i++) {
+		if (g1[i] == g2[i]) continue;
+		err = fmax(err, fabs(g1[i]-g2[i]) / fmax(fabs(g1[i]), fabs(g2[i])));
+	}
+	return err;
+}
+
+int main(int argc, char* argv[]) {
+
+	//handle input
+	int reps = 20000;
+	if (argc == 2) {
+		reps = atoi(argv[1]);
+	}
+
+	//set parameters
+	int rho = RANGE;
+	double Eh = bd::stickyNewton(8.0, rho, KAP, BETA);
+	int sizes[4] = {6, 7, 10, 20};
+	std::mt19937 generator(1);
+	std::normal_distribution<double> noise(0.0, 0.1);
+
+	int level = bd::simdLevel(); int fail = 0;
+	const char* simdNames[3] = {"scalar", "avx2", "avx512"};
+	printf("Best vector kernel: %s\n", simdNames[level]);
+	printf("%4s %10s %12s %12s %8s %12s\n", "N", "kernel", "old (ns)", "pairs (ns)",
+				 "speedup", "max diff");
+
+	for (int s = 0; s < 4; s++) {
+		int N = sizes[s];
+
+		//interaction matrices - chain plus every other particle sticky
+		int* P = new int[N*N]; double* E = new double[N*N];
+		for (int i = 0; i < N; i++) {
+			for (int j = 0; j < N; j++) {
+				int sticky = (abs(i-j) == 1) || (i != j && (i+j) % 2 == 0);
+				P[bd::toIndex(i,j,N)] = sticky; E[bd::toIndex(i,j,N)] = sticky ? Eh : 0.1;
+			}
+		}
+		bd::PairList pairs(N, E, P);
+
+		//perturbed compact chain so every branch of the kernels is hit
+		double* X = new double[DIMENSION*N];
+		double* particles = new double[DIMENSION*N];
+		for (int i = 0; i < N; i++) {
+			X[DIMENSION*i] = (i % 4) + noise(generator);
+			X[DIMENSION*i+1] = (i / 4) + noise(generator);
+#if (DIMENSION == 3)
+			X[DIMENSION*i+2] = noise(generator);
+#endif
+		}
+		bd::c2p(X, particles, N);
+
+		double* g1 = new double[DIMENSION*N]; double* g2 = new double[DIMENSION*N];
+		const char* names[3] = {"morse", "morseR", "lj"};
+
+		for (int k = 0; k < 3; k++) {
+			double tOld, tNew;
+			if (k == 0) {
+				tOld = timeKernel([&]{bd::morseGrad(particles, rho, E, N, P, g1);}, reps);
+				tNew = timeKernel([&]{bd::morseGradPairs(particles, rho, pairs, N, g2);}, reps);
+			}
+			else if (k == 1) {
+				tOld = timeKernel([&]{bd::morseGradR(particles, rho, E, N, P, g1);}, reps);
+				tNew = timeKernel([&]{bd::morseGradRPairs(particles, rho, pairs, N, g2);}, reps);
+			}
+			else {
+				tOld = timeKernel([&]{bd::ljGrad(particles, rho, E, N, P, g1);}, reps);
+				tNew = timeKernel([&]{bd::ljGradPairs(particles, rho, pairs, N, g2);}, reps);
+			}
+
+			//compare the gradients component by component
+			double diff = relativeError(g1, g2, DIMENSION*N);
+
+			printf("%4d %10s %12.1f %12.1f %8.2f %12.3e\n", N, names[k], tOld, tNew,
+						 tOld/tNew, diff);
+		}
+
+		//vector kernels against the scalar pair kernel
+		bd::morseGradPairs(particles, rho, pairs, N, g1);
+		double tScalar = timeKernel([&]{bd::morseGradPairs(particles, rho, pairs, N, g1);}, reps);
+		for (int l = 1; l <= level; l++) {
+			bd::PairGradFn kernel = bd::morseGradKernel(l, DIMENSION);
+			double tVec = timeKernel([&]{kernel(particles, rho, pairs, N, g2);}, reps);
+
+			double diff = relativeError(g1, g2, DIMENSION*N);
+			if (diff > bd::SIMD_TOL) fail = 1;
+
+			printf("%4d %10s %12.1f %12.1f %8.2f %12.3e\n", N, simdNames[l], tScalar, tVec,
+						 tScalar/tVec, diff);
+		}
+
+		//free memory
+		delete []P; delete []E; delete []X; delete []particles;
+		delete []g1; delete []g2;
+	}
+
+	if (fail) {
+		printf("Vector kernel differs from scalar by more than %e\n", bd::SIMD_TOL);
+	}
+
+	return fail;
+}
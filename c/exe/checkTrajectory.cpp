@@ -0,0 +1,132 @@
+/* Check of the event driven trajectory driver. Runs the mfpt sampler dynamics
+   from every state of a database twice with the same noise stream: once with
+   the TrajectoryDriver and its watch list, once with the full bond check of
+   every pair after every chunk (the original sampler loop). The chunks and the
+   states of every hit must agree. Returns 1 if any run differs. */
+
+#include <cstdlib>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "bDynamics.h"
+#include "database.h"
+#include "sampling.h"
+#include "../defines.h"
+
+//a hit, the chunk it happened on and the state it went to
+struct Hit {
+	int step; int state; int timer;
+	bool operator!=(const Hit& o) const {
+		return step != o.step || state != o.state || timer != o.timer;
+	}
+};
+
+void runFull(double* X, bd::Integrator* sde, bd::Database* db, int state, int N, double DT,
+						 int max_it, std::vector<Hit>& hits) {
+	//the full check, every chunk goes through checkState, hits reflect
+
+	int dim = db->getDimension();
+	double* temp = new double[dim*N]; memcpy(temp, X, dim*N*sizeof(double));
+	int timer = 0; int new_state = state;
+	for (int i = 0; i < max_it; i++) {
+		int reset = 0; int reflect = 0;
+		sde->solveSDE(X, DT);
+		bd::checkState(X, N, state, new_state, db, timer, reset, reflect);
+		if (reflect == 0 && reset == 0) {
+			memcpy(temp, X, dim*N*sizeof(double));
+		}
+		else {
+			if (reflect == 1) {
+				Hit h = {i+1, new_state, timer}; hits.push_back(h);
+				timer = 0;
+			}
+			memcpy(X, temp, dim*N*sizeof(double));
+		}
+	}
+	delete []temp;
+}
+
+void runDriver(double* X, bd::Integrator* sde, bd::Database* db, int state, int N, double DT,
+							 int max_it, std::vector<Hit>& hits) {
+	//the same run with the trajectory driver
+
+	bd::TrajectoryDriver traj(sde, db, N, DT);
+	traj.setState(X, state);
+	traj.setHit([&](int new_state) {
+		Hit h = {traj.getSteps(), new_state, traj.getTimer()}; hits.push_back(h);
+		traj.setTimer(0);
+		return bd::TRAJ_REFLECT;
+	});
+	traj.run(max_it);
+}
+
+int main(int argc, char* argv[]) {
+
+	//handle input
+	if (argc != 2 && argc != 3) {
+		fprintf(stderr, "Usage: %s <Input File> [Chunks per state]\n", argv[0]);
+		return 1;
+	}
+	std::string infile (argv[1]);
+	int max_it = 2000;
+	if (argc == 3) {
+		max_it = atoi(argv[2]);
+	}
+
+	//get the database
+	bd::Database* db = bd::readData(infile);
+	if (db == NULL) {
+		return 1;
+	}
+	int N = db->getN(); int num_states = db->getNumStates(); int dim = db->getDimension();
+
+	//set parameters, as estimateMFPT
+	int rho = 40; double beta = 1; double DT = 0.01; int Kh = 1850;
+	int pot = 1; int method = 1;
+	double Eh = bd::stickyNewton(8, rho, Kh, beta);
+	int* P = new int[N*N]; double* E = new double[N*N];
+	bd::setupSimMFPT(N, Eh, P, E);
+	bd::Integrator sde(N, rho, beta, E, P, method, pot, dim);
+
+	double* X0 = new double[dim*N]; double* X = new double[dim*N];
+	int fail = 0; int total = 0; double tFull = 0; double tDriver = 0;
+	for (int s = 0; s < num_states; s++) {
+		if ((*db)[s].getNumCoords() == 0) continue;
+		if (bd::isRigid(N, (*db)[s].getBonds(), dim)) continue;
+		(*db)[s].getCoords(0).makeArray(X0, N, dim);
+
+		std::vector<Hit> full; std::vector<Hit> driver;
+		memcpy(X, X0, dim*N*sizeof(double)); sde.seed(s+1);
+		auto start = std::chrono::high_resolution_clock::now();
+		runFull(X, &sde, db, s, N, DT, max_it, full);
+		auto mid = std::chrono::high_resolution_clock::now();
+		memcpy(X, X0, dim*N*sizeof(double)); sde.seed(s+1);
+		runDriver(X, &sde, db, s, N, DT, max_it, driver);
+		auto end = std::chrono::high_resolution_clock::now();
+		tFull += std::chrono::duration<double>(mid-start).count();
+		tDriver += std::chrono::duration<double>(end-mid).count();
+
+		//compare the hits
+		int differ = (full.size() != driver.size());
+		for (int i = 0; i < full.size() && !differ; i++) {
+			if (full[i] != driver[i]) differ = 1;
+		}
+		if (differ) {
+			printf("State %d: full check has %d hits, driver %d\n", s, int(full.size()),
+						 int(driver.size()));
+			fail = 1;
+		}
+		total += full.size();
+	}
+
+	printf("%d hits, full check %f s, driver %f s\n", total, tFull, tDriver);
+	if (fail) {
+		printf("The trajectory driver differs from the full bond check\n");
+	}
+
+	//free memory
+	delete []P; delete []E; delete []X0; delete []X; delete db;
+
+	return fail;
+}
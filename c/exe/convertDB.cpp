@@ -0,0 +1,44 @@
+#include <cstdlib>
+#include <stdio.h>
+#include <iostream>
+#include <fstream>
+#include "database.h"
+
+/* Convert a database between the text and binary formats. The input format
+   is detected from the file, the output is written in the other format. */
+
+int main(int argc, char* argv[]) {
+
+	//handle input
+	if (argc != 3) {
+		fprintf(stderr, "Usage: <Input File> <Output File> %s\n", argv[0]);
+		return 1;
+	}
+	std::string infile (argv[1]);
+	std::string outfile (argv[2]);
+
+	//get the database here
+	bool binary = bd::isBinaryDB(infile);
+	bd::Database* db = bd::readData(infile);
+	if (db == NULL) {
+		return 1;
+	}
+	printf("Read %d states from %s database %s\n", db->getNumStates(), 
+				 binary ? "binary" : "text", infile.c_str());
+
+	//write in the other format
+	if (binary) {
+		std::ofstream out_str(outfile);
+		out_str << *db;
+	}
+	else if (!bd::writeBinary(*db, outfile)) {
+		delete db;
+		return 1;
+	}
+	printf("Wrote %s database %s\n", binary ? "text" : "binary", outfile.c_str());
+
+	//free memory - delete database
+	delete db;
+
+	return 0;
+}
@@ -82,6 +82,19 @@ int main(int argc, char* argv[]) {
 		//lattice::testSampling(N);
 		lattice::testYield(N);
 	}
+	else if (runType == 4) { //mfpt estimator, each state stops at the target error
+		lattice::Database* db = lattice::readData(dbFile);
+		int num_states = db->getNumStates();
+		for (int i = 0; i < num_states; i++) {
+			printf("Beginning adaptive estimation for state %d of %d\n", i, num_states-1);
+			lattice::estimateMFPTAdaptive(N, i, db, 0.05, 0.05);
+		}
+		//print the new db
+		std::string out = "N" + std::to_string(N) + "mfptAdaptive.txt";
+		std::ofstream out_str(out);
+		out_str << *db;
+		delete db;
+	}
 
 	return 0;
 }
\ No newline at end of file
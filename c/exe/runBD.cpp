@@ -7,12 +7,16 @@
 int main(int argc, char* argv[]) {
 
 	//handle input
-	if (argc != 3) {
-		fprintf(stderr, "Usage: %s <Num Particles> <Final Time>", argv[0]);
+	if (argc != 3 && argc != 4) {
+		fprintf(stderr, "Usage: %s <Num Particles> <Final Time> [Dimension]", argv[0]);
 		return 1;
 	}
 	int N = atof(argv[1]);
 	double T = atof(argv[2]);
+	int dim = DIMENSION;
+	if (argc == 4) {
+		dim = atoi(argv[3]);
+	}
 
 	//set parameters
 	int rho = RANGE;
@@ -32,17 +36,18 @@ int main(int argc, char* argv[]) {
 	bd::fillP(N, types, P, E, kmap);
 
 	//set the initial and final state storage
-	double* X0 = new double[DIMENSION*N];
-	bd::setupChain(X0, N);
+	double* X0 = new double[dim*N];
+	bd::setupChainDim(X0, N, dim);
 
 	//set potential type
 	int pot = 0; //0 morse, 1 lj
 
 	//run bd
-	bd::solveSDE(X0, N, T, rho, beta, E, P, method, pot);
+	bd::Integrator sde(N, rho, beta, E, P, method, pot, dim);
+	sde.solveSDE(X0, T);
 
 	//output the final state
-	bd::printCluster(X0, N);
+	bd::printCluster(X0, N, dim);
 
 	//free memory
 	delete []P; delete []E; delete []X0; delete []kappa; delete []types;
@@ -12,6 +12,10 @@
 //					 0 for full run
 //					 1 for chain estimate, with resets
 //						2 for getttng trajectories
+//						3 for full run, splitting estimator (rare transitions)
+//						4 for full run, weighted ensemble from the chain state
+//						5 for full run, also storing the paths to reweight to other kappa
+//						6 for full run, each state sampled until accurate enough
 
 // Chain State: index of the linear chain in the DB. 1 for 6, 0 for 7.
 
@@ -25,7 +29,7 @@ int main(int argc, char* argv[]) {
 	std::string infile (argv[1]);
 	int rType = atoi(argv[2]); 
 	int source;
-	if (rType > 0) {
+	if (rType == 1 || rType == 2 || rType == 4) {
 		if (argc != 4) {
 			fprintf(stderr, "Usage: <Input File> <Run Type> <Chain State> %s\n", argv[0]);
 			return 1;
@@ -65,9 +69,9 @@ int main(int argc, char* argv[]) {
 		//do a full run over all states in DB
 
 		printf("Mean first passage time estimator beginning.\n");
-		//call estimator over every state, i. if i has 11 bonds (N=7), do nothing.
+		//call estimator over every state, i. if i is rigid, do nothing.
 		for (int i = 0; i < num_states; i++) {
-			if (((*db)[i].getBonds() >= 11 && N == 7) || ((*db)[i].getBonds() >= 9 && N == 6)) {//these states are rigid
+			if (bd::isRigid(N, (*db)[i].getBonds(), db->getDimension())) {//these states are rigid
 				//do nothing
 			}
 			else{
@@ -87,6 +91,73 @@ int main(int argc, char* argv[]) {
 
 	}
 
+	else if (rType == 3) {
+		//full run over all states with forward flux sampling
+
+		printf("Splitting mean first passage time estimator beginning.\n");
+		for (int i = 0; i < num_states; i++) {
+			if (bd::isRigid(N, (*db)[i].getBonds(), db->getDimension())) {//these states are rigid
+				//do nothing
+			}
+			else{
+				//call the estimator
+				bd::estimateMFPTSplitting(N, i, db);
+			}
+		}
+
+		//output the mfpt results to file
+		std::string out = infile.substr(6,2);
+		out = out + "mfptFFS.txt";
+		std::ofstream out_str(out);
+		out_str << *db; 
+	}
+
+	else if (rType == 6) {
+		//full run, stopping each state at the target error
+		bd::estimateMFPTAdaptive(N, db);
+
+		//output the mfpt results to file
+		std::string out = infile.substr(6,2);
+		out = out + "mfptAdaptive.txt";
+		std::ofstream out_str(out);
+		out_str << *db; 
+	}
+
+	else if (rType == 5) {
+		//full run, keeping the path likelihood of every hit
+
+		printf("Mean first passage time estimator with paths beginning.\n");
+		bd::PathCampaign C;
+		C.kappa = 1850; C.rho = 40; C.beta = 1; C.DT = 0.01; //as in estimateMFPT
+		for (int i = 0; i < num_states; i++) {
+			if (bd::isRigid(N, (*db)[i].getBonds(), db->getDimension())) {//these states are rigid
+				//do nothing
+			}
+			else{
+				//call the estimator
+				bd::estimateMFPT(N, i, db, &C.paths);
+			}
+		}
+
+		//output the mfpt results and the paths to file
+		std::string out = infile.substr(6,2);
+		bd::writePaths(C, out + "paths.txt");
+		out = out + "mfpt.txt";
+		std::ofstream out_str(out);
+		out_str << *db; 
+	}
+
+	else if (rType == 4) {
+		//all states reachable from the chain in one weighted ensemble run
+		std::string out = infile.substr(6,2);
+		bd::estimateRatesWE(N, source, db, out + "weCheckpoint.txt");
+
+		//output the mfpt results to file
+		out = out + "mfptWE.txt";
+		std::ofstream out_str(out);
+		out_str << *db; 
+	}
+
 	else if (rType == 1) {
 		//just perform test on linear chain with resets
 
@@ -10,6 +10,7 @@
 //MAKE SURE TO RUN THIS ON A PURGED DATA SET EX input/N7Purge.txt
 // Run Type: 0 for full run
 //					 1 for chain estimate, with resets
+//					 2 for full run, stopping each state at the target error
 // Chain State: index of the linear chain in the DB. 1 for 6, 0 for 7.
 
 int main(int argc, char* argv[]) {
@@ -76,6 +77,32 @@ int main(int argc, char* argv[]) {
 
 	}
 
+	else if (rType == 2) {
+		//full run, every state stops once its error is below the tolerance
+		for (int i = 0; i < num_states; i++) {
+#if (DIMENSION == 2)
+			if (((*db)[i].getBonds() >= 11 && N == 7) || ((*db)[i].getBonds() >= 9 && N == 6)) {//these states are rigid
+				//do nothing
+			}
+#elif (DIMENSION == 3) 
+			if ((*db)[i].getBonds() >= 12 && N == 6) {//these states are rigid
+				//do nothing
+			}
+#endif
+			else{
+				//call the estimator
+				mcm::estimateMFPTreflectAdaptive(N, i, db, rngee, 0.05, 0.05);
+				//mcm::estimateMFPTresetAdaptive(N, i, db, rngee, 0.05, 0.05);
+			}
+		}
+
+		//output the mfpt results to file
+		std::string out = infile.substr(6,2);
+		out = out + "mfptMCAdaptive.txt";
+		std::ofstream out_str(out);
+		out_str << *db; 
+	}
+
 	else if (rType == 1) {
 		//just perform test on linear chain with resets
 
@@ -145,39 +145,14 @@ Person Person::mate(Person partner, bool useFile, RandomNo* rngee) {
 }
 
 void Person::evalStats(int N, bd::Database* db, int initial, std::vector<int> targets, 
-											 double* eq, double* Tconst, double* T, double* m) {
+											 bd::DesignEvaluator& evaluator) {
 	//compute the eq and rate for this person
+	//evaluator is this thread's context for the targets, reused between persons
 
-	//get the number of states
-	int num_states = db->getNumStates();
-
-	//zero out the arrays before setting
-	for (int i = 0; i < num_states*num_states; i++) {
-		T[i] = 0;
-	}
-	for (int i = 0; i < num_states; i++) {
-		eq[i] = m[i] = 0;
-	}
-
-	//do rewieght
-	bd::reweight(N, num_states, db, types, eq, kappa);
-	//get eq prob
-	double eqProb = bd::getEqProb(initial, kappaVals, db, types, numTypes, targets);
-	//copy Tconst into T
-	std::copy(Tconst, Tconst+num_states*num_states, T);
-	//fill in transposed entries such that T satisfies detailed balance
-	bd::satisfyDB(T, num_states, db, eq);
-	//fill in diagonal with negative sum of row entries
-	bd::fillDiag(T, num_states);
-	//get the transition rate
-	//printf("%f, %f, %f\n", kappaVals[0], kappaVals[1], kappaVals[2]);
-	if (num_states > 300) { //do a sparse solve
-		bd::computeMFPTsSP(num_states, T, targets, m);
-	}
-	else { //do a dense solve
-		bd::computeMFPTs(num_states, T, targets, m);
-	}
-	double rate = 1/m[initial];
+	//get the transition rate, the eq prob comes from the same reweight
+	evaluator.setTypes(types);
+	double rate = evaluator.evaluate(kappaVals);
+	double eqProb = evaluator.getEqProb();
 
 	Rate = rate; Eq = eqProb;
 }
@@ -358,6 +333,7 @@ void perform_evolution(int N, bd::Database* db, int initial, int target, bool us
 	//get bonds->bonds+1 entries from mfpt estimates
 	std::vector<int> ground; //vector to hold all ground states
 	bd::createTransitionMatrix(Tconst, num_states, db, ground);
+	bd::RateMatrix forward(Tconst, num_states);
 	for (int i = 0; i < ground.size(); i++) {
 		std::cout << ground[i] << "\n";
 	}
@@ -379,9 +355,8 @@ void perform_evolution(int N, bd::Database* db, int initial, int target, bool us
 	#pragma omp parallel 
 	{
 	//declare all arrays we need to do calculations
-	double* T = new double[num_states*num_states]; //rate matrix
-	double* eq = new double[num_states];           //equilibrium measure
-	double* m = new double[num_states];            //mfpts 
+	bd::DesignEvaluator evaluator(bd::DESIGN_RATE, db, numTypes, initial, targets, 
+																forward, ground);  //reweight and rate solves
 	RandomNo* rngee = new RandomNo();              //random number generator
 
 	//loop over population
@@ -392,14 +367,13 @@ void perform_evolution(int N, bd::Database* db, int initial, int target, bool us
 		
 		//create a person, evaluate their stats
 		Person p = Person(N, numInteractions, numTypes, particleTypes, kappaVals);
-		p.evalStats(N, db, initial, targets, eq, Tconst, T, m);
+		p.evalStats(N, db, initial, targets, evaluator);
 		p.evalFitness(eqMax, rateMax);
 		pop_array[i] = p;
 		//printf("e %f, r %f, f %f\n", pop_array[i].Eq, pop_array[i].Rate, pop_array[i].fitness);
 		printf("Finsihing sample %d on thread %d\n", i, omp_get_thread_num());
 	}
 	//free memory
-	delete []T; delete []eq; delete []m;
 	delete rngee;
 	//end parallel region
 	}
@@ -476,9 +450,8 @@ void perform_evolution(int N, bd::Database* db, int initial, int target, bool us
 		#pragma omp parallel 
 		{
 		//init the arrays
-		double* T = new double[num_states*num_states]; //rate matrix
-		double* eq = new double[num_states];           //equilibrium measure
-		double* m = new double[num_states];            //mfpts 
+		bd::DesignEvaluator evaluator(bd::DESIGN_RATE, db, numTypes, initial, targets, 
+																	forward, ground);  //reweight and rate solves
 		RandomNo* rngee = new RandomNo(); 
 		//loop over population
 		#pragma omp for
@@ -488,12 +461,11 @@ void perform_evolution(int N, bd::Database* db, int initial, int target, bool us
 			Person p1 = population[r1];
 			Person p2 = population[r2];
 			Person kid = p1.mate(p2, useFile, rngee);
-			kid.evalStats(N, db, initial, targets, eq, Tconst, T, m);
+			kid.evalStats(N, db, initial, targets, evaluator);
 			kid.evalFitness(eqMax, rateMax);
 			pop_array[i] = kid;
 		}
 		//end parallel region / free memory
-		delete []T; delete []eq; delete []m;
 		delete rngee;
 		}
 
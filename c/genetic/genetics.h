@@ -75,7 +75,7 @@ public:
 	void setKappa(int num_interactions, double* kappaVals);
 	Person mate(Person partner, bool, RandomNo*);
 	void evalStats(int N, bd::Database* db, int initial, std::vector<int> targets, 
-								 double* eq, double* Tconst, double* T, double* m);
+								 bd::DesignEvaluator& evaluator);
 	void evalFitness(double eq, double rate);
 
 	void evalStats(double Tf, int samples, int* M_target, double* X_target);
@@ -71,8 +71,8 @@ void readTargetFile(int* M_target, double* X_target) {
 	}
 }
 
-double eqSample(int N, double Tf, double DT, double rho, double beta, double* E, int* P,
-								int method, int pot, int* M_target, double* X_target) {
+double eqSample(int N, double Tf, double DT, bd::Integrator* sde, int* M_target, 
+								double* X_target) {
 	//start in the target configuration and see what fraction of sim time is spent there
 
 	//set the target config
@@ -87,7 +87,7 @@ double eqSample(int N, double Tf, double DT, double rho, double beta, double* E,
 	//solve sde, increment time in target state
 	double t = 0; double eqTime = 0;
 	while (t < Tf) {
-		bd::solveSDE(X, N, DT, rho, beta, E, P, method, pot);
+		sde->solveSDE(X, DT);
 		t += DT;
 
 		bd::getAdjCut(X, N, M, CUT);
@@ -105,8 +105,7 @@ double eqSample(int N, double Tf, double DT, double rho, double beta, double* E,
 	return eqTime / Tf;
 }
 
-double rateSample(int N, double Tf, double DT, double rho, double beta, double* E, int* P,
-								int method, int pot, int* M_target) {
+double rateSample(int N, double Tf, double DT, bd::Integrator* sde, int* M_target) {
 	//start in chain. determine minimal time to form target. 
 	//if target does not form, return -1
 
@@ -120,7 +119,7 @@ double rateSample(int N, double Tf, double DT, double rho, double beta, double*
 	//solve sde, check if target state is hit
 	double t = 0; double hitTime = -1; 
 	while (t < Tf) {
-		bd::solveSDE(X, N, DT, rho, beta, E, P, method, pot);
+		sde->solveSDE(X, DT);
 		t += DT;
 
 		bd::getAdjCut(X, N, M, CUT);
@@ -156,8 +155,8 @@ double getMisfoldEnergy(int N, int* M, int* M_target, double* E) {
 	return badVibes;
 }
 
-double rateSampleBarrier(int N, double Tf, double DT, double rho, double beta, double* E, int* P,
-								         int method, int pot, int* M_target) {
+double rateSampleBarrier(int N, double Tf, double DT, bd::Integrator* sde, double* E,
+								         int* M_target) {
 	//run trajectory until Tf. return misfolded energy barrier
 
 
@@ -169,7 +168,7 @@ double rateSampleBarrier(int N, double Tf, double DT, double rho, double beta, d
 	int* M = new int[N*N]; for (int i = 0; i < N*N; i++) M[i] = 0;
 
 	//solve sde
-	bd::solveSDE(X, N, Tf, rho, beta, E, P, method, pot);
+	sde->solveSDE(X, Tf);
 
 	//get current adj mat
 	bd::getAdjCut(X, N, M, CUT);
@@ -185,8 +184,8 @@ double rateSampleBarrier(int N, double Tf, double DT, double rho, double beta, d
 	return misfoldE;
 }
 
-double rateSampleTrap(int N, double Tf, double DT, double ts, double rho, double beta, double* E, int* P,
-								         int method, int pot, int* M_target) {
+double rateSampleTrap(int N, double Tf, double DT, double ts, bd::Integrator* sde, double* E,
+								      int* M_target) {
 	//run trajectory until stuck in a state for > t_s. return misfolded energy barrier
 
 	//set the target config
@@ -204,7 +203,7 @@ double rateSampleTrap(int N, double Tf, double DT, double ts, double rho, double
 	double misfoldE = 0;
 	while (t < Tf) {
 		//solve sde
-		bd::solveSDE(X, N, DT, rho, beta, E, P, method, pot);
+		sde->solveSDE(X, DT);
 		t += DT;
 
 		//get adj matrix, compare to previous
@@ -253,9 +252,14 @@ void doSampling(int N, double Tf, int* types, std::map<std::pair<int,int>,double
 	double* E = new double[N*N];
 	bd::fillP(N, types, P, E, kappa);
 
-	eq = eqSample(N, Tf, DT, rho, beta, E, P,method, pot, M_target, X_target);
-	//time = rateSample(N, Tf, DT, rho, beta, E, P,method, pot, M_target);
-	time = exp(-rateSampleBarrier(N, Tf, DT, rho, beta, E, P, method, pot, M_target));
+	//one integrator serves both samples
+	bd::Integrator sde(N, rho, beta, E, P, method, pot);
+
+	eq = eqSample(N, Tf, DT, &sde, M_target, X_target);
+	//time = rateSample(N, Tf, DT, &sde, M_target);
+	time = exp(-rateSampleBarrier(N, Tf, DT, &sde, E, M_target));
+
+	delete []P; delete []E;
 
 }
 
@@ -356,11 +360,14 @@ void Person::evalStats(double Tf, double ts, int samples, int* M_target) {
 	//Eq = 1.0 - exp(-c1*smallestBarrier(N, M_target, E));
 	Eq = 1.0 - exp(-c1*harmonicBarrier(N, M_target, E));
 
+	//set up the integrator once, reuse for every sample
+	bd::Integrator sde(N, rho, beta, E, P, method, pot);
+
 	//sample for the rate
 	double rateEst = 0;
 	for (int i = 0; i < samples; i++) {
-		//rateEst += rateSampleBarrier(N, Tf, DT, rho, beta, E, P, method, pot, M_target);
-		rateEst += rateSampleTrap(N, Tf, DT, ts, rho, beta, E, P, method, pot, M_target);
+		//rateEst += rateSampleBarrier(N, Tf, DT, &sde, E, M_target);
+		rateEst += rateSampleTrap(N, Tf, DT, ts, &sde, E, M_target);
 	}
 	rateEst /= samples;
 	double c2 = 1.0;
@@ -205,36 +205,32 @@ void checkState(int N, double* X, int state, Database* db,
 	//get adjacency matrix of the current state
 	int* M = new int[N*N]; for (int i = 0; i < N*N; i++) M[i]=0;
 	getAdj(X, N, M, HYDRO_CUT);
+	AdjBits A; A.fromMatrix(M, N);
 
 	//compare old and new state, check if same
-	int* old = new int[N*N]; for (int i = 0; i < N*N; i++) old[i]=0;
 	int old_bonds = (*db)[state].getBonds();
-	extractAM(N, state, old, db);
-	int success = checkSame(old, M, N);
+	int success = ((*db)[state].getAdjacency() == A);
 
-	int B = 0;
-	for (int i = 0; i < N*N; i++) {
-		B += M[i];
-	}
-	B /= 2;
+	int B = A.count();
 	//std::cout << B << "\n";
 
 	if (success) {//same matrix
-		delete []M; delete []old;
+		delete []M;
 		return;
 	}
 	else {//not the same, find matrix in database
-		success = mcm::findMatrix(M, old, old_bonds, N, db,  reset,  new_state);
+		success = mcm::findMatrix(A, old_bonds, N, db,  reset,  new_state);
 		if (!success) {
 			//may output an unphysical state. refine with newton, check again
 			refine(N, X, M);
-			success = mcm::findMatrix(M, old, old_bonds, N, db,  reset,  new_state);
+			A.fromMatrix(M, N);
+			success = mcm::findMatrix(A, old_bonds, N, db,  reset,  new_state);
 			if (!success) { //state still not found after refine, ignore this sample
 				reset = true; 
 				printf("State not found in database, B = %d \n\n\n\n\n", B);
 			}
 		}
-		delete []M; delete []old;
+		delete []M;
 	}
 }
 
@@ -366,10 +362,7 @@ void determineTransitions(HCC* hc, Database* db, double tps) {
 		(*db)[initial_state].mfpt = mfpt*tps;
 		(*db)[initial_state].num = 0;
 		(*db)[initial_state].denom = 0;
-		(*db)[initial_state].num_neighbors = PM.size();
-		(*db)[initial_state].P = PM;
-		(*db)[initial_state].Z = temp;
-		(*db)[initial_state].Zerr = temp;
+		db->setRow(initial_state, PM, temp, temp);
 		(*db)[initial_state].sigma = 0;
 
 	}
@@ -1,4 +1,5 @@
 #include "latticeP.h"
+#include "sequential.h"
 #include <eigen3/unsupported/Eigen/MatrixFunctions>
 #include <eigen3/Eigen/Dense>
 #include <omp.h>
@@ -54,6 +55,7 @@ void State::copy(const State& old) {
 //database constructor
 Database::Database(int N_, int num_states_) {
 	N = N_; num_states = num_states_;
+	generation = bd::newGeneration();
 	states = new State[num_states];
 	for (int i = 0; i < num_states; i++) {
 		states[i].N = N;
@@ -1062,21 +1064,22 @@ void equilibrate(Particle* chain, particleMap& cMap, Database* db, int state, in
 }
 
 void getSamplesMFPT(Particle* chain, particleMap& cMap, Database* db, int state, int N,
-	std::vector<bd::Pair>& PM, std::vector<double>& mfptVec, RandomNo* rngee) {
-	//get a sample of the mean first passage time, record the state that gets visited
+	int samples, std::vector<bd::Pair>& PM, std::vector<double>& mfptVec, double& timer,
+	RandomNo* rngee) {
+	//get samples hits of the mean first passage time, record the states that get
+	//visited. the chain and timer (the open dwell) are left where the walker
+	//stopped, so it can be continued by another call
 
 	//parameters for the estimator and bond checking
-	int max_it = 1e6;             //cut off if not done after max_it samples
+	int max_it = 20*samples;      //cut off if not done after max_it samples
 	int new_state = state;            //new state id
 	bool accepted;                    //flag to check if MCMC accepted proposal
 	int b = (*db)[state].getBonds();  //num bonds in starting cluster
-	double timer = 0;                //init the timer for the mfpt
 	bool reset = false;              //if this becomes true, reset with no sample
 	int hits = 0;                    //counter for number of samples
 	double eps = 1000;               //energy per bond, so chain does not break
 	double energy0 = getEnergy(N, chain, eps);  //energy for initial state
 	double energy;                   //dummy energy
-	int samples = 50000;              //number of samples per walker
 
 	//make another chain and cMap for reversions
 	Particle* prev_chain = new Particle[N];
@@ -1168,6 +1171,14 @@ void getSamplesMFPT(Particle* chain, particleMap& cMap, Database* db, int state,
 	delete []prev_chain; delete []AM;
 }
 
+void getSamplesMFPT(Particle* chain, particleMap& cMap, Database* db, int state, int N,
+	std::vector<bd::Pair>& PM, std::vector<double>& mfptVec, RandomNo* rngee) {
+	//get a sample of the mean first passage time, record the state that gets visited
+	int samples = 50000;              //number of samples per walker
+	double timer = 0;
+	getSamplesMFPT(chain, cMap, db, state, N, samples, PM, mfptVec, timer, rngee);
+}
+
 void estimateMFPT(int N, int state, Database* db) {
 	/*estimate mean first passage time starting in state and going to state with
 	one additional bond. Uses parallel implementations of a single walker with
@@ -1300,6 +1311,113 @@ void estimateMFPT(int N, int state, Database* db) {
 }
 
 
+/* estimateMFPT, stopped once the state is accurate enough instead of after a
+   fixed number of hits per thread (see bd::SequentialStop). every round each
+   walker adds a batch of hits and keeps its chain and its open dwell for the
+   next round. the mfpt is the mean of all samples.
+	 Members:
+	 	chains, maps - chain and lattice map of each walker
+	 	timers - open dwell of each walker, rngs - generator of each walker
+	 	sum, count - sum and number of all samples
+*/
+
+struct AdaptiveWalkers {
+	std::vector<Particle*> chains; std::vector<particleMap> maps;
+	std::vector<double> timers; std::vector<RandomNo*> rngs;
+	double sum; int count;
+
+	AdaptiveWalkers() {sum = 0; count = 0;}
+};
+
+void estimateMFPTAdaptive(int N, int state, Database* db, double tol, double ptol) {
+	/*estimate mean first passage time starting in state and going to state with
+	one additional bond, until the relative standard error of the mfpt is below
+	tol and every transition probability is known to within ptol.*/
+
+	//set parameters
+	int num_states = db->getNumStates(); //total number of states
+	int batch = 1000;                    //hits per walker per round
+	int min_batches = 4;                 //fewest batches before the state may stop
+	int max_hits = 500000;               //give up on the tolerance after this many hits
+	int max_batches = 2*max_hits/batch;  //or after this many batches, hits or not
+
+	//check if this state has max number of bonds
+	int maxB = 0;
+	for (int i = 0; i < num_states; i++) {
+		int b = (*db)[i].getBonds();
+		if (b > maxB) {
+			maxB = b;
+		}
+	}
+	if ((*db)[state].getBonds() == maxB) {
+		printf("This state is a ground state. No MPFT estimation necessary.\n");
+		return;
+	}
+
+	//get starting coordinates from the database
+	const std::vector<int> c = (*db)[state].getCoordinates();
+	int* X = new int[DIMENSION*N];
+	for (int i = 0; i < DIMENSION*N; i++) {
+		X[i] = c[i];
+	}
+
+	AdaptiveWalkers W;
+	bd::SequentialStop stop(tol, ptol, min_batches, max_batches, max_hits);
+
+	bd::adaptiveRounds(1,
+		[&](int item, int per) {
+			//new walkers start from the database and are equilibrated
+			while (W.chains.size() < per) {
+				Particle* chain = new Particle[N]; particleMap cMap;
+				initChain(N, X, chain, cMap, false);
+				RandomNo* rngee = new RandomNo();
+				equilibrate(chain, cMap, db, state, N, rngee);
+				W.chains.push_back(chain); W.maps.push_back(cMap);
+				W.timers.push_back(0); W.rngs.push_back(rngee);
+			}
+			return int(W.chains.size());
+		},
+		[&](int item, int k) {
+			std::vector<bd::Pair> PM; std::vector<double> mfptVec;
+			getSamplesMFPT(W.chains[k], W.maps[k], db, state, N, batch, PM, mfptVec,
+										 W.timers[k], W.rngs[k]);
+
+			double sum = 0;
+			for (int i = 0; i < mfptVec.size(); i++) sum += mfptVec[i];
+
+			#pragma omp critical
+			{
+				W.sum += sum; W.count += mfptVec.size();
+				stop.addBatch(mfptVec.empty() ? 0 : sum / mfptVec.size(), PM);
+			}
+		},
+		[&](int item) {
+			double mfpt = (W.count > 0) ? W.sum / W.count : 0;
+			return stop.finished(mfpt);
+		});
+
+	//update database
+	if (W.count > 0) {
+		const std::vector<bd::Pair>& PMshare = stop.getPM();
+		(*db)[state].mfpt = W.sum / W.count;
+		(*db)[state].num_neighbors = PMshare.size();
+		(*db)[state].P = PMshare;
+		(*db)[state].sigma = stop.getSE();
+		printf("Total Estimate = %f +- %f from %d hits in %d batches\n", W.sum / W.count,
+					 stop.getSE(), stop.getHits(), stop.getNumBatches());
+	}
+	else {
+		printf("No samples for state %d, database entry left as it was\n", state);
+	}
+
+	//free memory
+	for (int i = 0; i < W.chains.size(); i++) {
+		delete []W.chains[i]; delete W.rngs[i];
+	}
+	delete []X;
+}
+
+
 void estimateEqProbs(int N, Database* db) { 
 	//estimate the equilibrium probabilities for each state
 	//use MCMC estimator, use every c moves
@@ -1428,25 +1546,27 @@ void estimateEqProbs(int N, Database* db) {
 /***************** Design Functions  ******************************************/
 /******************************************************************************/
 
-double getStickyProductL(int N, int state,  Database* db, int* particleTypes, 
-												const std::map<std::pair<int,int>,double>& kappa) {
-	//return the product of sticky param ^ num bonds for each type
-
-	double stickyProd = 1.0;
+const bd::BondHistogram& getBondHistogramL(int N, Database* db, int* particleTypes, 
+																					 int numTypes) {
+	//bond counts for the lattice database, one histogram per thread
 
-	//loop over the adjacency matrix, determine bond types, get factors
-	//todo - the isInteracting might fail here b/c AM is only upper triangular?
-	for (int i = 0; i < N; i++) {
-		for (int j = i+2; j < N; j++) {
-			if ((*db)[state].isInteracting(i,j)) {
-				int p1 = particleTypes[i]; int p2 = particleTypes[j];
-				stickyProd *= kappa.find({p1,p2})->second;
-				//printf("state: %d, i %d, j %d\n",state, i, j);
+	static thread_local bd::BondHistogram H;
+	int num_states = db->getNumStates();
+	if (!H.matches(db->getGeneration(), N, num_states, particleTypes, numTypes)) {
+		H.resize(db->getGeneration(), N, num_states, particleTypes, numTypes);
+		for (int s = 0; s < num_states; s++) {
+			for (int i = 0; i < N; i++) {
+				for (int j = i+2; j < N; j++) {
+					if ((*db)[s].isInteracting(i,j)) {
+						H.addBond(s, particleTypes[i], particleTypes[j]);
+					}
+				}
 			}
+			H.setBonds(s, (*db)[s].getBonds());
 		}
 	}
 
-	return stickyProd;
+	return H;
 }
 
 void reweightL(int N, int num_states, Database* db, int* particleTypes, double* eq,
@@ -1455,30 +1575,26 @@ void reweightL(int N, int num_states, Database* db, int* particleTypes, double*
 
 	double kap0 = exp(EPS);            //sticky parameter for initial measurement
 
-	double Z = 0;                     //normalizing constant for eq
-
-	//loop over states, get the equilibrium measure entry
-	for (int i = 0; i < num_states; i++) {
-		//get initial eq prob and number of bonds
-		int b = (*db)[i].getBonds();
-		int ntBonds = b - (N-1);               //number of non-trivial bonds
-		double prob = (*db)[i].getFrequency();
-
-		//get the denominator of reweight factor - KAP^b_i
-		double denom = pow(kap0, ntBonds);
-
-		//get the numerator of the re-weight factor
-		double num = getStickyProductL(N, i, db, particleTypes, kappa); 
+	//get the bond counts for these particle types
+	int numTypes = kappa.rbegin()->first.first + 1;
+	const bd::BondHistogram& H = getBondHistogramL(N, db, particleTypes, numTypes);
 
-		//compute the new probability
-		double new_prob = prob * num / denom;
+	//put the kappa map in kappaVals order
+	std::vector<double> kappaVals(H.getNumInteractions());
+	for (int i = 0; i < numTypes; i++) {
+		for (int j = i; j < numTypes; j++) {
+			kappaVals[H.getType(i,j)] = kappa.find({i,j})->second;
+		}
+	}
 
-		//debug line for corect reweight
-		//printf("Test: Old %f, New %f\n", prob, new_prob);
+	//prob * prod kappa^n / kap0^nt for every state, in log space
+	Eigen::VectorXd lw;
+	H.logWeights(kappaVals.data(), kap0, lw);
 
-		//increment Z and add to array
-		Z += new_prob;
-		eq[i] = new_prob;
+	double Z = 0;                     //normalizing constant for eq
+	for (int i = 0; i < num_states; i++) {
+		eq[i] = (*db)[i].getFrequency() * exp(lw(i));
+		Z += eq[i];
 	}
 
 	//re-normalize
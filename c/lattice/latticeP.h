@@ -129,9 +129,11 @@ class Database {
 		//accessor functions
 		int getN() const {return N;}
 		int getNumStates() const {return num_states;}
+		unsigned long getGeneration() const {return generation;}
 
 	private:	
 		int N; int num_states; State* states; 
+		unsigned long generation; //see bd::Database
 
 		//copy constructors - restricts compiling when user tries to copy a database
 		Database(const Database&) {
@@ -217,6 +219,7 @@ void addState(int N, Particle* chain, int* AM, std::vector<State>& new_states);
 void updatePDB(int N, Database* db);
 
 void estimateMFPT(int N, int state, Database* db);
+void estimateMFPTAdaptive(int N, int state, Database* db, double tol, double ptol);
 void estimateEqProbs(int N, Database* db);
 
 //design functions
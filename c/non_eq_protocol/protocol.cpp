@@ -132,11 +132,11 @@ void createRateMatrix(Eigen::MatrixXd& R, int num_states, Database* db,
 	for (int state = 0; state < num_states; state++) {
 		//determine the forward rate from mfpt and probability distribution
 		double mfpt = (*db)[state].getMFPT();
-		double S = (*db)[state].sumP(); //get normalizing constant for this row
+		double S = db->sumP(state); //get normalizing constant for this row
 
 		//get each pair of transitioning states and fill in the entry
-		std::vector<Pair> P = (*db)[state].getP();
-		for (int t_index = 0; t_index < P.size(); t_index++) {
+		SparseRow P = db->getP(state);
+		for (int t_index = 0; t_index < P.size; t_index++) {
 			//set the forward rates
 			int target = P[t_index].index;
 			double c = ((double(P[t_index].value) / S) / mfpt);
@@ -191,11 +191,11 @@ void createRateMatrix(Eigen::MatrixXd& R, Eigen::MatrixXd& D, int num_states, Da
 	for (int state = 0; state < num_states; state++) {
 		//determine the forward rate from mfpt and probability distribution
 		double mfpt = (*db)[state].getMFPT();
-		double S = (*db)[state].sumP(); //get normalizing constant for this row
+		double S = db->sumP(state); //get normalizing constant for this row
 
 		//get each pair of transitioning states and fill in the entry
-		std::vector<Pair> P = (*db)[state].getP();
-		for (int t_index = 0; t_index < P.size(); t_index++) {
+		SparseRow P = db->getP(state);
+		for (int t_index = 0; t_index < P.size; t_index++) {
 			//set the forward rates
 			int target = P[t_index].index;
 			double c = ((double(P[t_index].value) / S) / mfpt);
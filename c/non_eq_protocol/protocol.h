@@ -177,6 +177,11 @@ void createTransitionOperator(int N, int num_states, OptInfo* problem,
 															const Eigen::MatrixXd& f_rate, const Eigen::MatrixXd& kappaMat,
 															const Eigen::VectorXd& t_disc, double t0, double tf, int interval, 
 															Eigen::MatrixXd& trans_op);
+//v^T * trans_op (row = true) or trans_op * v, without forming the operator
+void applyTransitionOperator(int N, int num_states, OptInfo* problem, 
+														 const Eigen::MatrixXd& f_rate, const Eigen::MatrixXd& kappaMat,
+														 const Eigen::VectorXd& t_disc, double t0, double tf, int interval, 
+														 Eigen::VectorXd& v, bool row);
 
 double dlib_objective_call(int N, int num_states, int numInteractions, OptInfo* problem, 
 													 column_vector& kappaVec, const Eigen::MatrixXd& f_rate, 
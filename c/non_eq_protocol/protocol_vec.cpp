@@ -16,6 +16,8 @@ namespace bd{
 #define UPPER 10000.0 
 #define GAM exp(5.58)
 
+typedef Eigen::Triplet<double> Tr;
+
 
 /**********************************************************************/
 /******************** Vector Valued Protocols *************************/
@@ -147,31 +149,22 @@ void eqDerivative(int N, int num_states, int numTypes, int numInteractions, Data
 									const Eigen::VectorXd& kappaVals) {
 	//compute the derivative of the eq measure wrt to the given kappa
 
-	//map bond type to index
-	std::map<std::pair<int,int>,int> index;
-	int* indexVals = new int[numInteractions];
-	for (int i = 0; i < numInteractions; i++) {
-		indexVals[i] = i;
-	}
-	makeIndexMap(numTypes, indexVals, index);
+	//bond counts of each state
+	const BondHistogram& H = getBondHistogram(N, db, particleTypes, numTypes);
 
 	//init the weighted sum
 	double S = 0; 
 
 	//sum the eq prob over all states, weighted by n_b
 	for (int i = 0; i < num_states; i++) {
-		int b = searchForBonds(N, db, i, bond, particleTypes, index);
-		S += eq[i] * float(b);
+		S += eq[i] * H.getCount(i, bond);
 	}
 
 	//fill in the derivative array
 	for (int i = 0; i < num_states; i++) {
-		int b = searchForBonds(N, db, i, bond, particleTypes, index);
-		eqDeriv[i] = eq[i] / kappaVals[bond] * (float(b) - S);
+		eqDeriv[i] = eq[i] / kappaVals[bond] * (H.getCount(i, bond) - S);
 	}
 
-	delete []indexVals;
-
 }
 
 void OptInfo::CreateRateMatrix(Eigen::MatrixXd& R, Eigen::MatrixXd& D, 
@@ -228,47 +221,68 @@ void evalGradient(int N, const Eigen::MatrixXd& kappaMat, int num_states,
 							 OptInfo* problem, const Eigen::MatrixXd& f_rate, const Eigen::VectorXd& t_disc, 
 							 const Eigen::VectorXd& t_centers, int initial, std::vector<int> targets,
 							 Eigen::VectorXd& R) {
+	/*exact gradient of P = e_initial^T exp(dt_0 L_0) ... exp(dt_{N-1} L_{N-1}) 1_targets.
+	  with p_j the distribution at t_j and b_j the expectation of the target indicator,
+	  dP/dkappa_{ixn,j} = p_j^T Lf(dt_j L_j, dt_j LD_j) b_{j+1}, Lf the frechet derivative
+	  of the exponential. Lf(A,E) b is the top block of exp([A E; 0 A]) [0; b], and the 
+	  bottom block is b_j. every interaction shares A, so stacking the blocks
+	  gives the whole column of the gradient and the backward step from one expmv */
 
-	//loop over each interaction type
 	int numInteractions = problem->GetNumInteractions();
-	for (int ixn = 0; ixn < numInteractions; ixn++) {
+	int S = num_states; int K = numInteractions;
 
-		//loop over each component of R, compute the gradient
-		for (int j = 0; j < N; j++) {
-			//compute the derivative of the rate matrix at current beta val
-			Eigen::MatrixXd rate; rate.setZero(num_states,num_states);
-			Eigen::MatrixXd LD; LD.setZero(num_states,num_states);
+	//forward sweep, store the distribution at the start of each interval
+	Eigen::MatrixXd f_solution; f_solution.setZero(N+1, S); 
+	Eigen::VectorXd p = Eigen::VectorXd::Zero(S); p(initial) = 1;
+	Eigen::VectorXd next;
+	Eigen::MatrixXd rate; 
+	f_solution.row(0) = p.transpose();
+	for (int j = 0; j < N; j++) {
+		rate.setZero(S,S);
+		problem->CreateRateMatrix(rate, f_rate, kappaMat.col(j));
+		SpMat A = rate.transpose().sparseView();
+		expmv(A, t_disc(j+1) - t_disc(j), p, next);
+		p = next;
+		f_solution.row(j+1) = p.transpose();
+	}
+
+	//backward sweep with the frechet derivative terms
+	Eigen::VectorXd b = Eigen::VectorXd::Zero(S);
+	for (int t = 0; t < targets.size(); t++) {
+		b(targets[t]) = 1;
+	}
+
+	Eigen::MatrixXd LD;
+	Eigen::VectorXd v((K+1)*S); Eigen::VectorXd w;
+	std::vector<Tr> tripletList;
+	for (int j = N-1; j >= 0; j--) {
+		//assemble [L LD_0 ... LD_{K-1}; 0 L] on the stacked states
+		tripletList.clear();
+		for (int ixn = 0; ixn < K; ixn++) {
+			rate.setZero(S,S); LD.setZero(S,S);
 			problem->CreateRateMatrix(rate, LD, f_rate, kappaMat.col(j), ixn);
-			//std::cout << rate << "\n";
-			//std::cout << rate(7,7) << "\n";
-			//Eigen::MatrixXd test(num_states,num_states); test = rate * 100; test = test.exp();
-			//std::cout << test << "\n";
-			//abort();
-
-			//apply the transition operator from 0 to t_center(j), then LD, then to T
-			Eigen::MatrixXd T1; T1.setZero(num_states,num_states);
-			Eigen::MatrixXd T2; T2.setZero(num_states,num_states);
-			Eigen::MatrixXd trans_op; trans_op.setZero(num_states,num_states);
-			
-			createTransitionOperator(N, num_states, problem, f_rate, kappaMat, t_disc, 0, 
-															t_centers(j), j, T1);
-			createTransitionOperator(N, num_states, problem, f_rate, kappaMat, t_disc, t_centers(j), 
-															t_disc(N), j, T2);
-			trans_op = T1 * LD * T2;
-			//std::cout << LD.row(initial) << "\n";
-			//abort();
-
-			//std::cout << trans_op << "\n";
-
-
-			//extract the relevant entry: row = initial, column = target
-			for (int t = 0; t < targets.size(); t++) {
-				R(ixn*N+j) += trans_op(initial, targets[t]);
+			for (int r = 0; r < S; r++) {
+				for (int c = 0; c < S; c++) {
+					if (rate(r,c) != 0) {
+						tripletList.push_back(Tr(ixn*S+r, ixn*S+c, rate(r,c)));
+						if (ixn == 0) tripletList.push_back(Tr(K*S+r, K*S+c, rate(r,c)));
+					}
+					if (LD(r,c) != 0) {
+						tripletList.push_back(Tr(ixn*S+r, K*S+c, LD(r,c)));
+					}
+				}
 			}
+		}
+		SpMat B((K+1)*S, (K+1)*S);
+		B.setFromTriplets(tripletList.begin(), tripletList.end());
+
+		v.setZero(); v.tail(S) = b;
+		expmv(B, t_disc(j+1) - t_disc(j), v, w);
 
-			//check for a move that violates the lower bound
-			//todo - not neccesary with dlib constraint opt?
+		for (int ixn = 0; ixn < K; ixn++) {
+			R(ixn*N+j) = f_solution.row(j) * w.segment(ixn*S, S);
 		}
+		b = w.tail(S);
 	}
 
 }
@@ -313,33 +327,23 @@ void evalGradientFD(int N, Eigen::MatrixXd& kappaMat, int num_states,
 Eigen::RowVectorXd push_forward(int num_states, double dt, Eigen::MatrixXd& rate,  
 									const Eigen::RowVectorXd& initial) {
 	//apply the given rate matrix forward for the given time step
+	//initial * exp(dt*rate) by krylov propagation, no dense exponential
 
-	rate *= dt;
-	//exponentiate to get transition operator
-	Eigen::MatrixXd trans_op; 
-	trans_op.setZero(num_states,num_states);
-	trans_op = rate.exp();
+	SpMat A = rate.transpose().sparseView();
+	Eigen::VectorXd final;
+	expmv(A, dt, initial.transpose(), final);
 
-	//do the matrix vector mult
-	Eigen::RowVectorXd final; final.setZero(num_states);
-	final = initial * trans_op;
-
-	return final;
+	return final.transpose();
 }
 
 Eigen::VectorXd push_back(int num_states, double dt, Eigen::MatrixXd& rate,  
 									const Eigen::VectorXd& initial) {
 	//apply the given rate matrix forward for the given time step
+	//exp(dt*rate) * initial by krylov propagation, no dense exponential
 
-	rate *= dt;
-	//exponentiate to get transition operator
-	Eigen::MatrixXd trans_op; 
-	trans_op.setZero(num_states,num_states);
-	trans_op = rate.exp();
-
-	//do the matrix vector mult
-	Eigen::VectorXd final; final.setZero(num_states);
-	final = trans_op * initial;
+	SpMat A = rate.sparseView();
+	Eigen::VectorXd final;
+	expmv(A, dt, initial, final);
 
 	return final;
 }
@@ -538,77 +542,21 @@ void evalGradientAdjoint(int N, Eigen::MatrixXd& kappaMat, int num_states,
 							 const Eigen::VectorXd& t_centers, int initial, std::vector<int> targets,
 							 Eigen::VectorXd& R) {
 	//evaluate the gradient by using the adjoint formulation
+	//one forward and one backward sweep, see evalGradient
 
-	//first, we need to solve the forward and backward kolmogorov equations
-
-	//init storage for solution vectors at each time
-	Eigen::MatrixXd f_solution; f_solution.setZero(N+1, num_states); //rows are probabilities
-	Eigen::MatrixXd f_solution_half; f_solution_half.setZero(N+1, num_states); //rows are probabilities
-	Eigen::MatrixXd b_solution; b_solution.setZero(num_states, N+1); //columns are expectations
-	Eigen::MatrixXd b_solution_half; b_solution_half.setZero(num_states, N+1); //columns are expectations
-
-	//set the initial condition for forward solve
-	f_solution(0, initial) = 1.0; f_solution_half(0, initial) = 1.0;
-
-	//set the terminal condition for backward solve
-	for (int i = 0; i < targets.size(); i++) {
-		b_solution(targets[i], N) = 1.0;
-		b_solution_half(targets[i], N) = 1.0;
-	}
-
-	//do the forward solve
-	f_solve(N, kappaMat, num_states, problem, f_rate, t_disc, f_solution);
-	f_solve_half(N, kappaMat, num_states, problem, f_rate, t_disc, f_solution_half);
-
-	//do the backward solve
-	b_solve(N, kappaMat, num_states, problem, f_rate, t_disc, b_solution);
-	b_solve_half(N, kappaMat, num_states, problem, f_rate, t_disc, b_solution_half);
+	evalGradient(N, kappaMat, num_states, problem, f_rate, t_disc, t_centers, 
+							 initial, targets, R);
 
-	
-	//loop over each interaction, computing derivatives of the rate matrix, to get gradient
+	//if the gradient would push protocols past bounds, set to 0
 	int numInteractions = problem->GetNumInteractions();
 	for (int ixn = 0; ixn < numInteractions; ixn++) {
-
-		//loop over each component of R, compute the gradient
 		for (int j = 0; j < N; j++) {
-			//create the rate matrix and its derivative at this time
-			Eigen::MatrixXd rate; rate.setZero(num_states,num_states);
-			Eigen::MatrixXd LD; LD.setZero(num_states,num_states);
-			problem->CreateRateMatrix(rate, LD, f_rate, kappaMat.col(j), ixn);
-
-			//compute adjoint form of the gradient
-			double g = (f_solution.row(j) * LD * b_solution.col(j)); //using left endpoints
-			double gh = (f_solution_half.row(j+1) * LD * b_solution_half.col(j));
-			double g2 = (f_solution.row(j+1) * LD * b_solution.col(j+1));
-			//double g = f_solution.row(j+1) * LD * b_solution.col(j); //using midpoints
-
-			//store the gradient at this time
-			double dt = t_disc(j+1) - t_disc(j);
-			double val = (g+4*gh+g2)/6.0 * dt;
-			if (j == 0 || j == N-1) { //integral approx is bad at endpoints, use FD
-				//val = gaussQuad(t_disc(j), t_disc(j+1), num_states, rate ,LD,
-														  //f_solution.row(j), b_solution.col(j+1));
-				double h = 1e-7;
-				double base = computeFinalProb(N, num_states, problem, f_rate, kappaMat, t_disc,
-														  initial, targets);
-				kappaMat(ixn,j) += h;
-				double pert = computeFinalProb(N, num_states, problem, f_rate, kappaMat, t_disc,
-														  initial, targets);
-				kappaMat(ixn,j) -= h;
-				val = (pert-base) / h;
-			}
-			//double val = (g+g2)/2.0 * dt;
-			R(ixn*N+j) = val;
-
-			//if the gradient would push protocols past bounds, set to 0
+			double val = R(ixn*N+j);
 			if ((kappaMat(ixn,j) == UPPER && val > 0) ||
 				  (kappaMat(ixn,j) == LOWER && val < 0)) {
 				R(ixn*N+j) = 0;
 			}
-
-			//printf("g %f, gh %f, g2 %f, grad %f\n", g, gh, g2, R(ixn*N+j));
 		}
-
 	}
 
 }
@@ -1051,11 +999,63 @@ void createTransitionOperator(int N, int num_states, OptInfo* problem,
 
 
 
+static void transitionIntervals(int N, const Eigen::VectorXd& t_disc, double t0, double tf,
+																int interval, std::vector<int>& index, std::vector<double>& dt) {
+	//the (interval, time step) factors of the transition operator from t0 to tf,
+	//in time order. same cases as createTransitionOperator
+
+	index.clear(); dt.clear();
+	if (t0 == 0 && tf != t_disc(N)) {
+		for (int i = 0; i < interval; i++) {
+			index.push_back(i); dt.push_back(t_disc(i+1) - t_disc(i));
+		}
+		index.push_back(interval); dt.push_back(tf - t_disc(interval));
+	}
+	else if (tf == t_disc(N) && t0 != 0) {
+		index.push_back(interval); dt.push_back(t0 - t_disc(interval));
+		for (int i = interval+1; i < N; i++) {
+			index.push_back(i); dt.push_back(t_disc(i+1) - t_disc(i));
+		}
+	}
+	else if (tf == t_disc(N) && t0 == 0) {
+		for (int i = 0; i < N; i++) {
+			index.push_back(i); dt.push_back(t_disc(i+1) - t_disc(i));
+		}
+	}
+}
+
+void applyTransitionOperator(int N, int num_states, OptInfo* problem, 
+														 const Eigen::MatrixXd& f_rate, const Eigen::MatrixXd& kappaMat,
+														 const Eigen::VectorXd& t_disc, double t0, double tf, int interval, 
+														 Eigen::VectorXd& v, bool row) {
+	/*apply the transition operator from t0 to tf to v without forming it.
+	  row = true gives v^T * trans_op (a distribution, forward in time), 
+	  row = false gives trans_op * v (a function, backward in time).
+	  each interval is one krylov propagation, see expmv */
+
+	std::vector<int> index; std::vector<double> dt;
+	transitionIntervals(N, t_disc, t0, tf, interval, index, dt);
+
+	Eigen::MatrixXd rate; Eigen::VectorXd w;
+	int M = index.size();
+	for (int k = 0; k < M; k++) {
+		int i = row ? index[k] : index[M-1-k];
+		double delta_t = row ? dt[k] : dt[M-1-k];
+		rate.setZero(num_states,num_states);
+		problem->CreateRateMatrix(rate, f_rate, kappaMat.col(i));
+		SpMat A = row ? SpMat(rate.transpose().sparseView()) : SpMat(rate.sparseView());
+		expmv(A, delta_t, v, w);
+		v = w;
+	}
+}
+
 double computeFinalProb(int N, int num_states, OptInfo* problem, const Eigen::MatrixXd& f_rate,
 												const Eigen::MatrixXd& kappaMat, const Eigen::VectorXd& t_disc,  
 												int initial, std::vector<int> targets) {
 
-	Eigen::MatrixXd trans_op = Eigen::MatrixXd::Identity(num_states,num_states);
+	//only the row of initial in the transition operator is needed
+	Eigen::VectorXd prob = Eigen::VectorXd::Zero(num_states); prob(initial) = 1;
+	Eigen::VectorXd next;
 	Eigen::MatrixXd rate; rate.setZero(num_states,num_states);
 
 	for (int i = 0; i < N; i++) {
@@ -1063,15 +1063,16 @@ double computeFinalProb(int N, int num_states, OptInfo* problem, const Eigen::Ma
 		rate.setZero(num_states,num_states);
 		problem->CreateRateMatrix(rate, f_rate, kappaMat.col(i));
 
-		//scale by time interval and exponentiate
+		//propagate over the time interval
 		double delta_t = t_disc(i+1) - t_disc(i);
-		rate *= delta_t;
-		trans_op *= rate.exp();
+		SpMat A = rate.transpose().sparseView();
+		expmv(A, delta_t, prob, next);
+		prob = next;
 	}
 
 	double p = 0;
 	for (int i = 0; i < targets.size(); i++) {
-		p += trans_op(initial, targets[i]);
+		p += prob(targets[i]);
 	}
 
 	return p;
@@ -1081,7 +1082,9 @@ double computeFinalProb(int N, int num_states, OptInfo* problem, const Eigen::Ma
 												const Eigen::VectorXd& kappaVec, const Eigen::VectorXd& t_disc,  
 												int initial, std::vector<int> targets) {
 
-	Eigen::MatrixXd trans_op = Eigen::MatrixXd::Identity(num_states,num_states);
+	//only the row of initial in the transition operator is needed
+	Eigen::VectorXd prob = Eigen::VectorXd::Zero(num_states); prob(initial) = 1;
+	Eigen::VectorXd next;
 	Eigen::MatrixXd rate; rate.setZero(num_states,num_states);
 	int numInteractions = problem->GetNumInteractions();
 	Eigen::VectorXd theta; theta.setZero(numInteractions);
@@ -1094,15 +1097,16 @@ double computeFinalProb(int N, int num_states, OptInfo* problem, const Eigen::Ma
 		}
 		problem->CreateRateMatrix(rate, f_rate, theta);
 
-		//scale by time interval and exponentiate
+		//propagate over the time interval
 		double delta_t = t_disc(i+1) - t_disc(i);
-		rate *= delta_t;
-		trans_op *= rate.exp();
+		SpMat A = rate.transpose().sparseView();
+		expmv(A, delta_t, prob, next);
+		prob = next;
 	}
 
 	double p = 0;
 	for (int i = 0; i < targets.size(); i++) {
-		p += trans_op(initial, targets[i]);
+		p += prob(targets[i]);
 	}
 
 	return p;
@@ -1112,32 +1116,21 @@ void computeProbVec(int N, int num_states, OptInfo* problem, const Eigen::Matrix
 												const Eigen::MatrixXd& kappaMat, const Eigen::VectorXd& t_disc,  
 												int initial, std::vector<int> targets, Eigen::MatrixXd& probs) {
 
-	Eigen::MatrixXd trans_op = Eigen::MatrixXd::Identity(num_states,num_states);
+	//the row of initial in the transition operator after each interval
+	Eigen::VectorXd prob = Eigen::VectorXd::Zero(num_states); prob(initial) = 1;
+	Eigen::VectorXd next;
 	Eigen::MatrixXd rate; rate.setZero(num_states,num_states);
 
 	for (int i = 0; i < N; i++) {
 		rate.setZero(num_states,num_states);
 		problem->CreateRateMatrix(rate, f_rate, kappaMat.col(i));
 
-		//compute the eigenvalues of the rate matrix
-		Eigen::EigenSolver<Eigen::MatrixXd> es(rate);
-		//get second largest eigenvalue
-		double e = es.eigenvalues()[0].real(); if (fabs(e) < 1e-8) e = es.eigenvalues()[1].real();
-		for (int j = 1; j < num_states; j++) {
-			double val = es.eigenvalues()[j].real();
-			if (val > e && fabs(val) > 1e-8) {
-				e = val;
-			}
-		}
-		
-		std::cout << "Eigenvalue 1 is:" << std::endl << e << std::endl;
-		
-
 		double delta_t = t_disc(i+1) - t_disc(i);
-		rate *= delta_t;
-		trans_op *= rate.exp();
+		SpMat A = rate.transpose().sparseView();
+		expmv(A, delta_t, prob, next);
+		prob = next;
 
-		probs.row(i) = trans_op.row(initial);
+		probs.row(i) = prob.transpose();
 	}
 
 }
@@ -0,0 +1,183 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "bDynamics.h"
+#include "sampling.h"
+#include "database.h"
+#include "sequential.h"
+#include "../defines.h"
+#include <omp.h>
+
+namespace bd {
+
+/******************************************************************/
+/**************** Adaptive mfpt estimation ************************/
+/******************************************************************/
+
+/* estimateMFPT over a whole database, stopping each state when it is accurate
+   enough instead of after a fixed number of hits (see SequentialStop and
+   adaptiveRounds). every round, each walker of an unfinished state runs for
+   up to batch hits or 10*batch steps, whichever comes first, so slow states
+   get fewer hits per batch. a walker keeps its positions and its open dwell
+   (the estimator timer) from one round to the next, so no time is cut off at
+   the end of a batch.
+	 Members:
+	 	state - state in the database
+	 	walkers - positions of each walker, timers - open dwell of each walker
+	 	eq - walker still needs equilibration
+	 	NUM, DEN - estimator sums over all batches
+	 	stop - batch estimates and hits, the stopping rule
+*/
+
+struct AdaptiveState {
+	int state;
+	std::vector<std::vector<double> > walkers; std::vector<int> timers; std::vector<int> eq;
+	int NUM; int DEN;
+	SequentialStop stop;
+
+	AdaptiveState(int state_, const SequentialStop& stop_) : state(state_), stop(stop_) {
+		NUM = DEN = 0;
+	}
+};
+
+static void updateDatabase(const AdaptiveState& S, Database* db, double DT) {
+	//add the sums to the database entry, as estimateMFPT does
+
+	int state = S.state;
+	int num = (*db)[state].getNumerator() + S.NUM;
+	int den = (*db)[state].getDenominator() + S.DEN;
+	std::vector<Pair> pm = db->getP(state).pairs();
+	std::vector<Pair> PMshare = S.stop.getPM();
+	combinePairs(PMshare, pm);
+
+	//make a Z vector with same num of elements as P
+	std::vector<Pair> Z;
+	for (int i = 0; i < PMshare.size(); i++) {
+		Z.push_back(Pair(PMshare[i].index, 0));
+	}
+
+	(*db)[state].mfpt = (num * DT) / den;
+	(*db)[state].num = num;
+	(*db)[state].denom = den;
+	db->setRow(state, PMshare, Z, Z);
+	(*db)[state].sigma = S.stop.getSE();
+}
+
+void estimateMFPTAdaptive(int N, Database* db) {
+	estimateMFPTAdaptive(N, db, 0.05, 0.05);
+}
+
+void estimateMFPTAdaptive(int N, Database* db, double tol, double ptol) {
+	/*estimate the mfpt and transition probabilities of every state that is not
+	rigid, each to relative standard error tol and probability interval ptol.
+	sigma in the database is the standard error of the mfpt. */
+
+	//set parameters
+	int rho = 40; double beta = 1; double DT = 0.01; int Kh = 1850;
+	int pot = 1;  //set potential. 0 = morse, 1 = LJ
+	int method = 1; //solve SDEs with EM
+	int eq = 200; //number of steps to equilibrate for
+	int batch = 100; //most hits per walker per round
+	int min_batches = 4; //fewest batches before a state may stop
+	int max_hits = 20*SAMPLES; //give up on the tolerance after this many hits
+	int max_batches = 2*max_hits/batch; //or after this many batches, hits or not
+
+	int num_states = db->getNumStates(); int dim = db->getDimension();
+
+	//output start message
+	printf("Beginning adaptive MFPT Estimator, tolerance %f, probability interval %f.\n",
+				 tol, ptol);
+
+	//setup simulation
+	double Eh = stickyNewton(8, rho, Kh, beta); //get energy corresponding to kappa
+	//initialize interaction matrices
+	int* P = new int[N*N]; double* E = new double[N*N];
+	setupSimMFPT(N, Eh, P, E);
+
+	//one integrator per thread
+	int num_threads = omp_get_max_threads();
+	std::vector<Integrator*> sdes(num_threads);
+	for (int i = 0; i < num_threads; i++) {
+		sdes[i] = new Integrator(N, rho, beta, E, P, method, pot, dim);
+	}
+
+	//every state that is not rigid starts with one walker
+	std::vector<AdaptiveState> states;
+	SequentialStop rule(tol, ptol, min_batches, max_batches, max_hits);
+	for (int i = 0; i < num_states; i++) {
+		int b = (*db)[i].getBonds();
+		if (isRigid(N, b, dim)) continue;
+
+		AdaptiveState S(i, rule);
+		S.walkers.push_back(std::vector<double>(dim*N)); S.timers.push_back(0);
+		S.eq.push_back(1);
+		const Cluster& c = (*db)[i].getRandomIC();
+		c.makeArray(&S.walkers[0][0], N, dim);
+		states.push_back(S);
+	}
+
+	long total = 0;
+	int rounds = adaptiveRounds(states.size(),
+		[&](int i, int per) {
+			//new walkers start from a database sample, equilibrated in their first batch
+			AdaptiveState& S = states[i];
+			while (S.walkers.size() < per) {
+				S.walkers.push_back(std::vector<double>(dim*N)); S.timers.push_back(0);
+				S.eq.push_back(1);
+				const Cluster& c = (*db)[S.state].getRandomIC();
+				c.makeArray(&S.walkers.back()[0], N, dim);
+			}
+			return int(S.walkers.size());
+		},
+		[&](int i, int k) {
+			AdaptiveState& S = states[i];
+			Integrator* sde = sdes[omp_get_thread_num()];
+			double* X = &S.walkers[k][0];
+
+			if (S.eq[k]) {
+				equilibrate(X, sde, db, S.state, eq, N, DT);
+				S.eq[k] = 0;
+			}
+
+			int NUM = 0; int DEN = 0; std::vector<Pair> PM;
+			runTrajectoryMFPT(X, sde, db, S.state, batch, N, DT, NUM, DEN, PM, NULL, S.timers[k]);
+
+			#pragma omp critical
+			{
+				S.NUM += NUM; S.DEN += DEN;
+				S.stop.addBatch(DEN != 0 ? NUM * DT / DEN : 0, PM);
+				for (int j = 0; j < PM.size(); j++) total += PM[j].value;
+			}
+		},
+		[&](int i) {
+			//stop the state if it is done
+			AdaptiveState& S = states[i];
+			double mfpt = (S.DEN != 0) ? S.NUM * DT / S.DEN : 0;
+			if (!S.stop.finished(mfpt)) return false;
+
+			if (S.DEN != 0) {
+				updateDatabase(S, db, DT);
+			}
+			if (S.stop.converged(mfpt)) {
+				printf("State %d: mfpt %f +- %f from %d hits\n", S.state, mfpt, S.stop.getSE(),
+							 S.stop.getHits());
+			}
+			else {
+				printf("State %d stopped at %d hits short of the tolerance, mfpt %f +- %f\n",
+							 S.state, S.stop.getHits(), mfpt, S.stop.getSE());
+			}
+			S.walkers.clear(); S.timers.clear(); S.eq.clear();
+			return true;
+		});
+
+	printf("Adaptive MFPT Estimator finished, %ld hits over %d states in %d rounds\n", total,
+				 int(states.size()), rounds);
+
+	//free memory
+	for (int i = 0; i < num_threads; i++) delete sdes[i];
+	delete []E; delete []P;
+}
+
+}
@@ -6,10 +6,185 @@
 #include <map>
 #include <iostream>
 #include <vector>
+#include <random>
 #include <eigen3/Eigen/Dense>
 namespace bd { 
 class Database;
 
+/* list of particle pairs for the force kernels, built once from P and E.
+   each unordered pair appears once, stored structure-of-arrays. interacting
+   pairs come first so kernels that ignore the rest can stop early.
+	 Members:
+	 	num_pairs - total number of pairs, N(N-1)/2
+	 	num_interacting - number of pairs with P = 1
+	 	p1, p2 - particle indices, p1 < p2
+	 	E - well depth of the pair
+	 	type - 0 = not interacting, 1 = sticky, 2 = chain neighbor (harmonic)
+*/
+
+struct PairList {
+	PairList() {num_pairs = num_interacting = 0;}
+	PairList(int N, double* E, int* P) {build(N, E, P);}
+
+	//fill the list from interaction matrices
+	void build(int N, double* E, int* P);
+
+	int num_pairs; int num_interacting;
+	std::vector<int> p1; std::vector<int> p2;
+	std::vector<double> E;
+	std::vector<int> type;
+};
+
+/* brownian dynamics integrator. owns the gradient and particle workspace and a
+   noise stream that lives as long as the object. construct one per thread and
+   reuse it for every solve, rather than paying setup on each DT chunk.
+	 Members:
+	 	N, rho, beta, E, P - system and potential parameters (E, P are not owned)
+	 	method - time stepping scheme, 1 = EM
+	 	pot - potential, (-1,0,1) -> (morse w/ repulsion, morse, lennard jones)
+	 	dim - spatial dimension, 2 or 3. defaults to DIMENSION
+	 	pairs - pair list built from E and P at construction
+	 	step - EM instantiation for (dim, pot), picked when either changes so
+	 	       the time loop has no potential or dimension branch
+	 	record, lA, lB - girsanov path likelihood. while recording, every EM step
+	 	       adds to lA and lB so that scaling the drift by 1+d changes the log
+	 	       likelihood of the path by d*lA - d*d*lB/2
+*/
+
+//pair list gradient kernel, see morseGradPairs
+typedef void (*PairGradFn)(const double* particles, int rho, const PairList& pairs, int N, double* g);
+
+class Integrator {
+	public:
+		Integrator(int N_, int rho_, double beta_, double* E_, int* P_, int method_, int pot_);
+		Integrator(int N_, int rho_, double beta_, double* E_, int* P_, int method_, int pot_,
+							 int dim_);
+		~Integrator();
+
+		//advance X0 by time T with the current potential
+		void solveSDE(double* X0, double T);
+		//advance X0 by time T with the given potential
+		void solveSDE(double* X0, double T, int pot_);
+
+		//accessor functions
+		int getN() const {return N;}
+		int getPotential() const {return pot;}
+		int getDimension() const {return dim;}
+		double getBeta() const {return beta;}
+		void setPotential(int pot_);
+
+		//restart the noise stream, for runs that must be repeated exactly
+		void seed(unsigned long long s) {generator.seed(s); distribution.reset();}
+
+		//path likelihood terms, see above. recording starts from zero
+		void recordLikelihood(bool on);
+		void getLikelihood(double& A, double& B) const {A = lA; B = lB;}
+		void setLikelihood(double A, double B) {lA = A; lB = B;}
+
+		//seed that differs across threads and processes
+		static unsigned long long makeSeed();
+
+	private:
+		int N; int rho; double beta; double* E; int* P; int method; int pot; int dim;
+		PairList pairs;
+		PairGradFn morseKernel;
+		bool record; double lA; double lB;
+		double* g; double* particles;
+		std::mt19937_64 generator;
+		std::normal_distribution<double> distribution;
+		void (Integrator::*step)(double* X0, int Nt, double k);
+
+		//apply Nt steps of the EM scheme with time step k, in D dimensions with potential POT.
+		//REC adds the path likelihood terms
+		template <int D, int POT, bool REC> void EM(double* X0, int Nt, double k);
+		template <int D> void selectStep();
+		template <int D, bool REC> void selectStep();
+
+		//copy constructors - each integrator owns its stream, do not copy
+		Integrator(const Integrator&) {
+			throw 1;
+		}
+		Integrator& operator=(const Integrator&) {
+			throw 1;
+		}
+};
+
+/* integrator for R replicas of the same system, advanced in lock step.
+   positions are stored [coord][replica], X[q*R + r] is coordinate q (cluster
+   order) of replica r, so the force and update loops run over contiguous
+   replicas and vectorize. replicas are processed in blocks of BATCH_BLOCK,
+   each replica has its own random stream so results do not depend on the
+   number of threads.
+	 Members:
+	 	N, R - particles per replica, number of replicas
+	 	rho, beta, pot, dim, pairs - as in Integrator. pot is -1, 0 or 1
+	 	frozen - replicas that are not advanced (killed or finished), alive is
+	 	         the same as a 0/1 multiplier for the update loop
+	 	rng - xorshift128+ state of each replica, [2][replica]
+	 	cut, check_pairs - pairs [0, check_pairs) closer than cut are bonded
+	 	ref, cur - bonded sets of each replica as bitsets, [word][replica]
+*/
+
+const int BATCH_BLOCK = 64;
+
+class BatchIntegrator {
+	public:
+		BatchIntegrator(int N_, int R_, int rho_, double beta_, double* E_, int* P_, int pot_);
+		BatchIntegrator(int N_, int R_, int rho_, double beta_, double* E_, int* P_, int pot_,
+										int dim_);
+		~BatchIntegrator();
+
+		//copy a cluster array into or out of replica r
+		void setReplica(int r, const double* X0);
+		void getReplica(int r, double* X0) const;
+		void copyReplica(int from, int to);
+
+		//frozen replicas keep their positions
+		void setFrozen(int r, bool f) {frozen[r] = f; alive[r] = f ? 0.0 : 1.0;}
+		bool isFrozen(int r) const {return frozen[r];}
+		int numLive() const;
+
+		//advance every live replica by time T
+		void solveSDE(double T);
+
+		//bond detection. by default every pair within the bond cutoff counts,
+		//sticky_only restricts to pairs with P = 1
+		void setBondCheck(double cut_, bool sticky_only);
+		//record the current bonded sets as the reference, all replicas or just r
+		void markBonds();
+		void markBonds(int r);
+		//one pass over the batch. bonds[r] gets the bond count of replica r (may
+		//be NULL), hit[r] is set for live replicas whose bonded set differs from
+		//the reference. returns the number of hits
+		int checkBonds(int* bonds, bool* hit);
+
+		//accessor functions
+		int getN() const {return N;}
+		int getNumReplicas() const {return R;}
+		int getDimension() const {return dim;}
+
+	private:
+		int N; int R; int rho; double beta; int pot; int dim;
+		PairList pairs;
+		double* X; double* g;
+		bool* frozen; double* alive;
+		double cut; int check_pairs; int words;
+		unsigned long long* ref; unsigned long long* cur;
+		unsigned long long* rng;
+
+		//advance replicas [r0, r1) by Nt steps of size k
+		template <int D, int POT> void EMBlock(int r0, int r1, int Nt, double k);
+		template <int D> void bondBlock(int r0, int r1);
+
+		//copy constructors - the batch owns its streams, do not copy
+		BatchIntegrator(const BatchIntegrator&) {
+			throw 1;
+		}
+		BatchIntegrator& operator=(const BatchIntegrator&) {
+			throw 1;
+		}
+};
+
 //general stuff
 void makeKappaMap(int numTypes, double* kappaVals, 
 									std::map<std::pair<int,int>,double>& kappa);
@@ -32,6 +207,27 @@ double ljP(double r, double rho, double E);
 double ljEval(double* particles, int rho, double* E, int N, int* P);
 //evaluate gradient of morse potential
 void ljGrad(double* particles, int rho, double* E, int N, int* P, double* g);
+//pair list versions of the above. one pass over pairs, no allocation
+double morseEvalPairs(const double* particles, int rho, const PairList& pairs, int N);
+void morseGradPairs(const double* particles, int rho, const PairList& pairs, int N, double* g);
+void morseGradRPairs(const double* particles, int rho, const PairList& pairs, int N, double* g);
+double ljEvalPairs(const double* particles, int rho, const PairList& pairs, int N);
+void ljGradPairs(const double* particles, int rho, const PairList& pairs, int N, double* g);
+//dimension templated pair kernels, instantiated for D = 2 and 3
+template <int D> double morseEvalPairs(const double* particles, int rho, const PairList& pairs, int N);
+template <int D> void morseGradPairs(const double* particles, int rho, const PairList& pairs, int N, double* g);
+template <int D> void morseGradRPairs(const double* particles, int rho, const PairList& pairs, int N, double* g);
+template <int D> double ljEvalPairs(const double* particles, int rho, const PairList& pairs, int N);
+template <int D> void ljGradPairs(const double* particles, int rho, const PairList& pairs, int N, double* g);
+//vector versions of morseGradPairs, selected at runtime. level 0 scalar, 1 avx2, 2 avx512
+//agree with the scalar kernel to a relative tolerance of SIMD_TOL
+//below SIMD_MIN_N particles the gathers cost more than they save, the Integrator stays
+//scalar. 7 is where benchForces measures avx512 overtaking the scalar kernel
+const double SIMD_TOL = 1e-12;
+const int SIMD_MIN_N = 7;
+int simdLevel();
+PairGradFn morseGradKernel(int level, int dim);
+PairGradFn bestMorseGradKernel(int dim);
 //evaluate the sticky parameter for morse potential
 void stickyF(double E, double rho, double beta, double k0, double& f, double& fprime);
 //use newtons method to find E from kappa
@@ -41,12 +237,11 @@ double stickyNewton(double E, double rho, double k0, double beta);
 //time integration stuff
 //init the chain
 void setupChain(double* X, int N);
+void setupChainDim(double* X, int N, int dim);
 //print the cluster
 void printCluster(double* X, int N);
-//use em scheme to solve sde
-void EM(double* X0, int N, int Nt, double k, 
-					int rho, double* E, int* P, double beta, int pot);
-//solve sde system
+void printCluster(double* X, int N, int dim);
+//solve sde system - one shot, prefer a long lived Integrator in loops
 void solveSDE(double* X0, int N, double T, int rho, double beta,
 							double* E, int* P, int method, int pot);
 
@@ -0,0 +1,339 @@
+#include <math.h>
+#include <string.h>
+#include "bDynamics.h"
+#include "../defines.h"
+#include <omp.h>
+namespace bd {
+
+/* Lock step integration of many replicas. Each pair force is a loop over the
+   replicas of a block, with no branches on the replica, so the loops
+   vectorize. The exponential is the Cephes rational approximation written
+   out in arithmetic (see simdForces.cpp) so it vectorizes with the rest.
+   The noise comes from a xorshift128+ stream per replica and Box-Muller, with
+   log, sin and cos as polynomials, so it vectorizes too. */
+
+static inline double expBatch(double x) {
+	//exp of x for the morse force. x = n*ln2 + r, exp(r) by rational approximation
+	x = (x < -708.0) ? -708.0 : x; x = (x > 709.0) ? 709.0 : x;
+	//round to nearest by adding and removing 1.5*2^52
+	double n = (x * 1.4426950408889634073599 + 6755399441055744.0) - 6755399441055744.0;
+	double r = x - n * 6.93145751953125E-1 - n * 1.42860682030941723212E-6;
+	double rr = r*r;
+	double p = r * ((1.26177193074810590878E-4 * rr + 3.02994407707441961300E-2) * rr
+									+ 9.99999999999999999910E-1);
+	double q = ((3.00198505138664455042E-6 * rr + 2.52448340349684104192E-3) * rr
+							+ 2.27265548208155028766E-1) * rr + 2.00000000000000000009E0;
+	double e = 1.0 + 2.0 * p / (q - p);
+
+	//scale by 2^n through the exponent bits. n+1023 sits in the low bits of m
+	double m = n + 1023.0 + 4503599627370496.0;
+	unsigned long long bits; memcpy(&bits, &m, sizeof(double));
+	bits <<= 52;
+	double s; memcpy(&s, &bits, sizeof(double));
+	return e * s;
+}
+
+static inline double logBatch(double x) {
+	//natural log of x > 0. x = m*2^e with m in [sqrt(1/2), sqrt(2)), log(m) = 2 atanh(s)
+	unsigned long long bits; memcpy(&bits, &x, sizeof(double));
+	//exponent to double through the mantissa of 2^52, avoids an int64 conversion
+	unsigned long long ebits = (bits >> 52) | 0x4330000000000000ULL;
+	double e; memcpy(&e, &ebits, sizeof(double));
+	e -= 4503599627370496.0 + 1023.0;
+	bits = (bits & 0x000FFFFFFFFFFFFFULL) | 0x3FF0000000000000ULL;
+	double m; memcpy(&m, &bits, sizeof(double));
+	bool big = m > 1.4142135623730951;
+	m = big ? 0.5*m : m; e = big ? e + 1.0 : e;
+
+	double f = m - 1.0; double t = f / (2.0 + f); double t2 = t*t;
+	double p = 1.0/15 + t2*(1.0/17 + t2*(1.0/19 + t2*(1.0/21)));
+	p = 1.0 + t2*(1.0/3 + t2*(1.0/5 + t2*(1.0/7 + t2*(1.0/9 + t2*(1.0/11 + t2*(1.0/13 + t2*p))))));
+	return e * 0.6931471805599453 + 2.0 * t * p;
+}
+
+static inline void sinCosBatch(double u, double& sn, double& cs) {
+	//sin and cos of 2 pi u for u in [0,1). shift to [-pi, pi), Taylor series
+	double x = 6.283185307179586 * (u - 0.5); double x2 = x*x;
+	double ps = -1.0/39916800 + x2*(1.0/6227020800 + x2*(-1.0/1307674368000 + x2*(1.0/355687428096000
+							+ x2*(-1.0/121645100408832000 + x2*(1.0/51090942171709440000.0 + x2*(-1.0/25852016738884976640000.0))))));
+	ps = x * (1.0 + x2*(-1.0/6 + x2*(1.0/120 + x2*(-1.0/5040 + x2*(1.0/362880 + x2*ps)))));
+	double pc = -1.0/3628800 + x2*(1.0/479001600 + x2*(-1.0/87178291200 + x2*(1.0/20922789888000
+							+ x2*(-1.0/6402373705728000 + x2*(1.0/2432902008176640000.0 + x2*(-1.0/1124000727777607680000.0))))));
+	pc = 1.0 + x2*(-1.0/2 + x2*(1.0/24 + x2*(-1.0/720 + x2*(1.0/40320 + x2*pc))));
+	//shifting by pi flips the sign of both
+	sn = -ps; cs = -pc;
+}
+
+static inline double uniformBatch(unsigned long long& s0, unsigned long long& s1) {
+	//xorshift128+ step, 64 bit shifts and adds only. the top 52 bits go in the
+	//mantissa of a double in [1,2), giving a uniform in [0,1)
+	unsigned long long x = s0; unsigned long long y = s1;
+	s0 = y; x ^= x << 23;
+	s1 = x ^ y ^ (x >> 17) ^ (y >> 26);
+	unsigned long long bits = 0x3FF0000000000000ULL | ((s1 + y) >> 12);
+	double u; memcpy(&u, &bits, sizeof(double));
+	return u - 1.0;
+}
+
+template <int D, typename F>
+static inline void pairLoop(const double* xi, const double* xj, double* gi, double* gj,
+														int R, int r0, int r1, F force) {
+	//apply the force of one pair in every replica of [r0, r1). force(dist, R2) is
+	//the magnitude along the unit vector from j to i
+	#pragma omp simd
+	for (int r = r0; r < r1; r++) {
+		double dx = xi[r]-xj[r]; double dy = xi[R+r]-xj[R+r];
+		double dz = (D == 3) ? xi[2*R+r]-xj[2*R+r] : 0.0;
+		double R2 = dx*dx + dy*dy + dz*dz;
+		double dist = sqrt(R2);
+
+		double f = force(dist, R2) / dist;
+		gi[r] += f*dx; gj[r] -= f*dx;
+		gi[R+r] += f*dy; gj[R+r] -= f*dy;
+		if (D == 3) {
+			gi[2*R+r] += f*dz; gj[2*R+r] -= f*dz;
+		}
+	}
+}
+
+BatchIntegrator::BatchIntegrator(int N_, int R_, int rho_, double beta_, double* E_, int* P_,
+																 int pot_) : BatchIntegrator(N_, R_, rho_, beta_, E_, P_, pot_, DIMENSION) {
+}
+
+BatchIntegrator::BatchIntegrator(int N_, int R_, int rho_, double beta_, double* E_, int* P_,
+																 int pot_, int dim_) {
+	N = N_; R = R_; rho = rho_; beta = beta_; pot = pot_; dim = dim_;
+	pairs.build(N, E_, P_);
+
+	//positions and gradients, [coord][replica]
+	X = new double[dim*N*R]; g = new double[dim*N*R];
+	frozen = new bool[R]; alive = new double[R];
+	for (int i = 0; i < dim*N*R; i++) X[i] = g[i] = 0;
+	for (int r = 0; r < R; r++) setFrozen(r, false);
+
+	//bonded sets, every pair within the bond cutoff by default
+	ref = cur = NULL;
+	setBondCheck(bondCutoff(dim), false);
+
+	//one random stream per replica, seeded by splitmix64 from a single seed
+	rng = new unsigned long long[2*R];
+	unsigned long long z = Integrator::makeSeed();
+	for (int i = 0; i < 2*R; i++) {
+		z += 0x9E3779B97F4A7C15ULL;
+		unsigned long long y = z;
+		y = (y ^ (y >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		y = (y ^ (y >> 27)) * 0x94D049BB133111EBULL;
+		rng[i] = y ^ (y >> 31);
+	}
+}
+
+BatchIntegrator::~BatchIntegrator() {
+	delete []X; delete []g; delete []frozen; delete []alive;
+	delete []ref; delete []cur; delete []rng;
+}
+
+void BatchIntegrator::setReplica(int r, const double* X0) {
+	for (int q = 0; q < dim*N; q++) X[q*R+r] = X0[q];
+}
+
+void BatchIntegrator::getReplica(int r, double* X0) const {
+	for (int q = 0; q < dim*N; q++) X0[q] = X[q*R+r];
+}
+
+void BatchIntegrator::copyReplica(int from, int to) {
+	//copy positions and reference bonds of one replica into another
+	for (int q = 0; q < dim*N; q++) X[q*R+to] = X[q*R+from];
+	for (int w = 0; w < words; w++) ref[w*R+to] = ref[w*R+from];
+}
+
+int BatchIntegrator::numLive() const {
+	int live = 0;
+	for (int r = 0; r < R; r++) {
+		if (!frozen[r]) live++;
+	}
+	return live;
+}
+
+template <int D, int POT>
+void BatchIntegrator::EMBlock(int r0, int r1, int Nt, double k) {
+	//apply Nt steps of the EM scheme to replicas [r0, r1)
+
+	double amp = sqrt(2.0*k/beta);
+	unsigned long long* s0 = rng; unsigned long long* s1 = rng+R;
+
+	//morse with repulsion and lj only act between interacting pairs
+	int num_pairs = (POT == 0) ? pairs.num_pairs : pairs.num_interacting;
+	double rep = (POT == 0) ? 250.0 : 45.0;
+	double ch = 2.0 * rho * rho; double cm = -2.0 * rho;
+
+	const double* live = alive;
+
+	for (int step = 0; step < Nt; step++) {
+		for (int q = 0; q < D*N; q++) {
+			for (int r = r0; r < r1; r++) g[q*R+r] = 0;
+		}
+
+		for (int p = 0; p < num_pairs; p++) {
+			int i = pairs.p1[p]; int j = pairs.p2[p]; int t = pairs.type[p]; double E = pairs.E[p];
+			bool chain = (t == 2) || (POT == -1 && i == 4 && j == 6);
+			const double* xi = X+D*i*R; const double* xj = X+D*j*R;
+			double* gi = g+D*i*R; double* gj = g+D*j*R;
+
+			//same branches as the pair kernels. the pair type is fixed over the
+			//replicas, the distance tests are selects
+			if (POT == 1) {
+				pairLoop<D>(xi, xj, gi, gj, R, r0, r1, [&](double dist, double R2) {
+					double Y = pow(1/dist, rho);
+					return -4 * E * rho / dist * Y * (2*Y-1);
+				});
+			}
+			else if (t == 0) {
+				pairLoop<D>(xi, xj, gi, gj, R, r0, r1, [&](double dist, double R2) {
+					return (dist < 1.1) ? -rep / R2 : 0.0;
+				});
+			}
+			else if (chain) {
+				pairLoop<D>(xi, xj, gi, gj, R, r0, r1, [&](double dist, double R2) {
+					return ch * E * (dist-1.0);
+				});
+			}
+			else {
+				pairLoop<D>(xi, xj, gi, gj, R, r0, r1, [&](double dist, double R2) {
+					double Y = expBatch(-rho * (dist-1.0));
+					double fm = cm * E * (Y*Y - Y);
+					if (POT == -1) {
+						fm = (dist < 1.2) ? -rep / R2 : fm;
+					}
+					return (dist < 1) ? ch * E * (dist-1.0) : fm;
+				});
+			}
+		}
+
+		//update the live replicas. one box muller draw gives the noise of two coordinates
+		for (int q = 0; q < D*N; q += 2) {
+			int q1 = (q+1 < D*N) ? q+1 : q;
+			double* x0 = X+q*R; double* x1 = X+q1*R;
+			const double* g0 = g+q*R; const double* g1 = g+q1*R;
+			double w1 = (q1 != q) ? 1.0 : 0.0;
+
+			#pragma omp simd
+			for (int r = r0; r < r1; r++) {
+				double u1 = uniformBatch(s0[r], s1[r]);
+				double u2 = uniformBatch(s0[r], s1[r]);
+				double rad = amp * sqrt(-2.0 * logBatch(1.0 - u1));
+				double sn, cs; sinCosBatch(u2, sn, cs);
+
+				x0[r] += live[r] * (-g0[r]*k + rad*cs);
+				x1[r] += live[r] * w1 * (-g1[r]*k + rad*sn);
+			}
+		}
+	}
+}
+
+void BatchIntegrator::solveSDE(double T) {
+	//advance every live replica by time T, blocks in parallel
+
+	double k = EULER_TS; int Nt = T/k;
+	int blocks = (R + BATCH_BLOCK - 1) / BATCH_BLOCK;
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int b = 0; b < blocks; b++) {
+		int r0 = b*BATCH_BLOCK; int r1 = std::min(R, r0+BATCH_BLOCK);
+
+		//skip blocks with nothing left to advance
+		bool live = false;
+		for (int r = r0; r < r1; r++) {
+			if (!frozen[r]) live = true;
+		}
+		if (!live) continue;
+
+		if (dim == 3) {
+			if (pot == -1) EMBlock<3,-1>(r0, r1, Nt, k);
+			else if (pot == 1) EMBlock<3,1>(r0, r1, Nt, k);
+			else EMBlock<3,0>(r0, r1, Nt, k);
+		}
+		else {
+			if (pot == -1) EMBlock<2,-1>(r0, r1, Nt, k);
+			else if (pot == 1) EMBlock<2,1>(r0, r1, Nt, k);
+			else EMBlock<2,0>(r0, r1, Nt, k);
+		}
+	}
+}
+
+void BatchIntegrator::setBondCheck(double cut_, bool sticky_only) {
+	//choose which pairs count as bonds. clears the reference sets
+	cut = cut_;
+	check_pairs = sticky_only ? pairs.num_interacting : pairs.num_pairs;
+	words = (check_pairs + 63) / 64;
+	if (words == 0) words = 1;
+
+	delete []ref; delete []cur;
+	ref = new unsigned long long[words*R]; cur = new unsigned long long[words*R];
+	for (int i = 0; i < words*R; i++) ref[i] = cur[i] = 0;
+}
+
+template <int D>
+void BatchIntegrator::bondBlock(int r0, int r1) {
+	//bonded sets of replicas [r0, r1) into cur
+	for (int w = 0; w < words; w++) {
+		for (int r = r0; r < r1; r++) cur[w*R+r] = 0;
+	}
+
+	double cut2 = cut*cut;
+	for (int p = 0; p < check_pairs; p++) {
+		int i = pairs.p1[p]; int j = pairs.p2[p];
+		const double* xi = X+D*i*R; const double* xj = X+D*j*R;
+		unsigned long long* word = cur + (p/64)*R; int bit = p % 64;
+
+		#pragma omp simd
+		for (int r = r0; r < r1; r++) {
+			double dx = xi[r]-xj[r]; double dy = xi[R+r]-xj[R+r];
+			double dz = (D == 3) ? xi[2*R+r]-xj[2*R+r] : 0.0;
+			double R2 = dx*dx + dy*dy + dz*dz;
+			word[r] |= (unsigned long long)(R2 < cut2) << bit;
+		}
+	}
+}
+
+void BatchIntegrator::markBonds() {
+	int* none = NULL; bool* hit = new bool[R];
+	checkBonds(none, hit);
+	memcpy(ref, cur, words*R*sizeof(unsigned long long));
+	delete []hit;
+}
+
+void BatchIntegrator::markBonds(int r) {
+	//uses the sets from the last checkBonds
+	for (int w = 0; w < words; w++) ref[w*R+r] = cur[w*R+r];
+}
+
+int BatchIntegrator::checkBonds(int* bonds, bool* hit) {
+	//compare every replica's bonded set with its reference in one pass
+
+	int blocks = (R + BATCH_BLOCK - 1) / BATCH_BLOCK;
+	#pragma omp parallel for
+	for (int b = 0; b < blocks; b++) {
+		int r0 = b*BATCH_BLOCK; int r1 = std::min(R, r0+BATCH_BLOCK);
+		if (dim == 3) {
+			bondBlock<3>(r0, r1);
+		}
+		else {
+			bondBlock<2>(r0, r1);
+		}
+	}
+
+	int hits = 0;
+	for (int r = 0; r < R; r++) {
+		int count = 0; bool changed = false;
+		for (int w = 0; w < words; w++) {
+			count += __builtin_popcountll(cur[w*R+r]);
+			changed = changed || (cur[w*R+r] != ref[w*R+r]);
+		}
+		if (bonds != NULL) bonds[r] = count;
+		hit[r] = changed && !frozen[r];
+		if (hit[r]) hits++;
+	}
+	return hits;
+}
+
+}
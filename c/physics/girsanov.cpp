@@ -0,0 +1,149 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include "bDynamics.h"
+#include "sampling.h"
+#include "../defines.h"
+
+namespace bd {
+
+/******************************************************************/
+/**************** Path reweighting ********************************/
+/******************************************************************/
+
+/* the mfpt estimator at one kappa, with every hit weighted by the likelihood
+   ratio of its path at another kappa (girsanov), gives the estimator at the
+   other kappa. all sticky pairs share one well depth E(kappa), as in
+   setupSimMFPT, so the drift scales by E(kappa)/E(kappa0) and two numbers per
+   path are enough for any kappa. each hit is weighted by its own path from
+   the last hit, the start of the path is taken as fixed. the weights
+   degenerate as kappa moves away from kappa0, the effective number of samples
+   is checked for each state. */
+
+bool writePaths(const PathCampaign& C, const std::string& filename) {
+	//write a campaign to a text file. false if it can not be opened
+
+	std::ofstream out_str(filename);
+	if (!out_str.is_open()) {
+		fprintf(stderr, "Could not open %s to write paths\n", filename.c_str());
+		return false;
+	}
+
+	out_str << std::setprecision(17);
+	out_str << C.kappa << ' ' << C.rho << ' ' << C.beta << ' ' << C.DT << ' ';
+	out_str << C.paths.size() << '\n';
+	for (int i = 0; i < C.paths.size(); i++) {
+		const PathSample& p = C.paths[i];
+		out_str << p.state << ' ' << p.dest << ' ' << p.steps << ' ' << p.A << ' ' << p.B << '\n';
+	}
+	return true;
+}
+
+bool readPaths(const std::string& filename, PathCampaign& C) {
+	//read a campaign written by writePaths. false if missing or incomplete
+
+	std::ifstream in_str(filename);
+	if (!in_str.is_open()) {
+		fprintf(stderr, "Could not open %s to read paths\n", filename.c_str());
+		return false;
+	}
+
+	int n;
+	in_str >> C.kappa >> C.rho >> C.beta >> C.DT >> n;
+	C.paths.resize(n);
+	for (int i = 0; i < n && in_str; i++) {
+		PathSample& p = C.paths[i];
+		in_str >> p.state >> p.dest >> p.steps >> p.A >> p.B;
+	}
+
+	if (!in_str) {
+		fprintf(stderr, "Paths file %s is incomplete\n", filename.c_str());
+		C.paths.clear();
+		return false;
+	}
+	return true;
+}
+
+static void reweightStates(const PathCampaign& C, const std::vector<std::vector<int> >& byState,
+													 double kappa, int num_states, double* T) {
+	//fill T with the forward rates at kappa, as createTransitionMatrix
+
+	for (int i = 0; i < num_states*num_states; i++) T[i] = 0;
+
+	//relative change of the drift
+	double E0 = stickyNewton(8, C.rho, C.kappa, C.beta);
+	double d = stickyNewton(8, C.rho, kappa, C.beta) / E0 - 1;
+
+	std::vector<double> w; std::vector<double> Pw(num_states, 0.0);
+	int poor = 0;
+	for (int s = 0; s < num_states; s++) {
+		const std::vector<int>& idx = byState[s];
+		if (idx.empty()) continue;
+
+		//log weights, shifted by the largest
+		w.resize(idx.size()); double m = -1e300;
+		for (int i = 0; i < idx.size(); i++) {
+			const PathSample& p = C.paths[idx[i]];
+			w[i] = d*p.A - 0.5*d*d*p.B;
+			if (w[i] > m) m = w[i];
+		}
+
+		//weighted estimator sums
+		double num = 0; double den = 0; double S = 0; double S2 = 0;
+		for (int i = 0; i < idx.size(); i++) {
+			const PathSample& p = C.paths[idx[i]];
+			w[i] = exp(w[i] - m);
+			num += w[i] * p.steps*(p.steps+1)/2.0; den += w[i] * p.steps;
+			S += w[i]; S2 += w[i]*w[i];
+			Pw[p.dest] += w[i];
+		}
+		if (S*S < 0.1*idx.size()*S2) poor++;
+
+		if (den > 0) {
+			double mfpt = num * C.DT / den;
+			for (int i = 0; i < idx.size(); i++) {
+				int dest = C.paths[idx[i]].dest;
+				T[toIndex(s, dest, num_states)] = (Pw[dest] / S) / mfpt;
+			}
+		}
+		for (int i = 0; i < idx.size(); i++) Pw[C.paths[idx[i]].dest] = 0;
+	}
+
+	if (poor > 0) {
+		printf("kappa %f: %d states have under 10%% effective samples\n", kappa, poor);
+	}
+}
+
+static void groupPaths(const PathCampaign& C, int num_states, std::vector<std::vector<int> >& byState) {
+	//indices of the paths of each state
+	byState.assign(num_states, std::vector<int>());
+	for (int i = 0; i < C.paths.size(); i++) {
+		byState[C.paths[i].state].push_back(i);
+	}
+}
+
+void reweightTransitionMatrix(const PathCampaign& C, double kappa, int num_states, double* T) {
+	/*forward rates at kappa from the campaign C, in the layout of
+	createTransitionMatrix. T is num_states by num_states and is overwritten */
+
+	std::vector<std::vector<int> > byState;
+	groupPaths(C, num_states, byState);
+	reweightStates(C, byState, kappa, num_states, T);
+}
+
+void reweightTransitionMatrix(const PathCampaign& C, const std::vector<double>& kappas,
+															int num_states, double* T) {
+	/*forward rates at every kappa in kappas. T holds one num_states by num_states
+	matrix per kappa, one after another */
+
+	std::vector<std::vector<int> > byState;
+	groupPaths(C, num_states, byState);
+	for (int k = 0; k < kappas.size(); k++) {
+		reweightStates(C, byState, kappas[k], num_states, T + k*num_states*num_states);
+	}
+}
+
+}
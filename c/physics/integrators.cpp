@@ -3,57 +3,151 @@
 #include <chrono>
 #include "bDynamics.h"
 #include "../defines.h"
+#include <omp.h>
 namespace bd{
 
 
-void EM(double* X0, int N, int Nt, double k, 
-					int rho, double* E, int* P, double beta, int pot) {
+Integrator::Integrator(int N_, int rho_, double beta_, double* E_, int* P_, 
+											 int method_, int pot_) : Integrator(N_, rho_, beta_, E_, P_, method_, pot_, DIMENSION) {
+}
+
+Integrator::Integrator(int N_, int rho_, double beta_, double* E_, int* P_, 
+											 int method_, int pot_, int dim_) : generator(makeSeed()), distribution(0.0,1.0) {
+	N = N_; rho = rho_; beta = beta_; E = E_; P = P_; 
+	method = method_; dim = dim_;
+	record = false; lA = lB = 0;
+	pairs.build(N, E, P);
+	morseKernel = (N >= SIMD_MIN_N) ? bestMorseGradKernel(dim) : morseGradKernel(0, dim);
+	setPotential(pot_);
+
+	//workspace is allocated once and reused by every solve
+	g = new double[dim*N];
+	particles = new double[dim*N];
+}
+
+Integrator::~Integrator() {
+	delete []g; delete []particles;
+}
+
+unsigned long long Integrator::makeSeed() {
+	//mix hardware entropy, the clock, and the thread number so that threads
+	//started in the same clock tick still get independent streams
+	std::random_device rd;
+	unsigned long long t = std::chrono::high_resolution_clock::now().time_since_epoch().count();
+	std::seed_seq seq{rd(), rd(), unsigned(t), unsigned(t >> 32), unsigned(omp_get_thread_num())};
+	unsigned long long seed[2];
+	seq.generate(seed, seed+2);
+	return seed[0];
+}
+
+void Integrator::setPotential(int pot_) {
+	//change the potential and pick the matching EM instantiation
+	pot = pot_;
+	if (dim == 3) {
+		selectStep<3>();
+	}
+	else {
+		selectStep<2>();
+	}
+}
+
+void Integrator::recordLikelihood(bool on) {
+	//switch the likelihood terms on or off, keeping the potential
+	record = on; lA = lB = 0;
+	setPotential(pot);
+}
+
+template <int D>
+void Integrator::selectStep() {
+	if (record) {
+		selectStep<D,true>();
+	}
+	else {
+		selectStep<D,false>();
+	}
+}
+
+template <int D, bool REC>
+void Integrator::selectStep() {
+	if (pot == -1) {
+		step = &Integrator::EM<D,-1,REC>;
+	}
+	else if (pot == 1) {
+		step = &Integrator::EM<D,1,REC>;
+	}
+	else {
+		step = &Integrator::EM<D,0,REC>;
+	}
+}
+
+template <int D, int POT, bool REC>
+void Integrator::EM(double* X0, int Nt, double k) {
 	//apply the EM method to solve the SDE
-	//initialize particle and gradient storage
-	double* g = new double[DIMENSION*N];
-	double* particles = new double[DIMENSION*N];
 
-	//initialize the random number generator - Normal(0,1) //fix seed
-	unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
-	std::default_random_engine generator(seed);
-	std::normal_distribution<double> distribution(0.0,1.0);
+	//noise amplitude is fixed over the solve
+	double amp = sqrt(2.0*k/beta);
+
+	//likelihood terms of the drift -g against the noise
+	double a = 0; double b = 0;
 
 	//apply the EM scheme
 	for (int i = 0; i < Nt; i++) {
-		c2p(X0, particles, N);
-		if (pot == -1) {
-			morseGradR(particles, rho, E, N, P, g);
+		c2p<D>(X0, particles, N);
+		if (POT == -1) {
+			morseGradRPairs<D>(particles, rho, pairs, N, g);
 		}
-		if (pot == 0) {//use morse potential
-			morseGrad(particles, rho, E, N, P, g);
+		else if (POT == 0) {//use morse potential
+			morseKernel(particles, rho, pairs, N, g);
 		}
-		else if (pot == 1) {//use lennard jones potential
-			ljGrad(particles, rho, E, N, P, g);
+		else if (POT == 1) {//use lennard jones potential
+			ljGradPairs<D>(particles, rho, pairs, N, g);
 		}
-		for (int j = 0; j < DIMENSION*N; j++) {
-			X0[j] += -g[j]*k + sqrt(2.0*k/beta)*distribution(generator);
+		for (int j = 0; j < D*N; j++) {
+			double xi = distribution(generator);
+			X0[j] += -g[j]*k + amp*xi;
+			if (REC) {
+				a -= g[j]*xi; b += g[j]*g[j];
+			}
 		}
 	}
 
-	//free the memory
-	delete []g; delete []particles;
+	if (REC) {
+		lA += a*k/amp; lB += b*k*k/(amp*amp);
+	}
 }
 
-void solveSDE(double* X0, int N, double T, int rho, double beta,
-												 double* E, int* P, int method, int pot) {
+void Integrator::solveSDE(double* X0, double T) {
 	if (method == 1) {
 		//set time step
 		double k = EULER_TS; int Nt = T/k; 
 		//solve the sde
-		EM(X0,  N, Nt, k, rho, E, P, beta, pot);
+		(this->*step)(X0, Nt, k);
 	}
 }
 
+void Integrator::solveSDE(double* X0, double T, int pot_) {
+	if (pot_ != pot) {
+		setPotential(pot_);
+	}
+	solveSDE(X0, T);
+}
+
+void solveSDE(double* X0, int N, double T, int rho, double beta,
+												 double* E, int* P, int method, int pot) {
+	//one shot solve. sets up an integrator for a single call
+	Integrator sde(N, rho, beta, E, P, method, pot);
+	sde.solveSDE(X0, T);
+}
+
 void setupChain(double* X, int N) {
+	setupChainDim(X, N, DIMENSION);
+}
+
+void setupChainDim(double* X, int N, int dim) {
 	//construct a linear chain of particle positions
-	for (int i = 0; i < DIMENSION*N; i++) {
-		if (i % DIMENSION == 0) {
-			X[i] = i/DIMENSION+1;
+	for (int i = 0; i < dim*N; i++) {
+		if (i % dim == 0) {
+			X[i] = i/dim+1;
 		}
 		else{
 			X[i] = 0;
@@ -62,8 +156,12 @@ void setupChain(double* X, int N) {
 }
 
 void printCluster(double* X, int N) {
+	printCluster(X, N, DIMENSION);
+}
+
+void printCluster(double* X, int N, int dim) {
 	//print the cluster in X
-	for (int i = 0; i < DIMENSION*N; i++) printf("%f\n",X[i]);
+	for (int i = 0; i < dim*N; i++) printf("%f\n",X[i]);
 }
 
 
@@ -108,6 +206,38 @@ void fillP(int N, int* particleTypes, int* P, double* E,
 	}
 }
 
+void PairList::build(int N, double* E_, int* P) {
+	//list every pair once, interacting pairs first
+
+	p1.clear(); p2.clear(); E.clear(); type.clear();
+
+	for (int pass = 1; pass >= 0; pass--) {
+		for (int i = 0; i < N; i++) {
+			for (int j = i+1; j < N; j++) {
+				int interacting = (P[toIndex(i,j,N)] == 1);
+				if (interacting == pass) {
+					p1.push_back(i); p2.push_back(j);
+					E.push_back(E_[toIndex(i,j,N)]);
+					if (!interacting) {
+						type.push_back(0);
+					}
+					else if (j == i+1) {
+						type.push_back(2);
+					}
+					else {
+						type.push_back(1);
+					}
+				}
+			}
+		}
+		if (pass == 1) {
+			num_interacting = p1.size();
+		}
+	}
+
+	num_pairs = p1.size();
+}
+
 void readKappaFile(int numInteractions, double* kappa) {
 	//read the file to get particle identities
 
@@ -68,4 +68,59 @@ void ljGrad(double* particles, int rho, double* E, int N, int* P, double* g) {
   delete []S;
 }
 
-}
\ No newline at end of file
+
+/* Pair list kernels. See morse.cpp. Non-interacting pairs have no
+   repulsion for lennard jones, so only interacting pairs are visited. */
+
+template <int D>
+double ljEvalPairs(const double* particles, int rho, const PairList& pairs, int N) {
+  //compute total energy of system with pairwise lj potential
+  double S = 0;
+
+  for (int k = 0; k < pairs.num_interacting; k++) {
+    int i = pairs.p1[k]; int j = pairs.p2[k];
+    double R = 0;
+    for (int c = 0; c < D; c++) {
+      double d = particles[c*N+i]-particles[c*N+j]; R += d*d;
+    }
+    S += ljP(sqrt(R), rho, pairs.E[k]);
+  }
+  return S;
+}
+
+template <int D>
+void ljGradPairs(const double* particles, int rho, const PairList& pairs, int N, double* g) {
+  //compute gradient of energy of system with pairwise lj potential
+
+  for (int i = 0; i < D*N; i++) g[i] = 0;
+
+  for (int k = 0; k < pairs.num_interacting; k++) {
+    int i = pairs.p1[k]; int j = pairs.p2[k];
+    double d[D]; double R = 0;
+    for (int c = 0; c < D; c++) {
+      d[c] = particles[c*N+i]-particles[c*N+j]; R += d[c]*d[c];
+    }
+    double r = sqrt(R);
+
+    //apply to both particles
+    double f = ljP(r, rho, pairs.E[k]) / r;
+    for (int c = 0; c < D; c++) {
+      g[D*i+c] += f*d[c]; g[D*j+c] -= f*d[c];
+    }
+  }
+}
+
+template double ljEvalPairs<2>(const double*, int, const PairList&, int);
+template double ljEvalPairs<3>(const double*, int, const PairList&, int);
+template void ljGradPairs<2>(const double*, int, const PairList&, int, double*);
+template void ljGradPairs<3>(const double*, int, const PairList&, int, double*);
+
+double ljEvalPairs(const double* particles, int rho, const PairList& pairs, int N) {
+  return ljEvalPairs<DIMENSION>(particles, rho, pairs, N);
+}
+
+void ljGradPairs(const double* particles, int rho, const PairList& pairs, int N, double* g) {
+  ljGradPairs<DIMENSION>(particles, rho, pairs, N, g);
+}
+
+}
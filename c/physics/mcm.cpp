@@ -9,6 +9,7 @@
 #include "database.h"
 #include "adjacency.h"
 #include "sampling.h"
+#include "sequential.h"
 #include "../defines.h"
 #include <eigen3/Eigen/Dense>
 #include <eigen3/Eigen/QR>
@@ -517,27 +518,24 @@ double getTime(int N, Eigen::VectorXd x, Eigen::VectorXd x0) {
 	return SIG*SIG/2;
 }
 
-bool findMatrix(int* M, int* old, int old_bonds, int N, bd::Database* db, 
+bool findMatrix(const bd::AdjBits& M, int old_bonds, int N, bd::Database* db, 
 								bool& reset, int& new_state) {
 	//find a state by transition matrix in the database
 
-	//loop over each state and compare adjacency matrix
-	for (int i = 0; i < (*db).getNumStates(); i++) {
-		bd::extractAM(N, i, old, db);
-		int S = bd::checkSame(old, M, N); 
-		if (S == 1) {//found matrix
-			int new_bonds = (*db)[i].getBonds();
-			if (new_bonds == old_bonds + 1 || (old_bonds == 10 && new_bonds == 12)) {//keep these
-				new_state = i; 
-			}
-			else {// 2 states at once transition. just delete this sample
-				//new_state = i;
-				reset = true; 
-			}
-			return 1; 
-		}
+	int i = bd::findMatrix(M, N, db);
+	if (i == -1) {
+		return 0;
 	}
-	return 0;
+
+	int new_bonds = (*db)[i].getBonds();
+	if (new_bonds == old_bonds + 1 || (old_bonds == 10 && new_bonds == 12)) {//keep these
+		new_state = i; 
+	}
+	else {// 2 states at once transition. just delete this sample
+		//new_state = i;
+		reset = true; 
+	}
+	return 1; 
 }
 
 void checkState(int N, Eigen::VectorXd x, int state, bd::Database* db,
@@ -552,31 +550,33 @@ void checkState(int N, Eigen::VectorXd x, int state, bd::Database* db,
 	for (int i = 0; i < DIMENSION*N; i++) X[i]=x(i);
 
 	//get adjacency matrix of the current state
-	int* M = new int[N*N]; for (int i = 0; i < N*N; i++) M[i]=0;
+	bd::AdjBits M;
 	bd::getAdj(X, N, M);
 
 	//compare old and new state, check if same
-	int* old = new int[N*N]; for (int i = 0; i < N*N; i++) old[i]=0;
 	int old_bonds = (*db)[state].getBonds();
-	bd::extractAM(N, state, old, db);
-	int success = bd::checkSame(old, M, N);
+	int success = ((*db)[state].getAdjacency() == M);
 
 	if (success) {//same matrix
-		delete []M; delete []old; delete []X;
+		delete []X;
 		return;
 	}
 	else {//not the same, find matrix in database
-		success = findMatrix(M, old, old_bonds, N, db,  reset,  new_state);
+		success = findMatrix(M, old_bonds, N, db,  reset,  new_state);
 		if (!success) {
 			//may output an unphysical state. refine with newton, check again
-			bd::refine(N, X, M);
-			success = findMatrix(M, old, old_bonds, N, db,  reset,  new_state);
+			int* MI = new int[N*N];
+			M.toMatrix(MI, N);
+			bd::refine(N, X, MI);
+			M.fromMatrix(MI, N);
+			delete []MI;
+			success = findMatrix(M, old_bonds, N, db,  reset,  new_state);
 			if (!success) { //state still not found after refine, ignore this sample
 				reset = true; 
 				printf("State not found in database\n\n\n\n\n");
 			}
 		}
-		delete []M; delete []old; delete []X;
+		delete []X;
 	}
 }
 
@@ -736,10 +736,7 @@ void estimateMFPTreset(int N, int state, bd::Database* db, RandomNo* rngee) {
 		//cluster structs to arrays
 		double* X = new double[DIMENSION*N];
 		//set the initial configuration in array X
-		if (DIMENSION == 2)
-			c.makeArray2d(X, N);
-		else if (DIMENSION == 3) 
-			c.makeArray3d(X, N);
+		c.makeArray<DIMENSION>(X, N);
 
 		for (int step = 0; step < samples; step++) {
 			//equilibrate the trajectories
@@ -794,10 +791,7 @@ void estimateMFPTreset(int N, int state, bd::Database* db, RandomNo* rngee) {
 	(*db)[state].mfpt = mfpt;
 	(*db)[state].num = 0;
 	(*db)[state].denom = 0;
-	(*db)[state].num_neighbors = PMshare.size();
-	(*db)[state].P = PMshare;
-	(*db)[state].Z = Z;
-	(*db)[state].Zerr = Z;
+	db->setRow(state, PMshare, Z, Z);
 	(*db)[state].sigma = sigma;
 
 	//print out final estimates - debug
@@ -829,15 +823,23 @@ void estimateMFPTreset(int N, int state, bd::Database* db, RandomNo* rngee) {
 void getSamplesMFPT(double* X, bd::Database* db, int state, int N, int* M,
 	std::vector<bd::Pair>& PM, std::vector<double>& mfptVec, RandomNo* rngee) {
 	//get a sample of the mean first passage time, record the state that gets visited
+	double timer = 0;
+	getSamplesMFPT(X, db, state, N, M, SAMPLES, PM, mfptVec, timer, rngee);
+}
+
+void getSamplesMFPT(double* X, bd::Database* db, int state, int N, int* M, int samples,
+	std::vector<bd::Pair>& PM, std::vector<double>& mfptVec, double& timer, RandomNo* rngee) {
+	//get samples hits of the mean first passage time, record the states that get
+	//visited. X and timer (the open dwell) are left where the walker stopped, so
+	//it can be continued by another call
 
 	//parameters for the estimator and bond checking
-	int max_it = MAX_ITS;             //cut off if not done after max_it samples
+	int max_it = 300*samples;         //cut off if not done after max_it samples
 	int new_state = state;            //new state id
 	bool accepted;                    //flag to check if MCMC accepted proposal
 	int df = DIMENSION*N;             //num dimensions of the system
 	int b = (*db)[state].getBonds();  //num bonds in starting cluster
 	int d = df - b;                  //effective degrees of freedom
-	double timer = 0;                //init the timer for the mfpt
 	bool reset = false;              //if this becomes true, reset with no sample
 	int hits = 0;
 
@@ -888,7 +890,7 @@ void getSamplesMFPT(double* X, bd::Database* db, int state, int N, int* M,
 			}
 
 			//check if num_samples has been reached
-			if (hits == SAMPLES) {
+			if (hits == samples) {
 				break;
 			}
 
@@ -897,6 +899,9 @@ void getSamplesMFPT(double* X, bd::Database* db, int state, int N, int* M,
 		}
 	}
 	//ofile.close();
+
+	//update the array X with vector x values
+	for (int i = 0; i < df; i++) X[i] = x(i);
 }
 
 
@@ -952,10 +957,7 @@ void estimateMFPTreflect(int N, int state, bd::Database* db, RandomNo* rngee) {
 		//cluster structs to arrays
 		double* X = new double[DIMENSION*N];
 		//set the initial configuration in array X
-		if (DIMENSION == 2)
-			c.makeArray2d(X, N);
-		else if (DIMENSION == 3) 
-			c.makeArray3d(X, N);
+		c.makeArray<DIMENSION>(X, N);
 
 		//equilibrate the trajectories
 		equilibrate(X, db, state, N, M, rngee);
@@ -1002,10 +1004,7 @@ void estimateMFPTreflect(int N, int state, bd::Database* db, RandomNo* rngee) {
 	(*db)[state].mfpt = mfpt;
 	(*db)[state].num = 0;
 	(*db)[state].denom = 0;
-	(*db)[state].num_neighbors = PMshare.size();
-	(*db)[state].P = PMshare;
-	(*db)[state].Z = Z;
-	(*db)[state].Zerr = Z;
+	db->setRow(state, PMshare, Z, Z);
 	(*db)[state].sigma = sigma;
 
 	//print out final estimates - debug
@@ -1025,4 +1024,148 @@ void estimateMFPTreflect(int N, int state, bd::Database* db, RandomNo* rngee) {
 	delete []mfptSamples; delete []mfptVar; delete []M;
 }
 
-}
\ No newline at end of file
+/****************************************************/
+/*** End MFPT Estimator Functions - Reflect Method **/
+/****************************************************/
+
+/****************************************************/
+/**** MFPT Estimator Functions - Adaptive  **********/
+/****************************************************/
+
+/* the reset and reflect estimators, stopped when the state is accurate enough
+   instead of after SAMPLES hits per thread (see bd::SequentialStop). every
+   round each walker adds one batch. a reflect walker keeps its position and
+   its open dwell from one batch to the next, a reset batch is batch
+   independent samples. the mfpt is the mean of all samples.
+	 Members:
+	 	walkers - positions of each walker, timers - open dwell of each walker
+	 	eq - walker still needs equilibration
+	 	sum, count - sum and number of all samples
+*/
+
+struct AdaptiveWalkers {
+	std::vector<std::vector<double> > walkers; std::vector<double> timers; std::vector<int> eq;
+	double sum; int count;
+
+	AdaptiveWalkers() {sum = 0; count = 0;}
+};
+
+static void updateDatabaseAdaptive(int state, bd::Database* db, double mfpt, 
+																	 const bd::SequentialStop& stop) {
+	//update the database as the fixed sample estimators do
+
+	//make a Z vector with same num of elements as P
+	std::vector<bd::Pair> PMshare = stop.getPM();
+	std::vector<bd::Pair> Z; 
+	for (int i = 0; i < PMshare.size(); i++) {
+		Z.push_back(bd::Pair(PMshare[i].index, 0));
+	}
+
+	(*db)[state].mfpt = mfpt;
+	(*db)[state].num = 0;
+	(*db)[state].denom = 0;
+	db->setRow(state, PMshare, Z, Z);
+	(*db)[state].sigma = stop.getSE();
+
+	printf("Total Estimate = %f +- %f from %d hits in %d batches\n", mfpt, stop.getSE(),
+				 stop.getHits(), stop.getNumBatches());
+}
+
+static void estimateMFPTAdaptive(int N, int state, bd::Database* db, RandomNo* rngee,
+																 double tol, double ptol, bool reflect) {
+	//estimate the mfpt of state with the reflect or the reset method
+
+	//set parameters
+	int batch = 100; //hits (reflect) or samples (reset) per walker per round
+	int min_batches = 4; //fewest batches before the state may stop
+	int max_hits = 20*SAMPLES; //give up on the tolerance after this many hits
+	int max_batches = 2*max_hits/batch; //or after this many batches, hits or not
+	int num_states = db->getNumStates(); //total number of states
+
+	//construct the adjacency matrix of the state
+	int* M = new int[N*N];
+	bd::extractAM(N, state, M, db);
+
+	//output start message for this state
+	printf("Beginning adaptive MFPT Estimator for state %d out of %d.\n", state, num_states);
+
+	//the first walker starts from the database
+	AdaptiveWalkers W;
+	W.walkers.push_back(std::vector<double>(DIMENSION*N)); W.timers.push_back(0); 
+	W.eq.push_back(1);
+	const bd::Cluster& c = (*db)[state].getRandomIC();
+	c.makeArray<DIMENSION>(&W.walkers[0][0], N);
+
+	bd::SequentialStop stop(tol, ptol, min_batches, max_batches, max_hits);
+
+	bd::adaptiveRounds(1,
+		[&](int item, int per) {
+			//new walkers start from a database sample, equilibrated in their first batch
+			while (W.walkers.size() < per) {
+				W.walkers.push_back(std::vector<double>(DIMENSION*N)); W.timers.push_back(0);
+				W.eq.push_back(1);
+				const bd::Cluster& c = (*db)[state].getRandomIC();
+				c.makeArray<DIMENSION>(&W.walkers.back()[0], N);
+			}
+			return int(W.walkers.size());
+		},
+		[&](int item, int k) {
+			double* X = &W.walkers[k][0];
+			std::vector<bd::Pair> PM; std::vector<double> mfptVec;
+
+			if (reflect) {
+				if (W.eq[k]) {
+					equilibrate(X, db, state, N, M, rngee);
+					W.eq[k] = 0;
+				}
+				getSamplesMFPT(X, db, state, N, M, batch, PM, mfptVec, W.timers[k], rngee);
+			}
+			else {
+				for (int step = 0; step < batch; step++) {
+					equilibrate(X, db, state, N, M, rngee);
+					double sample_t = getSampleMFPT(X, db, state, N, M, PM, rngee);
+					if (sample_t >= 0) mfptVec.push_back(sample_t);
+				}
+			}
+
+			double sum = 0;
+			for (int i = 0; i < mfptVec.size(); i++) sum += mfptVec[i];
+
+			#pragma omp critical
+			{
+				W.sum += sum; W.count += mfptVec.size();
+				stop.addBatch(mfptVec.empty() ? 0 : sum / mfptVec.size(), PM);
+			}
+		},
+		[&](int item) {
+			double mfpt = (W.count > 0) ? W.sum / W.count : 0;
+			return stop.finished(mfpt);
+		});
+
+	//update the database with the estimates
+	if (W.count > 0) {
+		updateDatabaseAdaptive(state, db, W.sum / W.count, stop);
+	}
+	else {
+		printf("No samples for state %d, database entry left as it was\n", state);
+	}
+
+	//free memory
+	delete []M;
+}
+
+void estimateMFPTresetAdaptive(int N, int state, bd::Database* db, RandomNo* rngee,
+															 double tol, double ptol) {
+	/*estimateMFPTreset, stopping once the relative standard error of the mfpt is
+	below tol and every transition probability is known to within ptol */
+	estimateMFPTAdaptive(N, state, db, rngee, tol, ptol, false);
+}
+
+void estimateMFPTreflectAdaptive(int N, int state, bd::Database* db, RandomNo* rngee,
+																 double tol, double ptol) {
+	/*estimateMFPTreflect, stopping once the relative standard error of the mfpt 
+	is below tol and every transition probability is known to within ptol */
+	estimateMFPTAdaptive(N, state, db, rngee, tol, ptol, true);
+}
+
+}
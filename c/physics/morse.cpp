@@ -120,4 +120,123 @@ void morseGradR(double* particles, int rho, double* E, int N, int* P, double* g)
 }
 
 
-}
\ No newline at end of file
+
+/* Pair list kernels. Each pair is visited once and its force is applied to
+   both particles with opposite sign. particles is the SoA array from c2p,
+   the gradient is written in cluster order like the functions above.
+   Templated on the dimension D, the plain versions use D = DIMENSION. */
+
+template <int D>
+double morseEvalPairs(const double* particles, int rho, const PairList& pairs, int N) {
+  //compute total energy of system with pairwise morse potential
+  //non-interacting pairs contribute nothing, only loop over interacting
+  double S = 0;
+
+  for (int k = 0; k < pairs.num_interacting; k++) {
+    int i = pairs.p1[k]; int j = pairs.p2[k];
+    double R = 0;
+    for (int c = 0; c < D; c++) {
+      double d = particles[c*N+i]-particles[c*N+j]; R += d*d;
+    }
+    S += morseP(sqrt(R), rho, pairs.E[k]);
+  }
+  return S;
+}
+
+template <int D>
+void morseGradPairs(const double* particles, int rho, const PairList& pairs, int N, double* g) {
+  //compute gradient of energy of system with pairwise morse potential
+  double rep = 250.0;
+
+  for (int i = 0; i < D*N; i++) g[i] = 0;
+
+  for (int k = 0; k < pairs.num_pairs; k++) {
+    int i = pairs.p1[k]; int j = pairs.p2[k];
+    double d[D]; double R = 0;
+    for (int c = 0; c < D; c++) {
+      d[c] = particles[c*N+i]-particles[c*N+j]; R += d[c]*d[c];
+    }
+    double r = sqrt(R);
+
+    //get the force magnitude along the unit vector from j to i
+    double f;
+    if (pairs.type[k] != 0) {
+      double Eeff = pairs.E[k];
+      if (r < 1 || pairs.type[k] == 2) {
+        f = 2.0 * rho * rho * Eeff * (r-1.0);
+      }
+      else {
+        f = morseP(r, rho, Eeff);
+      }
+    }
+    else if (r < 1.1) {
+      f = -rep / (r*r);
+    }
+    else {
+      continue;
+    }
+
+    //apply to both particles
+    f /= r;
+    for (int c = 0; c < D; c++) {
+      g[D*i+c] += f*d[c]; g[D*j+c] -= f*d[c];
+    }
+  }
+}
+
+template <int D>
+void morseGradRPairs(const double* particles, int rho, const PairList& pairs, int N, double* g) {
+  //compute gradient of energy of system with pairwise morse potential
+  //includes repulsion force to keep particles from binding
+  double rep = 45.0;
+
+  for (int i = 0; i < D*N; i++) g[i] = 0;
+
+  for (int k = 0; k < pairs.num_interacting; k++) {
+    int i = pairs.p1[k]; int j = pairs.p2[k];
+    double d[D]; double R = 0;
+    for (int c = 0; c < D; c++) {
+      d[c] = particles[c*N+i]-particles[c*N+j]; R += d[c]*d[c];
+    }
+    double r = sqrt(R);
+
+    //get the force magnitude along the unit vector from j to i
+    double f;
+    if (r < 1 || pairs.type[k] == 2 || (i == 4 && j == 6)) {
+      f = 2.0 * rho * rho * pairs.E[k] * (r-1.0);
+    }
+    else if (r < 1.2) {
+      f = -rep / (r*r);
+    }
+    else {
+      f = morseP(r, rho, pairs.E[k]);
+    }
+
+    //apply to both particles
+    f /= r;
+    for (int c = 0; c < D; c++) {
+      g[D*i+c] += f*d[c]; g[D*j+c] -= f*d[c];
+    }
+  }
+}
+
+template double morseEvalPairs<2>(const double*, int, const PairList&, int);
+template double morseEvalPairs<3>(const double*, int, const PairList&, int);
+template void morseGradPairs<2>(const double*, int, const PairList&, int, double*);
+template void morseGradPairs<3>(const double*, int, const PairList&, int, double*);
+template void morseGradRPairs<2>(const double*, int, const PairList&, int, double*);
+template void morseGradRPairs<3>(const double*, int, const PairList&, int, double*);
+
+double morseEvalPairs(const double* particles, int rho, const PairList& pairs, int N) {
+  return morseEvalPairs<DIMENSION>(particles, rho, pairs, N);
+}
+
+void morseGradPairs(const double* particles, int rho, const PairList& pairs, int N, double* g) {
+  morseGradPairs<DIMENSION>(particles, rho, pairs, N, g);
+}
+
+void morseGradRPairs(const double* particles, int rho, const PairList& pairs, int N, double* g) {
+  morseGradRPairs<DIMENSION>(particles, rho, pairs, N, g);
+}
+
+}
@@ -29,19 +29,7 @@ void buildEmptyDB(int N) {
 	//fill in the state info
 
 	//adjacency matrix
-	s.am = new bool[N*N];
-	for (int i = 0; i < N; i++) {
-		for (int j = 0; j < N; j++) {
-			if (j == i+1 || j == i-1) {
-				s.am[toIndex(i,j,N)] = 1;
-				s.am[toIndex(j,i,N)] = 1;
-			}
-			else {
-				s.am[toIndex(i,j,N)] = 0;
-				s.am[toIndex(j,i,N)] = 0;
-			}
-		}
-	}
+	s.am = AdjBits::chain(N);
 
 	//bonds
 	s.bond = N-1;
@@ -68,7 +56,6 @@ void buildEmptyDB(int N) {
 	printf("Test Val %f %f %f\n", s.coordinates[0][1].x,s.coordinates[0][2].x,s.coordinates[0][3].x);
 
 	s.num = s.denom = 0;
-	s.num_neighbors = 0;
 	s.freq = s.mfpt = s.sigma = 0.0;
 
 	//print out the new database
@@ -78,21 +65,12 @@ void buildEmptyDB(int N) {
 	delete db;
 }
 
-bool checkSame(int N, int* AM, State& s) {
+bool checkSame(int N, const AdjBits& AM, State& s) {
 	//check if states are same by adjacency matrix
-
-	for (int i = 0; i < N; i++) {
-		for (int j = i+2; j < N; j++) {
-			if (s.isInteracting(i,j,N) != AM[toIndex(i,j,N)]) {
-				return false;
-			}
-		}
-	}
-
-	return true;
+	return s.getAdjacency() == AM;
 }
 
-int searchDB(int N, Database* db, std::vector<State> new_states, int* AM) {
+int searchDB(int N, Database* db, const AdjBits& AM) {
 	//check if the current adj matrix is in db. if yes, return state #. if not, return -1.
 
 	//check if the result is connected
@@ -102,47 +80,18 @@ int searchDB(int N, Database* db, std::vector<State> new_states, int* AM) {
 		return -2;
 	}
 
-	int num_states = db->getNumStates();
-
-	for (int state = 0; state < num_states; state++) {
-		State& s = (*db)[state];
-		bool same = checkSame(N, AM, s);
-		if (same)
-			return state;
-	}
-
-	//std::cout << new_states.size() << "\n\n\n\n\n";
-	for (int state = 0; state < new_states.size(); state++) {
-		State& s = new_states[state];
-		bool same = checkSame(N, AM, s);
-		if (same)
-			return state+num_states;
-	}
-
-	return -1;
+	return db->lookup(AM);
 }
 
-void addState(int N, double* X, int* AM, std::vector<State>& new_states) {
-	//add a new state to a vector
+void addState(int N, double* X, const AdjBits& AM, Database* db) {
+	//add a new state to the database, indexed for later searches
 
 	State s = State();
-
-	int b = 0;
 	s.N = N;
 
-	s.am = new bool[N*N];
-	//construct AM
-	for (int i = 0; i < N*N; i++) {
-		s.am[i] = AM[i];
-		if (AM[i] == 1) {
-			b++;
-			//std::cout <<"hello" << s.isInteracting(i / N, i % N) << "\n";
-		}
-	}
-
-	//add num bonds
-	b /= 2;
-	s.bond = b;
+	//construct AM, add num bonds
+	s.am = AM;
+	s.bond = AM.count();
 
 	//add configuration
 	int coord = 1;
@@ -164,8 +113,8 @@ void addState(int N, double* X, int* AM, std::vector<State>& new_states) {
 		}
 	}
 
-	//push to vector
-	new_states.push_back(s);
+	//append to database
+	db->appendState(s);
 }
 
 void addToDB(int N, Database* db) {
@@ -197,21 +146,21 @@ void addToDB(int N, Database* db) {
 	for (int i = 0; i < DIMENSION*N; i++) printf("%f\n", X[i]);
 
 	//set up an adjacency matrix
-	int* AM = new int[N*N];
-	for (int i = 0; i < N*N; i++) {
-		AM[i] = 0;
-	}
+	AdjBits AM;
 
-	//create vector of new states
-	std::vector<State> new_states;
+	//new states are appended to db
+	int num_states_old = db->getNumStates();
 	int count = 1;
 
+	//set up the integrator once, reuse for every step
+	Integrator sde(N, rho, beta, E, P, method, pot);
+
 	int broke_count = 0;
 
 	//do the time evolution
 	for (int i = 0; i < steps; i++) {
 		//solve sde
-		solveSDE(X, N, DT, rho, beta, E, P, method, pot);
+		sde.solveSDE(X, DT);
 
 		//check if the state changed from previous step
 		//get adjacency matrix for current state
@@ -219,7 +168,7 @@ void addToDB(int N, Database* db) {
 		//printAM(N, AM);
 
 		//check if this state has been seen before
-		int state = searchDB(N, db, new_states, AM);
+		int state = searchDB(N, db, AM);
 		//std::cout << state << "\n";
 		if (state == -2) {
 			printf("BROKEN \n");
@@ -234,8 +183,8 @@ void addToDB(int N, Database* db) {
 		}
 
 		if (state == -1) {
-			//add the new state to vector
-			addState(N, X, AM, new_states);
+			//add the new state to the database
+			addState(N, X, AM, db);
 			printAM(N,AM);
 			printf("Found new state. Total found this run: %d\n", count);
 			count++;
@@ -246,33 +195,18 @@ void addToDB(int N, Database* db) {
 		}
 	}
 
-	//construct a new database
-	int num_states_old = db->getNumStates();
-	int num_states_new = new_states.size();
-	int total = num_states_old + num_states_new;
-
-	Database* newDB = new Database(N, total);
-
-	//copy the first states from the old db
-	for (int i = 0; i < num_states_old; i++) {
-		(*newDB)[i] = (*db)[i];
-	}
-
-	//copy the rest from the vector
-	for (int i = 0; i < num_states_new; i++) {
-		(*newDB)[i+num_states_old] = new_states[i];
-	}
+	printf("Added %d states to the %d already known\n", db->getNumStates()-num_states_old,
+					num_states_old);
 
 	//print the new db
 	std::string out = "N" + std::to_string(N) + "DBupdate.txt";
 	std::ofstream out_str(out);
-	out_str << *newDB;
+	out_str << *db;
 
 	//delete memory
-	delete []X; delete []AM;
+	delete []X;
 	delete []types;
 	delete []P; delete []E; delete []kappa;
-	delete newDB;
 
 }
 
@@ -307,44 +241,35 @@ double sampleSTD(double* X, int n) {
 	return sqrt(std);
 }
 
+int findMatrix(const AdjBits& M, int N, Database* db) {
+	//find state by transition matrix, return the state. -1 if not found
+	return db->lookup(M);
+}
+
 int findMatrix(int* M, int N, Database* db) {
 	//find state by transition matrix, return the state
-
-	int* old = new int[N*N];
-
-	for (int i = 0; i < (*db).getNumStates(); i++) {
-		extractAM(N, i, old, db);
-		bool S = checkSame(old, M, N); 
-		if (S) {//found matrix
-			delete []old;
-			return i;
-		}
-	}
-
-	delete []old;
-	return -1;
+	AdjBits A; A.fromMatrix(M, N);
+	return findMatrix(A, N, db);
 }
 
 
-bool findMatrix(int* M, int* old, int old_bonds, int N, Database* db, int& timer, int& reset, int& reflect, 
-																					int& new_state) {
+bool findMatrix(const AdjBits& M, int old_bonds, int N, Database* db, int& timer, int& reset, 
+																					int& reflect, int& new_state) {
 	//find a state by transition matrix in the database
 
-	for (int i = 0; i < (*db).getNumStates(); i++) {
-		extractAM(N, i, old, db);
-		bool S = checkSame(old, M, N); 
-		if (S) {//found matrix
-			int new_bonds = (*db)[i].getBonds();
-			if (new_bonds == old_bonds + 1 || (old_bonds == 10 && new_bonds ==12 )) {//keep these
-				new_state = i; reflect = 1;
-			}
-			else {// 2 states at once transition. just delete this sample
-				reset = 1; timer = 0;
-			}
-			return 1; 
-		}
+	int i = findMatrix(M, N, db);
+	if (i == -1) {
+		return 0;
+	}
+
+	int new_bonds = (*db)[i].getBonds();
+	if (new_bonds == old_bonds + 1 || (old_bonds == 10 && new_bonds ==12 )) {//keep these
+		new_state = i; reflect = 1;
+	}
+	else {// 2 states at once transition. just delete this sample
+		reset = 1; timer = 0;
 	}
-	return 0;
+	return 1; 
 }
 
 
@@ -356,41 +281,38 @@ void checkState(double* X, int N, int state, int& new_state, Database* db, int&
 	timer +=1;
 
 	//get adjacnecy matrix of the current state
-	int* M = new int[N*N]; for (int i = 0; i < N*N; i++) M[i]=0;
-	getAdj(X, N, M);
-	//printAM(N,M);
+	int dim = db->getDimension();
+	AdjBits M;
+	getAdj(X, N, M, dim);
 
 	//check if state is connected
 	bool C = checkConnected(M, N);
 	if (!C) {//not connected
 		reset = 1; timer -= 1;
-		delete []M;
 		return;
 	}
 
 	//compare old and new state, check if same
-	int* old = new int[N*N]; for (int i = 0; i < N*N; i++) old[i]=0;
-	int old_bonds = (*db)[state].getBonds();
-	extractAM(N, state, old, db);
-	bool S = checkSame(old, M, N);
-
-	if (S) {//same matrix
+	if ((*db)[state].getAdjacency() == M) {//same matrix
 		new_state = state;        //warning, may mess up mfpt sampler????
-		delete []M; delete []old;
 		return;
 	}
 	else {//not the same, find matrix in database
-		S = findMatrix(M, old, old_bonds, N, db, timer, reset, reflect, new_state);
-		if (!S) {
-			//may output an unphysical state. refine with newton, check again
-			refine(N, X, M);
-			S = findMatrix(M, old, old_bonds, N, db, timer, reset, reflect, new_state);
-			if (!S) { //state still not found after refine, ignore this sample
-				reset = 1; timer = 0;
-				printf("State not found in database\n\n\n\n\n");
-			}
+		int old_bonds = (*db)[state].getBonds();
+		bool S = findMatrix(M, old_bonds, N, db, timer, reset, reflect, new_state);
+		if (!S && dim == 2) {
+			//may output an unphysical state. refine with newton (2d), check again
+			int* MI = new int[N*N];
+			M.toMatrix(MI, N);
+			refine(N, X, MI);
+			M.fromMatrix(MI, N);
+			delete []MI;
+			S = findMatrix(M, old_bonds, N, db, timer, reset, reflect, new_state);
+		}
+		if (!S) { //state still not found after refine, ignore this sample
+			reset = 1; timer = 0;
+			printf("State not found in database\n\n\n\n\n");
 		}
-		delete []M; delete []old;
 		return;
 	}
 }
@@ -413,112 +335,109 @@ void updatePM(int new_state, std::vector<Pair>& PM) {
 
 }
 
-void runTrajectoryChain(double* X, int pot, Database* db, int state, int samples, int N, 
-	double DT, int rho, double* E, double beta, int* P, int method, int& Num, 
-																											int& Den, std::vector<Pair>& PM ) {
+void runTrajectoryChain(double* X, Integrator* sde, Database* db, int state, int samples, int N, 
+	double DT, int& Num, int& Den, std::vector<Pair>& PM ) {
 	//run the trajectory, update mfpt estimates
 
-	//intiailize temp storage and set parameters
-	double* temp = new double[2*N]; memcpy(temp, X, 2*N*sizeof(double));
-	int reset; int reflect; int new_state = state; int hit = 0; int max_it = 100;
-	int timer = 0; pot = 0;
+	//set parameters
+	int hit = 0; int max_it = 100;
+	sde->setPotential(0);
+
+	//every hit updates the estimates and reflects back into state
+	TrajectoryDriver traj(sde, db, N, DT);
+	traj.setState(X, state);
+	traj.setHit([&](int new_state) {
+		int timer = traj.getTimer();
+		Den += timer; Num += timer*(timer+1)/2.0; 
+		updatePM(new_state, PM);
+		traj.setTimer(0); hit +=1;
+		//if we reach desired number of samples, stop
+		if (hit == samples) traj.stop();
+		return TRAJ_REFLECT;
+	});
 
 	//solve sde and update
-	for (int i = 0; i < max_it; i++) {
-		reset = 0; reflect = 0;
-		//solve SDE
-		solveSDE(X, N, DT, rho, beta, E, P, method, pot);
-		//check if state changed
-		checkState(X, N, state, new_state, db, timer, reset, reflect);
-		if (reflect == 0 && reset == 0) {//no hit, proceed
-			memcpy(temp, X, 2*N*sizeof(double)); // copy x to temp
-		}
-		else if (reflect == 1) {//hit new state, update estimates
-			Den += timer; Num += timer*(timer+1)/2.0; 
-			//PM[new_state] += 1;
-			updatePM(new_state, PM);
-			memcpy(X, temp, 2*N*sizeof(double));//copy temp to x -> reset step
-			timer = 0; hit +=1;
-			//printf("New state %d", new_state);
-		}
-		else {//chain broke, reset previous config
-			memcpy(X, temp, 2*N*sizeof(double));//copy temp to x -> reset step
-		}
-		//if we reach desired number of samples, break
-		if (hit == samples) {
-			break;
-		}
-	}
-	//free the temp memory
-	delete []temp;
+	traj.run(max_it);
 }
 
 
-void runTrajectoryMFPT(double* X, int pot, Database* db, int state, int samples, int N, 
-	double DT, int rho, double* E, double beta, int* P, int method, int& Num, 
-																											int& Den, std::vector<Pair>& PM ) {
-	//run the trajectory, update mfpt estimates
+void runTrajectoryMFPT(double* X, Integrator* sde, Database* db, int state, int samples, int N, 
+	double DT, int& Num, int& Den, std::vector<Pair>& PM ) {
+	runTrajectoryMFPT(X, sde, db, state, samples, N, DT, Num, Den, PM, NULL);
+}
 
-	//intiailize temp storage and set parameters
-	double* temp = new double[2*N]; memcpy(temp, X, 2*N*sizeof(double));
-	int reset; int reflect; int new_state = state; int hit = 0; int max_it = 10*samples;
-	int timer = 0; 
+void runTrajectoryMFPT(double* X, Integrator* sde, Database* db, int state, int samples, int N, 
+	double DT, int& Num, int& Den, std::vector<Pair>& PM, std::vector<PathSample>* paths) {
+	int timer = 0;
+	runTrajectoryMFPT(X, sde, db, state, samples, N, DT, Num, Den, PM, paths, timer);
+}
 
-	//solve sde and update
-	for (int i = 0; i < max_it; i++) {
-		reset = 0; reflect = 0;
-		//solve SDE
-		solveSDE(X, N, DT, rho, beta, E, P, method, pot);
-		//check if state changed
-		checkState(X, N, state, new_state, db, timer, reset, reflect);
-		if (reflect == 0 && reset == 0) {//no hit, proceed
-			memcpy(temp, X, 2*N*sizeof(double)); // copy x to temp
-		}
-		else if (reflect == 1) {//hit new state, update estimates
-			Den += timer; Num += timer*(timer+1)/2.0; 
-			//PM[new_state] += 1;
-			updatePM(new_state, PM);
-			memcpy(X, temp, 2*N*sizeof(double));//copy temp to x -> reset step
-			timer = 0; hit +=1;
-		}
-		else {//chain broke, reset previous config
-			memcpy(X, temp, 2*N*sizeof(double));//copy temp to x -> reset step
-		}
-		//if we reach desired number of samples, break
-		if (hit == samples) {
-			break;
+void runTrajectoryMFPT(double* X, Integrator* sde, Database* db, int state, int samples, int N, 
+	double DT, int& Num, int& Den, std::vector<Pair>& PM, std::vector<PathSample>* paths,
+	int& timer) {
+	//run the trajectory, update mfpt estimates. if paths is given, every hit also
+	//stores its path likelihood terms, sde must be recording them. timer is the
+	//open dwell, it starts the run and gets the one left at the end, so a walker
+	//continued over several calls loses no time
+
+	//set parameters
+	int hit = 0; int max_it = 10*samples;
+
+	//likelihood at the end of the last kept step
+	double A = 0; double B = 0;
+	if (paths) sde->setLikelihood(0, 0);
+
+	//every hit updates the estimates and reflects back into state
+	TrajectoryDriver traj(sde, db, N, DT);
+	traj.setState(X, state);
+	traj.setHit([&](int new_state) {
+		int timer = traj.getTimer();
+		Den += timer; Num += timer*(timer+1)/2.0; 
+		updatePM(new_state, PM);
+		if (paths) {
+			PathSample p; p.state = state; p.dest = new_state; p.steps = timer;
+			sde->getLikelihood(p.A, p.B);
+			paths->push_back(p);
+			sde->setLikelihood(0, 0); A = B = 0;
 		}
+		traj.setTimer(0); hit +=1;
+		//if we reach desired number of samples, stop
+		if (hit == samples) traj.stop();
+		return TRAJ_REFLECT;
+	});
+	if (paths) {
+		traj.setStep([&](int s) {
+			sde->getLikelihood(A, B);
+			return TRAJ_ACCEPT;
+		});
+		traj.setReset([&](int s) {
+			//the step is dropped, or the whole sample if the timer was cleared
+			if (traj.getTimer() == 0) A = B = 0;
+			sde->setLikelihood(A, B);
+			return TRAJ_REFLECT;
+		});
 	}
-	//free the temp memory
-	delete []temp;
+
+	//solve sde and update
+	traj.setTimer(timer);
+	traj.run(max_it);
+	timer = traj.getTimer();
 }
 
 
-void equilibrate(double* X, int pot, Database* db, int state, int eq, int N, double DT, 
-													int rho, double* E, double beta, int* P, int method) {
+void equilibrate(double* X, Integrator* sde, Database* db, int state, int eq, int N, double DT) {
 	//perform eq steps to equilibrate the trajectory. do not record data
+	//any change of state reflects back, the driver default
 
-	//initialize temp storage and set parameters;
-	double* temp = new double[2*N]; memcpy(temp, X, 2*N*sizeof(double));
-	int reset; int reflect; int new_state = state; int timer = 0;
+	TrajectoryDriver traj(sde, db, N, DT);
+	traj.setState(X, state);
+	traj.run(eq);
+}
 
-	//solve the SDE and update
-	for (int i = 0; i < eq; i++) {
-		reset = 0; reflect = 0;
-		//solve the sde
-		solveSDE(X, N, DT, rho, beta, E, P, method, pot);
-		//check if state changed
-		checkState(X, N, state, new_state, db, timer, reset, reflect);
-		//if state changed, reflect back. otherwise continue
-		if (reflect == 0 && reset == 0) {
-			memcpy(temp, X, 2*N*sizeof(double)); // copy x to temp
-		}
-		else {
-			memcpy(X, temp, 2*N*sizeof(double));//copy temp to x -> reset step
-		}
-	}
-	//free the temp memory
-	delete []temp;
+
+bool isRigid(int N, int bonds, int dim) {
+	//no further bonds can form once the cluster is rigid
+	return bonds >= dim*N - dim*(dim+1)/2;
 }
 
 
@@ -531,9 +450,14 @@ void setupSimMFPT(int N, double Eh, int*& P, double*& E) {
 
 
 void estimateMFPT(int N, int state, Database* db) {
+	estimateMFPT(N, state, db, NULL);
+}
+
+void estimateMFPT(int N, int state, Database* db, std::vector<PathSample>* paths) {
 	/*estimate mean first passage time starting in state and going to state with
 	one additional bond. Uses parallel implementations of a single walker with
-	long trajectory.*/
+	long trajectory. if paths is given, the hits are appended to it with their
+	path likelihood terms, for reweighting to other kappa.*/
 
 	//set parameters
 	int rho = 40; double beta = 1; double DT = 0.01; int Kh = 1850;
@@ -546,7 +470,7 @@ void estimateMFPT(int N, int state, Database* db) {
 	int num_states = db->getNumStates();
 	int num = (*db)[state].getNumerator(); 
 	int den = (*db)[state].getDenominator(); 
-	std::vector<Pair> pm = (*db)[state].getP();
+	std::vector<Pair> pm = db->getP(state).pairs();
 
 	//quantities to update - new estimates
 	int NUM = 0; int DEN = 0;
@@ -581,19 +505,29 @@ void estimateMFPT(int N, int state, Database* db) {
 	const Cluster& c = (*db)[state].getRandomIC();
 
 	//cluster structs to arrays
-	double* X = new double[DIMENSION*N];
-#if (DIMENSION == 2) 
-	c.makeArray2d(X, N);
-#endif
-#if (DIMENSION == 3)
-	c.makeArray3d(X, N);
-#endif
+	int dim = db->getDimension();
+	double* X = new double[dim*N];
+	c.makeArray(X, N, dim);
+
+	//set up this thread's integrator
+	Integrator sde(N, rho, beta, E, P, method, pot, dim);
 
 	//equilibrate the trajectories
-	equilibrate(X, pot, db, state, eq, N, DT, rho, E, beta, P, method);
+	equilibrate(X, &sde, db, state, eq, N, DT);
 
 	//run BD
-	runTrajectoryMFPT(X, pot, db, state, samples, N, DT, rho, E, beta, P, method, NUM, DEN, PM );
+	std::vector<PathSample> threadPaths;
+	if (paths) {
+		sde.recordLikelihood(true);
+		runTrajectoryMFPT(X, &sde, db, state, samples, N, DT, NUM, DEN, PM, &threadPaths);
+		#pragma omp critical
+		{
+			paths->insert(paths->end(), threadPaths.begin(), threadPaths.end());
+		}
+	}
+	else {
+		runTrajectoryMFPT(X, &sde, db, state, samples, N, DT, NUM, DEN, PM );
+	}
 
 	//store samples
 	if (DEN != 0) {
@@ -639,10 +573,7 @@ void estimateMFPT(int N, int state, Database* db) {
 		(*db)[state].mfpt = mfpt;
 		(*db)[state].num = num;
 		(*db)[state].denom = den;
-		(*db)[state].num_neighbors = PMshare.size();
-		(*db)[state].P = PMshare;
-		(*db)[state].Z = Z;
-		(*db)[state].Zerr = Z;
+		db->setRow(state, PMshare, Z, Z);
 		(*db)[state].sigma = sigma;
 	}
 
@@ -680,7 +611,7 @@ void estimateChain(int N, int state, Database* db) {
 	int num_states = db->getNumStates();
 	int num = (*db)[state].getNumerator(); 
 	int den = (*db)[state].getDenominator(); 
-	std::vector<Pair> pm = (*db)[state].getP();
+	std::vector<Pair> pm = db->getP(state).pairs();
 
 	//quantities to update - new estimates
 	int NUM = 0; int DEN = 0;
@@ -716,12 +647,15 @@ void estimateChain(int N, int state, Database* db) {
 	double* X = new double[2*N];
 	int mult = 1; int progress = 2000;
 
+	//set up this thread's integrator
+	Integrator sde(N, rho, beta, E, P, method, pot);
+
 
 
 	//run BD
 	for (int times = 0; times < samples; times++) {
 		setupChain(X,N); 
-		runTrajectoryChain(X, pot, db, state, 1, N, DT, rho, E, beta, P, method, NUM, DEN, PM );
+		runTrajectoryChain(X, &sde, db, state, 1, N, DT, NUM, DEN, PM );
 		if (times % progress == 0) {
 			printf("Thread %d generated sample %d.\n", omp_get_thread_num(), progress*mult);
 			mult++;
@@ -772,10 +706,7 @@ void estimateChain(int N, int state, Database* db) {
 		(*db)[state].mfpt = mfpt;
 		(*db)[state].num = num;
 		(*db)[state].denom = den;
-		(*db)[state].num_neighbors = PMshare.size();
-		(*db)[state].P = PMshare;
-		(*db)[state].Z = Z;
-		(*db)[state].Zerr = Z;
+		db->setRow(state, PMshare, Z, Z);
 		(*db)[state].sigma = sigma;
 	}
 
@@ -845,107 +776,64 @@ void sampleTrajectories(int N, Database* db, int initial) {
 	//determine index of target in lump if needed
 	//printf("Index is %d\n", db->lumpMap[67]);
 
-	//do the simulations
-	#pragma omp parallel for
-	for (int sample = 0; sample < samples; sample++) {
+	//do the simulations. every trajectory is advanced together in one batch and a
+	//trajectory's state is looked up only when its set of sticky bonds changes
+	BatchIntegrator batch(N, samples, rho, beta, E, P, pot);
+	batch.setBondCheck(1.07, true);
+	int* state = new int[samples]; bool* changed = new bool[samples];
 
-		//set the initial and final state storage
-		double* X0 = new double[DIMENSION*N];
-		int* M = new int[N*N]; 
+	//init in linear chain
+	double* X0 = new double[DIMENSION*N];
+	setupChain(X0, N);
+	for (int sample = 0; sample < samples; sample++) {
+		batch.setReplica(sample, X0);
+		state[sample] = initial;
 
-		//print update
-		printf("Beginning sample %d of %d\n", sample+1, samples);
+		//print initial state to file
+		output[sample].push_back(0); output[sample].push_back(db->lumpMap[initial]);
+	}
+	delete []X0;
 
-		//init in linear chain
-		setupChain(X0, N);
-		int state = initial; int new_state = initial;
-		double time = 0; 
-		//printCluster(X0,N);
+	//solve the sde and check for state changes
+	double time = 0; 
+	while (time < tf) {
+		batch.solveSDE(DT);
+		time += DT;
+		batch.checkBonds(NULL, changed);
 
-		//print initial state to file
-		//ofile << time << " " << db->lumpMap[state] << " ";
-		output[sample].push_back(time); output[sample].push_back(db->lumpMap[state]);
+		#pragma omp parallel
+		{
+		double* X0 = new double[DIMENSION*N];
+		int* M = new int[N*N]; 
 
-		//solve the sde and check for state changes
-		while (time < tf) {
-			bd::solveSDE(X0, N, DT, rho, beta, E, P, method, pot);
-			time += DT;
+		#pragma omp for
+		for (int sample = 0; sample < samples; sample++) {
+			if (!changed[sample]) {
+				continue;
+			}
+			batch.markBonds(sample);
+			batch.getReplica(sample, X0);
 
 			//exclude bonds with no interaction possible
 			for (int i = 0; i < N*N; i++) M[i]=0;	
 			getAdjCut(X0, N, M, 1.07);
 			for (int i = 0; i < N*N; i++) {
-				//printf("P is %d, M is %d\n", P[i], M[i]);
 				if (P[i] == 0 && M[i] == 1) {
-					//printf("hello\n");
 					M[i] = 0;
 				}
 			}
-			//printAM(N,M);
-			new_state = findMatrix(M,N,db);
-			//printf("Old state %d, new state %d\n", state, new_state);
-
-			/*
-			if (db->lumpMap[new_state] == 35) {
-				printf("cluster %d\n", new_state);
-				printCluster(X0,N);
-				abort();
-			}
-			*/
-			
-
-			if (state != new_state) {
-				//determine the bond that formed
-				int p1 = 0; int p2 = 0; int done = 0;
-				for (p1 = 0; p1 < N; p1++) {
-					for (p2 = 0; p2 < N; p2++) {
-						if ((*db)[state].isInteracting(p1,p2,N) != (*db)[new_state].isInteracting(p1,p2,N)) {
-							done = 1;
-							break;
-						}
-					}
-					if (done == 1) break;
-				}
-
-				//print time and index of state change to file
-				//printf("Transition from %d to %d at time %f\n", db->lumpMap[state],
-								//db->lumpMap[new_state], time);
-				//printf("Bond is between %d and %d\n", p1, p2);
-
-				//if AA breaks, kick out of well
-				/*
-				if (types[p1] == 0 && types[p2] == 0 && 
-					(*db)[state].getBonds() > (*db)[new_state].getBonds()) {
-					//printCluster(X0,N);
-					double x1 = X0[p1*2]; double y1 = X0[p1*2+1];  
-					double x2 = X0[p2*2]; double y2 = X0[p2*2+1]; 
-					double ux = x2-x1; double uy = y2-y1;
-
-					//add unit vector to p1, subtract from p2
-					X0[p1*2] -= 0.02 * ux; X0[p1*2+1] -= 0.02* uy;
-					X0[p2*2] += 0.02 * ux; X0[p2*2+1] += 0.02* uy;
-
-					//printf("Original %f, %f  Final %f, %f\n", x1, y1, X0[p1*2], X0[p1*2+1]);
-				}
-				*/
-
-				state = new_state;
-				//ofile << time << " " << db->lumpMap[state] << " ";
-				output[sample].push_back(time); output[sample].push_back(db->lumpMap[state]);
+			int new_state = findMatrix(M,N,db);
 
+			if (state[sample] != new_state) {
+				state[sample] = new_state;
+				output[sample].push_back(time); output[sample].push_back(db->lumpMap[new_state]);
 			}
 		}
 
-		//print a new line and go to the next trajectory
-		//ofile << "\n";
-
-		if (db->lumpMap[state] == 35) {
-				//printCluster(X0,N);
-			}
-
 		delete []X0; delete []M;
-
+		}
 	}
+	delete []state; delete []changed;
 
 	//print the results to a file
 	for (int i = 0; i < samples; i++) {
@@ -1141,77 +1029,80 @@ void sampleFirstExit(int N, int initial, Database* db) {
 	//if lumped states are needed
 	lumpPerms(db);
 
-	//run BD
-	#pragma omp parallel 
-	{
-	//setup position storage
+	//run BD. every sample is advanced together in one batch, the database is
+	//checked only for samples whose bonds changed
+	BatchIntegrator batch(N, samples, rho, beta, E, P, pot);
+	int* timer = new int[samples]; bool* changed = new bool[samples];
+	double* temp = new double[samples*DIMENSION*N]; //last accepted configurations
 	double* X = new double[DIMENSION*N];
-	double* temp = new double[DIMENSION*N];
-	#pragma omp parallel for
+	setupChain(X,N,0); 
 	for (int times = 0; times < samples; times++) {
+		batch.setReplica(times, X);
+		timer[times] = 0;
+	}
+	batch.markBonds();
+	int state = initial; int max_it = 10*samples;
 
-		printf("Running estimate %d\n", times+1);
-		setupChain(X,N,0); 
-		int state = initial;
-
-		//intiailize temp storage and set parameters
-	  memcpy(temp, X, N*DIMENSION*sizeof(double));
-		int reset; int reflect; int new_state = state; int max_it = 10*samples;
-		int timer = 0; 
-
-		//these lines are debug to find the index of a state defined by coordinates
-		//checkState(X, N, state, new_state, db, timer, reset, reflect);
-		//printf("First state is %d\n", new_state);
-		//abort();
-
-		//solve sde and update
-		for (int i = 0; i < max_it; i++) {
-			reset = 0; reflect = 0;
-			//solve SDE
-			solveSDE(X, N, DT, rho, beta, E, P, method, pot);
+	//solve sde and update
+	for (int i = 0; i < max_it && batch.numLive() > 0; i++) {
+		//keep the previous step while hits are still rejected
+		if (i <= t_cut) {
+			for (int times = 0; times < samples; times++) {
+				batch.getReplica(times, temp+times*DIMENSION*N);
+			}
+		}
 
-			//check if state changed
-			checkState(X, N, state, new_state, db, timer, reset, reflect);
+		//solve SDE
+		batch.solveSDE(DT);
+		batch.checkBonds(NULL, changed);
 
-			if (reflect == 0 && reset == 0) { //no hit, proceed
-				memcpy(temp, X, DIMENSION*N*sizeof(double)); // copy x to temp
-				//printf("Proceed %d\n", i);
+		//check if state changed
+		#pragma omp parallel
+		{
+		double* Y = new double[DIMENSION*N];
+
+		#pragma omp for
+		for (int times = 0; times < samples; times++) {
+			if (!changed[times]) {//no hit, proceed
+				continue;
+			}
+			int reset = 0; int reflect = 0; int new_state = state;
+			batch.getReplica(times, Y);
+			checkState(Y, N, state, new_state, db, timer[times], reset, reflect);
+			batch.setReplica(times, Y);
 
+			if (reflect == 0 && reset == 0) { //back in the starting state
+				batch.markBonds(times);
 			}
 			else if (reflect == 1) {//hit new state, get sample of quantity
 				if (i > t_cut) {
-					double q = gyrationRadius(N, X);
-					//double q = boop2d(N, X);
-					//double q = end2end(N, X);
-					//q_samples.push_back(q);
+					#pragma omp critical
+					{
 					q_samples.push_back(db->lumpMap[new_state]); //for distribution data
 					std::cout << i << "\n";
-					//printCluster(X,N);
-					break;
+					}
+					batch.setFrozen(times, true);
 				}
 				else {
-					memcpy(X, temp, DIMENSION*N*sizeof(double));//copy temp to x -> reset step
+					batch.setReplica(times, temp+times*DIMENSION*N); //reset step
 				}
-
 			}
-			else {//chain broke, reset previous config
-				//printCluster(X,N);
-				//memcpy(X, temp, DIMENSION*N*sizeof(double));//copy temp to x -> reset step
-				//printCluster(X,N);
+			else {//chain broke
 				if (i > t_cut) {
-					double q = gyrationRadius(N, X);
-					//double q = boop2d(N, X);
-					//double q = end2end(N, X);
+					double q = gyrationRadius(N, Y);
+					#pragma omp critical
+					{
 					q_samples.push_back(q);
 					std::cout << i << "\n";
-					break;
+					}
+					batch.setFrozen(times, true);
 				}
-
 			}
 		}
+		delete []Y;
+		}
 	}
-	delete []X; delete []temp;
-	}
+	delete []X; delete []temp; delete []timer; delete []changed;
 
 	//output the samples to a file
 	std::ofstream ofile;
@@ -1274,64 +1165,51 @@ void sampleSecondExit(int N, int initial, Database* db) {
 	{
 	//setup position storage
 	double* X = new double[DIMENSION*N];
-	double* temp = new double[DIMENSION*N];
+
+	//set up this thread's integrator and trajectory
+	Integrator sde(N, rho, beta, E, P, method, pot);
+	TrajectoryDriver traj(&sde, db, N, DT);
+	int max_it = 4000; int bhit = 0;
+
+	//below 8 bonds the trajectory moves between states, the first 8 bond state
+	//after t_cut is the sample. earlier ones reflect
+	traj.setHit([&](int new_state) {
+		int new_bonds = (*db)[new_state].getBonds();
+		if (new_bonds < 8) { //no hit, proceed
+			return TRAJ_ACCEPT;
+		}
+		if (new_bonds == 8) {
+			if (traj.getSteps() > t_cut+1) {//hit new state, get sample of quantity
+				double q = gyrationRadius(N, X);
+				//double q = boop2d(N, X);
+				//double q = end2end(N, X);
+				#pragma omp critical
+				{
+					q_samples.push_back(q);
+					std::cout << traj.getSteps()-1 << "\n";
+					printCluster(X,N);
+				}
+				traj.stop();
+				return TRAJ_ACCEPT;
+			}
+			bhit++;
+		}
+		return TRAJ_REFLECT;
+	});
+
+	#pragma omp for
 	for (int times = 0; times < samples; times++) {
 
 		printf("Running estimate %d\n", times+1);
 		//setupChain(X,N); 
 		setupTriangle(X,N);
 		//printCluster(X,N);
-		int state = initial;
-
-		//intiailize temp storage and set parameters
-	  memcpy(temp, X, N*DIMENSION*sizeof(double));
-		int reset; int reflect; int new_state = state; int max_it = 4000;
-		int timer = 0; 
-
-		int bhit = 0;
 
 		//solve sde and update
-		for (int i = 0; i < max_it; i++) {
-			reset = 0; reflect = 0;
-			//solve SDE
-			solveSDE(X, N, DT, rho, beta, E, P, method, pot);
-
-			//check if state changed
-			checkState(X, N, state, new_state, db, timer, reset, reflect);
-			int new_bonds = (*db)[new_state].getBonds();
-
-			if (new_bonds < 8 && reset == 0) { //no hit, proceed
-				memcpy(temp, X, DIMENSION*N*sizeof(double)); // copy x to temp
-				state = new_state;
-			}
-			else if (new_bonds == 8 && reflect == 1) {//hit new state, get sample of quantity
-				if (i > t_cut) {
-					double q = gyrationRadius(N, X);
-					//double q = boop2d(N, X);
-					//double q = end2end(N, X);
-					q_samples.push_back(q);
-					std::cout << i << "\n";
-					printCluster(X,N);
-					break;
-				}
-				else {
-					memcpy(X, temp, DIMENSION*N*sizeof(double));//copy temp to x -> reset step
-					bhit++;
-					/*
-					if (omp_get_thread_num() == 0) {
-						printf("Bhit %d at time %d\n", bhit, i);
-					}
-					*/
-				}
-
-			}
-			else {//chain broke, reset previous config
-				memcpy(X, temp, DIMENSION*N*sizeof(double));//copy temp to x -> reset step
-
-			}
-		}
+		traj.setState(X, initial);
+		traj.run(max_it);
 	}
-	delete []X; delete []temp;
+	delete []X;
 	}
 
 	//output the samples to a file
@@ -1419,9 +1297,35 @@ void sampleSecondExit(int N, Database* db) {
 	{
 	//setup position storage
 	double* X = new double[DIMENSION*N];
-	double* temp = new double[DIMENSION*N];
+
+	//set up this thread's integrator and trajectory
+	Integrator sde(N, rho, beta, E, P, method, pot);
+	TrajectoryDriver traj(&sde, db, N, DT);
+	int max_it = 2000; int sample = 0;
+
+	//below 7 bonds the trajectory moves between states, the first 7 bond state
+	//after t_cut is the sample. earlier ones reflect
+	traj.setHit([&](int new_state) {
+		int new_bonds = (*db)[new_state].getBonds();
+		if (new_bonds < 7) { //no hit, proceed
+			return TRAJ_ACCEPT;
+		}
+		if (new_bonds == 7 && traj.getSteps() > t_cut+1) {//hit new state, get sample of quantity
+			//double q = gyrationRadius(N, X);
+			//double q = boop2d(N, X);
+			double q = end2end(N, X);
+			//q_samples.push_back(q);
+			q_samples[sample] = q;
+			std::cout << traj.getSteps()-1 << "\n";
+			traj.stop();
+			return TRAJ_ACCEPT;
+		}
+		return TRAJ_REFLECT;
+	});
+
 	#pragma omp for schedule(auto)
-	for (int sample = 0; sample < num_samples; sample++) {
+	for (int s = 0; s < num_samples; s++) {
+		sample = s;
 
 		std::vector<double> coordinates = ics[sample];
 		for (int c = 0; c < N*DIMENSION; c++) {
@@ -1430,49 +1334,12 @@ void sampleSecondExit(int N, Database* db) {
 		int dummy = 0; int state;
 		checkState(X, N, 1, state, db, dummy, dummy, dummy);
 		printf("Sample %d on thread %d is starting in state %d\n", sample, omp_get_thread_num(), state);
-		
-
-		//intiailize temp storage and set parameters
-	  memcpy(temp, X, N*DIMENSION*sizeof(double));
-		int reset; int reflect; int new_state = state; int max_it = 2000;
-		int timer = 0; 
 
 		//solve sde and update
-		for (int i = 0; i < max_it; i++) {
-			reset = 0; reflect = 0;
-			//solve SDE
-			solveSDE(X, N, DT, rho, beta, E, P, method, pot);
-
-			//check if state changed
-			checkState(X, N, state, new_state, db, timer, reset, reflect);
-			int new_bonds = (*db)[new_state].getBonds();
-
-			if (new_bonds < 7 && reset == 0) { //no hit, proceed
-				memcpy(temp, X, DIMENSION*N*sizeof(double)); // copy x to temp
-				state = new_state;
-			}
-			else if (new_bonds == 7 && reflect == 1) {//hit new state, get sample of quantity
-				if (i > t_cut) {
-					//double q = gyrationRadius(N, X);
-					//double q = boop2d(N, X);
-					double q = end2end(N, X);
-					//q_samples.push_back(q);
-					q_samples[sample] = q;
-					std::cout << i << "\n";
-					break;
-				}
-				else {
-					memcpy(X, temp, DIMENSION*N*sizeof(double));//copy temp to x -> reset step
-				}
-
-			}
-			else {//chain broke, reset previous config
-				memcpy(X, temp, DIMENSION*N*sizeof(double));//copy temp to x -> reset step
-
-			}
-		}
+		traj.setState(X, state);
+		traj.run(max_it);
 	}
-	delete []X; delete []temp;
+	delete []X;
 	}
 
 	//output the samples to a file
@@ -1506,26 +1373,9 @@ void sampleSecondExit(int N, Database* db) {
 /************** Sampling QSD ****************************/
 /********************************************************/
 
-void getTrajectory(int N, int sample, double* configs, double* X) {
-	//extract the sample trajectory from the config and place in X
-
-	for (int j = 0; j < N*DIMENSION; j++) {
-		X[j] = configs[sample*N*DIMENSION+j];
-	}
-
-}
-
-void putTrajectory(int N, int sample, double* configs, double* X) {
-	//put the trajectory in X into the appropriate place in config
-
-	for (int j = 0; j < N*DIMENSION; j++) {
-		configs[sample*N*DIMENSION+j] = X[j];
-	}
-
-}
-
-void replaceTrajectories(int N, int samples, double* configs, bool* hit, RandomNo* rngee) {
+void replaceTrajectories(BatchIntegrator& batch, bool* hit, RandomNo* rngee) {
 	//replace any trajectories to be killed
+	int samples = batch.getNumReplicas();
 
 	//build a vector of each living trajectory
 	std::vector<int> alive;
@@ -1547,8 +1397,7 @@ void replaceTrajectories(int N, int samples, double* configs, bool* hit, RandomN
 	}
 
 	//if not, replace the dead with a random living one
-	double* X = new double[N*DIMENSION];
-
+	int replaced = 0;
 	for (int i = 0; i < samples; i++) {
 		if (hit[i]) {
 			//choose a random replacement
@@ -1556,15 +1405,12 @@ void replaceTrajectories(int N, int samples, double* configs, bool* hit, RandomN
 			int replacement = alive[u];
 
 			//do the replacing
-			getTrajectory(N, replacement, configs, X); //get trajectory replacement
-			putTrajectory(N, i, configs, X);           //put X in i-th slot
-			hit[i] = false;
-
-			printf("Trajectory %d has been replaced with trajectory %d\n", i, replacement);
+			batch.copyReplica(replacement, i);
+			batch.setFrozen(i, false);
+			hit[i] = false; replaced++;
 		}
 	}
-
-	delete []X;
+	printf("Replaced %d trajectories\n", replaced);
 }
 
 void sampleQSD(int N, Database* db) {
@@ -1594,20 +1440,26 @@ void sampleQSD(int N, Database* db) {
 	setupSimMFPT(N, Eh, P, E);
 	printf("E = %f\n", Eh);
 
-	//make arrays to store clusters and samples
-	double* configs    = new double[samples*N*DIMENSION]; //store all trajectories, shared
+	//make arrays to store samples
 	double* quantities = new double[samples];             //to evaluate quantity at hit time
 	bool*   hit        = new bool[samples];               //check if hit was made this timestep
+	int*    bonds      = new int[samples];                //bond count of each trajectory
+	bool*   changed    = new bool[samples];               //bonds changed this timestep
 	double* X          = new double[N*DIMENSION];         //just to set IC
 
 	//init the rng
 	RandomNo* rngee = new RandomNo();
 
+	//all trajectories are advanced together, stored in one batch
+	BatchIntegrator batch(N, samples, rho, beta, E, P, pot);
+
 	//initialize the configurations
 	setupChain(X,N);
 	for (int i = 0; i < samples; i++) {
-		putTrajectory(N, i, configs, X);
+		batch.setReplica(i, X);
+		hit[i] = false;
 	}
+	batch.markBonds();
 
 	//get the state index in db of this config
 	int dummy = 0; int state;
@@ -1616,66 +1468,29 @@ void sampleQSD(int N, Database* db) {
 
 	printf("The starting state is %d\n", state);
 
-	delete []X;
-
 	//begin the time-stepping
 	for (int time = 0; time < Tmax; time++) {
 
-		//set hit flag to 0 for this timestep, if t < tcut
-		if (time <= t_cut) {
-			for (int i = 0; i < samples; i++) {
-				hit[i] = false;
-			}
-		}
+		//update the positions of every unfinished trajectory
+		batch.solveSDE(DT);
 
-		//parallel for over configs
-		#pragma omp parallel for shared(configs,hit,state)
+		//kill condition - a bond formed. only trajectories whose bonds changed
+		//this step need their count compared
+		batch.checkBonds(bonds, changed);
 		for (int sample = 0; sample < samples; sample++) {
-			//first check if hit is false
-			double* X          = new double[N*DIMENSION];         
-
-			if (!hit[sample]) {
-				//store the current position of the cluster
-				getTrajectory(N, sample, configs, X);
-				
-				//update the positions by solving SDE
-				int reset = 0; int reflect = 0;
-				printf("Updating trajectory %d\n", sample);
-				solveSDE(X, N, DT, rho, beta, E, P, method, pot);
-
-				//replace the entry in the array
-				putTrajectory(N, sample, configs, X);
-
-				//check if state changed
-				int new_state;
-				checkState(X, N, state, new_state, db, dummy, dummy, dummy);
-				int new_bonds = (*db)[new_state].getBonds();
-
-				//check kill conditions
-				if (new_bonds > old_bonds) {
-					hit[sample] = true;
-					printf("Trajectory %d formed a bond\n", sample);
-					printCluster(X,N);
-				}
-				//printf("Sample %d, state %d, hit %d\n", sample, new_state, hit[sample]);
+			if (changed[sample] && bonds[sample] > old_bonds) {
+				hit[sample] = true;
+				batch.setFrozen(sample, true);
 			}
-
-			delete []X;
-			
 		}
 
 		//check which trajectories are to be killed and replaced
 		if (time < t_cut) {
-			replaceTrajectories(N, samples, configs, hit, rngee);
+			replaceTrajectories(batch, hit, rngee);
 			printf("Completed forced timestep %d of %d\n", time, t_cut);
 		}
 		else { //count how many have finished
-			int hits = 0;
-			for (int i = 0; i < samples; i++) {
-				if (hit[i]) {
-					hits++;
-				}
-			}
+			int hits = samples - batch.numLive();
 			printf("Completed timestep %d. Finished trajectories: %d of %d\n", time, hits, samples);
 			//if all samples are finished, break
 			if (hits == samples) {
@@ -1684,14 +1499,11 @@ void sampleQSD(int N, Database* db) {
 		}
 		
 	}
-	//configs now has all samples from the QSD. extract distribution
+	//the batch now has all samples from the QSD. extract distribution
 	printf("All trajectories completed. Computing quantities for each sample\n");
-	//#pragma omp parallel for
 	for (int i = 0; i < samples; i++) {
-		getTrajectory(N,i, configs, X);
+		batch.getReplica(i, X);
 		quantities[i] = gyrationRadius(N, X);
-		printCluster(X,N);
-		printf("Grad %f\n", quantities[i]);
 	}
 
 	//output to file
@@ -1703,8 +1515,8 @@ void sampleQSD(int N, Database* db) {
 	}
 	ofile.close();
 
-	delete []P; delete []E;
-	delete []configs; delete []quantities; delete []hit;
+	delete []P; delete []E; delete []X;
+	delete []quantities; delete []hit; delete []bonds; delete []changed;
 	delete rngee;
 
 
@@ -1742,8 +1554,38 @@ void sampleFirstExitR(int N, int initial, Database* db) {
 	{
 	//setup position storage
 	double* X = new double[DIMENSION*N];
-	double* temp = new double[DIMENSION*N];
-	#pragma omp parallel for
+
+	//set up this thread's integrator and trajectory
+	Integrator sde(N, rho, beta, E, P, method, pot);
+	TrajectoryDriver traj(&sde, db, N, DT);
+	int max_it = 1000;
+
+	//the first change of state ends the run, a sample if it is after t_cut.
+	//resets keep the new positions, as the state is unchanged
+	traj.setHit([&](int new_state) {
+		int i = traj.getSteps()-1;
+		if (i > t_cut) {
+			double q = gyrationRadius(N, X);
+			//double q = boop2d(N, X);
+			//double q = end2end(N, X);
+			#pragma omp critical
+			{
+				q_samples.push_back(q);
+				printf("Folded at step %d, q is %f\n", i, q);
+				printCluster(X,N);
+			}
+		}
+		else {
+			printf("BOnd formed before t_cut, t = %d\n", i);
+		}
+		traj.stop();
+		return TRAJ_ACCEPT;
+	});
+	traj.setReset([&](int new_state) {
+		return TRAJ_ACCEPT;
+	});
+
+	#pragma omp for
 	for (int times = 0; times < samples; times++) {
 
 		printf("Running estimate %d\n", times+1);
@@ -1753,56 +1595,21 @@ void sampleFirstExitR(int N, int initial, Database* db) {
 		checkState(X, N, 0, state, db, dummy, dummy, dummy);
 		printf("The starting state is %d\n", state);
 
-		//intiailize temp storage and set parameters
-	  memcpy(temp, X, N*DIMENSION*sizeof(double));
-		int reset; int reflect; int new_state = state; int max_it = 1000;
-		int timer = 0; 
-
 		//these lines are debug to find the index of a state defined by coordinates
 		//checkState(X, N, state, new_state, db, timer, reset, reflect);
 		//printf("First state is %d\n", new_state);
 		//abort();
 
-		//solve sde and update
-		for (int i = 0; i < max_it; i++) {
-			reset = 0; reflect = 0;
-			//solve SDE
-			if (i <= t_cut) {
-				solveSDE(X, N, DT, rho, beta, E, P, method, -1);
-			}
-			else {
-				solveSDE(X, N, DT, rho, beta, E, P, method, 0);
-			}
-
-			//check if state changed
-			checkState(X, N, state, new_state, db, timer, reset, reflect);
-
-			if (state == new_state) { //no hit, proceed
-				memcpy(temp, X, DIMENSION*N*sizeof(double)); // copy x to temp
-				//printf("Step %d\n", i);
-				//printCluster(X,N);
-				//printf("Proceed %d\n", i);
-
-			}
-			else  {//hit new state, get sample of quantity
-				if (i > t_cut) {
-					double q = gyrationRadius(N, X);
-					//double q = boop2d(N, X);
-					//double q = end2end(N, X);
-					q_samples.push_back(q);
-					printf("Folded at step %d, q is %f\n", i, q);
-					printCluster(X,N);
-					break;
-				}
-				else {
-					printf("BOnd formed before t_cut, t = %d\n", i);
-					break;
-				}
-
-			}
+		//solve sde and update. repulsion up to t_cut, then morse
+		traj.setState(X, state);
+		sde.setPotential(-1);
+		traj.run(t_cut+1);
+		if (!traj.isStopped()) {
+			sde.setPotential(0);
+			traj.run(max_it-t_cut-1);
 		}
 	}
-	delete []X; delete []temp;
+	delete []X;
 	}
 
 	//output the samples to a file
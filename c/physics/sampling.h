@@ -3,7 +3,9 @@
 #include "adjacency.h"
 #include "pair.h"
 #include <vector>
+#include <string>
 #include <random>
+#include <functional>
 #include <chrono>
 #include <eigen3/Eigen/Dense>
 
@@ -29,37 +31,162 @@ class RandomNo{
 namespace bd { 
 class Database;
 class State;
+class Integrator;
+
+/* event driven driver for one brownian dynamics trajectory. the integrator
+   advances the positions in chunks of DT, and after each chunk the bonded set
+   is compared to the adjacency of the current state using a watch list, the
+   pairs within skin of the bond cutoff at the last full scan. a pair off the
+   list cannot cross the cutoff before the particles have moved skin/2 relative
+   to their mean, so a chunk costs one displacement pass and the watch list,
+   and all pairs are rescanned only when that bound is used up. when the bonded
+   set differs from the state, checkState classifies the event and the hit or
+   reset callback decides to accept the new positions or reflect back to the
+   last accepted ones. the positions are only saved for that before a chunk
+   whose noise could reach a bond event within TRAJ_GUARD standard deviations,
+   or when there is a step callback, which may reflect any chunk.
+	 Members:
+	 	sde, db - integrator and database (not owned)
+	 	N, DT, dim - particles, time between checks, spatial dimension
+	 	X - positions of the trajectory (not owned), rollback - last accepted positions
+	 	state - current state, acc - its adjacency
+	 	timer - steps counted by checkState, steps - chunks since setState
+	 	skin - watch list width, Xscan - positions at the last full scan
+	 	guard - least change of a pair distance that can be a bond event
+	 	reach - largest change of a pair distance expected in one chunk
+	 	wi, wj - watched pairs, dirty - the last scan already differed from acc
+	 	onHit, onReset, onStep - callbacks, given the new state, return a TrajectoryAction
+*/
+
+enum TrajectoryAction {TRAJ_ACCEPT, TRAJ_REFLECT};
+typedef std::function<int(int new_state)> TrajectoryCallback;
+
+const double TRAJ_SKIN = 0.15;  //about the noise displacement of one chunk
+const double TRAJ_GUARD = 6;    //standard deviations of noise one chunk may move
+
+class TrajectoryDriver {
+	public:
+		TrajectoryDriver(Integrator* sde_, Database* db_, int N_, double DT_);
+		~TrajectoryDriver();
+
+		//follow the positions X0, which are in state_. resets the timer and steps
+		void setState(double* X0, int state_);
+		//checkState found a new state (reflect = 1) or an unusable one (reset = 1).
+		//without a callback both reflect
+		void setHit(TrajectoryCallback f) {onHit = f;}
+		void setReset(TrajectoryCallback f) {onReset = f;}
+		//called after every chunk with no bond event, given the current state
+		void setStep(TrajectoryCallback f) {onStep = f;}
+		//advance at most max_steps chunks of DT, or until stop. returns chunks taken
+		int run(int max_steps);
+		//end the run after the current callback
+		void stop() {stopped = true;}
+
+		//accessor functions
+		int getState() const {return state;}
+		int getTimer() const {return timer;}
+		void setTimer(int t) {timer = t;}
+		int getSteps() const {return steps;}
+		bool isStopped() const {return stopped;}
+		void setSkin(double s) {skin = s; scan();}
+
+	private:
+		Integrator* sde; Database* db;
+		int N; double DT; int dim;
+		double* X; double* rollback;
+		int state; AdjBits acc;
+		int timer; int steps; bool stopped;
+		double skin; double* Xscan; double guard; double reach;
+		std::vector<int> wi; std::vector<int> wj; bool dirty;
+		TrajectoryCallback onHit; TrajectoryCallback onReset; TrajectoryCallback onStep;
+
+		//full pass over the pairs, rebuilds the watch list
+		void scan();
+		//true if the bonded set may differ from acc
+		bool changed();
+
+		//copy constructors - do not copy
+		TrajectoryDriver(const TrajectoryDriver&) {
+			throw 1;
+		}
+		TrajectoryDriver& operator=(const TrajectoryDriver&) {
+			throw 1;
+		}
+};
+
+/* one hit of the mfpt estimator with the girsanov terms of its path, the steps
+   since the last hit. scaling every well depth by 1+d scales the drift by 1+d
+   (morse and lennard jones), which changes the log likelihood of the path by
+   d*A - d*d*B/2. a campaign is the hits of a run at one kappa.
+	 Members:
+	 	state, dest - state the path started in and the state it hit
+	 	steps - steps of DT to the hit (the estimator timer)
+	 	A, B - likelihood terms, see Integrator
+	 	kappa, rho, beta, DT - parameters of the run (campaign)
+*/
+
+struct PathSample {
+	int state; int dest; int steps;
+	double A; double B;
+};
+
+struct PathCampaign {
+	double kappa; int rho; double beta; double DT;
+	std::vector<PathSample> paths;
+};
 
 //brownian dynamics sampling section
 
 //building a database of all states by sampling
 void buildEmptyDB(int N);
-bool checkSame(int N, int* AM, State& s);
-int searchDB(int N, Database* db, std::vector<State> new_states, int* AM);
-void addState(int N, double* X, int* AM, std::vector<State>& new_states);
+bool checkSame(int N, const AdjBits& AM, State& s);
+int searchDB(int N, Database* db, const AdjBits& AM);
+void addState(int N, double* X, const AdjBits& AM, Database* db);
 void addToDB(int N, Database* db);
 
 
 //doing mfpt estimation with completed database
 void estimateMFPT(int N, int state, Database* db);
+void estimateMFPT(int N, int state, Database* db, std::vector<PathSample>* paths);
 void estimateChain(int N, int state, Database* db);
+void estimateMFPTAdaptive(int N, Database* db);
+void estimateMFPTAdaptive(int N, Database* db, double tol, double ptol);
+void estimateMFPTSplitting(int N, int state, Database* db);
+void estimateRatesWE(int N, int initial, Database* db, std::string checkpoint);
+void placeInterfaces(double* X0, Integrator* sde, Database* db, int state, int N, double DT,
+	int steps, double spacing, std::vector<double>& lambda);
+double forwardFlux(double* X0, Integrator* sde, Database* db, int state, int N, double DT,
+	const std::vector<double>& lambda, int crossings, int trials, int max_it,
+	RandomNo* rngee, std::vector<Pair>& PM);
 void setupSimMFPT(int N, double Eh, int*& P, double*& E);
-void equilibrate(double* X, int pot, Database* DB, int state, int eq, int N, double DT,
-													int rho, double* E, double beta, int* P, int method);
-void runTrajectoryMFPT(double* X, int pot, Database* DB, int state, int samples, int N, 
-	double DT, int rho, double* E, double beta, int* P, int method, int& Num, 
-																									int& Den, std::vector<Pair>& PM );
-void runTrajectoryChain(double* X, int pot, Database* db, int state, int samples, int N, 
-	double DT, int rho, double* E, double beta, int* P, int method, int& Num, 
-																											int& Den, std::vector<Pair>& PM ); 
+bool isRigid(int N, int bonds, int dim);
+void equilibrate(double* X, Integrator* sde, Database* DB, int state, int eq, int N, double DT);
+void runTrajectoryMFPT(double* X, Integrator* sde, Database* DB, int state, int samples, int N, 
+	double DT, int& Num, int& Den, std::vector<Pair>& PM );
+void runTrajectoryMFPT(double* X, Integrator* sde, Database* DB, int state, int samples, int N, 
+	double DT, int& Num, int& Den, std::vector<Pair>& PM, std::vector<PathSample>* paths);
+void runTrajectoryMFPT(double* X, Integrator* sde, Database* DB, int state, int samples, int N, 
+	double DT, int& Num, int& Den, std::vector<Pair>& PM, std::vector<PathSample>* paths,
+	int& timer);
+void runTrajectoryChain(double* X, Integrator* sde, Database* db, int state, int samples, int N, 
+	double DT, int& Num, int& Den, std::vector<Pair>& PM ); 
 void updatePM(int new_state, std::vector<Pair>& PM); 
 void checkState(double* X, int N, int state, int& new_state, Database* db, int& timer,
 							 int& reset, int& reflect);
 double sampleSTD(double* X, int n);
-bool findMatrix(int* M, int* old, int old_bonds, int N, Database* db, int& timer, 
+int findMatrix(const AdjBits& M, int N, Database* db);
+int findMatrix(int* M, int N, Database* db);
+bool findMatrix(const AdjBits& M, int old_bonds, int N, Database* db, int& timer, 
 	int& reset, int& reflect, int& new_state);
 
 
+//reweighting a campaign of paths to other kappa
+bool writePaths(const PathCampaign& C, const std::string& filename);
+bool readPaths(const std::string& filename, PathCampaign& C);
+void reweightTransitionMatrix(const PathCampaign& C, double kappa, int num_states, double* T);
+void reweightTransitionMatrix(const PathCampaign& C, const std::vector<double>& kappas,
+	int num_states, double* T);
+
 //sampling quantities at exit times
 void sampleFirstExit(int N, int state, Database* db);
 void sampleFirstExitR(int N, int initial, Database* db);
@@ -111,7 +238,7 @@ void sampleStats(std::vector<double> X, double& M, double& V);
 void sampleStats(double* X, int N, double& M, double& V);
 void minVarEstimate(int sampleSize, double* means, double* variances, double& M, double& V);
 double getTime(int N, Eigen::VectorXd x, Eigen::VectorXd x0);
-bool findMatrix(int* M, int* old, int old_bonds, int N, bd::Database* db, 
+bool findMatrix(const bd::AdjBits& M, int old_bonds, int N, bd::Database* db, 
 								bool& reset, int& new_state);
 void checkState(int N, Eigen::VectorXd x, int state, bd::Database* db,
 							  bool& reset, int& new_state);
@@ -120,8 +247,14 @@ double getSampleMFPT(double* X, bd::Database* db, int state, int N, int* M,
 	std::vector<bd::Pair>& PM, RandomNo* rngee);
 void getSamplesMFPT(double* X, bd::Database* db, int state, int N, int* M,
 	std::vector<bd::Pair>& PM, std::vector<double>& mfptVec, RandomNo* rngee);
+void getSamplesMFPT(double* X, bd::Database* db, int state, int N, int* M, int samples,
+	std::vector<bd::Pair>& PM, std::vector<double>& mfptVec, double& timer, RandomNo* rngee);
 void estimateMFPTreset(int N, int state, bd::Database* db, RandomNo* rngee);
 void estimateMFPTreflect(int N, int state, bd::Database* db, RandomNo* rngee);
+void estimateMFPTresetAdaptive(int N, int state, bd::Database* db, RandomNo* rngee,
+															 double tol, double ptol);
+void estimateMFPTreflectAdaptive(int N, int state, bd::Database* db, RandomNo* rngee,
+																 double tol, double ptol);
 
 
 
@@ -0,0 +1,365 @@
+#include <math.h>
+#include "bDynamics.h"
+#include "../defines.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BD_X86 1
+#endif
+namespace bd {
+
+/* Vectorized versions of morseGradPairs. AVX2 evaluates 4 pairs per
+   instruction, AVX-512 evaluates 8. Each kernel is compiled with a target
+   attribute so the library builds with default flags, and the best one is
+   picked at runtime from the cpu features.
+
+   The exponential in the morse force uses the Cephes rational approximation,
+   relative error < 2e-16 on the clamped range. Forces are accumulated in the
+   same pair order as the scalar kernel, so the gradient matches
+   morseGradPairs to a relative tolerance of SIMD_TOL (max abs difference
+   divided by max |g|), well below the EM noise at EULER_TS. */
+
+//scalar force on one pair, used for the tail of the vector kernels
+template <int D>
+static inline void morsePairScalar(const double* particles, int rho, const PairList& pairs,
+																	 int N, int k, double* g) {
+	double rep = 250.0;
+	int i = pairs.p1[k]; int j = pairs.p2[k];
+	double d[D]; double R = 0;
+	for (int c = 0; c < D; c++) {
+		d[c] = particles[c*N+i]-particles[c*N+j]; R += d[c]*d[c];
+	}
+	double r = sqrt(R);
+
+	double f;
+	if (pairs.type[k] != 0) {
+		if (r < 1 || pairs.type[k] == 2) {
+			f = 2.0 * rho * rho * pairs.E[k] * (r-1.0);
+		}
+		else {
+			f = morseP(r, rho, pairs.E[k]);
+		}
+	}
+	else if (r < 1.1) {
+		f = -rep / (r*r);
+	}
+	else {
+		return;
+	}
+
+	f /= r;
+	for (int c = 0; c < D; c++) {
+		g[D*i+c] += f*d[c]; g[D*j+c] -= f*d[c];
+	}
+}
+
+//add the pair forces of one block to the gradient, in pair order
+template <int D>
+static inline void scatterBlock(const PairList& pairs, int k, int width,
+																const double* fx, const double* fy, const double* fz, double* g) {
+	for (int l = 0; l < width; l++) {
+		int i = pairs.p1[k+l]; int j = pairs.p2[k+l];
+		g[D*i]   += fx[l]; g[D*j]   -= fx[l];
+		g[D*i+1] += fy[l]; g[D*j+1] -= fy[l];
+		if (D == 3) {
+			g[D*i+2] += fz[l]; g[D*j+2] -= fz[l];
+		}
+	}
+}
+
+#ifdef BD_X86
+
+/******************************************************************/
+/************************ AVX2 kernel *****************************/
+/******************************************************************/
+
+__attribute__((target("avx2,fma")))
+static inline __m256d exp4(__m256d x) {
+	//exp of 4 doubles. x = n*ln2 + r, exp(r) by rational approximation
+
+	x = _mm256_min_pd(x, _mm256_set1_pd(709.0));
+	x = _mm256_max_pd(x, _mm256_set1_pd(-708.0));
+
+	__m256d n = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(1.4426950408889634073599)),
+															_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256d r = _mm256_sub_pd(x, _mm256_mul_pd(n, _mm256_set1_pd(6.93145751953125E-1)));
+	r = _mm256_sub_pd(r, _mm256_mul_pd(n, _mm256_set1_pd(1.42860682030941723212E-6)));
+
+	__m256d rr = _mm256_mul_pd(r, r);
+	__m256d p = _mm256_set1_pd(1.26177193074810590878E-4);
+	p = _mm256_add_pd(_mm256_mul_pd(p, rr), _mm256_set1_pd(3.02994407707441961300E-2));
+	p = _mm256_add_pd(_mm256_mul_pd(p, rr), _mm256_set1_pd(9.99999999999999999910E-1));
+	p = _mm256_mul_pd(p, r);
+	__m256d q = _mm256_set1_pd(3.00198505138664455042E-6);
+	q = _mm256_add_pd(_mm256_mul_pd(q, rr), _mm256_set1_pd(2.52448340349684104192E-3));
+	q = _mm256_add_pd(_mm256_mul_pd(q, rr), _mm256_set1_pd(2.27265548208155028766E-1));
+	q = _mm256_add_pd(_mm256_mul_pd(q, rr), _mm256_set1_pd(2.00000000000000000009E0));
+	__m256d e = _mm256_div_pd(p, _mm256_sub_pd(q, p));
+	e = _mm256_add_pd(_mm256_set1_pd(1.0), _mm256_add_pd(e, e));
+
+	//scale by 2^n through the exponent bits
+	__m256i ni = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(n));
+	ni = _mm256_slli_epi64(_mm256_add_epi64(ni, _mm256_set1_epi64x(1023)), 52);
+	return _mm256_mul_pd(e, _mm256_castsi256_pd(ni));
+}
+
+template <int D>
+__attribute__((target("avx2,fma")))
+static inline void blockDistancesAVX2(const double* particles, int N, const int* p1, const int* p2,
+																			 __m256d& dx, __m256d& dy, __m256d& dz, __m256d& r) {
+	//pair separations and distances of a block of 4 pairs
+	const double* x = particles; const double* y = particles+N;
+	__m128i vi = _mm_loadu_si128((const __m128i*)p1);
+	__m128i vj = _mm_loadu_si128((const __m128i*)p2);
+	dx = _mm256_sub_pd(_mm256_i32gather_pd(x, vi, 8), _mm256_i32gather_pd(x, vj, 8));
+	dy = _mm256_sub_pd(_mm256_i32gather_pd(y, vi, 8), _mm256_i32gather_pd(y, vj, 8));
+	__m256d R = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+	if (D == 3) {
+		const double* z = particles+2*N;
+		dz = _mm256_sub_pd(_mm256_i32gather_pd(z, vi, 8), _mm256_i32gather_pd(z, vj, 8));
+		R = _mm256_add_pd(R, _mm256_mul_pd(dz, dz));
+	}
+	r = _mm256_sqrt_pd(R);
+}
+
+template <int D>
+__attribute__((target("avx2,fma")))
+static inline void blockComponentsAVX2(__m256d f, __m256d dx, __m256d dy, __m256d dz,
+																				double* fx, double* fy, double* fz) {
+	//force components of a block, f already divided by r
+	_mm256_storeu_pd(fx, _mm256_mul_pd(f, dx));
+	_mm256_storeu_pd(fy, _mm256_mul_pd(f, dy));
+	if (D == 3) {
+		_mm256_storeu_pd(fz, _mm256_mul_pd(f, dz));
+	}
+}
+
+template <int D>
+__attribute__((target("avx2,fma")))
+void morseGradPairsAVX2(const double* particles, int rho, const PairList& pairs, int N, double* g) {
+	//compute gradient of energy with pairwise morse potential, 4 pairs at a time
+
+	const int* p1 = pairs.p1.data(); const int* p2 = pairs.p2.data();
+	const int* type = pairs.type.data(); const double* Ep = pairs.E.data();
+
+	for (int i = 0; i < D*N; i++) g[i] = 0;
+
+	const __m256d one = _mm256_set1_pd(1.0); const __m256d two = _mm256_set1_pd(2.0);
+	const __m256d mrho = _mm256_set1_pd(-rho); const __m256d rep = _mm256_set1_pd(-250.0);
+	const __m256d cm = _mm256_set1_pd(-2.0*rho); const __m256d ch = _mm256_set1_pd(2.0*rho*rho);
+	const __m256d cut = _mm256_set1_pd(1.1);
+	double fx[4], fy[4], fz[4];
+	__m256d dx, dy, r; __m256d dz = _mm256_setzero_pd();
+
+	//interacting pairs - harmonic or morse
+	int k = 0; int ni = pairs.num_interacting;
+	for (; k+4 <= ni; k += 4) {
+		blockDistancesAVX2<D>(particles, N, p1+k, p2+k, dx, dy, dz, r);
+		__m256d E = _mm256_loadu_pd(Ep+k);
+		__m256d t = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(type+k)));
+		__m256d rm1 = _mm256_sub_pd(r, one);
+
+		__m256d harmonic = _mm256_or_pd(_mm256_cmp_pd(r, one, _CMP_LT_OQ),
+																		_mm256_cmp_pd(t, two, _CMP_EQ_OQ));
+		__m256d f = _mm256_mul_pd(_mm256_mul_pd(ch, E), rm1);
+		if (_mm256_movemask_pd(harmonic) != 0xF) {//exp only if some lane needs it
+			__m256d Y = exp4(_mm256_mul_pd(mrho, rm1));
+			__m256d fm = _mm256_mul_pd(_mm256_mul_pd(cm, E), _mm256_sub_pd(_mm256_mul_pd(Y, Y), Y));
+			f = _mm256_blendv_pd(fm, f, harmonic);
+		}
+		blockComponentsAVX2<D>(_mm256_div_pd(f, r), dx, dy, dz, fx, fy, fz);
+		scatterBlock<D>(pairs, k, 4, fx, fy, fz, g);
+	}
+	for (; k < ni; k++) {
+		morsePairScalar<D>(particles, rho, pairs, N, k, g);
+	}
+
+	//non interacting pairs - repulsion inside the cutoff, most blocks are skipped
+	for (; k+4 <= pairs.num_pairs; k += 4) {
+		blockDistancesAVX2<D>(particles, N, p1+k, p2+k, dx, dy, dz, r);
+		__m256d close = _mm256_cmp_pd(r, cut, _CMP_LT_OQ);
+		int m = _mm256_movemask_pd(close);
+		if (m == 0) continue;
+
+		__m256d f = _mm256_div_pd(rep, _mm256_mul_pd(r, r));
+		blockComponentsAVX2<D>(_mm256_and_pd(_mm256_div_pd(f, r), close), dx, dy, dz, fx, fy, fz);
+		for (int l = 0; l < 4; l++) {
+			if (m & (1 << l)) scatterBlock<D>(pairs, k+l, 1, fx+l, fy+l, fz+l, g);
+		}
+	}
+	for (; k < pairs.num_pairs; k++) {
+		morsePairScalar<D>(particles, rho, pairs, N, k, g);
+	}
+}
+
+/******************************************************************/
+/*********************** AVX-512 kernel ***************************/
+/******************************************************************/
+
+__attribute__((target("avx512f")))
+static inline __m512d exp8(__m512d x) {
+	//exp of 8 doubles. same scheme as exp4
+
+	x = _mm512_min_pd(x, _mm512_set1_pd(709.0));
+	x = _mm512_max_pd(x, _mm512_set1_pd(-708.0));
+
+	__m512d n = _mm512_roundscale_pd(_mm512_mul_pd(x, _mm512_set1_pd(1.4426950408889634073599)),
+																	 _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m512d r = _mm512_sub_pd(x, _mm512_mul_pd(n, _mm512_set1_pd(6.93145751953125E-1)));
+	r = _mm512_sub_pd(r, _mm512_mul_pd(n, _mm512_set1_pd(1.42860682030941723212E-6)));
+
+	__m512d rr = _mm512_mul_pd(r, r);
+	__m512d p = _mm512_set1_pd(1.26177193074810590878E-4);
+	p = _mm512_add_pd(_mm512_mul_pd(p, rr), _mm512_set1_pd(3.02994407707441961300E-2));
+	p = _mm512_add_pd(_mm512_mul_pd(p, rr), _mm512_set1_pd(9.99999999999999999910E-1));
+	p = _mm512_mul_pd(p, r);
+	__m512d q = _mm512_set1_pd(3.00198505138664455042E-6);
+	q = _mm512_add_pd(_mm512_mul_pd(q, rr), _mm512_set1_pd(2.52448340349684104192E-3));
+	q = _mm512_add_pd(_mm512_mul_pd(q, rr), _mm512_set1_pd(2.27265548208155028766E-1));
+	q = _mm512_add_pd(_mm512_mul_pd(q, rr), _mm512_set1_pd(2.00000000000000000009E0));
+	__m512d e = _mm512_div_pd(p, _mm512_sub_pd(q, p));
+	e = _mm512_add_pd(_mm512_set1_pd(1.0), _mm512_add_pd(e, e));
+
+	//scale by 2^n through the exponent bits
+	__m512i ni = _mm512_cvtepi32_epi64(_mm512_cvtpd_epi32(n));
+	ni = _mm512_slli_epi64(_mm512_add_epi64(ni, _mm512_set1_epi64(1023)), 52);
+	return _mm512_mul_pd(e, _mm512_castsi512_pd(ni));
+}
+
+template <int D>
+__attribute__((target("avx512f")))
+static inline void blockDistancesAVX512(const double* particles, int N, const int* p1, const int* p2,
+																			 __m512d& dx, __m512d& dy, __m512d& dz, __m512d& r) {
+	//pair separations and distances of a block of 8 pairs
+	const double* x = particles; const double* y = particles+N;
+	__m256i vi = _mm256_loadu_si256((const __m256i*)p1);
+	__m256i vj = _mm256_loadu_si256((const __m256i*)p2);
+	dx = _mm512_sub_pd(_mm512_i32gather_pd(vi, x, 8), _mm512_i32gather_pd(vj, x, 8));
+	dy = _mm512_sub_pd(_mm512_i32gather_pd(vi, y, 8), _mm512_i32gather_pd(vj, y, 8));
+	__m512d R = _mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy));
+	if (D == 3) {
+		const double* z = particles+2*N;
+		dz = _mm512_sub_pd(_mm512_i32gather_pd(vi, z, 8), _mm512_i32gather_pd(vj, z, 8));
+		R = _mm512_add_pd(R, _mm512_mul_pd(dz, dz));
+	}
+	r = _mm512_sqrt_pd(R);
+}
+
+template <int D>
+__attribute__((target("avx512f")))
+static inline void blockComponentsAVX512(__m512d f, __m512d dx, __m512d dy, __m512d dz,
+																				double* fx, double* fy, double* fz) {
+	//force components of a block, f already divided by r
+	_mm512_storeu_pd(fx, _mm512_mul_pd(f, dx));
+	_mm512_storeu_pd(fy, _mm512_mul_pd(f, dy));
+	if (D == 3) {
+		_mm512_storeu_pd(fz, _mm512_mul_pd(f, dz));
+	}
+}
+
+template <int D>
+__attribute__((target("avx512f")))
+void morseGradPairsAVX512(const double* particles, int rho, const PairList& pairs, int N, double* g) {
+	//compute gradient of energy with pairwise morse potential, 8 pairs at a time
+
+	const int* p1 = pairs.p1.data(); const int* p2 = pairs.p2.data();
+	const int* type = pairs.type.data(); const double* Ep = pairs.E.data();
+
+	for (int i = 0; i < D*N; i++) g[i] = 0;
+
+	const __m512d one = _mm512_set1_pd(1.0); const __m512d two = _mm512_set1_pd(2.0);
+	const __m512d mrho = _mm512_set1_pd(-rho); const __m512d rep = _mm512_set1_pd(-250.0);
+	const __m512d cm = _mm512_set1_pd(-2.0*rho); const __m512d ch = _mm512_set1_pd(2.0*rho*rho);
+	const __m512d cut = _mm512_set1_pd(1.1);
+	double fx[8], fy[8], fz[8];
+	__m512d dx, dy, r; __m512d dz = _mm512_setzero_pd();
+
+	//interacting pairs - harmonic or morse
+	int k = 0; int ni = pairs.num_interacting;
+	for (; k+8 <= ni; k += 8) {
+		blockDistancesAVX512<D>(particles, N, p1+k, p2+k, dx, dy, dz, r);
+		__m512d E = _mm512_loadu_pd(Ep+k);
+		__m512d t = _mm512_cvtepi32_pd(_mm256_loadu_si256((const __m256i*)(type+k)));
+		__m512d rm1 = _mm512_sub_pd(r, one);
+
+		__mmask8 harmonic = _mm512_cmp_pd_mask(r, one, _CMP_LT_OQ) |
+												_mm512_cmp_pd_mask(t, two, _CMP_EQ_OQ);
+		__m512d f = _mm512_mul_pd(_mm512_mul_pd(ch, E), rm1);
+		if (harmonic != 0xFF) {//exp only if some lane needs it
+			__m512d Y = exp8(_mm512_mul_pd(mrho, rm1));
+			__m512d fm = _mm512_mul_pd(_mm512_mul_pd(cm, E), _mm512_sub_pd(_mm512_mul_pd(Y, Y), Y));
+			f = _mm512_mask_blend_pd(harmonic, fm, f);
+		}
+		blockComponentsAVX512<D>(_mm512_div_pd(f, r), dx, dy, dz, fx, fy, fz);
+		scatterBlock<D>(pairs, k, 8, fx, fy, fz, g);
+	}
+	for (; k < ni; k++) {
+		morsePairScalar<D>(particles, rho, pairs, N, k, g);
+	}
+
+	//non interacting pairs - repulsion inside the cutoff, most blocks are skipped
+	for (; k+8 <= pairs.num_pairs; k += 8) {
+		blockDistancesAVX512<D>(particles, N, p1+k, p2+k, dx, dy, dz, r);
+		__mmask8 close = _mm512_cmp_pd_mask(r, cut, _CMP_LT_OQ);
+		if (close == 0) continue;
+
+		__m512d f = _mm512_div_pd(rep, _mm512_mul_pd(r, r));
+		blockComponentsAVX512<D>(_mm512_maskz_div_pd(close, f, r), dx, dy, dz, fx, fy, fz);
+		for (int l = 0; l < 8; l++) {
+			if (close & (1 << l)) scatterBlock<D>(pairs, k+l, 1, fx+l, fy+l, fz+l, g);
+		}
+	}
+	for (; k < pairs.num_pairs; k++) {
+		morsePairScalar<D>(particles, rho, pairs, N, k, g);
+	}
+}
+
+#endif
+
+/******************************************************************/
+/*********************** Runtime dispatch *************************/
+/******************************************************************/
+
+int simdLevel() {
+	//best vector kernel the cpu supports. 0 scalar, 1 avx2, 2 avx512
+#ifdef BD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return 2;
+	}
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		return 1;
+	}
+#endif
+	return 0;
+}
+
+template <int D>
+static PairGradFn morseGradKernelD(int level) {
+	//morse gradient kernel for a given level and dimension
+#ifdef BD_X86
+	if (level == 2) {
+		return morseGradPairsAVX512<D>;
+	}
+	if (level == 1) {
+		return morseGradPairsAVX2<D>;
+	}
+#endif
+	return morseGradPairs<D>;
+}
+
+PairGradFn morseGradKernel(int level, int dim) {
+	//morse gradient kernel for a given level, NULL if not available
+
+	if (level > simdLevel()) {
+		return NULL;
+	}
+	return (dim == 3) ? morseGradKernelD<3>(level) : morseGradKernelD<2>(level);
+}
+
+PairGradFn bestMorseGradKernel(int dim) {
+	//best morse gradient kernel on this cpu. level is found once per process
+	static int level = simdLevel();
+	return morseGradKernel(level, dim);
+}
+
+}
@@ -0,0 +1,319 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "bDynamics.h"
+#include "sampling.h"
+#include "database.h"
+#include "../defines.h"
+#include <omp.h>
+
+namespace bd {
+
+/******************************************************************/
+/**************** Forward flux sampling ***************************/
+/******************************************************************/
+
+/* the rate out of a state is the flux of trajectories leaving the basin,
+   times the probability that each of a sequence of interfaces is reached
+   before the basin again. the order parameter is the closest contact, the
+   smallest distance between two particles that are not bonded in the state,
+   and a new bond forms when it goes below the bond cutoff. the dynamics are
+   those of runTrajectoryMFPT (a TrajectoryDriver, unusable states reflect), and
+   the rate is that of its transitions out of the basin, without waiting for the
+   rare hits. */
+
+static double closestContact(const double* X, int N, int dim, const AdjBits& A) {
+	//smallest distance between particles that are not bonded in A
+	double r2 = 1e100;
+	for (int i = 0; i < N; i++) {
+		for (int j = i+1; j < N; j++) {
+			if (A.test(i,j,N)) continue;
+			double R2 = 0;
+			for (int k = 0; k < dim; k++) {
+				double d = X[dim*i+k] - X[dim*j+k];
+				R2 += d*d;
+			}
+			if (R2 < r2) r2 = R2;
+		}
+	}
+	return sqrt(r2);
+}
+
+void placeInterfaces(double* X0, Integrator* sde, Database* db, int state, int N, double DT,
+										 int steps, double spacing, std::vector<double>& lambda) {
+	/*interfaces for forwardFlux. the basin boundary lambda[0] is the 5% quantile
+	  of the closest contact over steps of DT in state, so the basin holds most of
+	  the time in the state. the rest are spacing apart, down toward the cutoff */
+
+	int dim = sde->getDimension();
+	const AdjBits& A = (*db)[state].getAdjacency();
+
+	//sample the closest contact, bonds reflect
+	std::vector<double> r;
+	TrajectoryDriver traj(sde, db, N, DT);
+	traj.setStep([&](int s) {
+		r.push_back(closestContact(X0, N, dim, A));
+		return TRAJ_ACCEPT;
+	});
+	traj.setState(X0, state);
+	traj.run(steps);
+
+	double cut = bondCutoff(dim);
+	double q = cut + spacing;
+	if (!r.empty()) {
+		std::sort(r.begin(), r.end());
+		q = r[r.size()/20];
+	}
+
+	lambda.clear(); lambda.push_back(q);
+	for (double l = q - spacing; l > cut + 0.5*spacing; l -= spacing) {
+		lambda.push_back(l);
+	}
+}
+
+double forwardFlux(double* X0, Integrator* sde, Database* db, int state, int N, double DT,
+									 const std::vector<double>& lambda, int crossings, int trials, int max_it,
+									 RandomNo* rngee, std::vector<Pair>& PM) {
+	/*direct forward flux sampling of the first new bond from state, starting at X0.
+	  lambda are the interfaces of the closest contact, decreasing, lambda[0] is the
+	  basin boundary. the last stage ends in a bond. returns the rate, 0 if a stage
+	  has no successes. PM gets the states reached at the end of the last stage */
+
+	int dim = sde->getDimension(); int n = lambda.size();
+	const AdjBits& A = (*db)[state].getAdjacency();
+
+	//configurations on the current interface. dest >= 0 marks one that already
+	//formed a bond, into state dest, which counts as reaching every later interface
+	std::vector<double> configs; std::vector<int> dests;
+	std::vector<double> next; std::vector<int> nextDests;
+
+	double* X = new double[dim*N];
+	memcpy(X, X0, dim*N*sizeof(double));
+	TrajectoryDriver traj(sde, db, N, DT);
+
+	//stage 0, the flux out of the basin. count the first crossings of lambda[0]
+	//after each visit to the basin, over the time since the basin was last visited
+	//more recently than a bond. reflected bonds leave the trajectory next to the
+	//bond, that time belongs to the bond, not the basin
+	bool inA = closestContact(X, N, dim, A) > lambda[0];
+	bool fromA = true;
+	long elapsed = 0;
+	traj.setStep([&](int s) {
+		if (closestContact(X, N, dim, A) > lambda[0]) {
+			inA = fromA = true;
+		}
+		else if (inA) {
+			inA = false;
+			configs.insert(configs.end(), X, X+dim*N); dests.push_back(-1);
+			if (dests.size() == crossings) traj.stop();
+		}
+		if (fromA) elapsed++;
+		return TRAJ_ACCEPT;
+	});
+	traj.setHit([&](int new_state) {
+		//a bond straight from the basin crosses lambda[0] too. reflect as in the
+		//mfpt sampler
+		if (fromA) elapsed++;
+		if (inA) {
+			configs.insert(configs.end(), X, X+dim*N); dests.push_back(new_state);
+			if (dests.size() == crossings) traj.stop();
+		}
+		inA = fromA = false;
+		return TRAJ_REFLECT;
+	});
+	traj.setState(X, state);
+	traj.run(max_it*crossings);
+
+	if (dests.empty()) {
+		printf("No trajectory left the basin of state %d\n", state);
+		delete []X;
+		return 0;
+	}
+	double rate = dests.size() / (elapsed * DT);
+
+	//stages 1 to n. fire trials from random configurations on interface i until
+	//the next interface, or a bond for the last one, or the basin is reached
+	int outcome; int dest;
+	for (int i = 0; i < n; i++) {
+		bool last = (i == n-1);
+		next.clear(); nextDests.clear();
+
+		traj.setStep([&](int s) {
+			double r = closestContact(X, N, dim, A);
+			if (r > lambda[0]) {
+				outcome = 0; traj.stop();
+			}
+			else if (!last && r < lambda[i+1]) {
+				outcome = 1; traj.stop();
+			}
+			return TRAJ_ACCEPT;
+		});
+		traj.setHit([&](int new_state) {
+			outcome = 1; dest = new_state; traj.stop();
+			return TRAJ_REFLECT;
+		});
+
+		int successes = 0;
+		for (int t = 0; t < trials; t++) {
+			int c = rngee->getU() * dests.size();
+			if (dests[c] >= 0) {//already bonded
+				next.insert(next.end(), configs.begin()+c*dim*N, configs.begin()+(c+1)*dim*N);
+				nextDests.push_back(dests[c]); successes++;
+				continue;
+			}
+
+			memcpy(X, &configs[c*dim*N], dim*N*sizeof(double));
+			outcome = 0; dest = -1;
+			traj.setState(X, state);
+			traj.run(max_it);
+
+			//trials that reach neither side within max_it count as failures
+			if (outcome == 1) {
+				next.insert(next.end(), X, X+dim*N);
+				nextDests.push_back(dest); successes++;
+			}
+		}
+
+		if (successes == 0) {
+			printf("No trials reached interface %d of state %d\n", i+1, state);
+			delete []X;
+			return 0;
+		}
+		rate *= double(successes) / trials;
+		configs.swap(next); dests.swap(nextDests);
+	}
+
+	//every configuration on the last interface has formed its bond
+	for (int c = 0; c < dests.size(); c++) {
+		updatePM(dests[c], PM);
+	}
+
+	delete []X;
+	return rate;
+}
+
+void estimateMFPTSplitting(int N, int state, Database* db) {
+	/*estimate mean first passage time starting in state and going to state with
+	one additional bond, by forward flux sampling. for states whose transitions
+	are too rare for estimateMFPT. each thread does an independent run, the mfpt
+	is one over the mean rate. */
+
+	//set parameters
+	int rho = 40; double beta = 1; double DT = 0.01; int Kh = 1850;
+	int pot = 1;  //set potential. 0 = morse, 1 = LJ
+	int method = 1; //solve SDEs with EM
+	int eq = 200; //number of steps to equilibrate for
+	int crossings = 200; //configurations stored on each interface
+	int trials = 400; //trials fired from each interface
+	int max_it = 10000; //longest trial, in steps of DT
+	int basin = 2000; //steps to place the interfaces
+	double spacing = 0.1; //distance between interfaces
+
+	//quantities to update - new estimates
+	int num_states = db->getNumStates();
+	std::vector<Pair> PM; std::vector<Pair> PMshare;
+	double mfpt = 0;
+	double sigma = 0;
+
+	//output start message
+	printf("Beginning splitting MFPT Estimator for state %d out of %d.\n", state, num_states);
+
+	//setup simulation
+	double Eh = stickyNewton(8, rho, Kh, beta); //get energy corresponding to kappa
+	//initialize interaction matrices
+	int* P = new int[N*N]; double* E = new double[N*N];
+	setupSimMFPT(N, Eh, P, E);
+
+	//store rate estimates on each thread to get standard deviation
+	double* rates; int num_threads;
+
+	//open parallel region
+	#pragma omp parallel private(PM) shared(PMshare)
+	{
+
+	//initialize samples
+	#pragma omp single
+	{
+	num_threads = omp_get_num_threads();
+	rates = new double[num_threads];
+	}
+
+	//get starting structures
+	const Cluster& c = (*db)[state].getRandomIC();
+
+	//cluster structs to arrays
+	int dim = db->getDimension();
+	double* X = new double[dim*N];
+	c.makeArray(X, N, dim);
+
+	//set up this thread's integrator and random numbers
+	Integrator sde(N, rho, beta, E, P, method, pot, dim);
+	RandomNo rngee(Integrator::makeSeed());
+
+	//equilibrate the trajectories
+	equilibrate(X, &sde, db, state, eq, N, DT);
+
+	//interfaces of the closest contact, from the basin boundary down to the bond
+	std::vector<double> lambda;
+	placeInterfaces(X, &sde, db, state, N, DT, basin, spacing, lambda);
+
+	//run the splitting
+	rates[omp_get_thread_num()] = forwardFlux(X, &sde, db, state, N, DT, lambda, crossings,
+																						trials, max_it, &rngee, PM);
+
+	if (omp_get_thread_num() == 0) {
+		PMshare = PM;
+	}
+	//do update on PM vectors - need barrier
+	#pragma omp barrier
+	#pragma omp critical
+	{
+		if (omp_get_thread_num() != 0) {
+			combinePairs(PMshare, PM);
+		}
+	}
+
+	//free cluster memory
+	delete []X;
+
+	//end parallel region
+	}
+
+	//combine estimates - if every thread found the transition
+	double k = 0; bool found = true;
+	for (int i = 0; i < num_threads; i++) {
+		k += rates[i] / num_threads;
+		found = found && rates[i] > 0;
+	}
+
+	if (found) {
+		mfpt = 1.0 / k;
+		if (num_threads > 1) {
+			for (int i = 0; i < num_threads; i++) rates[i] = 1.0 / rates[i];
+			sigma = sampleSTD(rates, num_threads);
+		}
+
+		//make a Z vector with same num of elements as P
+		std::vector<Pair> Z;
+		for (int i = 0; i < PMshare.size(); i++) {
+			Z.push_back(Pair(PMshare[i].index, 0));
+		}
+
+		//update database. the counts of the brute force estimator do not apply
+		(*db)[state].mfpt = mfpt;
+		(*db)[state].num = 0;
+		(*db)[state].denom = 0;
+		db->setRow(state, PMshare, Z, Z);
+		(*db)[state].sigma = sigma;
+	}
+	else {
+		printf("Splitting found no transition out of state %d, estimate not updated\n", state);
+	}
+
+	//free memory
+	delete []E; delete []P; delete []rates;
+}
+
+}
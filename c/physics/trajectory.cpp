@@ -0,0 +1,166 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "bDynamics.h"
+#include "sampling.h"
+#include "database.h"
+#include "../defines.h"
+
+namespace bd {
+
+/******************************************************************/
+/**************** Event driven trajectories ***********************/
+/******************************************************************/
+
+TrajectoryDriver::TrajectoryDriver(Integrator* sde_, Database* db_, int N_, double DT_) {
+	sde = sde_; db = db_; N = N_; DT = DT_;
+	dim = sde->getDimension();
+
+	X = NULL; state = 0; timer = steps = 0; stopped = false;
+	skin = TRAJ_SKIN; dirty = true; guard = 0;
+
+	//two particles, each moving TRAJ_GUARD standard deviations of the noise
+	reach = 2*TRAJ_GUARD*sqrt(2*dim*DT/sde->getBeta());
+
+	rollback = new double[dim*N]; Xscan = new double[dim*N];
+}
+
+TrajectoryDriver::~TrajectoryDriver() {
+	delete []rollback; delete []Xscan;
+}
+
+void TrajectoryDriver::setState(double* X0, int state_) {
+	X = X0; state = state_;
+	acc = (*db)[state].getAdjacency();
+	timer = steps = 0; stopped = false;
+
+	memcpy(rollback, X, dim*N*sizeof(double));
+	scan();
+}
+
+void TrajectoryDriver::scan() {
+	//compare every pair with acc, keep the ones near the cutoff
+
+	if (X == NULL) return;
+
+	double cut = bondCutoff(dim);
+	wi.clear(); wj.clear(); dirty = false; guard = skin;
+
+	for (int i = 0; i < N; i++) {
+		for (int j = i+1; j < N; j++) {
+			double R2 = 0;
+			for (int k = 0; k < dim; k++) {
+				double d = X[dim*i+k] - X[dim*j+k];
+				R2 += d*d;
+			}
+			double r = sqrt(R2);
+			if ((r < cut) != acc.test(i,j,N)) dirty = true;
+			if (fabs(r - cut) < skin) {
+				wi.push_back(i); wj.push_back(j);
+				guard = fmin(guard, fabs(r - cut));
+			}
+		}
+	}
+
+	if (dirty) guard = 0;
+	memcpy(Xscan, X, dim*N*sizeof(double));
+}
+
+bool TrajectoryDriver::changed() {
+	//pair distances change by at most the sum of two displacements relative to
+	//any common shift. use the mean displacement as the shift
+
+	if (dirty) return true;
+
+	double mean[3] = {0,0,0};
+	for (int i = 0; i < N; i++) {
+		for (int k = 0; k < dim; k++) mean[k] += X[dim*i+k] - Xscan[dim*i+k];
+	}
+	for (int k = 0; k < dim; k++) mean[k] /= N;
+
+	double max2 = 0;
+	for (int i = 0; i < N; i++) {
+		double d2 = 0;
+		for (int k = 0; k < dim; k++) {
+			double d = X[dim*i+k] - Xscan[dim*i+k] - mean[k];
+			d2 += d*d;
+		}
+		if (d2 > max2) max2 = d2;
+	}
+
+	if (4*max2 >= skin*skin) {//an unwatched pair may have crossed
+		scan();
+		return dirty;
+	}
+
+	//only the watched pairs can differ from acc. the rest are still at least
+	//skin - 2*max displacement from the cutoff
+	double cut = bondCutoff(dim);
+	guard = skin - 2*sqrt(max2);
+	for (int p = 0; p < wi.size(); p++) {
+		int i = wi[p]; int j = wj[p];
+		double R2 = 0;
+		for (int k = 0; k < dim; k++) {
+			double d = X[dim*i+k] - X[dim*j+k];
+			R2 += d*d;
+		}
+		double r = sqrt(R2);
+		if ((r < cut) != acc.test(i,j,N)) {
+			guard = 0; return true;
+		}
+		guard = fmin(guard, fabs(r - cut));
+	}
+	return false;
+}
+
+int TrajectoryDriver::run(int max_steps) {
+	//advance, classify bond events with checkState and hand them to the callbacks
+
+	stopped = false;
+	int i;
+	for (i = 0; i < max_steps && !stopped; i++) {
+		//save the positions only if this chunk may have to be undone
+		if (onStep || guard < reach) {
+			memcpy(rollback, X, dim*N*sizeof(double));
+		}
+		sde->solveSDE(X, DT);
+		steps++;
+
+		//no bond changed, the step counts and is kept
+		if (!changed()) {
+			timer++;
+			if (onStep && onStep(state) == TRAJ_REFLECT) {
+				memcpy(X, rollback, dim*N*sizeof(double));
+			}
+			continue;
+		}
+
+		int reset = 0; int reflect = 0; int new_state = state;
+		checkState(X, N, state, new_state, db, timer, reset, reflect);
+
+		int action = TRAJ_ACCEPT;
+		if (reflect == 1) {
+			action = onHit ? onHit(new_state) : TRAJ_REFLECT;
+		}
+		else if (reset == 1) {
+			new_state = state;
+			action = onReset ? onReset(new_state) : TRAJ_REFLECT;
+		}
+
+		if (action == TRAJ_ACCEPT) {
+			memcpy(rollback, X, dim*N*sizeof(double));
+			if (new_state != state) {
+				state = new_state; acc = (*db)[state].getAdjacency();
+			}
+		}
+		else {
+			memcpy(X, rollback, dim*N*sizeof(double));
+		}
+		//checkState may have refined X, and acc may be new
+		scan();
+	}
+
+	return i;
+}
+
+}
@@ -0,0 +1,332 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <iomanip>
+#include "bDynamics.h"
+#include "sampling.h"
+#include "database.h"
+#include "../defines.h"
+#include <omp.h>
+
+namespace bd {
+
+/******************************************************************/
+/**************** Weighted ensemble *******************************/
+/******************************************************************/
+
+/* weighted ensemble estimate of the mfpt and transition probabilities of every
+   state reachable from a source state, in one run. walkers carry a weight and
+   follow the dynamics of estimateMFPT, except a new bond is accepted, so the
+   ensemble flows from the source toward the rigid states. a walker that forms
+   a rigid state is recycled into the source with its weight. after every
+   iteration of tau steps the walkers are binned by lumped state (lumpMap) and
+   split or merged so each bin holds the same number, which keeps the rare
+   states sampled. the mfpt of a state is the weighted time spent in it over
+   the weighted number of transitions out of it. the time after entering a
+   state is included, so this agrees with estimateMFPT when the states relax
+   faster than they react.
+	 Members:
+	 	state, w - current state and weight of the walker
+	 	X - positions
+	 	done - formed a rigid state this iteration, to recycle
+	 	steps - steps spent in each state this iteration
+	 	hits - transitions (from, to) this iteration
+*/
+
+struct Walker {
+	int state; double w;
+	std::vector<double> X;
+	bool done;
+	std::vector<Pair> steps;
+	std::vector<std::pair<int,int> > hits;
+};
+
+static void addPair(int index, double value, std::vector<Pair>& PM) {
+	//find pair with index and add value, new pair if not there
+	int i;
+	for (i = 0; i < PM.size(); i++) {
+		if (PM[i].index == index) {
+			PM[i].value += value;
+			return;
+		}
+	}
+	PM.push_back(Pair(index, value));
+}
+
+static void propagateWalker(Walker& wk, Integrator* sde, Database* db, int N, double DT,
+														int tau) {
+	//advance one walker by tau steps, recording its time and transitions
+
+	wk.steps.clear(); wk.hits.clear(); wk.done = false;
+
+	TrajectoryDriver traj(sde, db, N, DT);
+	traj.setStep([&](int s) {
+		addPair(s, 1, wk.steps);
+		return TRAJ_ACCEPT;
+	});
+	traj.setHit([&](int new_state) {
+		//the step of the transition counts toward the old state, as in checkState
+		int s = traj.getState();
+		addPair(s, 1, wk.steps);
+		wk.hits.push_back(std::make_pair(s, new_state));
+		if (isRigid(N, (*db)[new_state].getBonds(), db->getDimension())) {
+			wk.done = true; traj.stop();
+		}
+		return TRAJ_ACCEPT;
+	});
+
+	traj.setState(&wk.X[0], wk.state);
+	traj.run(tau);
+	wk.state = traj.getState();
+}
+
+static void resampleBin(std::vector<Walker>& bin, int M, RandomNo* rngee) {
+	//merge the two lightest walkers or split the heaviest until there are M
+
+	while (bin.size() > M) {
+		int a = 0; int b = 1;
+		if (bin[b].w < bin[a].w) std::swap(a, b);
+		for (int i = 2; i < bin.size(); i++) {
+			if (bin[i].w < bin[a].w) {
+				b = a; a = i;
+			}
+			else if (bin[i].w < bin[b].w) {
+				b = i;
+			}
+		}
+		//keep one of the pair with probability proportional to weight
+		double w = bin[a].w + bin[b].w;
+		int keep = (rngee->getU() * w < bin[a].w) ? a : b;
+		int drop = (keep == a) ? b : a;
+		bin[keep].w = w;
+		bin[drop] = bin.back(); bin.pop_back();
+	}
+
+	while (bin.size() < M) {
+		int a = 0;
+		for (int i = 1; i < bin.size(); i++) {
+			if (bin[i].w > bin[a].w) a = i;
+		}
+		bin[a].w /= 2;
+		bin.push_back(bin[a]);
+	}
+}
+
+static void writeCheckpoint(const std::string& filename, int it, int blocks, int num_states,
+														const std::vector<Walker>& walkers, const std::vector<double>& T,
+														const std::vector<double>& H, const std::vector<int>& raw,
+														const std::vector<std::vector<Pair> >& PM) {
+	//save the walkers and the estimator sums to restart a run
+
+	std::ofstream out_str(filename);
+	out_str << std::setprecision(17);
+	out_str << it << ' ' << blocks << ' ' << num_states << ' ' << walkers.size() << '\n';
+	for (int k = 0; k < walkers.size(); k++) {
+		out_str << walkers[k].state << ' ' << walkers[k].w << ' ';
+		for (int i = 0; i < walkers[k].X.size(); i++) out_str << walkers[k].X[i] << ' ';
+		out_str << '\n';
+	}
+	for (int s = 0; s < num_states; s++) {
+		for (int b = 0; b < blocks; b++) {
+			out_str << T[s*blocks+b] << ' ' << H[s*blocks+b] << ' ';
+		}
+		out_str << raw[s] << ' ' << PM[s].size() << ' ';
+		for (int i = 0; i < PM[s].size(); i++) {
+			out_str << PM[s][i].index << ' ' << PM[s][i].value << ' ';
+		}
+		out_str << '\n';
+	}
+}
+
+static bool readCheckpoint(const std::string& filename, int N, int dim, int blocks,
+													 int num_states,
+													 int& it, std::vector<Walker>& walkers, std::vector<double>& T,
+													 std::vector<double>& H, std::vector<int>& raw,
+													 std::vector<std::vector<Pair> >& PM) {
+	//restart from a checkpoint. false if there is none or it does not match
+
+	std::ifstream in_str(filename);
+	if (!in_str.is_open()) {
+		return false;
+	}
+
+	int b, ns, nw;
+	in_str >> it >> b >> ns >> nw;
+	if (!in_str || b != blocks || ns != num_states) {
+		fprintf(stderr, "Checkpoint %s does not match this run, starting over\n", filename.c_str());
+		return false;
+	}
+
+	walkers.resize(nw);
+	for (int k = 0; k < nw; k++) {
+		walkers[k].X.resize(dim*N); walkers[k].done = false;
+		in_str >> walkers[k].state >> walkers[k].w;
+		for (int i = 0; i < dim*N; i++) in_str >> walkers[k].X[i];
+	}
+	for (int s = 0; s < num_states; s++) {
+		for (int b = 0; b < blocks; b++) {
+			in_str >> T[s*blocks+b] >> H[s*blocks+b];
+		}
+		int n; in_str >> raw[s] >> n;
+		PM[s].resize(n);
+		for (int i = 0; i < n; i++) in_str >> PM[s][i].index >> PM[s][i].value;
+	}
+
+	if (!in_str) {
+		fprintf(stderr, "Checkpoint %s is incomplete, starting over\n", filename.c_str());
+		return false;
+	}
+	return true;
+}
+
+void estimateRatesWE(int N, int initial, Database* db, std::string checkpoint) {
+	/*estimate the mfpt and transition probabilities of every state reachable from
+	initial with a weighted ensemble. the run is saved to checkpoint every few
+	iterations, and resumed from it if it exists. */
+
+	//set parameters
+	int rho = 40; double beta = 1; double DT = 0.01; int Kh = 1850;
+	int pot = 1;  //set potential. 0 = morse, 1 = LJ
+	int method = 1; //solve SDEs with EM
+	int eq = 200; //number of steps to equilibrate for
+	int tau = 10; //steps between resampling
+	int M = 8; //walkers per bin
+	int iterations = 2000; //resampling iterations
+	int save = 50; //iterations between checkpoints
+	int blocks = 10; //blocks of iterations for the standard deviation
+
+	int num_states = db->getNumStates(); int dim = db->getDimension();
+
+	//output start message
+	printf("Beginning weighted ensemble estimator from state %d out of %d.\n", initial, num_states);
+
+	//setup simulation
+	double Eh = stickyNewton(8, rho, Kh, beta); //get energy corresponding to kappa
+	//initialize interaction matrices
+	int* P = new int[N*N]; double* E = new double[N*N];
+	setupSimMFPT(N, Eh, P, E);
+
+	//one integrator per thread, tasks use the one of the thread they run on
+	int num_threads = omp_get_max_threads();
+	std::vector<Integrator*> sdes(num_threads);
+	for (int i = 0; i < num_threads; i++) {
+		sdes[i] = new Integrator(N, rho, beta, E, P, method, pot, dim);
+	}
+	RandomNo rngee(Integrator::makeSeed());
+
+	//weighted time (steps) and transitions out of each state, per block. raw
+	//counts of the transitions and the weighted destinations
+	std::vector<double> T(num_states*blocks, 0.0); std::vector<double> H(num_states*blocks, 0.0);
+	std::vector<int> raw(num_states, 0);
+	std::vector<std::vector<Pair> > PM(num_states);
+
+	//start M equilibrated walkers in the source, or resume
+	std::vector<Walker> walkers; int it = 0;
+	if (readCheckpoint(checkpoint, N, dim, blocks, num_states, it, walkers, T, H, raw, PM)) {
+		printf("Resuming from %s at iteration %d with %d walkers\n", checkpoint.c_str(), it,
+					 int(walkers.size()));
+	}
+	else {
+		it = 0; walkers.resize(M);
+		for (int k = 0; k < M; k++) {
+			walkers[k].state = initial; walkers[k].w = 1.0 / M; walkers[k].done = false;
+			walkers[k].X.resize(dim*N);
+			const Cluster& c = (*db)[initial].getRandomIC();
+			c.makeArray(&walkers[k].X[0], N, dim);
+			equilibrate(&walkers[k].X[0], sdes[0], db, initial, eq, N, DT);
+		}
+	}
+
+	for (; it < iterations; it++) {
+		//propagate every walker, one task each
+		#pragma omp parallel
+		{
+		#pragma omp single
+		{
+		for (int k = 0; k < walkers.size(); k++) {
+			#pragma omp task firstprivate(k)
+			propagateWalker(walkers[k], sdes[omp_get_thread_num()], db, N, DT, tau);
+		}
+		}
+		}
+
+		//update the estimator sums, recycle the walkers that became rigid
+		int b = it * blocks / iterations;
+		for (int k = 0; k < walkers.size(); k++) {
+			Walker& wk = walkers[k];
+			for (int i = 0; i < wk.steps.size(); i++) {
+				T[wk.steps[i].index*blocks+b] += wk.w * wk.steps[i].value;
+			}
+			for (int i = 0; i < wk.hits.size(); i++) {
+				int s = wk.hits[i].first;
+				H[s*blocks+b] += wk.w; raw[s]++;
+				addPair(wk.hits[i].second, wk.w, PM[s]);
+			}
+			if (wk.done) {
+				//restart in the source, equilibrated as the first walkers
+				wk.state = initial;
+				const Cluster& c = (*db)[initial].getRandomIC();
+				c.makeArray(&wk.X[0], N, dim);
+				equilibrate(&wk.X[0], sdes[0], db, initial, eq, N, DT);
+			}
+		}
+
+		//bin by lumped state, resample each bin
+		std::map<int, std::vector<Walker> > bins;
+		for (int k = 0; k < walkers.size(); k++) {
+			bins[db->lumpMap[walkers[k].state]].push_back(walkers[k]);
+		}
+		walkers.clear();
+		for (std::map<int, std::vector<Walker> >::iterator bin = bins.begin(); bin != bins.end();
+				 bin++) {
+			resampleBin(bin->second, M, &rngee);
+			walkers.insert(walkers.end(), bin->second.begin(), bin->second.end());
+		}
+
+		if ((it+1) % save == 0) {
+			printf("Iteration %d of %d, %d walkers in %d bins\n", it+1, iterations,
+						 int(walkers.size()), int(bins.size()));
+			writeCheckpoint(checkpoint, it+1, blocks, num_states, walkers, T, H, raw, PM);
+		}
+	}
+	writeCheckpoint(checkpoint, iterations, blocks, num_states, walkers, T, H, raw, PM);
+
+	//update the database for every state that was left
+	double* mfptSamples = new double[blocks];
+	for (int s = 0; s < num_states; s++) {
+		if (raw[s] == 0 || isRigid(N, (*db)[s].getBonds(), dim)) continue;
+
+		double t = 0; double h = 0; int n = 0;
+		for (int b = 0; b < blocks; b++) {
+			t += T[s*blocks+b]; h += H[s*blocks+b];
+			if (H[s*blocks+b] > 0) {
+				mfptSamples[n++] = T[s*blocks+b] * DT / H[s*blocks+b];
+			}
+		}
+		double mfpt = t * DT / h;
+		double sigma = (n > 1) ? sampleSTD(mfptSamples, n) : 0;
+
+		//the row holds the weights, scaled to the raw count. sumP normalizes them
+		std::vector<Pair> Ps; std::vector<Pair> Z;
+		for (int i = 0; i < PM[s].size(); i++) {
+			Ps.push_back(Pair(PM[s][i].index, raw[s] * PM[s][i].value / h));
+			Z.push_back(Pair(PM[s][i].index, 0));
+		}
+
+		//update database. the counts of the brute force estimator do not apply
+		(*db)[s].mfpt = mfpt;
+		(*db)[s].num = 0;
+		(*db)[s].denom = 0;
+		db->setRow(s, Ps, Z, Z);
+		(*db)[s].sigma = sigma;
+	}
+
+	//free memory
+	for (int i = 0; i < num_threads; i++) delete sdes[i];
+	delete []E; delete []P; delete []mfptSamples;
+}
+
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include <cstdlib>
+#include "nauty.h"
+
+namespace bd {
+
+//largest cluster the packed adjacency can hold, N(N-1)/2 <= 64*ADJ_WORDS
+const int ADJ_WORDS = 2;
+const int ADJ_MAX_N = 16;
+
+/* packed adjacency matrix. only the upper triangle is stored, one bit per
+	 pair, in the order (0,1),(0,2),...,(0,N-1),(1,2),... for N <= 11 every
+	 bond fits in the first word. comparing two states and counting bonds
+	 are a fixed number of word operations instead of a loop over N*N entries.
+	 Members:
+	 	w - the bit words, unused bits are always zero
+
+*/
+
+struct AdjBits {
+	//constructor - empty graph
+	AdjBits() {clear();}
+
+	unsigned long long w[ADJ_WORDS];
+
+	//position of pair (i,j), i < j, in the packed triangle
+	static int pairBit(int i, int j, int N) {
+		if (i > j) {int t = i; i = j; j = t;}
+		return i*N - i*(i+1)/2 + j-i-1;
+	}
+
+	void clear() {
+		for (int k = 0; k < ADJ_WORDS; k++) w[k] = 0;
+	}
+	void addBond(int i, int j, int N) {
+		int b = pairBit(i,j,N);
+		w[b >> 6] |= 1ULL << (b & 63);
+	}
+	bool test(int i, int j, int N) const {
+		if (i == j) return false;
+		int b = pairBit(i,j,N);
+		return (w[b >> 6] >> (b & 63)) & 1ULL;
+	}
+
+	//number of bonds
+	int count() const {
+		int S = 0;
+		for (int k = 0; k < ADJ_WORDS; k++) S += __builtin_popcountll(w[k]);
+		return S;
+	}
+
+	bool operator==(const AdjBits& other) const {
+		for (int k = 0; k < ADJ_WORDS; k++) {
+			if (w[k] != other.w[k]) return false;
+		}
+		return true;
+	}
+	bool operator!=(const AdjBits& other) const {return !(*this == other);}
+
+	//true if all bonds of other are present here
+	bool contains(const AdjBits& other) const {
+		for (int k = 0; k < ADJ_WORDS; k++) {
+			if ((w[k] & other.w[k]) != other.w[k]) return false;
+		}
+		return true;
+	}
+
+	//mix the words into one value for hashing
+	size_t hash() const {
+		unsigned long long h = w[0];
+		for (int k = 1; k < ADJ_WORDS; k++) h = h*0x9E3779B97F4A7C15ULL ^ w[k];
+		h ^= h >> 31; h *= 0xBF58476D1CE4E5B9ULL; h ^= h >> 29;
+		return (size_t)h;
+	}
+
+	//the linear chain, bonds (i,i+1)
+	static AdjBits chain(int N) {
+		AdjBits A;
+		for (int i = 0; i < N-1; i++) A.addBond(i,i+1,N);
+		return A;
+	}
+
+	//conversions to and from the N by N int matrix
+	void fromMatrix(const int* M, int N) {
+		clear();
+		for (int i = 0; i < N; i++) {
+			for (int j = i+1; j < N; j++) {
+				if (M[N*j+i]) addBond(i,j,N);
+			}
+		}
+	}
+	void toMatrix(int* M, int N) const {
+		for (int i = 0; i < N; i++) {
+			M[N*i+i] = 0;
+			for (int j = i+1; j < N; j++) {
+				int b = test(i,j,N);
+				M[N*j+i] = b; M[N*i+j] = b;
+			}
+		}
+	}
+
+	//write the rows of a nauty graph with m setwords per row directly from the bits
+	void toNauty(graph* g, int m, int N) const {
+		EMPTYGRAPH(g, m, N);
+		int b = 0;
+		for (int i = 0; i < N; i++) {
+			for (int j = i+1; j < N; j++, b++) {
+				if ((w[b >> 6] >> (b & 63)) & 1ULL) {
+					ADDONEEDGE(g, i, j, m);
+				}
+			}
+		}
+	}
+};
+
+//hash functor so AdjBits can key an unordered_map
+struct AdjBitsHash {
+	size_t operator()(const AdjBits& A) const {return A.hash();}
+};
+
+}
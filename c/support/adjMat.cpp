@@ -31,18 +31,24 @@ void extractAM(int N, int state, int* AM, Database* db) {
 	for (int i = 0; i < N*N; i++) AM[i] = 0;
 
 	//fill the matrix with db data
+	(*db)[state].getAdjacency().toMatrix(AM, N);
+}
+
+void printAM(int N, int* AM) {
+	//print out the adj matrix 
 	for (int i = 0; i < N; i++) {
 		for (int j = 0; j < N; j++) {
-			AM[i*N+j] = (*db)[state].isInteracting(i,j,N);
+			printf("%d ", AM[toIndex(i,j,N)]);
 		}
+		printf("\n");
 	}
 }
 
-void printAM(int N, int* AM) {
-	//print out the adj matrix 
+void printAM(int N, const AdjBits& A) {
+	//print out the packed adj matrix
 	for (int i = 0; i < N; i++) {
 		for (int j = 0; j < N; j++) {
-			printf("%d ", AM[toIndex(i,j,N)]);
+			printf("%d ", (int)A.test(i,j,N));
 		}
 		printf("\n");
 	}
@@ -62,6 +68,11 @@ bool checkConnected(int* M, int N) {
 	}
 }
 
+bool checkConnected(const AdjBits& A, int N) {
+	//check if every chain bond (i,i+1) is present
+	return A.contains(AdjBits::chain(N));
+}
+
 bool checkSame(int* M1, int* M2, int N) {
 	//check if adjacency matrices M1 and M2 are the same
 	for (int i = 0; i < N*N; i++) {
@@ -72,40 +83,81 @@ bool checkSame(int* M1, int* M2, int N) {
 	return true;
 }
 
-void getAdj(double* X, int N, int* M) {
-	//get the adjacnecy matrix from a cluster X
+template <int D>
+void getAdj(const double* X, int N, int* M) {
+	//get the adjacnecy matrix from a cluster X. reads X in place, no allocation
 
 	//clear out AM
 	for (int i = 0; i < N*N; i++) {
 		M[i] = 0;
 	}
-	
-	//init a particle array to 0, then fill it from X
-	double* particles = new double[DIMENSION*N]; double* Z = new double[DIMENSION];
-	for (int p = 0; p < DIMENSION*N; p++) {
-		particles[p] = 0;
-	}
-	c2p(X, particles, N);
 
-	/*
-	for (int q = 0; q < 2*N; q++) {
-		std::cout << particles[q] << "\n";
+	//compute the distance between particles, construct adj matrix
+	double cut = bondCutoff<D>();
+	for (int i = 0; i < N; i++) {
+		for (int j = i+1; j < N; j++) {
+			double R = 0;
+			for (int k = 0; k < D; k++) {
+				double d = X[D*i+k]-X[D*j+k];
+				R += d*d;
+			}
+			if (sqrt(R) < cut) {
+				M[toIndex(i,j,N)] = 1; M[toIndex(j,i,N)] = 1;
+			}
+		}
 	}
-	*/
+}
 
-	//compute the distance between particles, construct adj matrix
-	int i, j; 
-	for (int index = 0; index < N*N; index++) {
-		index2ij(index, N, i, j);
-		if (j > i) {
-			double d = euDist(particles, i, j, N, Z);
-			if (d < BOND_CUTOFF) {
-				M[index] = 1; M[toIndex(j,i,N)] = 1;
+template <int D>
+void getAdj(const double* X, int N, AdjBits& A) {
+	//packed adjacency matrix from a cluster X, same test as the int version
+
+	A.clear();
+	double cut = bondCutoff<D>();
+	int b = 0;
+	for (int i = 0; i < N; i++) {
+		for (int j = i+1; j < N; j++, b++) {
+			double R = 0;
+			for (int k = 0; k < D; k++) {
+				double d = X[D*i+k]-X[D*j+k];
+				R += d*d;
+			}
+			if (sqrt(R) < cut) {
+				A.w[b >> 6] |= 1ULL << (b & 63);
 			}
 		}
 	}
+}
 
-	delete []particles; delete []Z;
+template void getAdj<2>(const double*, int, int*);
+template void getAdj<3>(const double*, int, int*);
+template void getAdj<2>(const double*, int, AdjBits&);
+template void getAdj<3>(const double*, int, AdjBits&);
+
+void getAdj(double* X, int N, int* M) {
+	getAdj<DIMENSION>(X, N, M);
+}
+
+void getAdj(double* X, int N, int* M, int dim) {
+	if (dim == 3) {
+		getAdj<3>(X, N, M);
+	}
+	else {
+		getAdj<2>(X, N, M);
+	}
+}
+
+void getAdj(const double* X, int N, AdjBits& A) {
+	getAdj<DIMENSION>(X, N, A);
+}
+
+void getAdj(const double* X, int N, AdjBits& A, int dim) {
+	if (dim == 3) {
+		getAdj<3>(X, N, A);
+	}
+	else {
+		getAdj<2>(X, N, A);
+	}
 }
 
 void getAdjCut(double* X, int N, int* M, double cut) {
@@ -147,18 +199,8 @@ void getAdjCut(double* X, int N, int* M, double cut) {
 void buildNautyGraph(int N, int M, int state, Database* db, graph* g) {
 	//build nauty graph of given state
 
-	//zero out any pre-existing graph
-	EMPTYGRAPH(g, M, N);
-
-	//add edges for every non-zero entry in adjacnecy matrix
-	for (int i = 0; i < N; i++) {
-		for (int j = i+1; j < N; j++) {
-			//std::cout << i << ' ' << j << "\n";
-			if ((*db)[state].isInteracting(i,j,N)) {
-				ADDONEEDGE(g, i, j, M);
-			}
-		}
-	} 
+	//rows come straight from the packed bits
+	(*db)[state].getAdjacency().toNauty(g, M, N);
 }
 
 bool checkIsomorphic(int N, int M, graph* g1, graph* g2) {
@@ -177,39 +219,46 @@ bool checkIsomorphic(int N, int M, graph* g1, graph* g2) {
 }
 
 
-void findIsomorphic(int N, int num_states, int state, Database* db, std::vector<int>& iso) {
-	//finds all states isomorphic to given state in database. stored to iso.
+AdjBits canonicalForm(int N, const AdjBits& A) {
+	//canonically labeled graph of A, packed. equal for isomorphic graphs. thread safe
 
 	//set keywords for nauty
 	int M = SETWORDSNEEDED(N);
 
-	//initialize the nauty graphs and parameters
-	graph g1[N*M]; graph g2[N*M];   //the starting graphs
-	graph cg1[N*M]; graph cg2[N*M]; //graphs with canonical labeling
-	int lab1[N], lab2[N];           //label arrays
-	int ptn[N], orbits[N];          //needed to call functions
-	static DEFAULTOPTIONS_GRAPH(options); //defualt options
+	//initialize the nauty graphs and parameters, options are local so threads dont share
+	graph g[N*M]; graph cg[N*M];    //starting graph and canonical labeling
+	int lab[N], ptn[N], orbits[N];  //needed to call functions
+	DEFAULTOPTIONS_GRAPH(options);  //defualt options
 	statsblk stats;                 //nauty statistics of graph
 	options.getcanon = TRUE;        //get canonical labeling
 	options.defaultptn = TRUE;      //ignore any coloring of graph
 
-	//build nauty graph of the state, get canonical labeling
-	EMPTYGRAPH(cg1, M, N);
-	buildNautyGraph(N, M, state, db, g1);
-	densenauty(g1, lab1, ptn, orbits, &options, &stats, M, N, cg1);
-
-	//loop over all states, check if isomorphic
-	for (int i = 0; i < num_states; i++) {
-		//create graph
-		EMPTYGRAPH(cg2, M, N);
-		buildNautyGraph(N, M, i, db, g2);
-		densenauty(g2, lab2, ptn, orbits, &options, &stats, M, N, cg2);
-
-		/* Compare canonically labelled graphs */
-		if (checkIsomorphic(N, M, cg1, cg2) == 1) { //graphs are isomorphic, add to iso
-			iso.push_back(i);
+	//canonical labeling
+	A.toNauty(g, M, N);
+	EMPTYGRAPH(cg, M, N);
+	densenauty(g, lab, ptn, orbits, &options, &stats, M, N, cg);
+
+	//pack the rows of the canonical graph
+	AdjBits C;
+	for (int i = 0; i < N; i++) {
+		set* row = GRAPHROW(cg, i, M);
+		for (int j = i+1; j < N; j++) {
+			if (ISELEMENT(row, j)) C.addBond(i,j,N);
+		}
+	}
+	return C;
+}
+
+void findIsomorphic(int N, int num_states, int state, Database* db, std::vector<int>& iso) {
+	//finds all states isomorphic to given state in database. stored to iso.
+	//uses the isomorphism classes the database built when it was loaded
+
+	const std::vector<int>& members = db->getIsomorphic(state);
+	for (int k = 0; k < members.size(); k++) {
+		if (members[k] < num_states) {
+			iso.push_back(members[k]);
 		}
-	} 
+	}
 }
 
 void makeNM(int N, int* M, Eigen::VectorXd x, Eigen::MatrixXd& J, Eigen::VectorXd& F) {
@@ -3,6 +3,8 @@
 #include <eigen3/Eigen/Dense>
 #include "nauty.h"
 #include "database.h"
+#include "adjBits.h"
+#include "../defines.h"
 #include <string>
 #include <vector>
 
@@ -15,13 +17,16 @@ int toIndex(int r, int c, long m);
 void index2ij(int index, int N, int& i, int& j);
 bool checkConnected(int* M, int N);
 bool checkSame(int* M1, int* M2, int N);
+bool checkConnected(const AdjBits& A, int N);
 void getAdj(double* X, int N, int* M);
 void getAdjCut(double* X, int N, int* M, double cut);
 void findIsomorphic(int N, int num_states, int state, Database* db, std::vector<int>&);
 void buildNautyGraph(int N, int M, int state, Database* db, graph* g);
 bool checkIsomorphic(int N, int M, graph* g1, graph* g2);
+AdjBits canonicalForm(int N, const AdjBits& A);
 void extractAM(int N, int state, int* AM, Database* db);
 void printAM(int N, int* AM);
+void printAM(int N, const AdjBits& A);
 void refine(int N, double* X, int* M);
 void makeNM(int N, int* M, Eigen::VectorXd x, Eigen::MatrixXd& J, Eigen::VectorXd& F);
 
@@ -30,4 +35,21 @@ double euDist(double* particles, int i, int j, int N, double* Z);
 //go from cluster array to particle array
 void c2p(double* cluster, double* particles, int N);
 
+/* dimension templated kernels, instantiated for D = 2 and 3. the loops over
+   coordinates have a fixed trip count and are fully unrolled. the plain
+   versions above use D = DIMENSION, the versions taking dim pick the
+   instantiation at runtime so one binary runs disks and spheres.
+*/
+//bonding distance in D dimensions, BOND_CUTOFF for D = DIMENSION
+template <int D> inline double bondCutoff() {return (D == 3) ? BOND_CUTOFF_3D : BOND_CUTOFF_2D;}
+inline double bondCutoff(int dim) {return (dim == 3) ? bondCutoff<3>() : bondCutoff<2>();}
+template <int D> double euDist(const double* particles, int i, int j, int N, double* Z);
+template <int D> void c2p(const double* cluster, double* particles, int N);
+template <int D> void getAdj(const double* X, int N, int* M);
+template <int D> void getAdj(const double* X, int N, AdjBits& A);
+void c2p(double* cluster, double* particles, int N, int dim);
+void getAdj(double* X, int N, int* M, int dim);
+void getAdj(const double* X, int N, AdjBits& A);
+void getAdj(const double* X, int N, AdjBits& A, int dim);
+
 }
\ No newline at end of file
@@ -7,17 +7,18 @@
 #include <fstream>
 #include <cstdlib>
 #include <iostream>
+#include <atomic>
 namespace bd {
 
 
 //state constructor
 State::State() {
-	am = NULL; coordinates = NULL; 
+	coordinates = NULL; coord_data = NULL; 
 	//P = NULL; Z = NULL; Zerr = NULL;
 	freq = 0; bond = 0; num = 0; denom = 0;
 	num_coords = 0; mfpt = 0; 
-	sigma = 0; num_neighbors = 0;
-	N = 0;
+	sigma = 0;
+	N = 0; dim = DIMENSION;
 }
 
 //state deconstructor
@@ -26,7 +27,7 @@ State::~State() {
 }
 
 void State::destroy() {
-	delete []am; delete []coordinates; 
+	delete []coordinates; 
 }
 
 void State::copy(const State& old) {
@@ -36,56 +37,316 @@ void State::copy(const State& old) {
 	sigma = old.sigma;
 	num = old.num;
 	denom = old.denom;
-	num_neighbors = old.num_neighbors;
 	num_coords = old.num_coords;
-	N = old.N;
+	N = old.N; dim = old.dim;
 
-	am = new bool[N*N];
-	for (int i = 0; i < N*N; ++i) {
-		am[i] = old.am[i];
-	}
+	am = old.am;
 
+	//copies own their coordinates, mapped ones are decoded here
+	coord_data = NULL;
 	coordinates = new Cluster[num_coords];
 	for (int i = 0; i < num_coords; ++i) {
-		coordinates[i] = old.coordinates[i];
+		coordinates[i] = old.getCoords(i);
 	}
 
 }
 
+unsigned long newGeneration() {
+	//process wide counter, safe to call from any thread
+	static std::atomic<unsigned long> counter(0);
+	return ++counter;
+}
+
 //database constructor
-Database::Database(int N_, int num_states_) {
-	N = N_; num_states = num_states_;
+Database::Database(int N_, int num_states_) : Database(N_, num_states_, DIMENSION) {
+}
+
+Database::Database(int N_, int num_states_, int dim_) {
+	N = N_; dim = dim_; num_states = capacity = num_states_;
+	generation = newGeneration();
+	mapped = NULL; mapped_size = 0;
+	row_ptr.assign(num_states+1, 0); pointRows();
 	states = new State[num_states];
 	lumpMap = new int[num_states];
 	for (int i = 0; i < num_states; i++) {
 		lumpMap[i] = i;
-		states[i].N = N;
+		states[i].N = N; states[i].dim = dim;
 	}
 }
 
 //database deconstructor
 Database::~Database() {
 	delete []states; delete []lumpMap;
+	unmapFile(mapped, mapped_size);
+}
+
+//hash every state by its adjacency matrix. the first of any duplicates is kept
+void Database::buildIndex() {
+	index.clear();
+	index.reserve(num_states);
+	for (int i = 0; i < num_states; i++) {
+		index.emplace(states[i].getAdjacency(), i);
+	}
+}
+
+//state with adjacency matrix A, -1 if not in the database
+int Database::lookup(const AdjBits& A) const {
+	std::unordered_map<AdjBits, int, AdjBitsHash>::const_iterator it = index.find(A);
+	if (it == index.end()) {
+		return -1;
+	}
+	return it->second;
+}
+
+//add a state to the end of the database, return its id
+int Database::appendState(const State& s) {
+	//grow the storage by doubling
+	if (num_states == capacity) {
+		capacity = (capacity > 0) ? 2*capacity : 1;
+		State* new_states = new State[capacity];
+		int* new_map = new int[capacity];
+		for (int i = 0; i < num_states; i++) {
+			new_states[i] = states[i];
+			new_map[i] = lumpMap[i];
+		}
+		delete []states; delete []lumpMap;
+		states = new_states; lumpMap = new_map;
+	}
+
+	int id = num_states++;
+	states[id] = s;
+	states[id].N = N; states[id].dim = dim;
+	lumpMap[id] = id;
+	ownRows();
+	row_ptr.push_back(row_ptr.back());
+	index.emplace(s.getAdjacency(), id);
+	addToIsoClass(id, canonicalForm(N, s.getAdjacency()));
+	touch();
+	return id;
+}
+
+//canonical form of every state in parallel, then group states with equal forms
+void Database::buildIsoClasses() {
+	std::vector<AdjBits> canon(num_states);
+	#pragma omp parallel for schedule(dynamic, 16)
+	for (int i = 0; i < num_states; i++) {
+		canon[i] = canonicalForm(N, states[i].getAdjacency());
+	}
+
+	isoClass.clear(); isoMembers.clear(); canonIndex.clear();
+	for (int i = 0; i < num_states; i++) {
+		addToIsoClass(i, canon[i]);
+	}
+}
+
+void Database::addToIsoClass(int state, const AdjBits& canon) {
+	//put state in the class with this canonical form, new class if first seen
+	std::pair<std::unordered_map<AdjBits, int, AdjBitsHash>::iterator, bool> it = 
+																	canonIndex.emplace(canon, (int)isoMembers.size());
+	int c = it.first->second;
+	if (it.second) {
+		isoMembers.push_back(std::vector<int>());
+	}
+	isoMembers[c].push_back(state);
+	isoClass.push_back(c);
+}
+
+//class with the given canonical form, -1 if no state has it
+int Database::findIsoClass(const AdjBits& canon) const {
+	std::unordered_map<AdjBits, int, AdjBitsHash>::const_iterator it = canonIndex.find(canon);
+	if (it == canonIndex.end()) {
+		return -1;
+	}
+	return it->second;
+}
+
+//point the row data at the owned vectors
+void Database::pointRows() {
+	col_data = col.data(); P_data = Pv.data(); Z_data = Zv.data(); Zerr_data = Zerrv.data();
+}
+
+//copy rows that live in a mapped file into the vectors before changing them
+void Database::ownRows() {
+	if (col_data == col.data()) {
+		return;
+	}
+	int nnz = row_ptr[num_states];
+	col.assign(col_data, col_data+nnz);
+	Pv.assign(P_data, P_data+nnz); Zv.assign(Z_data, Z_data+nnz);
+	Zerrv.assign(Zerr_data, Zerr_data+nnz);
+	pointRows();
 }
 
-//sum the entries of s.P
-int State::sumP() const{
-	int S = 0;
-	for (int i = 0; i < num_neighbors; i++) {
-		S += P[i].value;
+SparseRow Database::getP(int state) const {
+	int a = row_ptr[state];
+	return SparseRow(col_data+a, P_data+a, row_ptr[state+1]-a);
+}
+
+SparseRow Database::getZ(int state) const {
+	int a = row_ptr[state];
+	return SparseRow(col_data+a, Z_data+a, row_ptr[state+1]-a);
+}
+
+SparseRow Database::getZerr(int state) const {
+	int a = row_ptr[state];
+	return SparseRow(col_data+a, Zerr_data+a, row_ptr[state+1]-a);
+}
+
+//sum the entries of row P. counts, or weights for a weighted ensemble
+double Database::sumP(int state) const {
+	double S = 0;
+	for (int k = row_ptr[state]; k < row_ptr[state+1]; k++) {
+		S += P_data[k];
 	}
 	return S;
 }
 
+void Database::setRow(int state, const std::vector<Pair>& P, const std::vector<Pair>& Z,
+											const std::vector<Pair>& Zerr) {
+	//replace the row of state. Z and Zerr values are matched to P by position
+	ownRows(); touch();
+
+	int a = row_ptr[state]; int b = row_ptr[state+1];
+	int n = P.size(); int shift = n - (b-a);
+
+	//open or close the gap, then fill it
+	col.erase(col.begin()+a, col.begin()+b); Pv.erase(Pv.begin()+a, Pv.begin()+b);
+	Zv.erase(Zv.begin()+a, Zv.begin()+b); Zerrv.erase(Zerrv.begin()+a, Zerrv.begin()+b);
+	col.insert(col.begin()+a, n, 0); Pv.insert(Pv.begin()+a, n, 0.0);
+	Zv.insert(Zv.begin()+a, n, 0.0); Zerrv.insert(Zerrv.begin()+a, n, 0.0);
+	for (int k = 0; k < n; k++) {
+		col[a+k] = P[k].index; Pv[a+k] = P[k].value;
+		if (k < Z.size()) Zv[a+k] = Z[k].value;
+		if (k < Zerr.size()) Zerrv[a+k] = Zerr[k].value;
+	}
+	for (int s = state+1; s <= num_states; s++) {
+		row_ptr[s] += shift;
+	}
+	pointRows();
+}
+
+void Database::setRow(int state, const std::vector<Pair>& P) {
+	//replace the row of state, Z and Zerr set to 0
+	std::vector<Pair> none;
+	setRow(state, P, none, none);
+}
+
+void Database::getGenerator(Eigen::SparseMatrix<double, Eigen::RowMajor>& L, 
+														std::vector<int>& endStates) const {
+	/*rate matrix straight from the rows, no dense intermediate. entry (i,j) is
+	  (P_ij/S_i)/mfpt_i, the same as tpt createTransitionMatrix. the diagonal
+	  makes each row sum to 0. states with no transitions go in endStates */
+
+	std::vector<Eigen::Triplet<double> > entries;
+	entries.reserve(row_ptr[num_states] + num_states);
+	for (int i = 0; i < num_states; i++) {
+		double S = sumP(i);
+		if (S == 0) {
+			endStates.push_back(i);
+			continue;
+		}
+		double mfpt = states[i].getMFPT(); double diag = 0;
+		for (int k = row_ptr[i]; k < row_ptr[i+1]; k++) {
+			double rate = (P_data[k] / S) / mfpt;
+			entries.push_back(Eigen::Triplet<double>(i, col_data[k], rate));
+			diag += rate;
+		}
+		entries.push_back(Eigen::Triplet<double>(i, i, -diag));
+	}
+
+	L.resize(num_states, num_states);
+	L.setFromTriplets(entries.begin(), entries.end());
+}
+
 //pull a random set of coordinates from the available
-const Cluster& State::getRandomIC() const {
+Cluster State::getRandomIC() const {
 	int rand_state = rand() % num_coords;
-	return coordinates[rand_state];
+	return getCoords(rand_state);
 }
 
+//k-th sample cluster, decoded from the mapped file if there is one
+Cluster State::getCoords(int k) const {
+	if (coord_data == NULL) {
+		return coordinates[k];
+	}
+
+	Cluster c(N);
+	const double* x = coord_data + (size_t)k*dim*N;
+	for (int j = 0; j < N; j++) {
+		if (dim == 2) {
+			c[j] = Point(x[dim*j], x[dim*j+1]);
+		}
+		else {
+			c[j] = Point(x[dim*j], x[dim*j+1], x[dim*j+2]);
+		}
+	}
+	return c;
+}
+
+
+int textDimension(std::string& filename) {
+	//count the coordinates of the first state that has some. the mfpt flag is
+	//the first token after them that is not a number
+
+	std::ifstream in_str(filename);
+	int N = 0; int num_lines = 0;
+	in_str >> N >> num_lines;
+	if (!in_str || N <= 0) {
+		return DIMENSION;
+	}
+
+	std::string tok;
+	for (int k = 0; k < num_lines; k++) {
+		for (int i = 0; i < N*N+2; i++) in_str >> tok; //adjacency, freq, bond
+		int coord = 0; in_str >> coord;
+		if (!in_str) break;
+
+		long count = 0;
+		while (in_str >> tok && tok != "Y" && tok != "N") count++;
+		if (coord > 0) {
+			return (count == 2L*coord*N) ? 2 : 3;
+		}
+
+		//no coordinates, skip the rest of the state
+		if (tok == "Y") {
+			int nn = 0;
+			for (int i = 0; i < 4; i++) in_str >> tok;
+			in_str >> nn;
+			for (int i = 0; i < 4*nn; i++) in_str >> tok;
+		}
+	}
+
+	return DIMENSION;
+}
 
 //function to read in the database and store in database class
 Database* readData(std::string& filename) {
+	//binary databases are mapped, not parsed
+	if (isBinaryDB(filename)) {
+		return readBinary(filename);
+	}
+
+	return readData(filename, textDimension(filename));
+}
+
+Database* readData(std::string& filename, int dim) {
+	//binary databases know their dimension, check it agrees
+	if (isBinaryDB(filename)) {
+		Database* database = readBinary(filename);
+		if (database != NULL && database->getDimension() != dim) {
+			fprintf(stderr, "Database %s has dimension %d, not %d\n", filename.c_str(),
+							database->getDimension(), dim);
+			delete database;
+			return NULL;
+		}
+		return database;
+	}
+
+	if (dim != 2 && dim != 3) {
+		fprintf(stderr, "Dimension %d is not supported\n", dim);
+		return NULL;
+	}
+
 	std::ifstream in_str(filename);
 
 	//check if the file can be opened
@@ -109,21 +370,31 @@ Database* readData(std::string& filename) {
 	double x, y, z; //coordinates in a point
 	char extra; //flag for whether mfpt estimates are in file
 	int v1; double v2; //storing index and info in a pair
+	int num_neighbors; //entries in the row of a state
 	double v3; double v4;
 
+	//the packed adjacency holds at most ADJ_MAX_N particles
+	if (N > ADJ_MAX_N) {
+		fprintf(stderr, "Database %s has %d particles, at most %d supported\n", 
+						filename.c_str(), N, ADJ_MAX_N);
+		return NULL;
+	}
+
 	//call the database class constructor
-	Database* database = new Database(N, num_lines);
+	Database* database = new Database(N, num_lines, dim);
 
 	//fill the database state classes
 	while (in_str >> val) {
 		//create reference to state, database[index]
 		State& s = (*database)[index];
 
-		//fill in adjacency matrix
-		s.am = new bool[N*N];
-		s.am[0] = val;
-		for (int i = 1; i < N*N; i++) {
-			in_str >> s.am[i];
+		//fill in adjacency matrix, entry (i,j) is at toIndex(i,j,N)
+		s.am.clear();
+		bool b = val;
+		for (int i = 0; i < N*N; i++) {
+			if (i > 0) in_str >> b;
+			int r, c; index2ij(i, N, r, c);
+			if (b && r < c) s.am.addBond(r,c,N);
 		}
 
 		//fill in frequency, bonds, and coords
@@ -137,13 +408,14 @@ Database* readData(std::string& filename) {
 		for (int i = 0; i < coord; i++) {
 			s.coordinates[i].setNumPoints(N);
 			for (int j = 0; j < N; j++) {
-#if (DIMENSION == 2)
-				in_str >> x >> y;
-				s.coordinates[i][j] = Point(x,y);
-#elif (DIMENSION == 3)
-				in_str >> x >> y >> z;
-				s.coordinates[i][j] = Point(x,y,z);
-#endif
+				if (dim == 2) {
+					in_str >> x >> y;
+					s.coordinates[i][j] = Point(x,y);
+				}
+				else {
+					in_str >> x >> y >> z;
+					s.coordinates[i][j] = Point(x,y,z);
+				}
 			}
 		}
 
@@ -154,45 +426,50 @@ Database* readData(std::string& filename) {
 			s.denom = 0;
 			s.mfpt = 0;
 			s.sigma = 0;
-			s.num_neighbors = 0;
 		}
 		else if (extra == 'Y') {//mfpt estimates exist, read in
 			in_str >> s.num;
 			in_str >> s.denom;
 			in_str >> s.mfpt;
 			in_str >> s.sigma; 
-			in_str >> s.num_neighbors;
+			in_str >> num_neighbors;
 
-			for (int i = 0; i < s.num_neighbors; i ++) {
+			//states come in order, so the rows are appended to the csr arrays
+			for (int i = 0; i < num_neighbors; i ++) {
 				in_str >> v1; in_str >> v2; in_str >> v3; in_str >> v4;
-				s.P.push_back(Pair(v1,v2));
-				s.Z.push_back(Pair(v1,v3));
-				s.Zerr.push_back(Pair(v1,v4));
+				database->col.push_back(v1); database->Pv.push_back(v2);
+				database->Zv.push_back(v3); database->Zerrv.push_back(v4);
 			}
 		}
+		database->row_ptr[index+1] = database->col.size();
 
 		//next state
 		index++; 
 	}
 	in_str.close();
+	for (int i = index+1; i <= num_lines; i++) {
+		database->row_ptr[i] = database->col.size();
+	}
+	database->pointRows();
+	database->buildIndex();
+	database->buildIsoClasses();
 	return database;
 }
 
 //write functions to output the updated database to a file
-std::ostream& State::print(std::ostream& out_str, int N, int* lumpMap) const {
+std::ostream& State::print(std::ostream& out_str, int N, int* lumpMap, const SparseRow& P) const {
 	for (int i = 0; i < N*N; i++) {
-		out_str << am[i] << ' ';
+		int r, c; index2ij(i, N, r, c);
+		out_str << am.test(r,c,N) << ' ';
 	}
 	out_str << freq << ' ';
 	out_str << bond << ' ';
 	out_str << num_coords << ' ';
 	for (int i = 0; i < num_coords; i++) {
+		Cluster c = getCoords(i);
 		for (int j = 0; j < N; j++) {
-#if (DIMENSION == 2)
-			out_str << coordinates[i][j].x << ' ' << coordinates[i][j].y << ' ';
-#elif (DIMENSION == 3)
-			out_str << coordinates[i][j].x << ' ' << coordinates[i][j].y << ' ' << coordinates[i][j].z << ' ';
-#endif
+			out_str << c[j].x << ' ' << c[j].y << ' ';
+			if (dim == 3) out_str << c[j].z << ' ';
 		}
 	}
 	out_str << "Y" << ' ';
@@ -200,14 +477,14 @@ std::ostream& State::print(std::ostream& out_str, int N, int* lumpMap) const {
 	out_str << denom << ' ';
 	out_str << mfpt << ' ';
 	out_str << sigma << ' ';
-	out_str << num_neighbors << ' ';
-	for (int i = 0; i < num_neighbors; i ++) {
-		out_str << lumpMap[P[i].index] << ' ' << P[i].value << ' ';
+	out_str << P.size << ' ';
+	for (int i = 0; i < P.size; i ++) {
+		out_str << lumpMap[P.index[i]] << ' ' << P.value[i] << ' ';
 		out_str << 0 << ' ' << 0 << ' ';
 	}
 	
 	out_str << '\n';
-	
+	return out_str;
 }
 
 std::ostream& operator<<(std::ostream& out_str, const Database& db) {
@@ -215,15 +492,20 @@ std::ostream& operator<<(std::ostream& out_str, const Database& db) {
 
 	//check if any states are being purged
 	int num_purge = db.toPurge.size();
+	std::vector<bool> purged(db.num_states, false);
+	for (int k = 0; k < num_purge; k++) {
+		purged[db.toPurge[k]] = true;
+	}
 
 	//print the non-purged states
 	out_str << db.N << '\n';
 	out_str << db.num_states - num_purge << '\n';
 	for (int i = 0; i < db.num_states; i++) {
-		if (std::find(db.toPurge.begin(), db.toPurge.end(), i) == db.toPurge.end()) {
-			db[i].print(out_str, db.N, db.lumpMap);
+		if (!purged[i]) {
+			db[i].print(out_str, db.N, db.lumpMap, db.getP(i));
 		}
 	}
+	return out_str;
 }
 
 
@@ -239,23 +521,24 @@ void makeNM(int N, int state, Database* db, Eigen::VectorXd x, Eigen::MatrixXd&
 	double XD, YD;
 	double ZD = 0;
 	int count = 0;
+	int dim = db->getDimension();
 
 	//loop over and construct system
 	for (int i = 0; i < N; i ++) {
 		for (int j = i+1; j < N; j++) {
 			if ((*db)[state].isInteracting(i,j,N)) {
-				XD = x(DIMENSION*i) - x(DIMENSION*j);
-				YD = x(DIMENSION*i+1) - x(DIMENSION*j+1);
-#if (DIMENSION == 3)
-				ZD = x(DIMENSION*i+2) - x(DIMENSION*j+2);
-#endif
+				XD = x(dim*i) - x(dim*j);
+				YD = x(dim*i+1) - x(dim*j+1);
+				if (dim == 3) {
+					ZD = x(dim*i+2) - x(dim*j+2);
+				}
 
 				F(count) = XD*XD + YD*YD + ZD*ZD -1.0;
-				J(count, DIMENSION*i) = 2*XD; J(count, DIMENSION*j) = -2*XD;
-				J(count, DIMENSION*i+1) = 2*YD; J(count, DIMENSION*j+1) = -2*YD;
-#if (DIMENSION == 3) 
-				J(count, DIMENSION*i+2) = 2*ZD; J(count, DIMENSION*j+2) = -2*ZD;
-#endif
+				J(count, dim*i) = 2*XD; J(count, dim*j) = -2*XD;
+				J(count, dim*i+1) = 2*YD; J(count, dim*j+1) = -2*YD;
+				if (dim == 3) {
+					J(count, dim*i+2) = 2*ZD; J(count, dim*j+2) = -2*ZD;
+				}
 				count += 1;
 			}
 		}
@@ -281,21 +564,22 @@ bool checkPhysicalState(int N, int state, Database* db) {
 
 	//get the number of bonds
 	int b = (*db)[state].getBonds(); 
+	int dim = db->getDimension();
 
 	//initialize the matrix and vectors
-	Eigen::MatrixXd J(b,DIMENSION*N); 
+	Eigen::MatrixXd J(b,dim*N); 
 	Eigen::VectorXd F(b); 
-	Eigen::VectorXd dx(DIMENSION*N);  
-	Eigen::VectorXd x(DIMENSION*N); 
+	Eigen::VectorXd dx(dim*N);  
+	Eigen::VectorXd x(dim*N); 
 
 	//initialize x. fill others with zeros.
 	const Cluster& xc = (*db)[state].getRandomIC();
 	for (int i = 0; i < N; i++) {
-		x(DIMENSION*i) = xc.points[i].x; 
-		x(DIMENSION*i+1) = xc.points[i].y;
-#if (DIMENSION == 3)
-		x(DIMENSION*i+2) = xc.points[i].z;
-#endif
+		x(dim*i) = xc.points[i].x; 
+		x(dim*i+1) = xc.points[i].y;
+		if (dim == 3) {
+			x(dim*i+2) = xc.points[i].z;
+		}
 	}
 	dx.fill(0.0); F.fill(0.0); J.fill(0.0);
 
@@ -349,25 +633,15 @@ bool checkPhysicalState(int N, int state, Database* db) {
 	densenauty(g1, lab1, ptn, orbits, &options, &stats, M, N, cg1);
 
 	//get adjacnecy matrix of post newton state
-	int* AM = new int[N*N]; for (int i = 0; i < N*N; i++) AM[i] = 0;
-	double* X = new double[DIMENSION*N]; for (int i = 0; i < DIMENSION*N; i++) X[i]=x(i);
-	getAdj(X, N, AM);
+	AdjBits AM;
+	double* X = new double[dim*N]; for (int i = 0; i < dim*N; i++) X[i]=x(i);
+	getAdj(X, N, AM, dim);
 
 	//make graph
-	//zero out any pre-existing graph
-	EMPTYGRAPH(g2, M, N); 
-
-	//add edges for every non-zero entry in adjacnecy matrix
-	for (int i = 0; i < N; i++) {
-		for (int j = i+1; j < N; j++) {
-			if (AM[toIndex(i,j,N)] == 1) {
-				ADDONEEDGE(g2, i, j, M);
-			}
-		}
-	} 
+	AM.toNauty(g2, M, N);
 
 	//free memory
-	delete []X; delete []AM;
+	delete []X;
 
 	//build nauty graph of the old state, get canonical labeling
 	EMPTYGRAPH(cg2, M, N);
@@ -434,20 +708,19 @@ void combinePairs(std::vector<Pair>& p1, std::vector<Pair> p2) {
 	}
 }
 
-void getMinIndex(int N, int ns, std::vector<Pair> P, Database* db, 
+void getMinIndex(int N, int ns, const SparseRow& P, Database* db, 
 									std::vector<int>& iso, std::vector<Pair>& isoPair ) {
 
 	isoPair.clear();
 
-	for (int j = 0; j < P.size(); j++) {
-			iso.clear();
-			findIsomorphic(N, ns, P[j].index, db, iso);
-			int min_iso = *std::min_element(iso.begin(), iso.end());
-			isoPair.push_back(Pair(min_iso, P[j].value));
+	//members of a class are ascending, the first is the min
+	for (int j = 0; j < P.size; j++) {
+			int min_iso = db->getIsomorphic(P.index[j])[0];
+			isoPair.push_back(Pair(min_iso, P.value[j]));
 		}
 }
 
-void lumpEntries(Database* db, int state, std::vector<int> perms) {
+void lumpEntries(Database* db, int state, const std::vector<int>& perms) {
 	//updates the entries of the lumped state //todo Z and Zerr
 
 	int N = db->getN(); int ns = db->getNumStates();
@@ -461,9 +734,7 @@ void lumpEntries(Database* db, int state, std::vector<int> perms) {
 	double dt = mfpt * denom / num;
 
 	//state dependent quantities
-	std::vector<Pair> P = (*db)[state].getP();
-	std::vector<Pair> Z = (*db)[state].getZ();
-	std::vector<Pair> Zerr = (*db)[state].getZerr();
+	SparseRow P = db->getP(state);
 
 	//isomorphism vectors
 	std::vector<int> iso;
@@ -492,9 +763,7 @@ void lumpEntries(Database* db, int state, std::vector<int> perms) {
 
 		//update state dependent quantities
 		//get quantities for states getting lumped
-		std::vector<Pair> P2 = (*db)[perms[i]].getP();
-		std::vector<Pair> Z2 = (*db)[perms[i]].getZ();
-		std::vector<Pair> Zerr2 = (*db)[perms[i]].getZerr();
+		SparseRow P2 = db->getP(perms[i]);
 
 		//compute the minimum index of this states isomorphisms
 		getMinIndex(N, ns, P2, db, iso, isoPair);
@@ -511,57 +780,40 @@ void lumpEntries(Database* db, int state, std::vector<int> perms) {
 	(*db)[state].denom = denom;
 	(*db)[state].mfpt = mfpt;
 	(*db)[state].sigma = sigma*mfpt*mfpt;
-	(*db)[state].num_neighbors = Pnew.size();
-	(*db)[state].P = Pnew;
-	(*db)[state].Z = Z; // todo
-	(*db)[state].Zerr = Zerr;// todo
+	db->setRow(state, Pnew); //todo Z and Zerr
 		
 
 }
 
 
 void lumpPerms(Database* db) {
-	//loop over states, lump perms, get vector of repeated states
+	//loop over isomorphism classes, lump perms into the lowest state of each
 
-	int N = db->getN(); int ns = db->getNumStates();
+	int ns = db->getNumStates();
 	std::vector<int> repeated; repeated.clear();
-	std::vector<int> perms; perms.clear();
-	int* lumpMap = new int[ns]; 
-
-	int count = 0;
 
+	//classes are numbered by their lowest state, so the class is the lumped index
 	for (int i = 0; i < ns; i++) {
-		//check that i is not in repeated list
-		if (std::find(repeated.begin(), repeated.end(), i) == repeated.end()) {
-			//find iso states, lump them together
-			findIsomorphic(N, ns, i, db, perms);
-			printf("State %d is a permutation of state ", i);
-			lumpEntries(db, i, perms);
-			printf("\n");
-			//add to repeated vector, so they are not called twice
-			repeated.insert(repeated.end(), perms.begin()+1, perms.end());
-			//update lumpMap
-			for (int j = 0; j < perms.size(); j++) {
-				lumpMap[perms[j]] = count;
-			}
-			count += 1;
-			//clear perms vector
-			perms.clear();
-		}
+		db->lumpMap[i] = db->getIsoClass(i);
 	}
-	//store the purge vector
-	db->toPurge = repeated;
-	
-	//store lumpMap in DB
-	for (int i = 0; i < ns; i++) {
-		db->lumpMap[i] = lumpMap[i];
+
+	for (int c = 0; c < db->getNumIsoClasses(); c++) {
+		const std::vector<int>& perms = db->getIsoMembers(c);
+		int i = perms[0];
+		//lump the class together
+		printf("State %d is a permutation of state ", i);
+		lumpEntries(db, i, perms);
+		printf("\n");
+		//every other member is purged
+		repeated.insert(repeated.end(), perms.begin()+1, perms.end());
 	}
 
-	//free memory
-	delete []lumpMap;
+	//store the purge vector
+	db->toPurge = repeated;
+	db->touch();
 }
 
-void lumpEntries(Database* db, int state, std::vector<int> perms, bool quiet) {
+void lumpEntries(Database* db, int state, const std::vector<int>& perms, bool quiet) {
 	//updates the entries of the lumped state //todo Z and Zerr
 
 	int N = db->getN(); int ns = db->getNumStates();
@@ -575,9 +827,7 @@ void lumpEntries(Database* db, int state, std::vector<int> perms, bool quiet) {
 	double dt = mfpt * denom / num;
 
 	//state dependent quantities
-	std::vector<Pair> P = (*db)[state].getP();
-	std::vector<Pair> Z = (*db)[state].getZ();
-	std::vector<Pair> Zerr = (*db)[state].getZerr();
+	SparseRow P = db->getP(state);
 
 	//isomorphism vectors
 	std::vector<int> iso;
@@ -607,9 +857,7 @@ void lumpEntries(Database* db, int state, std::vector<int> perms, bool quiet) {
 
 		//update state dependent quantities
 		//get quantities for states getting lumped
-		std::vector<Pair> P2 = (*db)[perms[i]].getP();
-		std::vector<Pair> Z2 = (*db)[perms[i]].getZ();
-		std::vector<Pair> Zerr2 = (*db)[perms[i]].getZerr();
+		SparseRow P2 = db->getP(perms[i]);
 
 		//compute the minimum index of this states isomorphisms
 		getMinIndex(N, ns, P2, db, iso, isoPair);
@@ -626,55 +874,38 @@ void lumpEntries(Database* db, int state, std::vector<int> perms, bool quiet) {
 	(*db)[state].denom = denom;
 	(*db)[state].mfpt = mfpt;
 	(*db)[state].sigma = sigma*mfpt*mfpt;
-	(*db)[state].num_neighbors = Pnew.size();
-	(*db)[state].P = Pnew;
-	(*db)[state].Z = Z; // todo
-	(*db)[state].Zerr = Zerr;// todo
+	db->setRow(state, Pnew); //todo Z and Zerr
 		
 
 }
 
 void lumpPerms(Database* db, bool quiet) {
-	//loop over states, lump perms, get vector of repeated states
+	//loop over isomorphism classes, lump perms into the lowest state of each
 
-	int N = db->getN(); int ns = db->getNumStates();
+	int ns = db->getNumStates();
 	std::vector<int> repeated; repeated.clear();
-	std::vector<int> perms; perms.clear();
-	int* lumpMap = new int[ns]; 
-
-	int count = 0;
 
+	//classes are numbered by their lowest state, so the class is the lumped index
 	for (int i = 0; i < ns; i++) {
-		//check that i is not in repeated list
-		if (std::find(repeated.begin(), repeated.end(), i) == repeated.end()) {
-			//find iso states, lump them together
-			findIsomorphic(N, ns, i, db, perms);
-			if (!quiet)
-				printf("State %d is a permutation of state ", i);
-			lumpEntries(db, i, perms, quiet);
-			if (!quiet)
-				printf("\n");
-			//add to repeated vector, so they are not called twice
-			repeated.insert(repeated.end(), perms.begin()+1, perms.end());
-			//update lumpMap
-			for (int j = 0; j < perms.size(); j++) {
-				lumpMap[perms[j]] = count;
-			}
-			count += 1;
-			//clear perms vector
-			perms.clear();
-		}
+		db->lumpMap[i] = db->getIsoClass(i);
 	}
-	//store the purge vector
-	db->toPurge = repeated;
-	
-	//store lumpMap in DB
-	for (int i = 0; i < ns; i++) {
-		db->lumpMap[i] = lumpMap[i];
+
+	for (int c = 0; c < db->getNumIsoClasses(); c++) {
+		const std::vector<int>& perms = db->getIsoMembers(c);
+		int i = perms[0];
+		//lump the class together
+		if (!quiet)
+			printf("State %d is a permutation of state ", i);
+		lumpEntries(db, i, perms, quiet);
+		if (!quiet)
+			printf("\n");
+		//every other member is purged
+		repeated.insert(repeated.end(), perms.begin()+1, perms.end());
 	}
 
-	//free memory
-	delete []lumpMap;
+	//store the purge vector
+	db->toPurge = repeated;
+	db->touch();
 }
 
 void combineMFPTdata(Database* db1, Database* db2) {
@@ -695,15 +926,13 @@ void combineMFPTdata(Database* db1, Database* db2) {
 			double sigma = 1.0/S * sqrt(1.0/v1 + 1.0/v2);
 
 			//combine the hit counts via pairs
-			std::vector<Pair> p1 = (*db1)[state].getP();
-			std::vector<Pair> p2 = (*db2)[state].getP();
-			combinePairs(p1, p2);
+			std::vector<Pair> p1 = db1->getP(state).pairs();
+			combinePairs(p1, db2->getP(state).pairs());
 
 			//add back to database 1
 			(*db1)[state].mfpt = mfpt;
 			(*db1)[state].sigma = sigma;
-			(*db1)[state].num_neighbors = p1.size();
-			(*db1)[state].P = p1;
+			db1->setRow(state, p1);
 
 			//print out message giving old and new errors
 			printf("Old errors: %f and %f. New Error: %f. Relative Error %f \n", 
@@ -723,14 +952,12 @@ void combineHittingData(Database* db1, Database* db2) {
 		//get new mfpt and error bar estimate - minimize var of a linear combination
 		
 		//combine the hit counts via pairs
-		std::vector<Pair> p1 = (*db1)[state].getP();
-		std::vector<Pair> p2 = (*db2)[state].getP();
-		combinePairs(p1, p2);
+		std::vector<Pair> p1 = db1->getP(state).pairs();
+		combinePairs(p1, db2->getP(state).pairs());
 
 
 		//add back to database 1
-		(*db1)[state].num_neighbors = p1.size();
-		(*db1)[state].P = p1;
+		db1->setRow(state, p1);
 	}
 }
 
@@ -760,26 +987,26 @@ void printProbs(Database* db1, Database* db2) {
 	//loop over the states and combine estimates
 	for (int state = 0; state < ns; state++) {
 		//get mfpt estimates
-		int S1 = (*db1)[state].sumP();
-		int S2 = (*db2)[state].sumP();
+		double S1 = db1->sumP(state);
+		double S2 = db2->sumP(state);
 
-		std::vector<Pair> p1 = (*db1)[state].getP();
-		std::vector<Pair> p2 = (*db2)[state].getP();
+		std::vector<Pair> p1 = db1->getP(state).pairs();
+		std::vector<Pair> p2 = db2->getP(state).pairs();
 
 		printf("State %d transition probabilities\n", state);
 
 		for (int i = 0; i < p1.size(); i++) {
-			int index = p1[i].index; int val1 = p1[i].value;
-			int val2 = -1;
+			int index = p1[i].index; double val1 = p1[i].value;
+			double val2 = -1;
 			for (int j = 0; j < p2.size(); j++) {
 				if (p2[j].index == index) {
 					val2 = p2[j].value;
 					break;
 				}
 			}
-			double prob1 = float(val1)/float(S1);
-			double prob2 = float(val2)/float(S2);
-			double diff = abs(prob2-prob1);
+			double prob1 = val1/S1;
+			double prob2 = val2/S2;
+			double diff = fabs(prob2-prob1);
 
 			printf("%d, %f, %f, Difference = %f\n", index, prob1, prob2, diff);
 		}
@@ -792,16 +1019,14 @@ int findMatch(std::string identity, Database* db) {
 	//Note: 1 in identity string -> bond
 
 	//make adjacency matrix for identity
-	int N = db->getN(); int ns = db->getNumStates(); 
-	int* AM = new int[N*N]; int* M = new int[N*N];
-	for (int i = 0; i < N*N; i++) AM[i]  = 0;
+	int N = db->getN();
+	AdjBits AM;
 
 	//fill AM by looping over identity
 	int particle1 = 0; int particle2 = 1;
 	for (char & c : identity) {
     if (c == '1') {
-    	AM[toIndex(particle1, particle2, N)] = 1;
-    	AM[toIndex(particle2, particle1, N)] = 1;
+    	AM.addBond(particle1, particle2, N);
     	particle2++;
     }
     if (c == '2') {
@@ -813,19 +1038,8 @@ int findMatch(std::string identity, Database* db) {
     }
 	}
 
-	//loop over the db and compare adjacency matrices
-	for (int i = 0; i < ns; i++) {
-		extractAM(N,i,M,db);
-		bool same = checkSame(AM,M,N);
-		if (same) {
-			delete []AM; delete []M;
-			return i;
-		}
-	}
-
-	//return -1 if the state could not be found
-	delete []AM; delete []M;
-	return -1;
+	//look up the adjacency matrix, -1 if the state could not be found
+	return db->lookup(AM);
 }
 
 void updateFreq(Database* db, std::string filename) {
@@ -2,30 +2,51 @@
 #include "point.h"
 #include "pair.h"
 #include "adjacency.h"
+#include "adjBits.h"
 #include "nauty.h"
 #include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/Sparse>
 #include <vector>
 #include <string>
+#include <unordered_map>
 
 /*database structure to store all states.
 	  N - number of particles in system
+		dim - spatial dimension of the coordinates, 2 or 3. read from the file,
+		      so one build handles disks and spheres
 		num_states - number of known states
 		toPurge - states to not include when writing database to a new file
 		lumpMap - a mapping of all original states to a new index upon lumping
+		index - hash map from adjacency matrix to state id. built by readData,
+		        kept current by appendState. lookup returns -1 for unknown states
+		isoClass - isomorphism class of each state. states are grouped by their
+		           canonical nauty labeling, computed once per state. classes are
+		           numbered in order of their lowest state, members stored ascending
+		rows - P, Z and Zerr of every state in one CSR structure. row s holds
+		       entries row_ptr[s] to row_ptr[s+1]. getP/getZ/getZerr give read only
+		       views, setRow replaces a row. for a binary database the arrays point
+		       into the mapped file until the first write
+		generation - changes whenever rows or states are replaced, added or lumped.
+		             numbers come from one process wide counter, so no two
+		             databases (or versions of one) share a generation. caches
+		             built from a database are keyed on it, not on its address
 
 	state structure to store all info about a state.
-		am - adjacency matrix for the state - N by N
+		am - adjacency matrix for the state, packed upper triangle. read and written as N by N
 		freq - the frequency of the state during a bd simulation
 		bond - the number of bonds the state has
-		coordinates - an array of sample coordinates in the state - unknown by 2*N;
+		coordinates - an array of sample coordinates in the state - unknown by dim*N;
+		              states read from a binary database leave this empty and decode
+		              clusters from the mapped file on demand
 		num - the numerator in an mfpt estimator
 		denom - the denominator in an mfpt estimator
 		mfpt - num/den*delta_t
 		sigma - standard deviation of the mfpt estimate
 		num_neighbors - number of states that this state talks to
-		P - un-normalized tranisition probabilities. stored sparsely in pairs
-		Z - ratio of partition functions. sparse pair storage
-		Zerr - standard deviation of partition function estimate
+		P - un-normalized tranisition probabilities, counts or weights. stored in
+		    the database rows
+		Z - ratio of partition functions. stored in the database rows
+		Zerr - standard deviation of partition function estimate. database rows
 
 		values appear in this order when reading and writing to file.
 
@@ -35,6 +56,9 @@ namespace bd {
 
 class Database;
 
+//a number no database in this process has had, see Database::generation
+unsigned long newGeneration();
+
 class State{
 	public:
 		State();
@@ -54,41 +78,39 @@ class State{
 		
 		//friends
 		friend Database* readData(std::string& filename);
+		friend Database* readData(std::string& filename, int dim);
+		friend Database* readBinary(const std::string& filename);
 		friend void buildEmptyDB(int N);
-		friend void addState(int N, double* X, int* AM, std::vector<State>& new_states);
+		friend void addState(int N, double* X, const AdjBits& AM, Database* db);
 		friend void addToDB(int N, Database* db);
 
 		//accessor functions
 		double getFrequency() const {return freq;}
 		int getBonds() const {return bond;}
 		int getNumCoords() const {return num_coords;}
-		const Cluster& getRandomIC() const;
-		bool isInteracting(int i, int j, int N) const {return am[i*N+j];}
+		Cluster getRandomIC() const;
+		Cluster getCoords(int k) const;
+		bool isInteracting(int i, int j, int N) const {return am.test(i,j,N);}
+		const AdjBits& getAdjacency() const {return am;}
 		int getNumerator() const {return num;}
 		int getDenominator() const {return denom;}
 		double getMFPT() const {return mfpt;}
 		double getSigma() const {return sigma;}
-		int sumP() const;
-		std::vector<Pair> getP() const {return P;}
-		std::vector<Pair> getZ() const {return Z;}
-		std::vector<Pair> getZerr() const {return Zerr;}
 
 		//quantities to update
 		int num, denom;
-		int num_neighbors;
 		double freq, mfpt, sigma;
-		//Pair* P; Pair* Z; Pair* Zerr;
-		std::vector<Pair> P; std::vector<Pair> Z; std::vector<Pair> Zerr;
-		int N;
+		int N, dim;
 
-		//print function
-		std::ostream& print(std::ostream&, int, int*) const;
+		//print function, P is the state's row in the database
+		std::ostream& print(std::ostream&, int, int*, const SparseRow& P) const;
 
 	private:
 		int bond;
-		bool* am; 
+		AdjBits am; 
 		int num_coords; 
 		Cluster* coordinates; 
+		const double* coord_data;
 
 		//copy constructors
 		void destroy();
@@ -98,6 +120,7 @@ class State{
 class Database {
 	public:
 		Database(int N_, int num_states_); 
+		Database(int N_, int num_states_, int dim_); 
 		~Database();
 		State& operator[](int index) {return states[index];}
 		const State& operator[](int index) const {return states[index];}
@@ -108,10 +131,58 @@ class Database {
 
 		//accessor functions
 		int getN() const {return N;}
+		int getDimension() const {return dim;}
 		int getNumStates() const {return num_states;}
+		unsigned long getGeneration() const {return generation;}
+
+		//mark the database as changed, gives it a new generation
+		void touch() {generation = newGeneration();}
+
+		//state lookup by adjacency matrix
+		void buildIndex();
+		int lookup(const AdjBits& A) const;
+		int appendState(const State& s);
+
+		//isomorphism classes
+		void buildIsoClasses();
+		int getIsoClass(int state) const {return isoClass[state];}
+		int getNumIsoClasses() const {return isoMembers.size();}
+		const std::vector<int>& getIsoMembers(int c) const {return isoMembers[c];}
+		const std::vector<int>& getIsomorphic(int state) const {return isoMembers[isoClass[state]];}
+		int findIsoClass(const AdjBits& canon) const;
+
+		//sparse transition data
+		SparseRow getP(int state) const;
+		SparseRow getZ(int state) const;
+		SparseRow getZerr(int state) const;
+		int getNumNeighbors(int state) const {return row_ptr[state+1]-row_ptr[state];}
+		double sumP(int state) const;
+		void setRow(int state, const std::vector<Pair>& P, const std::vector<Pair>& Z,
+								const std::vector<Pair>& Zerr);
+		void setRow(int state, const std::vector<Pair>& P);
+		void getGenerator(Eigen::SparseMatrix<double, Eigen::RowMajor>& L, 
+											std::vector<int>& endStates) const;
 
 	private:	
-		int N; int num_states; State* states; 
+		int N; int dim; int num_states; int capacity; State* states; 
+		unsigned long generation;
+		std::unordered_map<AdjBits, int, AdjBitsHash> index;
+		std::vector<int> isoClass; std::vector<std::vector<int> > isoMembers;
+		std::unordered_map<AdjBits, int, AdjBitsHash> canonIndex;
+
+		void addToIsoClass(int state, const AdjBits& canon);
+
+		//csr rows. the data pointers are the vectors, or the mapped file
+		std::vector<int> row_ptr; std::vector<int> col;
+		std::vector<double> Pv, Zv, Zerrv;
+		const int* col_data; const double* P_data; const double* Z_data; const double* Zerr_data;
+		void ownRows();
+		void pointRows();
+		friend Database* readData(std::string& filename, int dim);
+
+		//read only mapping of a binary database file, NULL for text databases
+		void* mapped; size_t mapped_size;
+		friend Database* readBinary(const std::string& filename);
 
 		//copy constructors - restricts compiling when user tries to copy a database
 		Database(const Database&) {
@@ -124,10 +195,26 @@ class Database {
 };
 
 
-//read/write data functions
+//read/write data functions. without dim, a text database gets the dimension
+//from the length of its first state with coordinates
 Database* readData(std::string& filename);
+Database* readData(std::string& filename, int dim);
+int textDimension(std::string& filename);
 std::ostream& operator<<(std::ostream&, const Database&);
 
+/* binary database format. a fixed header, one fixed size record per state,
+   then the sample coordinates (dim doubles per particle) and the
+   P/Z/Zerr rows as parallel arrays. the file is mapped read only, so several
+   processes on a node share one copy in the page cache. readData detects the
+   format from the magic bytes. bump DB_VERSION whenever the layout changes.
+*/
+const char DB_MAGIC[8] = {'C','P','F','O','L','D','D','B'};
+const int DB_VERSION = 1;
+bool isBinaryDB(const std::string& filename);
+Database* readBinary(const std::string& filename);
+bool writeBinary(const Database& db, const std::string& filename);
+void unmapFile(void* data, size_t size);
+
 //searching db
 void findState(Database* db, int num_bonds, std::string* bonds, int bond_cons);
 
@@ -140,11 +227,11 @@ void purgeUnphysical(Database* db);
 
 //functions to lump permutations together in the database
 void combinePairs(std::vector<Pair>& p1, std::vector<Pair> p2);
-void lumpEntries(Database* db, int state, std::vector<int> perms);
-void lumpEntries(Database* db, int state, std::vector<int> perms, bool quiet);
+void lumpEntries(Database* db, int state, const std::vector<int>& perms);
+void lumpEntries(Database* db, int state, const std::vector<int>& perms, bool quiet);
 void lumpPerms(Database* db);
 void lumpPerms(Database* db, bool quiet);
-void getMinIndex(int N, int ns, std::vector<Pair> P, Database* db, 
+void getMinIndex(int N, int ns, const SparseRow& P, Database* db, 
 									std::vector<int>& iso, std::vector<Pair>& isoPair );
 
 //map outside structures to my structures
@@ -0,0 +1,222 @@
+#include "database.h"
+#include "../defines.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fstream>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+namespace bd {
+
+/* on disk layout of a binary database, version 1. all offsets are in bytes
+   from the start of the file and every section starts 8 byte aligned.
+   pair rows of state s are entries [pair_offset, pair_offset+num_neighbors)
+   of the four pair arrays. coordinates of state s start at double number
+   coord_offset of the coordinate section.
+*/
+struct DBHeader {
+	char magic[8];
+	int32_t version, N, dim, adj_words;
+	int32_t num_states, pad;
+	int64_t num_coords, num_pairs;
+	int64_t records, coords, pair_index, pair_P, pair_Z, pair_Zerr;
+};
+
+struct DBRecord {
+	uint64_t am[ADJ_WORDS];
+	double freq, mfpt, sigma;
+	int32_t bond, num_coords, num, denom, num_neighbors, pad;
+	int64_t coord_offset, pair_offset;
+};
+
+void unmapFile(void* data, size_t size) {
+	if (data != NULL) {
+		munmap(data, size);
+	}
+}
+
+bool isBinaryDB(const std::string& filename) {
+	//check the first bytes of the file for the magic string
+	char magic[8];
+	FILE* f = fopen(filename.c_str(), "rb");
+	if (f == NULL) {
+		return false;
+	}
+	size_t got = fread(magic, 1, 8, f);
+	fclose(f);
+	return got == 8 && memcmp(magic, DB_MAGIC, 8) == 0;
+}
+
+Database* readBinary(const std::string& filename) {
+	//map a binary database read only. coordinates stay in the mapping
+
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open file %s\n", filename.c_str());
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(DBHeader)) {
+		fprintf(stderr, "File %s is too short to be a database\n", filename.c_str());
+		close(fd);
+		return NULL;
+	}
+	size_t size = st.st_size;
+	void* data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "Cannot map file %s\n", filename.c_str());
+		return NULL;
+	}
+
+	//check the header matches this build
+	const char* base = (const char*)data;
+	const DBHeader* h = (const DBHeader*)base;
+	if (memcmp(h->magic, DB_MAGIC, 8) != 0 || h->version != DB_VERSION) {
+		fprintf(stderr, "File %s is not a version %d database\n", filename.c_str(), DB_VERSION);
+		munmap(data, size);
+		return NULL;
+	}
+	if ((h->dim != 2 && h->dim != 3) || h->adj_words != ADJ_WORDS || h->N > ADJ_MAX_N) {
+		fprintf(stderr, "Database %s has dimension %d, N = %d. This build supports N <= %d\n",
+						filename.c_str(), h->dim, h->N, ADJ_MAX_N);
+		munmap(data, size);
+		return NULL;
+	}
+	if ((size_t)h->pair_Zerr + h->num_pairs*sizeof(double) > size) {
+		fprintf(stderr, "Database %s is truncated\n", filename.c_str());
+		munmap(data, size);
+		return NULL;
+	}
+
+	int N = h->N; int ns = h->num_states;
+	const DBRecord* rec = (const DBRecord*)(base + h->records);
+	const double* coords = (const double*)(base + h->coords);
+	const int32_t* pi = (const int32_t*)(base + h->pair_index);
+	const double* pP = (const double*)(base + h->pair_P);
+	const double* pZ = (const double*)(base + h->pair_Z);
+	const double* pZerr = (const double*)(base + h->pair_Zerr);
+
+	//fill the states, pointing the coordinates and the rows into the mapping
+	Database* database = new Database(N, ns, h->dim);
+	database->mapped = data; database->mapped_size = size;
+	for (int i = 0; i < ns; i++) {
+		State& s = (*database)[i];
+		const DBRecord& r = rec[i];
+
+		for (int k = 0; k < ADJ_WORDS; k++) s.am.w[k] = r.am[k];
+		s.freq = r.freq; s.mfpt = r.mfpt; s.sigma = r.sigma;
+		s.bond = r.bond; s.num = r.num; s.denom = r.denom;
+		s.num_coords = r.num_coords;
+		s.coord_data = coords + r.coord_offset;
+
+		if (r.pair_offset != database->row_ptr[i]) {
+			fprintf(stderr, "Database %s has rows out of order\n", filename.c_str());
+			delete database;
+			return NULL;
+		}
+		database->row_ptr[i+1] = r.pair_offset + r.num_neighbors;
+	}
+	database->col_data = (const int*)pi; database->P_data = pP;
+	database->Z_data = pZ; database->Zerr_data = pZerr;
+
+	database->buildIndex();
+	database->buildIsoClasses();
+	return database;
+}
+
+//pad the stream to a multiple of 8 bytes, return the new offset
+static int64_t align8(std::ofstream& out, int64_t offset) {
+	while (offset % 8 != 0) {
+		out.put(0); offset++;
+	}
+	return offset;
+}
+
+bool writeBinary(const Database& db, const std::string& filename) {
+	//write db in the binary format. purged states are skipped and P indices go
+	//through lumpMap, the same as the text output
+
+	int N = db.getN(); int ns = db.getNumStates(); int dim = db.getDimension();
+
+	//states that are written
+	std::vector<bool> purged(ns, false);
+	for (int k = 0; k < db.toPurge.size(); k++) {
+		purged[db.toPurge[k]] = true;
+	}
+	std::vector<int> kept;
+	for (int i = 0; i < ns; i++) {
+		if (!purged[i]) kept.push_back(i);
+	}
+	int nk = kept.size();
+
+	//build the records and count the sections
+	std::vector<DBRecord> rec(nk);
+	int64_t nc = 0, np = 0;
+	for (int k = 0; k < nk; k++) {
+		const State& s = db[kept[k]];
+		DBRecord& r = rec[k];
+		memset(&r, 0, sizeof(DBRecord));
+		for (int w = 0; w < ADJ_WORDS; w++) r.am[w] = s.getAdjacency().w[w];
+		r.freq = s.freq; r.mfpt = s.mfpt; r.sigma = s.sigma;
+		r.bond = s.getBonds(); r.num = s.num; r.denom = s.denom;
+		r.num_coords = s.getNumCoords();
+		r.num_neighbors = db.getNumNeighbors(kept[k]);
+		r.coord_offset = nc; r.pair_offset = np;
+		nc += (int64_t)r.num_coords*dim*N; np += r.num_neighbors;
+	}
+
+	DBHeader h;
+	memset(&h, 0, sizeof(DBHeader));
+	memcpy(h.magic, DB_MAGIC, 8);
+	h.version = DB_VERSION; h.N = N; h.dim = dim; h.adj_words = ADJ_WORDS;
+	h.num_states = nk; h.num_coords = nc; h.num_pairs = np;
+	h.records = sizeof(DBHeader);
+	h.coords = h.records + (int64_t)nk*sizeof(DBRecord);
+	h.pair_index = h.coords + nc*sizeof(double);
+	h.pair_P = h.pair_index + np*sizeof(int32_t); h.pair_P += (8 - h.pair_P % 8) % 8;
+	h.pair_Z = h.pair_P + np*sizeof(double);
+	h.pair_Zerr = h.pair_Z + np*sizeof(double);
+
+	std::ofstream out(filename.c_str(), std::ios::binary);
+	if (!out) {
+		fprintf(stderr, "Cannot open file %s\n", filename.c_str());
+		return false;
+	}
+	out.write((const char*)&h, sizeof(DBHeader));
+	out.write((const char*)rec.data(), nk*sizeof(DBRecord));
+
+	//coordinates
+	std::vector<double> x(dim*N);
+	for (int k = 0; k < nk; k++) {
+		const State& s = db[kept[k]];
+		for (int c = 0; c < s.getNumCoords(); c++) {
+			s.getCoords(c).makeArray(x.data(), N, dim);
+			out.write((const char*)x.data(), dim*N*sizeof(double));
+		}
+	}
+
+	//pair rows, one array per quantity
+	for (int k = 0; k < nk; k++) {
+		SparseRow P = db.getP(kept[k]);
+		for (int j = 0; j < P.size; j++) {
+			int32_t index = db.lumpMap[P.index[j]];
+			out.write((const char*)&index, sizeof(int32_t));
+		}
+	}
+	align8(out, h.pair_index + np*sizeof(int32_t));
+	for (int q = 0; q < 3; q++) {
+		for (int k = 0; k < nk; k++) {
+			SparseRow row = (q == 0) ? db.getP(kept[k]) : 
+											((q == 1) ? db.getZ(kept[k]) : db.getZerr(kept[k]));
+			out.write((const char*)row.value, row.size*sizeof(double));
+		}
+	}
+
+	return out.good();
+}
+
+}
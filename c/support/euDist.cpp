@@ -3,61 +3,55 @@
 #include "../defines.h"
 namespace bd {
 
-void c2p(double* cluster, double* particles, int N) {
+template <int D>
+void c2p(const double* cluster, double* particles, int N) {
 	//converts array of form (x1,y1,x2,y2,...) to (x1,x2,x3,x4,...)
 
-#if (DIMENSION == 2) 
-	for (int i = 0; i < 2*N; i++) {
-		if (i % 2 == 0) {
-			particles[i/2] = cluster[i];
-		}
-		else {
-			particles[N+i/2] = cluster[i];
+	for (int i = 0; i < N; i++) {
+		for (int k = 0; k < D; k++) {
+			particles[k*N+i] = cluster[D*i+k];
 		}
 	}
-#elif (DIMENSION == 3)
-	for (int i = 0; i < 3*N; i++) {
-		if (i % 3 == 0) {
-			particles[i/3] = cluster[i];
-		}
-		else if (i % 3 == 1) {
-			particles[N+i/3] = cluster[i];
-		}
-		else {
-			particles[2*N+i/3] = cluster[i];
-		}
-	}
-#endif
-
 }
 
+template <int D>
+double euDist(const double* particles, int i, int j, int N, double* Z) {
+	//computes euclidean distance between particles i and j, Z is the unit separation
 
-double euDist(double* particles, int i, int j, int N, double* Z) {
-	//computes euclidean distance between particles i and j
+	double R = 0;
+	for (int k = 0; k < D; k++) {
+		Z[k] = particles[k*N+i]-particles[k*N+j];
+		R += Z[k]*Z[k];
+	}
 
-	//printf("Particles %d and %d\n", i+1, j+1);
-	//printf("x: %f, Y: %f\n", particles[i], particles[N+i]);
-	//printf("x: %f, Y: %f\n", particles[j], particles[N+j]);
-	
-  Z[0] = particles[i]-particles[j];
-  Z[1] = particles[N+i]-particles[N+j];
-#if (DIMENSION == 3)
-	Z[2] = particles[2*N+i]-particles[2*N+j];
-#endif
+	R = sqrt(R);
+	for (int k = 0; k < D; k++) {
+		Z[k] /= R;
+	}
 
+	return R;
+}
 
-  double R = Z[0]*Z[0]+Z[1]*Z[1];
-#if (DIMENSION == 3)
-  R += Z[2]*Z[2];
-#endif
+template void c2p<2>(const double*, double*, int);
+template void c2p<3>(const double*, double*, int);
+template double euDist<2>(const double*, int, int, int, double*);
+template double euDist<3>(const double*, int, int, int, double*);
 
-  R = sqrt(R);
-  Z[0] /= R; Z[1] /= R;
-#if (DIMENSION == 3)
-  Z[2] /= R;
-#endif
+void c2p(double* cluster, double* particles, int N) {
+	c2p<DIMENSION>(cluster, particles, N);
+}
 
-  return R;
+void c2p(double* cluster, double* particles, int N, int dim) {
+	if (dim == 3) {
+		c2p<3>(cluster, particles, N);
+	}
+	else {
+		c2p<2>(cluster, particles, N);
+	}
+}
+
+double euDist(double* particles, int i, int j, int N, double* Z) {
+	return euDist<DIMENSION>(particles, i, j, N, Z);
 }
 
 
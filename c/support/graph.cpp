@@ -39,13 +39,13 @@ void updateGraph(int node, Database* db, Graph* g, bool* present, int& count) {
 	creates or updates target nodes*/
 
 	//get the interactions of the current node
-	std::vector<Pair> P = (*db)[node].getP();
-	double S = (*db)[node].sumP();
+	SparseRow P = db->getP(node);
+	double S = db->sumP(node);
 	double mfpt = (*db)[node].getMFPT();
 	double tol = 1e-5;
 
 	//loop over P - make edges, add nodes
-	for (int i = 0; i < P.size(); i++) {
+	for (int i = 0; i < P.size; i++) {
 		//make edge
 		int target = P[i].index; double prob = P[i].value/S;
 		if (1/mfpt*prob > tol) {
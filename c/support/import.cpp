@@ -27,37 +27,19 @@ void buildNautyGraph(int N, int M, int* AM, graph* g) {
 void findIsomorphic(int N, int num_states, int* AM, Database* db, std::vector<int>& iso) {
 	//finds all states isomorphic to given state in database. stored to iso.
 
-	//set keywords for nauty
-	int M = SETWORDSNEEDED(N);
-
-	//initialize the nauty graphs and parameters
-	graph g1[N*M]; graph g2[N*M];   //the starting graphs
-	graph cg1[N*M]; graph cg2[N*M]; //graphs with canonical labeling
-	int lab1[N], lab2[N];           //label arrays
-	int ptn[N], orbits[N];          //needed to call functions
-	static DEFAULTOPTIONS_GRAPH(options); //defualt options
-	statsblk stats;                 //nauty statistics of graph
-	options.getcanon = TRUE;        //get canonical labeling
-	options.defaultptn = TRUE;      //ignore any coloring of graph
-
-	//build nauty graph of the state, get canonical labeling
-	EMPTYGRAPH(cg1, M, N);
-	buildNautyGraph(N, M, AM, g1);
-	densenauty(g1, lab1, ptn, orbits, &options, &stats, M, N, cg1);
-
-	//loop over all states, check if isomorphic
-	for (int i = 0; i < num_states; i++) {
-		//create graph
-		EMPTYGRAPH(cg2, M, N);
-		buildNautyGraph(N, M, i, db, g2);
-		densenauty(g2, lab2, ptn, orbits, &options, &stats, M, N, cg2);
-
-
-		/* Compare canonically labelled graphs */
-		if (checkIsomorphic(N, M, cg1, cg2) == 1) { //graphs are isomorphic, add to iso
-			iso.push_back(i);
+	//canonical form of the state, look up its class
+	AdjBits A; A.fromMatrix(AM, N);
+	int c = db->findIsoClass(canonicalForm(N, A));
+	if (c == -1) {
+		return;
+	}
+
+	const std::vector<int>& members = db->getIsoMembers(c);
+	for (int k = 0; k < members.size(); k++) {
+		if (members[k] < num_states) {
+			iso.push_back(members[k]);
 		}
-	} 
+	}
 }
 
 void structureMap(std::string& filename, Database* db, int* M2A, int& NC) {
@@ -151,9 +133,9 @@ void printTM(Database* db, int* M2A, int NC) {
 	int ns = db->getNumStates();
 
 	for (int i = 0; i < ns; i++) {
-		std::vector<Pair> P = (*db)[i].getP();
-		double S = (*db)[i].sumP();
-		for (int entry = 0; entry < P.size(); entry++) {
+		SparseRow P = db->getP(i);
+		double S = db->sumP(i);
+		for (int entry = 0; entry < P.size; entry++) {
 			int index = P[entry].index; double val = P[entry].value;
 			if (M2A[i] != -1 && M2A[index]!= -1 && val/S > tol) {
 				TM[toIndex(M2A[i],M2A[index],NC)] = val/S; 
@@ -187,9 +169,9 @@ void printTM(Database* db) {
 
 
 	for (int i = 0; i < ns; i++) {
-		std::vector<Pair> P = (*db)[i].getP();
-		double S = (*db)[i].sumP();
-		for (int entry = 0; entry < P.size(); entry++) {
+		SparseRow P = db->getP(i);
+		double S = db->sumP(i);
+		for (int entry = 0; entry < P.size; entry++) {
 			int index = P[entry].index; double val = P[entry].value;
 			if (val/S > tol) {
 				TM[toIndex(i,index,ns)] = val/S; 
@@ -1,5 +1,6 @@
 #pragma once
 #include <cstdlib>
+#include <vector>
 
 namespace bd{
 
@@ -24,6 +25,32 @@ struct Pair {
 	Pair(int index_, double value_) : index(index_), value(value_) {}
 };
 
+/* read only view of one sparse row, entry k is (index[k], value[k]).
+	 points into storage owned by someone else, valid until that row changes
+	 Members:
+	 	index
+	 	value
+	 	size - number of entries
+
+*/
+
+struct SparseRow {
+	SparseRow() {index = NULL; value = NULL; size = 0;}
+	SparseRow(const int* index_, const double* value_, int size_) : 
+								index(index_), value(value_), size(size_) {}
+
+	const int* index; const double* value; int size;
+
+	Pair operator[](int k) const {return Pair(index[k], value[k]);}
+
+	//copy out as pairs
+	std::vector<Pair> pairs() const {
+		std::vector<Pair> p; p.reserve(size);
+		for (int k = 0; k < size; k++) p.push_back(Pair(index[k], value[k]));
+		return p;
+	}
+};
+
 
 
 
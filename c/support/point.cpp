@@ -2,34 +2,54 @@
 namespace bd{
 
 //functions to go to/from arrays and clusters in 2 and 3 dimensions
-	
-void Cluster::makeArray2d(double* array, int N) const {
+
+template <int D>
+void Cluster::makeArray(double* array, int N) const {
 	for (int j = 0; j < N; j++) {
-		array[2*j] = points[j].x;
-		array[2*j+1] = points[j].y;
+		array[D*j] = points[j].x;
+		array[D*j+1] = points[j].y;
+		if (D == 3) array[D*j+2] = points[j].z;
 	}
 }
 
-void Cluster::makeArray3d(double* array, int N) const {
+template <int D>
+void Cluster::makeCluster(double* array, int N) const {
 	for (int j = 0; j < N; j++) {
-		array[3*j] = points[j].x;
-		array[3*j+1] = points[j].y;
-		array[3*j+2] = points[j].z;
+		double x = array[D*j]; double y = array[D*j+1];
+		double z = (D == 3) ? array[D*j+2] : 0;
+		points[j] = Point(x,y,z);
 	}
 }
 
+template void Cluster::makeArray<2>(double*, int) const;
+template void Cluster::makeArray<3>(double*, int) const;
+template void Cluster::makeCluster<2>(double*, int) const;
+template void Cluster::makeCluster<3>(double*, int) const;
+	
+void Cluster::makeArray2d(double* array, int N) const {
+	makeArray<2>(array, N);
+}
+
+void Cluster::makeArray3d(double* array, int N) const {
+	makeArray<3>(array, N);
+}
+
 void Cluster::makeCluster2d(double* array, int N) const {
-	for (int j = 0; j < N; j+=2) {
-		double x = array[j]; double y = array[j+1]; 
-		points[j] = Point(x,y);
-	}
+	makeCluster<2>(array, N);
 }
 
 void Cluster::makeCluster3d(double* array, int N) const {
-	for (int j = 0; j < N; j+=3) {
-		double x = array[j]; double y = array[j+1]; double z = array[j+2];
-		points[j] = Point(x,y,z);
-	}
+	makeCluster<3>(array, N);
 }
 
-}
\ No newline at end of file
+void Cluster::makeArray(double* array, int N, int dim) const {
+	if (dim == 3) makeArray<3>(array, N);
+	else makeArray<2>(array, N);
+}
+
+void Cluster::makeCluster(double* array, int N, int dim) const {
+	if (dim == 3) makeCluster<3>(array, N);
+	else makeCluster<2>(array, N);
+}
+
+}
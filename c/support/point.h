@@ -57,6 +57,12 @@ struct Cluster {
 	void makeCluster2d(double* array, int N) const;
 	void makeArray3d(double* array, int N) const; 
 	void makeCluster3d(double* array, int N) const;
+	//same in D dimensions, instantiated for D = 2 and 3
+	template <int D> void makeArray(double* array, int N) const;
+	template <int D> void makeCluster(double* array, int N) const;
+	//dimension picked at run time
+	void makeArray(double* array, int N, int dim) const;
+	void makeCluster(double* array, int N, int dim) const;
 };
 
 }
\ No newline at end of file
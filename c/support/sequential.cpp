@@ -0,0 +1,106 @@
+#include <math.h>
+#include <algorithm>
+#include "sequential.h"
+#include <omp.h>
+
+namespace bd {
+
+SequentialStop::SequentialStop(double tol_, double ptol_, int min_batches_, int max_batches_,
+															 int max_hits_) {
+	tol = tol_; ptol = ptol_; min_batches = min_batches_; max_batches = max_batches_;
+	max_hits = max_hits_;
+	hits = tries = 0;
+}
+
+void SequentialStop::addBatch(double estimate, const std::vector<Pair>& P) {
+	//add the hits of the batch to PM, keep the estimate if there were any
+	int h = 0;
+	for (int i = 0; i < P.size(); i++) {
+		int j;
+		for (j = 0; j < PM.size(); j++) {
+			if (PM[j].index == P[i].index) {
+				PM[j].value += P[i].value;
+				break;
+			}
+		}
+		if (j == PM.size()) {
+			PM.push_back(P[i]);
+		}
+		h += P[i].value;
+	}
+
+	hits += h; tries++;
+	if (h > 0) {
+		batches.push_back(estimate);
+	}
+}
+
+double SequentialStop::getSE() const {
+	//standard error of the mean of the batch estimates
+	int nb = batches.size();
+	if (nb < 2) return 0;
+
+	double mean = 0; double var = 0;
+	for (int i = 0; i < nb; i++) mean += batches[i];
+	mean /= nb;
+	for (int i = 0; i < nb; i++) var += (batches[i]-mean)*(batches[i]-mean);
+	var /= (nb-1);
+	return sqrt(var / nb);
+}
+
+bool SequentialStop::converged(double mfpt) const {
+	if (batches.size() < std::max(2, min_batches) || mfpt <= 0) return false;
+	if (getSE() > tol*mfpt) return false;
+
+	//95% interval of every transition probability
+	for (int i = 0; i < PM.size(); i++) {
+		double p = PM[i].value / hits;
+		if (1.96*sqrt(p*(1-p)/hits) > ptol) return false;
+	}
+	return true;
+}
+
+bool SequentialStop::finished(double mfpt) const {
+	return converged(mfpt) || hits >= max_hits || tries >= max_batches;
+}
+
+int adaptiveRounds(int items, const std::function<int(int item, int per)>& grow,
+									 const std::function<void(int item, int walker)>& batch,
+									 const std::function<bool(int item)>& done) {
+	//run rounds until every item is done
+
+	int num_threads = omp_get_max_threads();
+	std::vector<int> active;
+	for (int i = 0; i < items; i++) active.push_back(i);
+
+	int rounds = 0;
+	while (!active.empty()) {
+		//spread the threads over the unfinished items
+		int per = std::max(1, num_threads / int(active.size()));
+		std::vector<std::pair<int,int> > tasks;
+		for (int a = 0; a < active.size(); a++) {
+			int walkers = grow(active[a], per);
+			for (int k = 0; k < walkers; k++) {
+				tasks.push_back(std::make_pair(active[a], k));
+			}
+		}
+
+		//one batch per walker
+		#pragma omp parallel for schedule(dynamic)
+		for (int t = 0; t < tasks.size(); t++) {
+			batch(tasks[t].first, tasks[t].second);
+		}
+		rounds++;
+
+		//keep the items that are not done
+		std::vector<int> still;
+		for (int a = 0; a < active.size(); a++) {
+			if (!done(active[a])) still.push_back(active[a]);
+		}
+		active.swap(still);
+	}
+
+	return rounds;
+}
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "pair.h"
+#include <vector>
+#include <functional>
+
+namespace bd {
+
+/* sequential stopping rule of the adaptive mfpt estimators. each finished
+   batch of samples adds its own estimate of the mfpt and the states it hit.
+   an estimate is done once the standard error of the batch estimates is below
+   tol times the mfpt and every transition probability is known to within ptol
+   (95% interval), after at least min_batches batches with hits. it gives up
+   after max_hits hits, or after max_batches batches with or without hits, so
+   a sampler that never hits still ends.
+	 Members:
+	 	tol, ptol - target relative standard error and probability half width
+	 	min_batches - fewest batches with hits, max_batches - most batches
+	 	max_hits - most hits
+	 	batches - estimate of each batch with hits
+	 	PM - hits into each state, hits - total hits, tries - batches added
+*/
+
+class SequentialStop {
+	public:
+		SequentialStop(double tol_, double ptol_, int min_batches_, int max_batches_,
+									 int max_hits_);
+
+		//a finished batch that hit the states in P
+		void addBatch(double estimate, const std::vector<Pair>& P);
+
+		//the rule, at the point estimate mfpt of all batches together
+		bool converged(double mfpt) const;
+		bool finished(double mfpt) const;
+
+		//accessor functions
+		double getSE() const;
+		int getHits() const {return hits;}
+		int getNumBatches() const {return batches.size();}
+		const std::vector<Pair>& getPM() const {return PM;}
+
+	private:
+		double tol; double ptol; int min_batches; int max_batches; int max_hits;
+		std::vector<double> batches;
+		std::vector<Pair> PM; int hits; int tries;
+};
+
+/* rounds of the adaptive estimators over items (states). every round each
+   unfinished item is grown to at least threads/unfinished walkers, grow(item,
+   per) adds them and returns how many the item has. every walker then runs one
+   batch, batch(item, walker), one parallel task each, and done(item) is asked
+   for every unfinished item. the threads of finished items go to the rest.
+   returns the number of rounds. */
+int adaptiveRounds(int items, const std::function<int(int item, int per)>& grow,
+									 const std::function<void(int item, int walker)>& batch,
+									 const std::function<bool(int item)>& done);
+
+}
@@ -0,0 +1,1185 @@
+#include <math.h>
+#include <cmath>
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <eigen3/Eigen/SparseLU>
+#include <eigen3/Eigen/IterativeLinearSolvers>
+#include <eigen3/unsupported/Eigen/IterativeSolvers>
+#include <eigen3/unsupported/Eigen/MatrixFunctions>
+#include "database.h"
+#include "rateMatrix.h"
+#include "../defines.h"
+namespace bd {
+
+typedef Eigen::Triplet<double> Tr;
+
+//keep the last value when the same entry is set twice, like writing a dense matrix
+static double overwrite(const double&, const double& b) {return b;}
+
+void denseToSparse(const double* T, int num_states, SpMat& S) {
+	//copy the nonzero entries of a dense column major matrix. nan entries, from
+	//states with zero equilibrium weight, are dropped like the old sparse mfpt solve
+
+	std::vector<Tr> tripletList;
+	tripletList.reserve(num_states*10);
+	for (int j = 0; j < num_states; j++) {
+		for (int i = 0; i < num_states; i++) {
+			double value = T[toIndex(i,j,num_states)];
+			if (value != 0 && value == value) {
+				tripletList.push_back(Tr(i,j,value));
+			}
+		}
+	}
+	S.resize(num_states, num_states);
+	S.setFromTriplets(tripletList.begin(), tripletList.end());
+}
+
+RateMatrix::RateMatrix() {
+	num_states = 0; solver = SOLVE_LU; tol = 1e-10;
+}
+
+RateMatrix::RateMatrix(const double* T, int num_states_) {
+	num_states = num_states_; solver = SOLVE_LU; tol = 1e-10;
+	denseToSparse(T, num_states, L);
+}
+
+RateMatrix::RateMatrix(const SpMat& L_) : L(L_) {
+	num_states = L.rows(); solver = SOLVE_LU; tol = 1e-10;
+}
+
+RateMatrix::RateMatrix(Database* db, std::vector<int>& endStates) {
+	//forward rates from the mfpt estimates, (P_ij/S_i)/mfpt_i
+
+	num_states = db->getNumStates(); solver = SOLVE_LU; tol = 1e-10;
+
+	std::vector<Tr> tripletList;
+	for (int state = 0; state < num_states; state++) {
+		double mfpt = (*db)[state].getMFPT();
+		double S = db->sumP(state);
+
+		//if S = 0, this is end state, add it to vector
+		if (S == 0) {
+			endStates.push_back(state);
+		}
+
+		SparseRow P = db->getP(state);
+		for (int i = 0; i < P.size; i++) {
+			tripletList.push_back(Tr(state, P.index[i], (P.value[i] / S) / mfpt));
+		}
+	}
+	L.resize(num_states, num_states);
+	L.setFromTriplets(tripletList.begin(), tripletList.end(), overwrite);
+}
+
+void RateMatrix::satisfyDB(const double* eq) {
+	//fill the transpose of every positive entry so detailed balance holds wrt eq.
+	//same arithmetic as the dense satisfyDB, whose column major sweep comes back
+	//to entries below the diagonal through their transpose
+
+	std::vector<Tr> tripletList;
+	tripletList.reserve(2*L.nonZeros());
+	for (int i = 0; i < num_states; i++) {
+		for (SpMat::InnerIterator it(L,i); it; ++it) {
+			int j = it.col(); double value = it.value();
+			if (value > 0 && i != j) {
+				double back = value * eq[i] / eq[j];
+				tripletList.push_back(Tr(j, i, back));
+				if (i > j) {
+					value = back * eq[j] / eq[i];
+				}
+			}
+			tripletList.push_back(Tr(i, j, value));
+		}
+	}
+	L.setFromTriplets(tripletList.begin(), tripletList.end(), overwrite);
+}
+
+void RateMatrix::fillDiag() {
+	//set the diagonal to the negative sum of the off diagonal entries
+	//inaccessible states get -1 so the systems stay solvable
+
+	std::vector<Tr> tripletList;
+	tripletList.reserve(L.nonZeros() + num_states);
+	for (int i = 0; i < num_states; i++) {
+		double S = 0;
+		for (SpMat::InnerIterator it(L,i); it; ++it) {
+			if (it.col() != i) {
+				tripletList.push_back(Tr(i, it.col(), it.value()));
+				S += it.value();
+			}
+		}
+		if (S == 0) {
+			S = 1;
+		}
+		tripletList.push_back(Tr(i, i, -S));
+	}
+	L.setFromTriplets(tripletList.begin(), tripletList.end());
+}
+
+void RateMatrix::getProbabilityMatrix(SpMat& P) const {
+	//jump chain of the generator, P_ij = -L_ij/L_ii off the diagonal
+
+	std::vector<Tr> tripletList;
+	tripletList.reserve(L.nonZeros());
+	for (int i = 0; i < num_states; i++) {
+		double d = L.coeff(i,i);
+		for (SpMat::InnerIterator it(L,i); it; ++it) {
+			if (it.col() != i) {
+				tripletList.push_back(Tr(i, it.col(), -it.value() / d));
+			}
+		}
+	}
+	P.resize(num_states, num_states);
+	P.setFromTriplets(tripletList.begin(), tripletList.end());
+}
+
+void RateMatrix::toDense(double* T) const {
+	//write the matrix to a dense column major array
+
+	for (int i = 0; i < num_states*num_states; i++) {
+		T[i] = 0;
+	}
+	for (int i = 0; i < num_states; i++) {
+		for (SpMat::InnerIterator it(L,i); it; ++it) {
+			T[toIndex(i, it.col(), num_states)] = it.value();
+		}
+	}
+}
+
+void RateMatrix::committor(int initial, const std::vector<int>& targets, double* q) const {
+	//solve L q = 0 with q = 0 on initial and q = 1 on targets
+
+	//rows of initial and targets are replaced by identity rows
+	std::vector<bool> fixed(num_states, false);
+	fixed[initial] = true;
+	for (int i = 0; i < targets.size(); i++) {
+		fixed[targets[i]] = true;
+	}
+
+	std::vector<Tr> tripletList;
+	tripletList.reserve(L.nonZeros());
+	for (int i = 0; i < num_states; i++) {
+		if (fixed[i]) {
+			tripletList.push_back(Tr(i,i,1.0));
+			continue;
+		}
+		for (SpMat::InnerIterator it(L,i); it; ++it) {
+			tripletList.push_back(Tr(i, it.col(), it.value()));
+		}
+	}
+	Eigen::SparseMatrix<double> A(num_states, num_states);
+	A.setFromTriplets(tripletList.begin(), tripletList.end());
+
+	Eigen::MatrixXd b = Eigen::MatrixXd::Zero(num_states, 1);
+	for (int i = 0; i < targets.size(); i++) {
+		b(targets[i]) = 1;
+	}
+
+	//solve the linear system, store solution in q
+	Eigen::MatrixXd x;
+	solveSparse(A, b, x, solver, tol);
+	for (int i = 0; i < num_states; i++) {
+		q[i] = fabs(x(i));
+	}
+}
+
+void RateMatrix::flux(const double* q, const double* eq, double* F) const {
+	//probability flux eq_i L_ij q_j (1-q_i), written to the nonzero entries of
+	//the dense column major array F
+
+	for (int i = 0; i < num_states; i++) {
+		for (SpMat::InnerIterator it(L,i); it; ++it) {
+			int j = it.col();
+			if (i != j) {
+				F[toIndex(i,j,num_states)] = eq[i]*it.value()*q[j]*(1-q[i]);
+			}
+		}
+	}
+}
+
+double RateMatrix::transitionRate(const double* q, const double* eq) const {
+	//average transition rate from A to B on reactive trajectories
+
+	double S = 0;
+	for (int i = 0; i < num_states; i++) {
+		for (SpMat::InnerIterator it(L,i); it; ++it) {
+			int j = it.col();
+			if (i != j) {
+				S += eq[i] * it.value() * (q[j]-q[i]) * (q[j]-q[i]);
+			}
+		}
+	}
+
+	return S / 2;
+}
+
+void RateMatrix::mfpt(const std::vector<int>& targets, double* m) const {
+	//mean first passage time of every state to targets. solves A*tau = -1,
+	//where A is the generator with the rows/cols of the targets removed
+
+	std::vector<int> row;
+	Eigen::SparseMatrix<double> A;
+	int M = reduce(targets, row, A);
+
+	Eigen::MatrixXd b = Eigen::MatrixXd::Constant(M, 1, -1.0);
+	Eigen::MatrixXd tau;
+	solveSparse(A, b, tau, solver, tol);
+
+	//store solution in m - re-add lost zeros
+	for (int i = 0; i < num_states; i++) {
+		m[i] = (row[i] == -1) ? 0 : fabs(tau(row[i]));
+	}
+}
+
+int RateMatrix::reduce(const std::vector<int>& targets, std::vector<int>& row, 
+											Eigen::SparseMatrix<double>& A) const {
+	//remove the rows/cols of targets from the generator
+
+	//map each kept state to its row in A, -1 for targets
+	row.assign(num_states, 0);
+	for (int i = 0; i < targets.size(); i++) {
+		row[targets[i]] = -1;
+	}
+	int M = 0;
+	for (int i = 0; i < num_states; i++) {
+		if (row[i] != -1) {
+			row[i] = M++;
+		}
+	}
+
+	std::vector<Tr> tripletList;
+	tripletList.reserve(L.nonZeros());
+	for (int i = 0; i < num_states; i++) {
+		if (row[i] == -1) continue;
+		for (SpMat::InnerIterator it(L,i); it; ++it) {
+			if (row[it.col()] != -1) {
+				tripletList.push_back(Tr(row[i], row[it.col()], it.value()));
+			}
+		}
+	}
+	A.resize(M,M);
+	A.setFromTriplets(tripletList.begin(), tripletList.end());
+
+	return M;
+}
+
+void RateMatrix::hittingProbability(const std::vector<int>& endStates,
+																		Eigen::MatrixXd& U) const {
+	//hitting probabilities of the end states through the jump chain
+
+	SpMat P;
+	getProbabilityMatrix(P);
+	hittingProbabilityJump(P, endStates, U, solver, tol);
+}
+
+void hittingProbabilityJump(const SpMat& P, const std::vector<int>& endStates,
+														Eigen::MatrixXd& U, SolverType solver, double tol) {
+	/*solve (I-Q)U = R, Q is P with the rows/cols of end states zero'd out and
+	  column k of R is the column of P for endStates[k], with a 1 on the end state.
+	  every end state is one right hand side of the same factorization */
+
+	int num_states = P.rows();
+	int ne = endStates.size();
+	std::vector<int> endCol(num_states, -1);
+	for (int k = 0; k < ne; k++) {
+		endCol[endStates[k]] = k;
+	}
+
+	std::vector<Tr> tripletList;
+	tripletList.reserve(P.nonZeros() + num_states);
+	Eigen::MatrixXd R = Eigen::MatrixXd::Zero(num_states, ne);
+	for (int i = 0; i < num_states; i++) {
+		tripletList.push_back(Tr(i,i,1.0));
+		for (SpMat::InnerIterator it(P,i); it; ++it) {
+			int j = it.col();
+			if (endCol[j] != -1) {
+				R(i, endCol[j]) = it.value();
+			}
+			else if (endCol[i] == -1) {
+				tripletList.push_back(Tr(i, j, -it.value()));
+			}
+		}
+		if (endCol[i] != -1) {
+			R(i, endCol[i]) = 1;
+		}
+	}
+	Eigen::SparseMatrix<double> D(num_states, num_states);
+	D.setFromTriplets(tripletList.begin(), tripletList.end());
+
+	solveSparse(D, R, U, solver, tol);
+}
+
+Generator::Generator(const RateMatrix& forward) {
+	//set up the pattern of the full generator and how each entry is computed
+
+	//the pattern does not depend on eq, so build it once with eq = 1
+	int num_states = forward.getNumStates();
+	std::vector<double> ones(num_states, 1.0);
+	RateMatrix L = forward;
+	L.satisfyDB(ones.data());
+	L.fillDiag();
+	G = L.getMatrix();
+	G.makeCompressed();
+
+	//replay the writes of satisfyDB, the last write to an entry wins
+	kind.assign(G.nonZeros(), FORWARD); rate.assign(G.nonZeros(), 0.0);
+	const SpMat& F = forward.getMatrix();
+	for (int i = 0; i < num_states; i++) {
+		for (SpMat::InnerIterator it(F,i); it; ++it) {
+			int j = it.col(); double value = it.value();
+			if (value > 0 && i != j) {
+				int k = find(j,i);
+				kind[k] = BACK; rate[k] = value;
+			}
+			int k = find(i,j);
+			kind[k] = (value > 0 && i > j) ? ROUND_TRIP : FORWARD; rate[k] = value;
+		}
+	}
+
+	//diagonals are the negative row sums
+	diag.resize(num_states);
+	for (int i = 0; i < num_states; i++) {
+		diag[i] = find(i,i);
+		kind[diag[i]] = DIAGONAL;
+	}
+}
+
+int Generator::find(int i, int j) const {
+	//position of entry (i,j) in the value array, -1 if not stored
+	const int* inner = G.innerIndexPtr();
+	const int* first = inner + G.outerIndexPtr()[i];
+	const int* last = inner + G.outerIndexPtr()[i+1];
+	const int* k = std::lower_bound(first, last, j);
+	return (k != last && *k == j) ? k - inner : -1;
+}
+
+void Generator::update(const double* eq) {
+	//rewrite the values for this eq, same arithmetic as satisfyDB and fillDiag
+
+	double* v = G.valuePtr();
+	const int* outer = G.outerIndexPtr(); const int* inner = G.innerIndexPtr();
+	int num_states = G.rows();
+	for (int i = 0; i < num_states; i++) {
+		double S = 0;
+		for (int k = outer[i]; k < outer[i+1]; k++) {
+			int j = inner[k];
+			if (kind[k] == DIAGONAL) {
+				continue;
+			}
+			else if (kind[k] == FORWARD) {
+				v[k] = rate[k];
+			}
+			else if (kind[k] == ROUND_TRIP) {
+				double back = rate[k] * eq[i] / eq[j];
+				v[k] = back * eq[j] / eq[i];
+			}
+			else {
+				v[k] = rate[k] * eq[j] / eq[i];
+			}
+			S += v[k];
+		}
+		if (S == 0) {
+			S = 1;
+		}
+		v[diag[i]] = -S;
+	}
+}
+
+MFPTSolver::MFPTSolver(const RateMatrix& forward, const std::vector<int>& targets_) : 
+											 G(forward), targets(targets_) {
+	//reduced pattern, its symbolic analysis and where each entry comes from in G
+
+	analyzed = false; factored = false; solver = SOLVE_LU; tol = 1e-10;
+
+	RateMatrix L(G.getMatrix());
+	int M = L.reduce(targets, row, A);
+	A.makeCompressed();
+
+	std::vector<int> state(M);
+	for (int i = 0; i < row.size(); i++) {
+		if (row[i] != -1) state[row[i]] = i;
+	}
+	source.resize(A.nonZeros());
+	for (int c = 0; c < M; c++) {
+		for (Eigen::SparseMatrix<double>::InnerIterator it(A,c); it; ++it) {
+			source[&it.valueRef() - A.valuePtr()] = G.find(state[it.row()], state[c]);
+		}
+	}
+
+	b = Eigen::MatrixXd::Constant(M, 1, -1.0);
+	lambda.resize(M, 1); e.resize(M, 1);
+}
+
+void MFPTSolver::solve(const double* eq, double* m) {
+	//write the generator at this eq into the fixed pattern, then refactor
+
+	G.update(eq);
+	const double* v = G.getMatrix().valuePtr();
+	double* a = A.valuePtr();
+	for (int k = 0; k < A.nonZeros(); k++) {
+		a[k] = v[source[k]];
+	}
+
+	int M = A.rows();
+	bool warm = (tau.rows() == M) && tau.allFinite();
+	bool done = false; factored = false;
+	bool finite = Eigen::Map<const Eigen::VectorXd>(A.valuePtr(), A.nonZeros()).allFinite();
+
+	//no solver can do anything with inf entries. report it, the mfpts are nan
+	if (!finite) {
+		fprintf(stderr, "MFPT solve has non-finite rates, %d states\n", M);
+		tau = Eigen::MatrixXd::Constant(M, 1, NAN);
+		done = true;
+	}
+	else if (solver == SOLVE_LU) {
+		if (!analyzed) {
+			lu.analyzePattern(A);
+			analyzed = true;
+		}
+		lu.factorize(A);
+		if (lu.info() == Eigen::Success) {
+			tau = lu.solve(b);
+			done = (lu.info() == Eigen::Success);
+			factored = done;
+		}
+	}
+	else if (solver == SOLVE_BICGSTAB && warm) {
+		Eigen::BiCGSTAB<Eigen::SparseMatrix<double>, Eigen::IncompleteLUT<double> > bicg;
+		bicg.setTolerance(tol);
+		bicg.compute(A);
+		if (bicg.info() == Eigen::Success) {
+			Eigen::MatrixXd x = bicg.solveWithGuess(b, tau);
+			if (bicg.info() == Eigen::Success) {
+				tau = x; done = true;
+			}
+		}
+	}
+	else if (solver == SOLVE_GMRES && warm) {
+		Eigen::GMRES<Eigen::SparseMatrix<double>, Eigen::IncompleteLUT<double> > gmres;
+		gmres.setTolerance(tol);
+		gmres.set_restart(50);
+		gmres.compute(A);
+		if (gmres.info() == Eigen::Success) {
+			Eigen::MatrixXd x = gmres.solveWithGuess(b, tau);
+			if (gmres.info() == Eigen::Success) {
+				tau = x; done = true;
+			}
+		}
+	}
+
+	//cold start, or the fallbacks of the plain solve
+	if (!done) {
+		solveSparse(A, b, tau, (solver == SOLVE_LU) ? SOLVE_BICGSTAB : solver, tol);
+	}
+
+	//store solution in m - re-add lost zeros
+	for (int i = 0; i < row.size(); i++) {
+		m[i] = (row[i] == -1) ? 0 : fabs(tau(row[i]));
+	}
+}
+
+double MFPTSolver::gradient(int initial, const Eigen::MatrixXd& dlogeq, double* g) {
+	/*d tau = -A^-1 dA tau, so d tau_initial = -lambda^T dA tau with A^T lambda = e_initial.
+	  row r of dA tau is sum over c of dL_rc (tau_c - tau_r), tau = 0 on targets */
+
+	int np = dlogeq.cols();
+	int r0 = row[initial];
+	for (int k = 0; k < np; k++) {
+		g[k] = 0;
+	}
+	if (r0 == -1) {
+		return 0;
+	}
+
+	//adjoint solve, reuses the factorization when there is one
+	e.setZero();
+	e(r0) = 1;
+	if (factored) {
+		lambda = lu.transpose().solve(e);
+	}
+	else {
+		Eigen::SparseMatrix<double> At = A.transpose();
+		solveSparse(At, e, lambda, (solver == SOLVE_LU) ? SOLVE_BICGSTAB : solver, tol);
+	}
+
+	const SpMat& L = G.getMatrix();
+	const double* v = L.valuePtr();
+	const int* outer = L.outerIndexPtr(); const int* inner = L.innerIndexPtr();
+	int num_states = row.size();
+	for (int r = 0; r < num_states; r++) {
+		if (row[r] == -1) continue;
+		double lr = lambda(row[r]);
+		double tr = tau(row[r]);
+		for (int k = outer[r]; k < outer[r+1]; k++) {
+			if (!G.isBackRate(k)) continue;
+			int c = inner[k];
+			double tc = (row[c] == -1) ? 0 : tau(row[c]);
+			double w = lr * v[k] * (tc - tr);
+			for (int q = 0; q < np; q++) {
+				g[q] -= w * (dlogeq(c,q) - dlogeq(r,q));
+			}
+		}
+	}
+
+	//the mfpt is |tau|
+	double m = tau(r0);
+	if (m < 0) {
+		for (int k = 0; k < np; k++) g[k] = -g[k];
+	}
+	return fabs(m);
+}
+
+HittingSolver::HittingSolver(const RateMatrix& forward, const std::vector<int>& endStates, 
+														 const std::vector<int>& targets) : G(forward) {
+	//pattern of I-Q and where each entry comes from in G
+
+	int num_states = G.getNumStates();
+	factored = false; initial = -1;
+
+	//mark end states and targets
+	isEnd.assign(num_states, false); isTarget.assign(num_states, false);
+	for (int k = 0; k < endStates.size(); k++) {
+		isEnd[endStates[k]] = true;
+	}
+	for (int k = 0; k < targets.size(); k++) {
+		if (isEnd[targets[k]]) isTarget[targets[k]] = true;
+	}
+
+	//Q is the jump chain between states that are not end states
+	const SpMat& L = G.getMatrix();
+	std::vector<Tr> tripletList;
+	tripletList.reserve(L.nonZeros());
+	for (int i = 0; i < num_states; i++) {
+		tripletList.push_back(Tr(i,i,1.0));
+		if (isEnd[i]) continue;
+		for (SpMat::InnerIterator it(L,i); it; ++it) {
+			int j = it.col();
+			if (j != i && !isEnd[j]) {
+				tripletList.push_back(Tr(i, j, 1.0));
+			}
+		}
+	}
+	D.resize(num_states, num_states);
+	D.setFromTriplets(tripletList.begin(), tripletList.end());
+	D.makeCompressed();
+
+	source.resize(D.nonZeros());
+	for (int c = 0; c < num_states; c++) {
+		for (Eigen::SparseMatrix<double>::InnerIterator it(D,c); it; ++it) {
+			int r = it.row();
+			source[&it.valueRef() - D.valuePtr()] = (r == c) ? -1 : G.find(r,c);
+		}
+	}
+	lu.analyzePattern(D);
+
+	rhs.resize(num_states, 1); u.resize(num_states, 1); 
+	mu.resize(num_states, 1); e.resize(num_states, 1); w.resize(num_states);
+}
+
+double HittingSolver::solve(const double* eq, int initial_) {
+	/*u solves (I-Q)u = r, the same system as hittingProbabilityJump with the
+	  columns of the targets summed. returns u at initial */
+
+	initial = initial_;
+	G.update(eq);
+	const SpMat& L = G.getMatrix();
+	const double* v = L.valuePtr();
+	const int* outer = L.outerIndexPtr(); const int* inner = L.innerIndexPtr();
+	const std::vector<int>& diag = G.getDiagonal();
+	int num_states = G.getNumStates();
+
+	//I-Q, P_ij = -L_ij/L_ii
+	double* dv = D.valuePtr();
+	const int* drow = D.innerIndexPtr();
+	for (int k = 0; k < D.nonZeros(); k++) {
+		if (source[k] == -1) {
+			dv[k] = 1.0;
+		}
+		else {
+			dv[k] = -(-v[source[k]] / v[diag[drow[k]]]);
+		}
+	}
+
+	//summed right hand side
+	rhs.setZero();
+	for (int i = 0; i < num_states; i++) {
+		double d = v[diag[i]];
+		for (int k = outer[i]; k < outer[i+1]; k++) {
+			if (isTarget[inner[k]] && inner[k] != i) {
+				rhs(i) += -v[k] / d;
+			}
+		}
+		if (isTarget[i]) {
+			rhs(i) += 1;
+		}
+	}
+
+	lu.factorize(D);
+	factored = (lu.info() == Eigen::Success);
+	if (factored) {
+		u = lu.solve(rhs);
+	}
+	else {
+		solveSparse(D, rhs, u, SOLVE_BICGSTAB, 1e-10);
+	}
+
+	return u(initial);
+}
+
+void HittingSolver::gradient(const Eigen::MatrixXd& dlogeq, double* g) {
+	/*dH = mu^T (dQ u + dr) with (I-Q)^T mu = e_initial. row i of dQ u + dr is
+	  sum over j of dP_ij w_j, where w = u off the end states, 1 on targets and
+	  0 on the other end states. with P_ij = L_ij/d_i this is
+	  sum over j of dL_ij (w_j - (Pw)_i) / d_i */
+
+	int num_states = G.getNumStates();
+	int np = dlogeq.cols();
+
+	//adjoint solve with the same factorization
+	e.setZero();
+	e(initial) = 1;
+	if (factored) {
+		mu = lu.transpose().solve(e);
+	}
+	else {
+		Eigen::SparseMatrix<double> Dt = D.transpose();
+		solveSparse(Dt, e, mu, SOLVE_BICGSTAB, 1e-10);
+	}
+
+	//weights w
+	for (int j = 0; j < num_states; j++) {
+		w[j] = isEnd[j] ? (isTarget[j] ? 1.0 : 0.0) : u(j);
+	}
+
+	for (int k = 0; k < np; k++) {
+		g[k] = 0;
+	}
+	const SpMat& L = G.getMatrix();
+	const double* v = L.valuePtr();
+	const int* outer = L.outerIndexPtr(); const int* inner = L.innerIndexPtr();
+	const std::vector<int>& diag = G.getDiagonal();
+	for (int i = 0; i < num_states; i++) {
+		double d = -v[diag[i]];
+		if (mu(i) == 0 || d == 0) continue;
+
+		//(Pw)_i, for end rows only the targets count
+		double Pw = 0;
+		for (int k = outer[i]; k < outer[i+1]; k++) {
+			int j = inner[k];
+			if (j == i) continue;
+			Pw += (v[k] / d) * ((isEnd[i] && !isTarget[j]) ? 0.0 : w[j]);
+		}
+
+		for (int k = outer[i]; k < outer[i+1]; k++) {
+			if (!G.isBackRate(k)) continue;
+			int j = inner[k];
+			double wj = (isEnd[i] && !isTarget[j]) ? 0.0 : w[j];
+			double c = mu(i) * v[k] * (wj - Pw) / d;
+			for (int q = 0; q < np; q++) {
+				g[q] += c * (dlogeq(j,q) - dlogeq(i,q));
+			}
+		}
+	}
+}
+
+double hittingGradient(const RateMatrix& forward, const double* eq, 
+											 const Eigen::MatrixXd& dlogeq, int initial, 
+											 const std::vector<int>& endStates, const std::vector<int>& targets,
+											 double* g) {
+	//one off hitting probability and gradient, see HittingSolver
+
+	HittingSolver solver(forward, endStates, targets);
+	double h = solver.solve(eq, initial);
+	solver.gradient(dlogeq, g);
+	return h;
+}
+
+BoundarySolver::BoundarySolver(const RateMatrix& L_, const std::vector<int>& candidates_) :
+															 L(L_.getMatrix()) {
+	//factor K once, solve for every candidate column and the mfpt rhs as one block
+
+	num_states = L_.getNumStates(); solver = L_.getSolver(); tol = L_.getTol();
+
+	//index of each candidate, repeats are dropped
+	cand.assign(num_states, -1);
+	for (int k = 0; k < candidates_.size(); k++) {
+		if (cand[candidates_[k]] == -1) {
+			cand[candidates_[k]] = candidates.size();
+			candidates.push_back(candidates_[k]);
+		}
+	}
+	int nc = candidates.size();
+
+	//K is the generator with identity rows on the candidates
+	std::vector<Tr> tripletList;
+	tripletList.reserve(L.nonZeros());
+	for (int i = 0; i < num_states; i++) {
+		if (cand[i] != -1) {
+			tripletList.push_back(Tr(i,i,1.0));
+			continue;
+		}
+		for (SpMat::InnerIterator it(L,i); it; ++it) {
+			tripletList.push_back(Tr(i, it.col(), it.value()));
+		}
+	}
+	Eigen::SparseMatrix<double> K(num_states, num_states);
+	K.setFromTriplets(tripletList.begin(), tripletList.end());
+
+	//candidate columns, then -1 off the candidates for the mfpt
+	Eigen::MatrixXd B = Eigen::MatrixXd::Zero(num_states, nc+1);
+	for (int c = 0; c < nc; c++) {
+		B(candidates[c], c) = 1;
+	}
+	for (int i = 0; i < num_states; i++) {
+		if (cand[i] == -1) B(i, nc) = -1;
+	}
+	Eigen::MatrixXd X;
+	solveSparse(K, B, X, solver, tol);
+	Z = X.leftCols(nc); w = X.col(nc);
+
+	//row c of V_C^T is row candidates[c] of L - I
+	G.resize(nc, nc); gw.resize(nc);
+	for (int c = 0; c < nc; c++) {
+		int r = candidates[c];
+		G.row(c) = -Z.row(r); gw(c) = -w(r);
+		for (SpMat::InnerIterator it(L,r); it; ++it) {
+			G.row(c) += it.value() * Z.row(it.col());
+			gw(c) += it.value() * w(it.col());
+		}
+	}
+}
+
+bool BoundarySolver::boundary(const std::vector<int>& B, std::vector<bool>& inB) const {
+	//mark the candidates in B
+
+	for (int k = 0; k < B.size(); k++) {
+		if (cand[B[k]] == -1) {
+			return false;
+		}
+		inB[cand[B[k]]] = true;
+	}
+	return true;
+}
+
+void BoundarySolver::freeSet(const std::vector<bool>& inB, std::vector<int>& f) const {
+	//candidates that are generator rows for this boundary
+
+	f.clear();
+	for (int c = 0; c < candidates.size(); c++) {
+		if (!inB[c]) f.push_back(c);
+	}
+}
+
+void BoundarySolver::update(const std::vector<int>& f, const Eigen::MatrixXd& VY, 
+														Eigen::MatrixXd& Y) const {
+	//Woodbury, A_B^-1 = K^-1 - Z_F S^-1 V_F^T K^-1 with S = I + V_F^T Z_F
+
+	int nf = f.size();
+	if (nf == 0) {
+		return;
+	}
+
+	Eigen::MatrixXd S(nf, nf);
+	for (int a = 0; a < nf; a++) {
+		for (int b = 0; b < nf; b++) {
+			S(a,b) = G(f[a], f[b]);
+		}
+		S(a,a) += 1;
+	}
+	Eigen::MatrixXd C = S.partialPivLu().solve(VY);
+
+	for (int a = 0; a < nf; a++) {
+		Y.noalias() -= Z.col(f[a]) * C.row(a);
+	}
+}
+
+void BoundarySolver::committor(int initial, const std::vector<int>& targets, double* q) const {
+	//committor for one pair
+
+	std::vector<int> initials(1, initial);
+	std::vector<std::vector<int> > targetSets(1, targets);
+	Eigen::MatrixXd Q;
+	committor(initials, targetSets, Q);
+	for (int i = 0; i < num_states; i++) {
+		q[i] = Q(i,0);
+	}
+}
+
+void BoundarySolver::committor(const std::vector<int>& initials, 
+															 const std::vector<std::vector<int> >& targetSets, 
+															 Eigen::MatrixXd& Q) const {
+	//q = 0 on initial and 1 on targets. K^-1 b is the sum of the target columns
+
+	int nc = candidates.size();
+	Q.resize(num_states, targetSets.size());
+	std::vector<bool> inB; std::vector<int> f;
+	for (int k = 0; k < targetSets.size(); k++) {
+		const std::vector<int>& targets = targetSets[k];
+		inB.assign(nc, false);
+		std::vector<int> B(targets); B.push_back(initials[k]);
+		if (!boundary(B, inB)) {
+			RateMatrix R(L); R.setSolver(solver, tol);
+			R.committor(initials[k], targets, Q.col(k).data());
+			continue;
+		}
+		freeSet(inB, f);
+
+		Eigen::MatrixXd y = Eigen::MatrixXd::Zero(num_states, 1);
+		Eigen::MatrixXd VY = Eigen::MatrixXd::Zero(f.size(), 1);
+		for (int t = 0; t < targets.size(); t++) {
+			int c = cand[targets[t]];
+			y.col(0) += Z.col(c);
+			for (int a = 0; a < f.size(); a++) {
+				VY(a) += G(f[a], c);
+			}
+		}
+		update(f, VY, y);
+
+		for (int i = 0; i < num_states; i++) {
+			Q(i,k) = fabs(y(i));
+		}
+	}
+}
+
+void BoundarySolver::mfpt(const std::vector<int>& targets, double* m) const {
+	//mfpt for one target set
+
+	std::vector<std::vector<int> > targetSets(1, targets);
+	Eigen::MatrixXd M;
+	mfpt(targetSets, M);
+	for (int i = 0; i < num_states; i++) {
+		m[i] = M(i,0);
+	}
+}
+
+void BoundarySolver::mfpt(const std::vector<std::vector<int> >& targetSets, 
+													Eigen::MatrixXd& M) const {
+	//tau = -1 off the targets, 0 on them. K^-1 b is w minus the free columns
+
+	int nc = candidates.size();
+	M.resize(num_states, targetSets.size());
+	std::vector<bool> inB; std::vector<int> f;
+	for (int k = 0; k < targetSets.size(); k++) {
+		const std::vector<int>& targets = targetSets[k];
+		inB.assign(nc, false);
+		if (!boundary(targets, inB)) {
+			RateMatrix R(L); R.setSolver(solver, tol);
+			R.mfpt(targets, M.col(k).data());
+			continue;
+		}
+		freeSet(inB, f);
+
+		Eigen::MatrixXd y = w;
+		Eigen::MatrixXd VY(f.size(), 1);
+		for (int a = 0; a < f.size(); a++) {
+			y.col(0) -= Z.col(f[a]);
+			VY(a) = gw(f[a]);
+			for (int b = 0; b < f.size(); b++) {
+				VY(a) -= G(f[a], f[b]);
+			}
+		}
+		update(f, VY, y);
+
+		for (int i = 0; i < num_states; i++) {
+			M(i,k) = fabs(y(i));
+		}
+		for (int t = 0; t < targets.size(); t++) {
+			M(targets[t],k) = 0;
+		}
+	}
+}
+
+void BoundarySolver::mfptPairs(const std::vector<int>& states, Eigen::MatrixXd& M) const {
+	//every state of the list against every other
+
+	int ns = states.size();
+	std::vector<std::vector<int> > targetSets(ns);
+	for (int b = 0; b < ns; b++) {
+		targetSets[b].push_back(states[b]);
+	}
+	Eigen::MatrixXd T;
+	mfpt(targetSets, T);
+
+	M.resize(ns, ns);
+	for (int a = 0; a < ns; a++) {
+		for (int b = 0; b < ns; b++) {
+			M(a,b) = T(states[a], b);
+		}
+	}
+}
+
+void BoundarySolver::hittingProbability(const std::vector<int>& endStates, 
+																				Eigen::MatrixXd& U) const {
+	/*column k is the committor to endStates[k] against the other end states.
+	  the rows of the end states are set like hittingProbabilityJump, one step of
+	  the jump chain into the end states plus 1 on the own column */
+
+	int nc = candidates.size(); int ne = endStates.size();
+	std::vector<bool> inB(nc, false);
+	if (!boundary(endStates, inB)) {
+		RateMatrix R(L); R.setSolver(solver, tol);
+		R.hittingProbability(endStates, U);
+		return;
+	}
+	std::vector<int> f;
+	freeSet(inB, f);
+
+	U.resize(num_states, ne);
+	Eigen::MatrixXd VY(f.size(), ne);
+	for (int k = 0; k < ne; k++) {
+		int c = cand[endStates[k]];
+		U.col(k) = Z.col(c);
+		for (int a = 0; a < f.size(); a++) {
+			VY(a,k) = G(f[a], c);
+		}
+	}
+	update(f, VY, U);
+
+	//end state rows
+	std::vector<int> endCol(num_states, -1);
+	for (int k = 0; k < ne; k++) {
+		endCol[endStates[k]] = k;
+	}
+	for (int k = 0; k < ne; k++) {
+		int i = endStates[k];
+		U.row(i).setZero();
+		double d = L.coeff(i,i);
+		for (SpMat::InnerIterator it(L,i); it; ++it) {
+			int j = it.col();
+			if (j != i && endCol[j] != -1) {
+				U(i, endCol[j]) = -it.value() / d;
+			}
+		}
+		U(i,k) += 1;
+	}
+}
+
+void RateMatrix::propagate(double t, const Eigen::VectorXd& p0, Eigen::VectorXd& p) const {
+	//forward kolmogorov, p exp(tL) = exp(tL^T) p
+	SpMat Lt = L.transpose();
+	expmv(Lt, t, p0, p);
+}
+
+void RateMatrix::propagateBack(double t, const Eigen::VectorXd& f0, Eigen::VectorXd& f) const {
+	//backward kolmogorov, exp(tL) f
+	expmv(L, t, f0, f);
+}
+
+//round the step size to 2 significant digits, as expokit does
+static double roundStep(double h) {
+	double s = pow(10.0, floor(log10(h)) - 1);
+	return ceil(h / s) * s;
+}
+
+double expmv(const SpMat& A, double t, const Eigen::VectorXd& v, Eigen::VectorXd& w) {
+	return expmv(A, t, v, w, 1e-10, 30);
+}
+
+//diagonal d so D A D^-1 has equal off diagonal row and column sums (osborne).
+//for a generator that satisfies detailed balance this tends to the symmetric
+//scaling, which takes away the non-normality the krylov steps are sensitive to
+static void balance(const SpMat& A, Eigen::VectorXd& d) {
+	int n = A.rows();
+	SpMat At = A.transpose();
+	d = Eigen::VectorXd::Ones(n);
+	for (int sweep = 0; sweep < 20; sweep++) {
+		bool changed = false;
+		for (int i = 0; i < n; i++) {
+			double r = 0; double c = 0;
+			for (SpMat::InnerIterator it(A,i); it; ++it) {
+				if (it.col() != i) r += fabs(it.value()) / d(it.col());
+			}
+			for (SpMat::InnerIterator it(At,i); it; ++it) {
+				if (it.col() != i) c += fabs(it.value()) * d(it.col());
+			}
+			if (r == 0 || c == 0) continue;
+			double f = sqrt(c / (r * d(i) * d(i)));
+			if (fabs(f - 1) > 0.05) changed = true;
+			d(i) *= f;
+		}
+		if (!changed) break;
+	}
+}
+
+double expmv(const SpMat& A, double t, const Eigen::VectorXd& v, Eigen::VectorXd& w, 
+						 double tol, int m) {
+	//krylov exponential action with local error control, see rateMatrix.h
+
+	int n = A.rows();
+	m = std::min(m, n);
+	w = v;
+	if (t == 0 || v.norm() == 0 || n == 0) {
+		return 0;
+	}
+
+	//work with the balanced matrix D A D^-1 and D v
+	Eigen::VectorXd d;
+	balance(A, d);
+	SpMat B = d.asDiagonal() * A * d.cwiseInverse().asDiagonal();
+	w = d.cwiseProduct(v);
+	double beta = w.norm();
+
+	//step control constants from expokit
+	const int max_reject = 50;
+	const double gamma = 0.9; const double delta = 1.2;
+	double anorm = 0;
+	for (int i = 0; i < B.outerSize(); i++) {
+		double S = 0;
+		for (SpMat::InnerIterator it(B,i); it; ++it) S += fabs(it.value());
+		anorm = std::max(anorm, S);
+	}
+	if (anorm == 0) {
+		w = v;
+		return 0;
+	}
+	//breakdown only for a basis that is invariant to rounding. the rates span
+	//many orders of magnitude, an absolute test stops early on small components
+	const double btol = 1e-14 * anorm;
+	double rndoff = anorm * std::numeric_limits<double>::epsilon();
+	double sgn = (t > 0) ? 1.0 : -1.0;
+	double t_out = fabs(t); double t_now = 0; double s_error = 0;
+
+	//first step size from the a priori bound
+	double xm = 1.0 / m;
+	double fact = pow((m+1)/exp(1.0), m+1) * sqrt(2*M_PI*(m+1));
+	double t_new = (1.0/anorm) * pow((fact*tol) / (4*beta*anorm), xm);
+	t_new = roundStep(t_new);
+
+	Eigen::MatrixXd V(n, m+1); Eigen::MatrixXd H(m+2, m+2); Eigen::MatrixXd F;
+	Eigen::VectorXd p(n);
+	while (t_now < t_out) {
+		double t_step = std::min(t_out - t_now, t_new);
+
+		//arnoldi
+		V.col(0) = w / beta; H.setZero();
+		int k1 = 2; int mb = m; double avnorm = 0;
+		for (int j = 0; j < m; j++) {
+			p.noalias() = B * V.col(j);
+			for (int i = 0; i <= j; i++) {
+				H(i,j) = V.col(i).dot(p);
+				p -= H(i,j) * V.col(i);
+			}
+			double s = p.norm();
+			if (s < btol) { //happy breakdown, the basis is invariant
+				k1 = 0; mb = j+1; t_step = t_out - t_now;
+				break;
+			}
+			H(j+1,j) = s;
+			V.col(j+1) = p / s;
+		}
+		if (k1 != 0) {
+			H(m+1,m) = 1;
+			p.noalias() = B * V.col(m);
+			avnorm = p.norm();
+		}
+
+		//exponentiate the hessenberg matrix, shrink the step until the error is small
+		double err_loc = btol;
+		for (int reject = 0; ; reject++) {
+			int mx = mb + k1;
+			F = (sgn * t_step * H.topLeftCorner(mx, mx)).exp();
+			if (k1 == 0) {
+				err_loc = btol;
+				break;
+			}
+			double phi1 = fabs(beta * F(m,0)); double phi2 = fabs(beta * F(m+1,0) * avnorm);
+			if (phi1 > 10*phi2) {
+				err_loc = phi2; xm = 1.0/m;
+			}
+			else if (phi1 > phi2) {
+				err_loc = (phi1*phi2) / (phi1-phi2); xm = 1.0/m;
+			}
+			else {
+				err_loc = phi1; xm = 1.0/(m-1);
+			}
+			if (err_loc <= delta * t_step * tol) {
+				break;
+			}
+			if (reject == max_reject) {
+				fprintf(stderr, "expmv: step size too small, error estimate %g\n", err_loc);
+				break;
+			}
+			t_step = roundStep(gamma * t_step * pow(t_step*tol/err_loc, xm));
+		}
+
+		//advance
+		int mx = mb + std::max(0, k1-1);
+		w.noalias() = V.leftCols(mx) * (beta * F.col(0).head(mx));
+		beta = w.norm();
+		t_now += t_step;
+		if (err_loc > 0) {
+			t_new = roundStep(gamma * t_step * pow(t_step*tol/err_loc, xm));
+		}
+		else {
+			t_new = t_out - t_now;
+		}
+		s_error += std::max(err_loc, rndoff);
+		if (beta == 0) {
+			break;
+		}
+	}
+	w = w.cwiseQuotient(d);
+
+	return s_error;
+}
+
+bool solveSparse(const Eigen::SparseMatrix<double>& A, const Eigen::MatrixXd& B,
+								 Eigen::MatrixXd& X, SolverType solver, double tol) {
+	//solve A*X = B, every column of B shares one factorization/preconditioner
+
+	//no solver can do anything with inf entries
+	for (int k = 0; k < A.nonZeros(); k++) {
+		if (!std::isfinite(A.valuePtr()[k])) {
+			fprintf(stderr, "Sparse solve has non-finite entries, %d states\n", (int)A.rows());
+			X = Eigen::MatrixXd::Constant(A.cols(), B.cols(), NAN);
+			return false;
+		}
+	}
+
+	if (solver == SOLVE_LU) {
+		Eigen::SparseLU<Eigen::SparseMatrix<double> > lu;
+		lu.analyzePattern(A);
+		lu.factorize(A);
+		if (lu.info() == Eigen::Success) {
+			X = lu.solve(B);
+			if (lu.info() == Eigen::Success) {
+				return true;
+			}
+		}
+		solver = SOLVE_BICGSTAB;
+	}
+
+	if (solver == SOLVE_BICGSTAB) {
+		Eigen::BiCGSTAB<Eigen::SparseMatrix<double>, Eigen::IncompleteLUT<double> > bicg;
+		bicg.setTolerance(tol);
+		bicg.compute(A);
+		if (bicg.info() == Eigen::Success) {
+			X = bicg.solve(B);
+			if (bicg.info() == Eigen::Success) {
+				return true;
+			}
+		}
+		solver = SOLVE_GMRES;
+	}
+
+	Eigen::GMRES<Eigen::SparseMatrix<double>, Eigen::IncompleteLUT<double> > gmres;
+	gmres.setTolerance(tol);
+	gmres.set_restart(50);
+	gmres.compute(A);
+	if (gmres.info() == Eigen::Success) {
+		X = gmres.solve(B);
+		if (gmres.info() == Eigen::Success) {
+			return true;
+		}
+	}
+
+	fprintf(stderr, "Sparse solve did not converge, %d states\n", (int)A.rows());
+	if (X.rows() != A.cols() || X.cols() != B.cols()) {
+		X = Eigen::MatrixXd::Zero(A.cols(), B.cols());
+	}
+	return false;
+}
+
+}
@@ -0,0 +1,290 @@
+#pragma once
+#include <vector>
+#include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/Sparse>
+#include <eigen3/Eigen/SparseLU>
+
+/* sparse rate matrix used for all the tpt solves. the generator of a folding
+	 network has a few nonzeros per row, so the committor, mfpt and hitting
+	 probability systems are factored sparsely instead of copied to dense.
+
+	 solveSparse does the linear algebra for all of them. it takes any number of
+	 right hand sides (the columns of B) and uses
+		SOLVE_LU       - sparse lu, falls back to bicgstab if factorization fails
+		SOLVE_BICGSTAB - bicgstab with incomplete lu, falls back to gmres
+		SOLVE_GMRES    - restarted gmres with incomplete lu
+
+	 RateMatrix members:
+		num_states - number of states in the network
+		L - the rates, row major. entry (i,j) is the rate from i to j
+		solver - which solver to use for the linear systems
+		tol - tolerance for the iterative solvers
+
+	 Generator is the full generator for a fixed set of forward rates. the pattern
+	 does not depend on eq, so it is built once and update(eq) only rewrites the
+	 values, with the same arithmetic as satisfyDB and fillDiag. no allocation.
+	 Generator members:
+		G - the generator, row major
+		kind - how each stored value is computed from eq
+		rate - the forward rate each stored value is computed from
+		diag - position of each diagonal in the values of G
+
+ MFPTSolver is for optimization loops where only kappa changes. the pattern of
+	 the generator is fixed by the database, so the ordering and symbolic analysis
+	 of the lu are done once per (database, target set) and every new kappa only
+	 refactors numerically. the iterative solvers start from the previous solution.
+	 results are the same as RateMatrix::mfpt. not thread safe, use one per thread.
+	 MFPTSolver members:
+		G - the full generator of the last solve
+		targets - the absorbing states
+		row - row of each state in the reduced system, -1 for targets
+		A - the last reduced generator, rows/cols of targets removed
+		source - position in G of each value of A
+		lu - sparse lu holding the symbolic analysis of A
+		b, tau - right hand side and last solution, the guess for iterative solvers
+		lambda, e - adjoint workspace
+
+ BoundarySolver answers committors, mfpts and hitting probabilities for many
+	 boundary sets from one factorization. every boundary set is a subset of a
+	 fixed list of candidate states C (e.g. all ground states). K is the complete
+	 generator with the rows of C replaced by identity rows, factored once and
+	 solved for the columns e_c, c in C, plus the mfpt right hand side, as one
+	 block. for a boundary set B, the Dirichlet matrix differs from K only in the
+	 rows of F = C\B, which are generator rows again, so
+		A_B = K + E_F V_F^T,  V_F^T = rows F of (L - I)
+	 and Woodbury gives the solution from the stored columns and a dense |F|x|F|
+	 system, no new sparse solve. made for the every ground state against every
+	 other case. the generator is fixed, so this is per kappa.
+	 BoundarySolver members:
+		num_states - number of states
+		L - the complete generator
+		solver, tol - solver settings of the generator, for the one factorization
+		candidates - the states allowed in boundary sets, index of each in cand.
+		             a boundary set with other states falls back to RateMatrix
+		Z - K^-1 e_c for each candidate c, one column each
+		w - K^-1 b with b = -1 off the candidates, 0 on them
+		G, gw - rows of V_C^T times Z and w, the inputs to every Woodbury update
+
+ HittingSolver does the same for the probability to hit targets before the other
+	 end states. one per thread.
+	 HittingSolver members:
+		G - the full generator of the last solve
+		isEnd, isTarget - marks for the end states and targets
+		D - I-Q, Q the jump chain between the states that are not end states
+		source - position in G of each value of D, -1 on the diagonal
+		lu - sparse lu, analyzed once
+		initial - initial state of the last solve
+		rhs, u, mu, e, w - solution and adjoint workspace
+
+*/
+
+namespace bd {
+
+class Database;
+
+typedef Eigen::SparseMatrix<double, Eigen::RowMajor> SpMat;
+
+enum SolverType {SOLVE_LU, SOLVE_BICGSTAB, SOLVE_GMRES};
+
+class RateMatrix {
+	public:
+		RateMatrix();
+		//forward rates from the mfpt estimates in db, same as createTransitionMatrix
+		RateMatrix(Database* db, std::vector<int>& endStates);
+		//copy the nonzeros of a dense column major rate matrix
+		RateMatrix(const double* T, int num_states_);
+		RateMatrix(const SpMat& L_);
+
+		//accessor functions
+		int getNumStates() const {return num_states;}
+		const SpMat& getMatrix() const {return L;}
+		void setSolver(SolverType solver_, double tol_) {solver = solver_; tol = tol_;}
+		SolverType getSolver() const {return solver;}
+		double getTol() const {return tol;}
+
+		//complete the generator
+		void satisfyDB(const double* eq);
+		void fillDiag();
+		void getProbabilityMatrix(SpMat& P) const;
+		void toDense(double* T) const;
+
+		//p exp(tL) and exp(tL) f, by expmv. p is a distribution (row), f a function (column)
+		void propagate(double t, const Eigen::VectorXd& p0, Eigen::VectorXd& p) const;
+		void propagateBack(double t, const Eigen::VectorXd& f0, Eigen::VectorXd& f) const;
+
+		//tpt quantities
+		void committor(int initial, const std::vector<int>& targets, double* q) const;
+		void flux(const double* q, const double* eq, double* F) const;
+		double transitionRate(const double* q, const double* eq) const;
+		void mfpt(const std::vector<int>& targets, double* m) const;
+		void hittingProbability(const std::vector<int>& endStates, Eigen::MatrixXd& U) const;
+
+		//generator with the rows/cols of targets removed, returns its size
+		int reduce(const std::vector<int>& targets, std::vector<int>& row, 
+							 Eigen::SparseMatrix<double>& A) const;
+
+	private:
+		int num_states;
+		SpMat L;
+		SolverType solver; double tol;
+};
+
+class Generator {
+	public:
+		//pattern from forward rates only, as from createTransitionMatrix
+		Generator(const RateMatrix& forward);
+
+		int getNumStates() const {return G.rows();}
+		const SpMat& getMatrix() const {return G;}
+		const std::vector<int>& getDiagonal() const {return diag;}
+		//true if stored value k is a detailed balance back rate
+		bool isBackRate(int k) const {return kind[k] == BACK;}
+		//position of entry (i,j) in the values of G, -1 if not stored
+		int find(int i, int j) const;
+
+		//rewrite the values for detailed balance wrt eq
+		void update(const double* eq);
+
+	private:
+		enum Kind {FORWARD, ROUND_TRIP, BACK, DIAGONAL};
+		SpMat G;
+		std::vector<Kind> kind; std::vector<double> rate; std::vector<int> diag;
+};
+
+class MFPTSolver {
+	public:
+		MFPTSolver(const RateMatrix& forward, const std::vector<int>& targets_);
+
+		void setSolver(SolverType solver_, double tol_) {solver = solver_; tol = tol_;}
+		int getNumStates() const {return G.getNumStates();}
+		const std::vector<int>& getTargets() const {return targets;}
+
+		//mfpt of every state to the targets, with detailed balance wrt eq
+		void solve(const double* eq, double* m);
+		//derivative of the mfpt of initial from the last solve, one adjoint solve.
+		//dlogeq(i,k) is the derivative of log eq_i in parameter k
+		double gradient(int initial, const Eigen::MatrixXd& dlogeq, double* g);
+
+	private:
+		Generator G;
+		std::vector<int> targets; std::vector<int> row; std::vector<int> source;
+		Eigen::SparseMatrix<double> A;
+		Eigen::SparseLU<Eigen::SparseMatrix<double> > lu;
+		Eigen::MatrixXd b; Eigen::MatrixXd tau; Eigen::MatrixXd lambda; Eigen::MatrixXd e;
+		bool analyzed; bool factored; SolverType solver; double tol;
+
+		//copy constructors - the lu can not be copied
+		MFPTSolver(const MFPTSolver&) : G(RateMatrix()) {
+			throw 1;
+		}
+		MFPTSolver& operator=(const MFPTSolver&) {
+			throw 1;
+		}
+};
+
+class HittingSolver {
+	public:
+		HittingSolver(const RateMatrix& forward, const std::vector<int>& endStates, 
+									const std::vector<int>& targets);
+
+		int getNumStates() const {return G.getNumStates();}
+
+		//probability to hit the targets before the other end states from initial
+		double solve(const double* eq, int initial_);
+		//derivative of the last solve, one adjoint solve. dlogeq as for MFPTSolver
+		void gradient(const Eigen::MatrixXd& dlogeq, double* g);
+
+	private:
+		Generator G;
+		std::vector<bool> isEnd; std::vector<bool> isTarget;
+		Eigen::SparseMatrix<double> D; std::vector<int> source;
+		Eigen::SparseLU<Eigen::SparseMatrix<double> > lu;
+		bool factored; int initial;
+		Eigen::MatrixXd rhs; Eigen::MatrixXd u; Eigen::MatrixXd mu; Eigen::MatrixXd e;
+		std::vector<double> w;
+
+		//copy constructors - the lu can not be copied
+		HittingSolver(const HittingSolver&) : G(RateMatrix()) {
+			throw 1;
+		}
+		HittingSolver& operator=(const HittingSolver&) {
+			throw 1;
+		}
+};
+
+class BoundarySolver {
+	public:
+		//L is the complete generator. factors once with the solver settings of L
+		BoundarySolver(const RateMatrix& L_, const std::vector<int>& candidates_);
+
+		int getNumStates() const {return num_states;}
+		const std::vector<int>& getCandidates() const {return candidates;}
+
+		//same as RateMatrix::committor
+		void committor(int initial, const std::vector<int>& targets, double* q) const;
+		//one column of Q for each (initials[k], targetSets[k]) pair
+		void committor(const std::vector<int>& initials, 
+									 const std::vector<std::vector<int> >& targetSets, Eigen::MatrixXd& Q) const;
+		//mfpt of every state to targets, same as RateMatrix::mfpt
+		void mfpt(const std::vector<int>& targets, double* m) const;
+		//one column of M for each target set
+		void mfpt(const std::vector<std::vector<int> >& targetSets, Eigen::MatrixXd& M) const;
+		//M(a,b) is the mfpt from states[a] to states[b], every state against every other
+		void mfptPairs(const std::vector<int>& states, Eigen::MatrixXd& M) const;
+		//same as RateMatrix::hittingProbability
+		void hittingProbability(const std::vector<int>& endStates, Eigen::MatrixXd& U) const;
+
+	private:
+		int num_states;
+		SpMat L; SolverType solver; double tol;
+		std::vector<int> candidates; std::vector<int> cand;
+		Eigen::MatrixXd Z; Eigen::VectorXd w;
+		Eigen::MatrixXd G; Eigen::VectorXd gw;
+
+		//mark the candidates in B, false if a state of B is not a candidate
+		bool boundary(const std::vector<int>& B, std::vector<bool>& inB) const;
+		//candidates not in the boundary
+		void freeSet(const std::vector<bool>& inB, std::vector<int>& f) const;
+		//Y -= Z_F S^-1 VY, S = I + G(F,F). VY is rows F of V^T times the K solution Y
+		void update(const std::vector<int>& f, const Eigen::MatrixXd& VY, Eigen::MatrixXd& Y) const;
+};
+
+//copy the nonzeros of a dense column major matrix
+void denseToSparse(const double* T, int num_states, SpMat& S);
+
+//solve A*X = B for all columns of B at once. returns false if no solver converged
+bool solveSparse(const Eigen::SparseMatrix<double>& A, const Eigen::MatrixXd& B,
+								 Eigen::MatrixXd& X, SolverType solver, double tol);
+
+//hitting probabilities of a jump chain P, column k of U is for endStates[k]
+void hittingProbabilityJump(const SpMat& P, const std::vector<int>& endStates,
+														Eigen::MatrixXd& U, SolverType solver, double tol);
+
+/* krylov propagation, after expokit's expv. w = exp(tA) v without forming exp(tA).
+	 each step builds an m dimensional arnoldi basis of A at the current vector,
+	 exponentiates the small hessenberg matrix, and picks the step size so the
+	 local error estimate stays below tol per unit time, rejecting and shrinking
+	 steps that miss. a step is m sparse products, O(nnz m), instead of the O(S^3)
+	 dense exponential. for a generator L a distribution evolves as p exp(tL),
+	 so A = L^T; a function (committor, indicator) evolves with A = L.
+	 returns the accumulated error estimate */
+double expmv(const SpMat& A, double t, const Eigen::VectorXd& v, Eigen::VectorXd& w, 
+						 double tol, int m);
+//same with tol = 1e-10, m = 30
+double expmv(const SpMat& A, double t, const Eigen::VectorXd& v, Eigen::VectorXd& w);
+
+/* adjoint gradients. the generator is the forward rates plus the detailed
+	 balance back rates F_ij eq_i/eq_j, so a parameter only moves the back rates,
+	 d L_ji = L_ji (dlog eq_i - dlog eq_j), and the diagonal with them. one solve
+	 for the quantity and one transposed solve give the derivative in every
+	 parameter. dlogeq is num_states by number of parameters */
+
+//probability to hit targets (a subset of endStates) before the other end
+//states, starting from initial. g gets the derivative in each parameter.
+//one off version of HittingSolver
+double hittingGradient(const RateMatrix& forward, const double* eq, 
+											 const Eigen::MatrixXd& dlogeq, int initial, 
+											 const std::vector<int>& endStates, const std::vector<int>& targets,
+											 double* g);
+
+}
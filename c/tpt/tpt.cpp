@@ -8,6 +8,7 @@
 #include "database.h"
 #include "bDynamics.h"
 #include "tpt.h"
+#include "rateMatrix.h"
 #include "nauty.h"
 #include "graph.h"
 #include "graphviz.h"
@@ -16,271 +17,60 @@ namespace bd{
 
 void computeMFPTsSP(int num_states, double* T, std::vector<int> targets, double* m) {
 	//compute the mean first passage time of every state to targets
-	//solves A*tau = -1, where is A is rate matrix with rows/cols of the targets
-	//zero'd out (removed)
-
-	//uses sparse solver
-
-	//Eigen::setNbThreads(0);
-	//omp_set_num_threads(0);
-
-	//printf("Solving with %d threads\n", Eigen::nbThreads());
-
-	double tol = 1e-7;
-
-	//find number of non-zero'd entries
-	int num_targets = targets.size();
-	int M = num_states - num_targets;
-	Eigen::SparseMatrix<double> QMs(M,M);
-	Eigen::SparseLU<Eigen::SparseMatrix<double>>   solver;
-	Eigen::VectorXd b(M); 
-	Eigen::VectorXd tau(M);  
-
-	//construct a boolean array to check if a row should be skipped
-	bool* skip = new bool[num_states]; for (int i = 0; i < num_states; i++) skip[i] = false;
-	for (int i = 0; i < num_targets; i++) skip[targets[i]] = true;
-
-	//fill in transition matrix for all non-skipped rows/cols
-	typedef Eigen::Triplet<double> Tr;
-	std::vector<Tr> tripletList;
-	tripletList.reserve(num_states*10);
-
-	int i_index = 0;
-	for (int i = 0; i < num_states; i++) {
-		if (!skip[i]) {
-			int j_index = 0;
-			for (int j = 0; j < num_states; j++) {
-				if (!skip[j]) {
-					double value = T[toIndex(i,j,num_states)];
-					if (abs(value) > tol) {
-						tripletList.push_back(Tr(i_index,j_index,value));
-					}
-					j_index++;
-				}
-			}
-			i_index++;
-		}
-	}
-	QMs.setFromTriplets(tripletList.begin(), tripletList.end());
-	//QMs.makeCompressed();
-
-	//fill b with -1
-	b.fill(-1.0);
-
-	//solve for tau
-	solver.analyzePattern(QMs);
-	solver.factorize(QMs);
-	//std::cout << solver.info() << "\n";
-
-	if (solver.info() != Eigen::Success) { //could not compute sparse lu, do dense solve
-
-		//perform a dense solve
-		computeMFPTs(num_states, T, targets, m);
-		delete []skip;
-		return;
-	}
-
-	else {
-		//do the sparse solve
-		tau = solver.solve(b);
-
-		//std::cout << (QMs * tau - b).norm() << "\n";
-
-		//store solution in m - re-add lost zeros
-		int lostIndex = 0;
-		for (int i = 0; i < num_states; i++) {
-			if (!skip[i]) {
-				m[i] = abs(tau(lostIndex));
-				lostIndex++;
-			}
-			else {
-				m[i] = 0;
-			}
-		}
-
-		//free memory
-		delete []skip;
-		return;
-	}
-
-
+	//same as computeMFPTs, kept for existing callers
 
+	RateMatrix R(T, num_states);
+	R.mfpt(targets, m);
 }
 
 void computeMFPTs(int num_states, double* T, std::vector<int> targets, double* m) {
 	//compute the mean first passage time of every state to targets
 	//solves A*tau = -1, where is A is rate matrix with rows/cols of the targets
-	//zero'd out (removed)
-
-	//Eigen::setNbThreads(0);
-	//omp_set_num_threads(0);
-
-	//printf("Solving with %d threads\n", Eigen::nbThreads());
-
-	//find number of non-zero'd entries
-	int num_targets = targets.size();
-	int M = num_states - num_targets;
-	Eigen::MatrixXd QM(M,M); 
-	Eigen::VectorXd b(M); 
-	Eigen::VectorXd tau(M);  
-
-	//construct a boolean array to check if a row should be skipped
-	bool* skip = new bool[num_states]; for (int i = 0; i < num_states; i++) skip[i] = false;
-	for (int i = 0; i < num_targets; i++) skip[targets[i]] = true;
-
-	//fill in transition matrix for all non-skipped rows/cols
-	int i_index = 0;
-	for (int i = 0; i < num_states; i++) {
-		if (!skip[i]) {
-			int j_index = 0;
-			for (int j = 0; j < num_states; j++) {
-				if (!skip[j]) {
-					QM(i_index, j_index) = T[toIndex(i,j,num_states)];
-					j_index++;
-				}
-			}
-			i_index++;
-		}
-	}
-
-
-	//std::cout << QM.row(543)<< "\n";
-	//abort();
+	//removed. uses the sparse engine, see rateMatrix.h
 
-	//fill b with -1
-	b.fill(-1.0);
-
-	//solve for tau
-	tau = QM.lu().solve(b);
-
-	//std::cout << tau << "\n";
-	//std::cout << (QM * tau - b).norm() << "\n";
-
-	//store solution in m - re-add lost zeros
-	int lostIndex = 0;
-	for (int i = 0; i < num_states; i++) {
-		if (!skip[i]) {
-			m[i] = abs(tau(lostIndex));
-			lostIndex++;
-		}
-		else {
-			m[i] = 0;
-		}
-	}
-
-	//free memory
-	delete []skip;
+	RateMatrix R(T, num_states);
+	R.mfpt(targets, m);
 }
 
 double computeTransitionRateTPT(int num_states, double* q, double* T, double* eq) {
 	//compute the average transition rate from A to B with committor fn
 
-	double S = 0; 
-	int i, j;
-
-	for (int entry = 0; entry < num_states*num_states; entry++) {
-		index2ij(entry, num_states, i, j);
-		if (i != j) {
-			S += eq[i] * T[entry] * (q[j]-q[i]) * (q[j]-q[i]);
-		}
-	}
-
-	S /= 2;
-
-	return S;
+	RateMatrix R(T, num_states);
+	return R.transitionRate(q, eq);
 }
 
 void computeFlux(int num_states, double* q, double* T, double* eq, double* flux) {
 	//compute the probability flux from generator, invariant measure, and committor
 
-	int i, j;
-
-	for (int entry = 0; entry < num_states*num_states; entry++) {
-		index2ij(entry, num_states, i, j);
-		if (i != j) {
-			flux[entry] = eq[i]*T[entry]*q[j]*(1-q[i]);
-		}
-	}
+	RateMatrix R(T, num_states);
+	R.flux(q, eq, flux);
 }
 
 void computeCommittor(double* q, double* T, int num_states, int initial, std::vector<int> targets) {
 	//set up and solve equation for the committor function
 
-	//initialize the matrix and vectors
-	Eigen::MatrixXd TM(num_states,num_states); 
-	Eigen::VectorXd b(num_states); 
-	Eigen::VectorXd x(num_states);      
-
-
-	//fill the matrix and RHS appropriately
-	//copy T into TM, fill b with zeros
-	for (int i = 0; i < num_states*num_states; i++) {
-		TM(i) = T[i]; 
-	}
-	b.fill(0.0);
-
-	//loop over initial and target states. edit corresponding rows.
-	//initial
-	for (int j = 0; j < num_states; j++) {
-		if (j != initial) {
-			TM(initial, j) = 0;
-		}
-		else {
-			TM(initial, j) = 1;
-		}
-	}
-
-	//target
-	for (int ind = 0; ind < targets.size(); ind++) {
-		int target = targets[ind];
-		for (int j = 0; j < num_states; j++) {
-			if (j != target) {
-				TM(target, j) = 0;
-			}
-			else {
-				TM(target, j) = 1;
-			}
-		}
-		b(target) = 1;
-	}
-
-	//solve the linear system
-	x = TM.lu().solve(b);
-
-	//store solution in q
-	for (int i = 0; i < x.size(); i++) {
-		q[i] = abs(x(i));
-	}
+	RateMatrix R(T, num_states);
+	R.committor(initial, targets, q);
 }
 
 void computeHittingProbability(double* P, int num_states, std::vector<int> endStates, 
 															 double* U) {
 	//compute the hitting probabilities for the states in endStates
+	//only the columns of end states are nonzero
 
-	//init and fill all the required matrices
-	Eigen::MatrixXd R(num_states,num_states); Eigen::MatrixXd Q(num_states,num_states); 
-	Eigen::MatrixXd Pm(num_states,num_states); Eigen::MatrixXd Um(num_states,num_states); 
-	for (int i = 0; i < num_states*num_states; i++) {
-		R(i) = 0; Um(i) = 0; 
-		Q(i) = P[i]; Pm(i) = P[i];
-	}
-
-
-	//let R be matrix with only columns corresponding to end states, diagonal = 1
-	//let Q be matrix with rows/cols corresponding to end state zero'd out
-	for (int i = 0; i < endStates.size(); i++) {
-		int state = endStates[i];
-		R.col(state) = Pm.col(state); R(state,state) = 1;
-		Q.row(state) = Um.row(state); Q.col(state) = Um.col(state); 
-	}
-
-	//solve for Um via (I-Q)Um = R
-	Eigen::MatrixXd D = Eigen::MatrixXd::Identity(num_states,num_states) - Q;
-	Um = D.lu().solve(R);
+	SpMat Ps;
+	denseToSparse(P, num_states, Ps);
+	Eigen::MatrixXd Um;
+	hittingProbabilityJump(Ps, endStates, Um, SOLVE_LU, 1e-10);
 
 	//store back in U array
 	for (int i = 0; i < num_states*num_states; i++) {
-		U[i] = Um(i);
+		U[i] = 0;
+	}
+	for (int k = 0; k < endStates.size(); k++) {
+		for (int i = 0; i < num_states; i++) {
+			U[toIndex(i, endStates[k], num_states)] = Um(i,k);
+		}
 	}
 }
 
@@ -288,30 +78,14 @@ void computeHittingProbability(Eigen::MatrixXd& P, int num_states, std::vector<i
 															 Eigen::MatrixXd& U) {
 	//compute the hitting probabilities for the states in endStates
 
-	//init and fill all the required matrices
-	Eigen::MatrixXd R(num_states,num_states); Eigen::MatrixXd Q(num_states,num_states); 
-	Eigen::MatrixXd Pm(num_states,num_states); Eigen::MatrixXd Um(num_states,num_states); 
-	for (int i = 0; i < num_states*num_states; i++) {
-		R(i) = 0; Um(i) = 0; 
-		Q(i) = P(i); Pm(i) = P(i);
-	}
+	SpMat Ps = P.sparseView();
+	Eigen::MatrixXd Um;
+	hittingProbabilityJump(Ps, endStates, Um, SOLVE_LU, 1e-10);
 
-
-	//let R be matrix with only columns corresponding to end states, diagonal = 1
-	//let Q be matrix with rows/cols corresponding to end state zero'd out
-	for (int i = 0; i < endStates.size(); i++) {
-		int state = endStates[i];
-		R.col(state) = Pm.col(state); R(state,state) = 1;
-		Q.row(state) = Um.row(state); Q.col(state) = Um.col(state); 
-	}
-
-	//solve for Um via (I-Q)Um = R
-	Eigen::MatrixXd D = Eigen::MatrixXd::Identity(num_states,num_states) - Q;
-	Um = D.lu().solve(R);
-
-	//store back in U array
-	for (int i = 0; i < num_states*num_states; i++) {
-		U(i) = Um(i);
+	//store back in U
+	U = Eigen::MatrixXd::Zero(num_states, num_states);
+	for (int k = 0; k < endStates.size(); k++) {
+		U.col(endStates[k]) = Um.col(k);
 	}
 }
 
@@ -423,7 +197,7 @@ void createTransitionMatrix(double* T, int num_states, Database* db,
 	for (int state = 0; state < num_states; state++) {
 		//get all relevant data
 		mfpt = (*db)[state].getMFPT();
-		S = (*db)[state].sumP(); //get normalizing constant for this row
+		S = db->sumP(state); //get normalizing constant for this row
 		//printf("MFPT %f, sum %f\n", mfpt, S);
 
 		//if S = 0, this is end state, add it to vector
@@ -432,8 +206,8 @@ void createTransitionMatrix(double* T, int num_states, Database* db,
 		}
 
 		//fill in value in transition matrix
-		std::vector<Pair> P = (*db)[state].getP();
-		for (int i = 0; i < P.size(); i++) {
+		SparseRow P = db->getP(state);
+		for (int i = 0; i < P.size; i++) {
 			T[toIndex(state, P[i].index, num_states)] = (P[i].value / S) / mfpt;
 		}
 	}
@@ -475,20 +249,12 @@ void getHittingProbabilityGS(int initial, Database* db) {
 	for (int i = 0; i < M/2; i++) kappa[i] = float(i)/10.0+0.1;
 	for (int i = M/2; i < M; i++) kappa[i] = i-M/2+10.0;
 
-	//declare rate matrix, probability transition matrix, equilibrium measure
-	double* T = new double[num_states*num_states]; //rate matrix
-	double* P = new double[num_states*num_states]; //probability transition matrix
-	double* U = new double[num_states*num_states]; //hitting probability matrix
-	double* eq = new double[num_states];           //equilibrium measure
-	double* Tconst = new double[num_states*num_states]; //rate matrix - only forward entries
-
-	//init the rate matrix with zeros
-	for (int i = 0; i < num_states*num_states; i++) {
-		Tconst[i] = 0;
-	}
+	//equilibrium measure, hitting probabilities
+	double* eq = new double[num_states];
+	Eigen::MatrixXd U;
 
 	//get bonds->bonds+1 entries from mfpt estimates
-	createTransitionMatrix(Tconst, num_states, db, endStates);
+	RateMatrix Tconst(db, endStates);
 
 	//create a data array which will store the hitting probabilities
 	double* data = new double[M*endStates.size()];
@@ -499,33 +265,25 @@ void getHittingProbabilityGS(int initial, Database* db) {
 		//get sticky parameter
 		double sticky = kappa[k]; 
 
-		//reset transition matrices
-		for (int i = 0; i < num_states*num_states; i++) {
-			P[i] = U[i] = 0;
-		}
-
 		//copy Tconst into T
-		std::copy(Tconst, Tconst+num_states*num_states, T);
+		RateMatrix T = Tconst;
 
 		//make array for equilibrium distribution
 		createMeasure(num_states, db, eq, sticky);
 
 		//fill in transposed entries such that T satisfies detailed balance
-		satisfyDB(T, num_states, db, eq);
+		T.satisfyDB(eq);
 
 		//fill in diagonal with negative sum of row entries
-		fillDiag(T, num_states);
-
-		//use the filled rate matrix to compute probability matrix
-		createProbabilityMatrix(T, num_states, P);
+		T.fillDiag();
 
-		//solve for hitting probabilities to endStates states
-		computeHittingProbability(P, num_states, endStates, U);
+		//solve for hitting probabilities to endStates states, one column each
+		BoundarySolver S(T, endStates);
+		S.hittingProbability(endStates, U);
 
 		//store hitting probabilities in data
 		for (int end = 0; end < endStates.size(); end++) {
-			double hit_prob = U[toIndex(initial, endStates[end], num_states)];
-			data[k*endStates.size() + end] = hit_prob;
+			data[k*endStates.size() + end] = U(initial, end);
 		}
 	}
 
@@ -533,7 +291,6 @@ void getHittingProbabilityGS(int initial, Database* db) {
 	writeHittingProbabilityGS(kappa, data, endStates, M);
 
 	//free the memory
-	delete []T; delete []Tconst; delete []P; delete []U;
 	delete []eq; delete []kappa; delete []data;
 }
 
@@ -552,14 +309,8 @@ void performTPT(int initial, int target, Database* db, bool getIso) {
 	computePartitionFn(num_states, db, Z); 
 	computeFreeEnergy(num_states, Z, F);
 
-	//initialize the transition rate matrix
-	double* T = new double[num_states*num_states];
-	for (int i = 0; i < num_states*num_states; i++) {
-		T[i] =  0;
-	}
-
 	//get bonds -> bonds+1 entries from mfpt estimates
-	createTransitionMatrix(T, num_states, db, endStates);
+	RateMatrix T(db, endStates);
 
 	//init array for equilibrium distribution and compute it
 	double* eq = new double[num_states];
@@ -567,10 +318,10 @@ void performTPT(int initial, int target, Database* db, bool getIso) {
 	for (int i = 0; i < num_states; i++) std::cout << eq[i] << "\n";
 
 	//fill in transposed entries such that T satisfies detailed balance
-	satisfyDB(T, num_states, db, eq);
+	T.satisfyDB(eq);
 
 	//fill in diagonal with negative sum of row entries
-	fillDiag(T, num_states);
+	T.fillDiag();
 
 	//solve for the committor
 	//initialize committor in q
@@ -588,18 +339,22 @@ void performTPT(int initial, int target, Database* db, bool getIso) {
 		targets.push_back(target);
 	}
 	
+	//one factorization for the committor and the mfpts
+	std::vector<int> boundary(targets); boundary.push_back(initial);
+	BoundarySolver S(T, boundary);
+
 	//solve dirichlet problem for committor, q 
-	computeCommittor(q, T, num_states, initial, targets);
+	S.committor(initial, targets, q);
 
 	//init and compute the probability fluxes
 	double* flux = new double[num_states*num_states]; 
 	for (int i = 0; i < num_states*num_states; i++) flux[i] = 0;
-	computeFlux(num_states, q, T, eq, flux);
+	T.flux(q, eq, flux);
 
-	double R = computeTransitionRateTPT(num_states, q, T, eq);
+	double R = T.transitionRate(q, eq);
 	std::cout << "Trans rate " << R << "\n";
 	double* m = new double[num_states];
-	computeMFPTs(num_states, T, targets, m);
+	S.mfpt(targets, m);
 	std::cout << 1/m[1] << "\n";
 
 	//make a graph structure of the database
@@ -609,7 +364,7 @@ void performTPT(int initial, int target, Database* db, bool getIso) {
 	printGraphRev(g, initial, F, flux, 1, 1, 0);
 
 	//free the memory
-	delete []T; delete []q; delete []eq; delete []flux;
+	delete []q; delete []eq; delete []flux;
 	delete []Z; delete []F; 
 	delete g; delete []m;
 